@@ -0,0 +1,322 @@
+/** @file cache.c
+ *  @brief Cache of decompressed text records
+ *
+ * Copyright (c) 2026 Bartek Fabiszewski
+ * http://www.fabiszewski.net
+ *
+ * This file is part of libmobi.
+ * Licensed under LGPL, either version 3, or any later.
+ * See <http://www.gnu.org/licenses/>
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include "cache.h"
+#include "debug.h"
+
+/**
+ @brief Lock cache
+ 
+ @param[in] cache MOBIRecordCache structure
+ */
+static void mobi_cache_lock(MOBIRecordCache *cache) {
+#ifdef USE_THREADS
+    pthread_mutex_lock(&cache->lock);
+#else
+    (void) cache;
+#endif
+}
+
+/**
+ @brief Unlock cache
+ 
+ @param[in] cache MOBIRecordCache structure
+ */
+static void mobi_cache_unlock(MOBIRecordCache *cache) {
+#ifdef USE_THREADS
+    pthread_mutex_unlock(&cache->lock);
+#else
+    (void) cache;
+#endif
+}
+
+/**
+ @brief Initializer for MOBIRecordCache structure
+ 
+ Cache holds decompressed text records of any number of documents.
+ When memory used by entries exceeds the budget, least recently used entries are evicted.
+ Cache may be shared by threads.
+ Memory should be freed with mobi_cache_free(), after all documents using the cache are freed.
+ 
+ @param[in] max_size Budget of memory used by cached records in bytes
+ @return MOBIRecordCache on success, NULL otherwise
+ */
+MOBIRecordCache * mobi_cache_init(const size_t max_size) {
+    MOBIRecordCache *cache = calloc(1, sizeof(MOBIRecordCache));
+    if (cache == NULL) {
+        debug_print("%s", "Memory allocation for cache failed\n");
+        return NULL;
+    }
+    cache->buckets_bits = MOBI_CACHE_BUCKETS_BITS;
+    cache->buckets = calloc((size_t) 1 << cache->buckets_bits, sizeof(*cache->buckets));
+    if (cache->buckets == NULL) {
+        debug_print("%s", "Memory allocation for cache failed\n");
+        free(cache);
+        return NULL;
+    }
+#ifdef USE_THREADS
+    if (pthread_mutex_init(&cache->lock, NULL) != 0) {
+        debug_print("%s", "Initialization of cache lock failed\n");
+        free(cache->buckets);
+        free(cache);
+        return NULL;
+    }
+#endif
+    cache->max_size = max_size;
+    return cache;
+}
+
+/**
+ @brief Free MOBIRecordCache structure and all cached records
+ 
+ @param[in] cache MOBIRecordCache structure
+ */
+void mobi_cache_free(MOBIRecordCache *cache) {
+    if (cache == NULL) {
+        return;
+    }
+    MOBICacheEntry *curr = cache->head;
+    while (curr) {
+        MOBICacheEntry *tmp = curr;
+        curr = curr->next;
+        free(tmp->data);
+        free(tmp);
+    }
+#ifdef USE_THREADS
+    pthread_mutex_destroy(&cache->lock);
+#endif
+    free(cache->buckets);
+    free(cache);
+}
+
+/**
+ @brief Get identity of a document in cache
+ 
+ Identity is 64-bit FNV-1a hash of document id string.
+ If id string is NULL, unique identity is assigned.
+ 
+ @param[in] cache MOBIRecordCache structure
+ @param[in] doc_id Document id string or NULL
+ @return Document identity
+ */
+uint64_t mobi_cache_identity(MOBIRecordCache *cache, const char *doc_id) {
+    if (doc_id == NULL) {
+        mobi_cache_lock(cache);
+        const uint64_t identity = MOBI_CACHE_ANONYMOUS | cache->next_anonymous++;
+        mobi_cache_unlock(cache);
+        return identity;
+    }
+    uint64_t hash = 0xcbf29ce484222325ULL;
+    while (*doc_id) {
+        hash ^= (unsigned char) *doc_id++;
+        hash *= 0x100000001b3ULL;
+    }
+    return hash & ~MOBI_CACHE_ANONYMOUS;
+}
+
+/**
+ @brief Get hash table bucket of the entry
+ 
+ @param[in] doc_id Document identity
+ @param[in] seqnumber Sequential number of the record
+ @param[in] bits Hash table size is 2^bits
+ @return Bucket index
+ */
+static size_t mobi_cache_bucket(const uint64_t doc_id, const size_t seqnumber, const size_t bits) {
+    uint64_t hash = doc_id ^ ((uint64_t) seqnumber * 0x9e3779b97f4a7c15ULL);
+    hash ^= hash >> 31;
+    hash *= 0xbf58476d1ce4e5b9ULL;
+    hash ^= hash >> 29;
+    return (size_t) (hash >> (64 - bits));
+}
+
+/**
+ @brief Find entry in hash table, cache must be locked
+ 
+ @param[in] cache MOBIRecordCache structure
+ @param[in] doc_id Document identity
+ @param[in] seqnumber Sequential number of the record
+ @return Entry or NULL if not found
+ */
+static MOBICacheEntry * mobi_cache_find(const MOBIRecordCache *cache, const uint64_t doc_id, const size_t seqnumber) {
+    MOBICacheEntry *curr = cache->buckets[mobi_cache_bucket(doc_id, seqnumber, cache->buckets_bits)];
+    while (curr) {
+        if (curr->doc_id == doc_id && curr->seqnumber == seqnumber) {
+            return curr;
+        }
+        curr = curr->chain;
+    }
+    return NULL;
+}
+
+/**
+ @brief Unlink entry from LRU list, cache must be locked
+ 
+ @param[in,out] cache MOBIRecordCache structure
+ @param[in,out] entry Entry
+ */
+static void mobi_cache_unlink(MOBIRecordCache *cache, MOBICacheEntry *entry) {
+    if (entry->prev) {
+        entry->prev->next = entry->next;
+    } else {
+        cache->head = entry->next;
+    }
+    if (entry->next) {
+        entry->next->prev = entry->prev;
+    } else {
+        cache->tail = entry->prev;
+    }
+    entry->prev = NULL;
+    entry->next = NULL;
+}
+
+/**
+ @brief Insert entry at the front of LRU list, cache must be locked
+ 
+ @param[in,out] cache MOBIRecordCache structure
+ @param[in,out] entry Entry
+ */
+static void mobi_cache_push_front(MOBIRecordCache *cache, MOBICacheEntry *entry) {
+    entry->prev = NULL;
+    entry->next = cache->head;
+    if (cache->head) {
+        cache->head->prev = entry;
+    } else {
+        cache->tail = entry;
+    }
+    cache->head = entry;
+}
+
+/**
+ @brief Evict least recently used entry, cache must be locked
+ 
+ @param[in,out] cache MOBIRecordCache structure
+ */
+static void mobi_cache_evict(MOBIRecordCache *cache) {
+    MOBICacheEntry *entry = cache->tail;
+    if (entry == NULL) {
+        return;
+    }
+    MOBICacheEntry **link = &cache->buckets[mobi_cache_bucket(entry->doc_id, entry->seqnumber, cache->buckets_bits)];
+    while (*link != entry) {
+        link = &(*link)->chain;
+    }
+    *link = entry->chain;
+    mobi_cache_unlink(cache, entry);
+    cache->size -= entry->size + sizeof(MOBICacheEntry);
+    cache->count--;
+    free(entry->data);
+    free(entry);
+}
+
+/**
+ @brief Double hash table size, cache must be locked
+ 
+ On allocation failure table is left unchanged.
+ 
+ @param[in,out] cache MOBIRecordCache structure
+ */
+static void mobi_cache_grow(MOBIRecordCache *cache) {
+    const size_t bits = cache->buckets_bits + 1;
+    MOBICacheEntry **buckets = calloc((size_t) 1 << bits, sizeof(*buckets));
+    if (buckets == NULL) {
+        debug_print("%s", "Memory allocation for cache failed\n");
+        return;
+    }
+    for (MOBICacheEntry *curr = cache->head; curr; curr = curr->next) {
+        const size_t bucket = mobi_cache_bucket(curr->doc_id, curr->seqnumber, bits);
+        curr->chain = buckets[bucket];
+        buckets[bucket] = curr;
+    }
+    free(cache->buckets);
+    cache->buckets = buckets;
+    cache->buckets_bits = bits;
+}
+
+/**
+ @brief Copy cached record to a buffer
+ 
+ @param[in] cache MOBIRecordCache structure
+ @param[in] doc_id Document identity
+ @param[in] seqnumber Sequential number of the record
+ @param[out] data Memory area to be filled with decompressed record
+ @param[in,out] size Size of the memory area, on return set to decompressed record size
+ @return True if record was found and fits in the memory area, false otherwise
+ */
+bool mobi_cache_get(MOBIRecordCache *cache, const uint64_t doc_id, const size_t seqnumber, unsigned char *data, size_t *size) {
+    bool found = false;
+    mobi_cache_lock(cache);
+    MOBICacheEntry *entry = mobi_cache_find(cache, doc_id, seqnumber);
+    if (entry && entry->size <= *size) {
+        memcpy(data, entry->data, entry->size);
+        *size = entry->size;
+        mobi_cache_unlink(cache, entry);
+        mobi_cache_push_front(cache, entry);
+        found = true;
+    }
+    mobi_cache_unlock(cache);
+    return found;
+}
+
+/**
+ @brief Store copy of decompressed record in cache
+ 
+ Least recently used entries are evicted to keep cache within its budget.
+ Records larger than the budget are not stored.
+ 
+ @param[in,out] cache MOBIRecordCache structure
+ @param[in] doc_id Document identity
+ @param[in] seqnumber Sequential number of the record
+ @param[in] data Decompressed record
+ @param[in] size Size of decompressed record
+ */
+void mobi_cache_put(MOBIRecordCache *cache, const uint64_t doc_id, const size_t seqnumber, const unsigned char *data, const size_t size) {
+    const size_t entry_size = size + sizeof(MOBICacheEntry);
+    if (entry_size > cache->max_size) {
+        return;
+    }
+    MOBICacheEntry *entry = malloc(sizeof(MOBICacheEntry));
+    if (entry == NULL) {
+        return;
+    }
+    entry->data = malloc(size ? size : 1);
+    if (entry->data == NULL) {
+        free(entry);
+        return;
+    }
+    memcpy(entry->data, data, size);
+    entry->size = size;
+    entry->doc_id = doc_id;
+    entry->seqnumber = seqnumber;
+    mobi_cache_lock(cache);
+    if (mobi_cache_find(cache, doc_id, seqnumber)) {
+        /* stored by other thread in the meantime */
+        mobi_cache_unlock(cache);
+        free(entry->data);
+        free(entry);
+        return;
+    }
+    while (cache->size + entry_size > cache->max_size) {
+        mobi_cache_evict(cache);
+    }
+    if (cache->count >= ((size_t) 1 << cache->buckets_bits)) {
+        mobi_cache_grow(cache);
+    }
+    const size_t bucket = mobi_cache_bucket(doc_id, seqnumber, cache->buckets_bits);
+    entry->chain = cache->buckets[bucket];
+    cache->buckets[bucket] = entry;
+    mobi_cache_push_front(cache, entry);
+    cache->size += entry_size;
+    cache->count++;
+    mobi_cache_unlock(cache);
+}
@@ -0,0 +1,58 @@
+/** @file cache.h
+ *
+ * Copyright (c) 2026 Bartek Fabiszewski
+ * http://www.fabiszewski.net
+ *
+ * This file is part of libmobi.
+ * Licensed under LGPL, either version 3, or any later.
+ * See <http://www.gnu.org/licenses/>
+ */
+
+#ifndef libmobi_cache_h
+#define libmobi_cache_h
+
+#include "config.h"
+#include "mobi.h"
+
+#ifdef USE_THREADS
+#include <pthread.h>
+#endif
+
+#define MOBI_CACHE_BUCKETS_BITS 8 /**< Initial hash table size is 2^MOBI_CACHE_BUCKETS_BITS */
+#define MOBI_CACHE_ANONYMOUS 0x8000000000000000ULL /**< Bit set in identities not derived from document id string */
+
+/**
+ @brief Decompressed text record stored in cache
+ */
+typedef struct MOBICacheEntry {
+    uint64_t doc_id; /**< Identity of the document */
+    size_t seqnumber; /**< Sequential number of the record in the document */
+    unsigned char *data; /**< Decompressed data */
+    size_t size; /**< Size of decompressed data */
+    struct MOBICacheEntry *prev; /**< Previous (more recently used) entry in LRU list */
+    struct MOBICacheEntry *next; /**< Next (less recently used) entry in LRU list */
+    struct MOBICacheEntry *chain; /**< Next entry in hash table bucket */
+} MOBICacheEntry;
+
+/**
+ @brief Cache of decompressed text records, shared by documents and threads
+ */
+struct MOBIRecordCache {
+    size_t max_size; /**< Budget of memory used by entries */
+    size_t size; /**< Memory currently used by entries */
+    size_t count; /**< Number of entries */
+    MOBICacheEntry **buckets; /**< Hash table of entries keyed by document identity and record number */
+    size_t buckets_bits; /**< Hash table size is 2^buckets_bits */
+    MOBICacheEntry *head; /**< Most recently used entry */
+    MOBICacheEntry *tail; /**< Least recently used entry, evicted first */
+    uint64_t next_anonymous; /**< Counter of identities assigned to documents without id string */
+#ifdef USE_THREADS
+    pthread_mutex_t lock; /**< Lock guarding all fields */
+#endif
+};
+
+uint64_t mobi_cache_identity(MOBIRecordCache *cache, const char *doc_id);
+bool mobi_cache_get(MOBIRecordCache *cache, const uint64_t doc_id, const size_t seqnumber, unsigned char *data, size_t *size);
+void mobi_cache_put(MOBIRecordCache *cache, const uint64_t doc_id, const size_t seqnumber, const unsigned char *data, const size_t size);
+
+#endif
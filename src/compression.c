@@ -9,6 +9,7 @@
  * See <http://www.gnu.org/licenses/>
  */
 
+#include <stdlib.h>
 #include <string.h>
 #include "compression.h"
 #include "buffer.h"
@@ -16,20 +17,23 @@
 #include "debug.h"
 
 
-/** 
- @brief Decompressor fo PalmDOC version of LZ77 compression
-
- Decompressor based on this algorithm:
- http://en.wikibooks.org/wiki/Data_Compression/Dictionary_compression#PalmDoc
-
+/**
+ @brief Decode PalmDOC LZ77 data byte by byte, starting at given input and output positions
+ 
+ Straightforward implementation on MOBIBuffer structures.
+ Output preceding out_offset must hold data decoded from input preceding in_offset.
+ 
  @param[out] out Decompressed destination data
  @param[in] in Compressed source data
  @param[in,out] len_out Size of the memory reserved for decompressed data.
  On return it is set to actual size of decompressed data
  @param[in] len_in Size of compressed data
+ @param[in] in_offset Position of the first decoded token in compressed data
+ @param[in] out_offset Size of data already decompressed
  @return MOBI_RET status code (on success MOBI_SUCCESS)
  */
-MOBI_RET mobi_decompress_lz77(unsigned char *out, const unsigned char *in, size_t *len_out, const size_t len_in) {
+static MOBI_RET mobi_decompress_lz77_buffer(unsigned char *out, const unsigned char *in, size_t *len_out, const size_t len_in,
+                                            const size_t in_offset, const size_t out_offset) {
     MOBI_RET ret = MOBI_SUCCESS;
     MOBIBuffer *buf_in = mobi_buffer_init_null((unsigned char *) in, len_in);
     if (buf_in == NULL) {
@@ -42,6 +46,8 @@ MOBI_RET mobi_decompress_lz77(unsigned char *out, const unsigned char *in, size_
         debug_print("%s\n", "Memory allocation failed");
         return MOBI_MALLOC_FAILED;
     }
+    mobi_buffer_setpos(buf_in, in_offset);
+    mobi_buffer_setpos(buf_out, out_offset);
     while (ret == MOBI_SUCCESS && buf_in->offset < buf_in->maxlen) {
         uint8_t byte = mobi_buffer_get8(buf_in);
         /* byte pair: space + char */
@@ -81,6 +87,359 @@ MOBI_RET mobi_decompress_lz77(unsigned char *out, const unsigned char *in, size_
     return ret;
 }
 
+/** 
+ @brief Decompressor for PalmDOC version of LZ77 compression
+
+ Decompressor based on this algorithm:
+ http://en.wikibooks.org/wiki/Data_Compression/Dictionary_compression#PalmDoc
+ 
+ Works directly on input and output memory, checking bounds once per token.
+ Literal runs are copied with memcpy, back-references at least 8 bytes back
+ are copied in 8-byte chunks.
+ Decoding of the token exceeding input or output and of the following ones
+ is left to byte by byte decoder, so that status and partially decompressed data
+ are the same as returned by mobi_decompress_lz77_reference().
+
+ @param[out] out Decompressed destination data
+ @param[in] in Compressed source data
+ @param[in,out] len_out Size of the memory reserved for decompressed data.
+ On return it is set to actual size of decompressed data
+ @param[in] len_in Size of compressed data
+ @return MOBI_RET status code (on success MOBI_SUCCESS)
+ */
+MOBI_RET mobi_decompress_lz77(unsigned char *out, const unsigned char *in, size_t *len_out, const size_t len_in) {
+    const unsigned char *in_ptr = in;
+    const unsigned char *in_end = in + len_in;
+    unsigned char *out_ptr = out;
+    size_t out_left = *len_out;
+    while (in_ptr < in_end) {
+        const unsigned char *token = in_ptr;
+        const uint8_t byte = *in_ptr++;
+        /* single char, not modified */
+        if (byte >= 0x09 && byte < 0x80) {
+            if (out_left == 0) {
+                in_ptr = token;
+                break;
+            }
+            *out_ptr++ = byte;
+            out_left--;
+        }
+        /* byte pair: space + char */
+        else if (byte >= 0xc0) {
+            if (out_left < 2) {
+                in_ptr = token;
+                break;
+            }
+            *out_ptr++ = ' ';
+            *out_ptr++ = byte ^ 0x80;
+            out_left -= 2;
+        }
+        /* length, distance pair */
+        /* 0x8000 + (distance << 3) + ((length-3) & 0x07) */
+        else if (byte >= 0x80) {
+            if (in_ptr == in_end) {
+                in_ptr = token;
+                break;
+            }
+            const uint8_t next = *in_ptr++;
+            const size_t distance = ((((size_t) byte << 8) | next) >> 3) & 0x7ff;
+            size_t length = (next & 0x7) + 3;
+            if (distance > (size_t) (out_ptr - out) || length > out_left) {
+                in_ptr = token;
+                break;
+            }
+            out_left -= length;
+            if (distance == 0) {
+                /* bytes copied onto themselves, only position is advanced, as in reference decoder */
+                out_ptr += length;
+                continue;
+            }
+            const unsigned char *source = out_ptr - distance;
+            if (distance >= 8) {
+                /* chunks do not overlap */
+                while (length >= 8) {
+                    memcpy(out_ptr, source, 8);
+                    out_ptr += 8;
+                    source += 8;
+                    length -= 8;
+                }
+            }
+            while (length--) {
+                *out_ptr++ = *source++;
+            }
+        }
+        /* val chars not modified */
+        else if (byte >= 0x01) {
+            if (byte > (size_t) (in_end - in_ptr) || byte > out_left) {
+                in_ptr = token;
+                break;
+            }
+            memcpy(out_ptr, in_ptr, byte);
+            in_ptr += byte;
+            out_ptr += byte;
+            out_left -= byte;
+        }
+        /* char '\0', not modified */
+        else {
+            if (out_left == 0) {
+                in_ptr = token;
+                break;
+            }
+            *out_ptr++ = byte;
+            out_left--;
+        }
+    }
+    if (in_ptr < in_end) {
+        /* token exceeds input or output */
+        return mobi_decompress_lz77_buffer(out, in, len_out, len_in, (size_t) (in_ptr - in), (size_t) (out_ptr - out));
+    }
+    *len_out = (size_t) (out_ptr - out);
+    return MOBI_SUCCESS;
+}
+
+/** 
+ @brief Reference decompressor for PalmDOC version of LZ77 compression
+ 
+ Straightforward byte by byte implementation on MOBIBuffer structures.
+ It is slower than mobi_decompress_lz77() and is kept for differential testing.
+
+ @param[out] out Decompressed destination data
+ @param[in] in Compressed source data
+ @param[in,out] len_out Size of the memory reserved for decompressed data.
+ On return it is set to actual size of decompressed data
+ @param[in] len_in Size of compressed data
+ @return MOBI_RET status code (on success MOBI_SUCCESS)
+ */
+MOBI_RET mobi_decompress_lz77_reference(unsigned char *out, const unsigned char *in, size_t *len_out, const size_t len_in) {
+    return mobi_decompress_lz77_buffer(out, in, len_out, len_in, 0, 0);
+}
+
+
+/**
+ @brief Hash chains of LZ77 compressor
+ */
+typedef struct {
+    size_t *head; /**< Most recent position + 1 for each hash of 3 bytes, 0 if none */
+    size_t *prev; /**< Previous position + 1 with the same hash, indexed with position modulo LZ77_WINDOW_SIZE */
+    size_t inserted; /**< Positions below this one are inserted into chains */
+    size_t max_chain; /**< Maximal number of candidates checked for a match */
+} MOBILz77Chains;
+
+/**
+ @brief Number of match candidates checked for each compression level
+ */
+static const size_t mobi_lz77_chain_lengths[MOBI_LZ77_LEVEL_BEST + 1] = { 0, 1, 2, 4, 8, 16, 32, 64, 256, LZ77_WINDOW_SIZE };
+
+/**
+ @brief Hash of 3 bytes for LZ77 compressor
+ 
+ @param[in] data Pointer to 3 bytes
+ @return Hash value of LZ77_HASH_BITS bits
+ */
+static MOBI_INLINE size_t mobi_lz77_hash(const unsigned char *data) {
+    const uint32_t value = (uint32_t) data[0] << 16 | (uint32_t) data[1] << 8 | data[2];
+    return (uint32_t) (value * 2654435761U) >> (32 - LZ77_HASH_BITS);
+}
+
+/**
+ @brief Insert positions up to given one into hash chains
+ 
+ @param[in,out] chains MOBILz77Chains structure
+ @param[in] in Uncompressed data
+ @param[in] len_in Size of uncompressed data
+ @param[in] position Position past last inserted
+ */
+static void mobi_lz77_insert(MOBILz77Chains *chains, const unsigned char *in, const size_t len_in, const size_t position) {
+    while (chains->inserted < position && chains->inserted + LZ77_LENGTH_MIN <= len_in) {
+        const size_t hash = mobi_lz77_hash(in + chains->inserted);
+        chains->prev[chains->inserted & (LZ77_WINDOW_SIZE - 1)] = chains->head[hash];
+        chains->head[hash] = ++chains->inserted;
+    }
+}
+
+/**
+ @brief Find longest match for data at given position
+ 
+ All earlier positions must be inserted into hash chains.
+ 
+ @param[in] chains MOBILz77Chains structure
+ @param[in] in Uncompressed data
+ @param[in] len_in Size of uncompressed data
+ @param[in] position Position of data to be matched
+ @param[out] distance Distance of the match
+ @return Length of the match, 0 if no match was found
+ */
+static size_t mobi_lz77_match(const MOBILz77Chains *chains, const unsigned char *in, const size_t len_in, const size_t position, size_t *distance) {
+    size_t max_length = len_in - position;
+    if (max_length > LZ77_LENGTH_MAX) {
+        max_length = LZ77_LENGTH_MAX;
+    }
+    if (max_length < LZ77_LENGTH_MIN) {
+        return 0;
+    }
+    const unsigned char *data = in + position;
+    size_t best = 0;
+    size_t chain = chains->max_chain;
+    size_t candidate = chains->head[mobi_lz77_hash(data)];
+    while (candidate && chain--) {
+        const unsigned char *match = in + candidate - 1;
+        const size_t match_distance = (size_t) (data - match);
+        if (match_distance > LZ77_DISTANCE_MAX) {
+            break;
+        }
+        if (match[best] == data[best]) {
+            size_t length = 0;
+            while (length < max_length && match[length] == data[length]) {
+                length++;
+            }
+            if (length > best) {
+                best = length;
+                *distance = match_distance;
+                if (length == max_length) {
+                    break;
+                }
+            }
+        }
+        candidate = chains->prev[(candidate - 1) & (LZ77_WINDOW_SIZE - 1)];
+    }
+    return best >= LZ77_LENGTH_MIN ? best : 0;
+}
+
+/**
+ @brief Check if byte must be stored in a block of raw bytes
+ 
+ @param[in] byte Byte
+ @return True if byte can not be stored as a single character
+ */
+static MOBI_INLINE bool mobi_lz77_is_raw(const unsigned char byte) {
+    return (byte >= 0x01 && byte <= 0x08) || byte >= 0x80;
+}
+
+/**
+ @brief Compressor for PalmDOC version of LZ77 compression
+ 
+ Matches are found with hash chains of 3-byte prefixes within 2047 bytes window.
+ Level sets number of candidates checked for each position,
+ levels from LZ77_LAZY_LEVEL up also defer a match if next position has longer one.
+ Level 0 only encodes space + character pairs and stores other data as literals.
+ 
+ @param[out] out Compressed destination data, len_in + (len_in + 7) / 8 bytes is always enough
+ @param[in] in Uncompressed source data
+ @param[in,out] len_out Size of the memory reserved for compressed data.
+ On return it is set to actual size of compressed data
+ @param[in] len_in Size of uncompressed data
+ @param[in] level Compression level from 0 to MOBI_LZ77_LEVEL_BEST
+ @return MOBI_RET status code (on success MOBI_SUCCESS)
+ */
+MOBI_RET mobi_compress_lz77(unsigned char *out, const unsigned char *in, size_t *len_out, const size_t len_in, const int level) {
+    if (level < 0 || level > MOBI_LZ77_LEVEL_BEST) {
+        debug_print("Wrong compression level: %i\n", level);
+        return MOBI_PARAM_ERR;
+    }
+    MOBILz77Chains chains;
+    chains.head = calloc(((size_t) 1 << LZ77_HASH_BITS) + LZ77_WINDOW_SIZE, sizeof(*chains.head));
+    if (chains.head == NULL) {
+        debug_print("%s\n", "Memory allocation failed");
+        return MOBI_MALLOC_FAILED;
+    }
+    chains.prev = chains.head + ((size_t) 1 << LZ77_HASH_BITS);
+    chains.inserted = 0;
+    chains.max_chain = mobi_lz77_chain_lengths[level];
+    const bool lazy = level >= LZ77_LAZY_LEVEL;
+    MOBI_RET ret = MOBI_SUCCESS;
+    unsigned char *out_ptr = out;
+    size_t out_left = *len_out;
+    size_t position = 0;
+    /* match found at next position while checking for lazy match */
+    bool pending = false;
+    size_t pending_length = 0;
+    size_t pending_distance = 0;
+    while (position < len_in) {
+        size_t length = 0;
+        size_t distance = 0;
+        if (pending) {
+            length = pending_length;
+            distance = pending_distance;
+            pending = false;
+        } else if (chains.max_chain) {
+            mobi_lz77_insert(&chains, in, len_in, position);
+            length = mobi_lz77_match(&chains, in, len_in, position, &distance);
+        }
+        const unsigned char byte = in[position];
+        if (length && lazy && length < LZ77_LENGTH_MAX) {
+            mobi_lz77_insert(&chains, in, len_in, position + 1);
+            pending_length = mobi_lz77_match(&chains, in, len_in, position + 1, &pending_distance);
+            if (pending_length > length) {
+                /* store single character, use longer match at next position */
+                pending = true;
+                length = 0;
+                const size_t size = mobi_lz77_is_raw(byte) ? 2 : 1;
+                if (out_left < size) {
+                    ret = MOBI_BUFFER_END;
+                    break;
+                }
+                if (size == 2) {
+                    *out_ptr++ = 1;
+                }
+                *out_ptr++ = byte;
+                out_left -= size;
+                position++;
+                continue;
+            }
+        }
+        if (length) {
+            /* length, distance pair */
+            if (out_left < 2) {
+                ret = MOBI_BUFFER_END;
+                break;
+            }
+            const uint16_t pair = (uint16_t) (0x8000 | (distance << 3) | (length - 3));
+            *out_ptr++ = (unsigned char) (pair >> 8);
+            *out_ptr++ = (unsigned char) pair;
+            out_left -= 2;
+            position += length;
+        } else if (byte == ' ' && position + 1 < len_in && in[position + 1] >= 0x40 && in[position + 1] < 0x80) {
+            /* byte pair: space + char */
+            if (out_left == 0) {
+                ret = MOBI_BUFFER_END;
+                break;
+            }
+            *out_ptr++ = in[position + 1] ^ 0x80;
+            out_left--;
+            position += 2;
+        } else if (mobi_lz77_is_raw(byte)) {
+            /* block of up to 8 bytes, ending with last byte that must be stored raw */
+            size_t count = 1;
+            for (size_t i = 1; i < 8 && position + i < len_in; i++) {
+                if (mobi_lz77_is_raw(in[position + i])) {
+                    count = i + 1;
+                }
+            }
+            if (out_left < count + 1) {
+                ret = MOBI_BUFFER_END;
+                break;
+            }
+            *out_ptr++ = (unsigned char) count;
+            memcpy(out_ptr, in + position, count);
+            out_ptr += count;
+            out_left -= count + 1;
+            position += count;
+        } else {
+            /* single char, not modified */
+            if (out_left == 0) {
+                ret = MOBI_BUFFER_END;
+                break;
+            }
+            *out_ptr++ = byte;
+            out_left--;
+            position++;
+        }
+    }
+    free(chains.head);
+    *len_out = (size_t) (out_ptr - out);
+    return ret;
+}
+
 /**
  @brief Read at most 8 bytes from buffer, big-endian
  
@@ -102,6 +461,138 @@ static MOBI_INLINE uint64_t mobi_buffer_fill64(MOBIBuffer *buf) {
     return val;
 }
 
+/** @brief Huffman symbol has not been processed yet */
+#define HUFF_SYMBOL_NEW 0
+/** @brief Huffman symbol is being expanded */
+#define HUFF_SYMBOL_PENDING 1
+/** @brief Huffman symbol is expanded in symbol table */
+#define HUFF_SYMBOL_EXPANDED 2
+/** @brief Huffman symbol could not be expanded, it must be decompressed with recursive routine */
+#define HUFF_SYMBOL_FALLBACK 3
+
+static MOBI_RET mobi_decompress_huffman_internal(MOBIBuffer *buf_out, MOBIBuffer *buf_in, const MOBIHuffCdic *huffcdic, size_t depth);
+
+/**
+ @brief Decode symbol index from huffman code using HUFF tables
+ 
+ @param[in] huffcdic MOBIHuffCdic structure with parsed data from huff/cdic records
+ @param[in] code Next 32 bits of compressed data
+ @param[out] code_length Length of the code in bits
+ @param[out] index Index of the symbol
+ @return MOBI_RET status code (on success MOBI_SUCCESS)
+ */
+static MOBI_RET mobi_huffman_decode_code(const MOBIHuffCdic *huffcdic, const uint32_t code, uint8_t *code_length, uint32_t *index) {
+    /* lookup code in table1 */
+    const uint32_t t1 = huffcdic->table1[code >> 24];
+    /* get maxcode and codelen from t1 */
+    uint8_t length = t1 & 0x1f;
+    uint32_t maxcode;
+    /* check termination bit */
+    if (t1 & 0x80) {
+        if (length == 0) {
+            debug_print("%s\n", "Wrong code length: 0");
+            return MOBI_DATA_CORRUPT;
+        }
+        maxcode = (((t1 >> 8) + 1) << (32 - length)) - 1;
+    } else {
+        /* get offset from mincode, maxcode tables */
+        while (code < huffcdic->mincode_table[length]) {
+            if (++length >= HUFF_CODETABLE_SIZE) {
+                debug_print("Wrong offset to mincode table: %hhu\n", length);
+                return MOBI_DATA_CORRUPT;
+            }
+        }
+        if (length == 0) {
+            debug_print("%s\n", "Wrong code length: 0");
+            return MOBI_DATA_CORRUPT;
+        }
+        maxcode = huffcdic->maxcode_table[length];
+    }
+    *code_length = length;
+    *index = (uint32_t) (maxcode - code) >> (32 - length);
+    return MOBI_SUCCESS;
+}
+
+/**
+ @brief Decode symbol index from huffman code
+ 
+ Short codes are resolved with a single lookup in decoding table,
+ longer codes are decoded using HUFF tables.
+ 
+ @param[in] huffcdic MOBIHuffCdic structure with built decoding table
+ @param[in] code Next 32 bits of compressed data
+ @param[out] code_length Length of the code in bits
+ @param[out] index Index of the symbol
+ @return MOBI_RET status code (on success MOBI_SUCCESS)
+ */
+static MOBI_INLINE MOBI_RET mobi_huffman_lookup_code(const MOBIHuffCdic *huffcdic, const uint32_t code, uint8_t *code_length, uint32_t *index) {
+    const uint32_t entry = huffcdic->lookup_table[code >> (32 - HUFF_LOOKUP_BITS)];
+    if (entry) {
+        *code_length = entry & 0x1f;
+        *index = entry >> 5;
+        return MOBI_SUCCESS;
+    }
+    return mobi_huffman_decode_code(huffcdic, code, code_length, index);
+}
+
+/**
+ @brief Read 32 bits of data starting at given bit position, big-endian
+ 
+ If data is shorter returned value is padded with zeroes
+ 
+ @param[in] in Input data
+ @param[in] len_in Size of input data
+ @param[in] bitpos Bit position in input data
+ @return 32-bit value
+ */
+static MOBI_INLINE uint32_t mobi_huffman_peek32(const unsigned char *in, const size_t len_in, const size_t bitpos) {
+    const size_t pos = bitpos >> 3;
+    uint64_t val = 0;
+    if (pos + 8 <= len_in) {
+        const unsigned char *ptr = in + pos;
+        val = (uint64_t) ptr[0] << 56 | (uint64_t) ptr[1] << 48 | (uint64_t) ptr[2] << 40 | (uint64_t) ptr[3] << 32
+            | (uint64_t) ptr[4] << 24 | (uint64_t) ptr[5] << 16 | (uint64_t) ptr[6] << 8 | (uint64_t) ptr[7];
+    } else {
+        for (size_t i = 0; i < 8 && pos + i < len_in; i++) {
+            val |= (uint64_t) in[pos + i] << (56 - 8 * i);
+        }
+    }
+    return (uint32_t) ((val << (bitpos & 7)) >> 32);
+}
+
+/**
+ @brief Decompress single symbol from CDIC record
+ 
+ @param[in,out] buf_out MOBIBuffer structure with decompressed data
+ @param[in] huffcdic MOBIHuffCdic structure with parsed data from huff/cdic records
+ @param[in] index Index of the symbol
+ @param[in] depth Recursion level for decompression of compressed symbol
+ @return MOBI_RET status code (on success MOBI_SUCCESS)
+ */
+static MOBI_RET mobi_decompress_huffman_symbol(MOBIBuffer *buf_out, const MOBIHuffCdic *huffcdic, const uint32_t index, const size_t depth) {
+    /* check which part of cdic to use */
+    const uint16_t cdic_index = (uint16_t) (index >> huffcdic->code_length);
+    /* get offset */
+    const uint32_t offset = huffcdic->symbol_offsets[index];
+    uint32_t symbol_length = (uint32_t) huffcdic->symbols[cdic_index][offset] << 8 | (uint32_t) huffcdic->symbols[cdic_index][offset + 1];
+    /* 1st bit is is_decompressed flag */
+    const int is_decompressed = symbol_length >> 15;
+    /* get rid of flag */
+    symbol_length &= 0x7fff;
+    if (is_decompressed) {
+        /* symbol is at (offset + 2), 2 bytes used earlier for symbol length */
+        mobi_buffer_addraw(buf_out, (huffcdic->symbols[cdic_index] + offset + 2), symbol_length);
+        return buf_out->error;
+    }
+    /* symbol is compressed */
+    MOBIBuffer buf_sym;
+    buf_sym.data = huffcdic->symbols[cdic_index] + offset + 2;
+    buf_sym.offset = 0;
+    buf_sym.maxlen = symbol_length;
+    buf_sym.error = MOBI_SUCCESS;
+    return mobi_decompress_huffman_internal(buf_out, &buf_sym, huffcdic, depth);
+}
+
 /**
  @brief Internal function for huff/cdic decompression
  
@@ -109,6 +600,8 @@ static MOBI_INLINE uint64_t mobi_buffer_fill64(MOBIBuffer *buf) {
  perl EBook::Tools::Mobipocket
  python mobiunpack.py, calibre
  
+ Used when symbols could not be expanded by mobi_build_huffcdic_tables().
+ 
  @param[out] buf_out MOBIBuffer structure with decompressed data
  @param[in] buf_in MOBIBuffer structure with compressed data
  @param[in] huffcdic MOBIHuffCdic structure with parsed data from huff/cdic records
@@ -132,57 +625,277 @@ static MOBI_RET mobi_decompress_huffman_internal(MOBIBuffer *buf_out, MOBIBuffer
             buffer = mobi_buffer_fill64(buf_in);
         }
         uint32_t code = (buffer >> bitcount) & 0xffffffffU;
-        /* lookup code in table1 */
-        uint32_t t1 = huffcdic->table1[code >> 24];
-        /* get maxcode and codelen from t1 */
-        code_length = t1 & 0x1f;
-        uint32_t maxcode = (((t1 >> 8) + 1) << (32 - code_length)) - 1;
-        /* check termination bit */
-        if (!(t1 & 0x80)) {
-            /* get offset from mincode, maxcode tables */
-            while (code < huffcdic->mincode_table[code_length]) {
-                if (++code_length >= HUFF_CODETABLE_SIZE) {
-                    debug_print("Wrong offset to mincode table: %hhu\n", code_length);
-                    return MOBI_DATA_CORRUPT;
-                }
-            }
-            maxcode = huffcdic->maxcode_table[code_length];
+        uint32_t index;
+        ret = mobi_huffman_decode_code(huffcdic, code, &code_length, &index);
+        if (ret != MOBI_SUCCESS) {
+            return ret;
         }
         bitcount -= code_length;
         bitsleft -= code_length;
         if (bitsleft < 0) {
             break;
         }
-        /* get index for symbol offset */
-        uint32_t index = (uint32_t) (maxcode - code) >> (32 - code_length);
-        /* check which part of cdic to use */
-        uint16_t cdic_index = (uint16_t) ((uint32_t)index >> huffcdic->code_length);
         if (index >= huffcdic->index_count) {
             debug_print("Wrong symbol offsets index: %u\n", index);
             return MOBI_DATA_CORRUPT;
         }
-        /* get offset */
-        uint32_t offset = huffcdic->symbol_offsets[index];
-        uint32_t symbol_length = (uint32_t) huffcdic->symbols[cdic_index][offset] << 8 | (uint32_t) huffcdic->symbols[cdic_index][offset + 1];
-        /* 1st bit is is_decompressed flag */
-        int is_decompressed = symbol_length >> 15;
-        /* get rid of flag */
-        symbol_length &= 0x7fff;
-        if (is_decompressed) {
-            /* symbol is at (offset + 2), 2 bytes used earlier for symbol length */
-            mobi_buffer_addraw(buf_out, (huffcdic->symbols[cdic_index] + offset + 2), symbol_length);
-            ret = buf_out->error;
+        ret = mobi_decompress_huffman_symbol(buf_out, huffcdic, index, depth + 1);
+    }
+    return ret;
+}
+
+/**
+ @brief Append data of expanded symbol to symbols data
+ 
+ @param[in,out] huffcdic MOBIHuffCdic structure
+ @param[in,out] data_size Size of symbols data
+ @param[in,out] data_capacity Size of memory allocated for symbols data
+ @param[in] length Size of data that will be appended
+ @return MOBI_RET status code (on success MOBI_SUCCESS),
+ MOBI_BUFFER_END if total size of symbols would exceed HUFF_SYMBOLS_SIZEMAX
+ */
+static MOBI_RET mobi_huffman_reserve(MOBIHuffCdic *huffcdic, const size_t data_size, size_t *data_capacity, const size_t length) {
+    if (data_size + length <= *data_capacity) {
+        return MOBI_SUCCESS;
+    }
+    if (data_size + length > HUFF_SYMBOLS_SIZEMAX) {
+        return MOBI_BUFFER_END;
+    }
+    size_t capacity = *data_capacity ? *data_capacity : 0x10000;
+    while (capacity < data_size + length) {
+        capacity *= 2;
+    }
+    if (capacity > HUFF_SYMBOLS_SIZEMAX) {
+        capacity = HUFF_SYMBOLS_SIZEMAX;
+    }
+    unsigned char *data = realloc(huffcdic->symbol_data, capacity);
+    if (data == NULL) {
+        debug_print("%s\n", "Memory allocation failed");
+        return MOBI_MALLOC_FAILED;
+    }
+    huffcdic->symbol_data = data;
+    *data_capacity = capacity;
+    return MOBI_SUCCESS;
+}
+
+/**
+ @brief Expand symbol from CDIC record into symbol table
+ 
+ Compressed symbols are decompressed once, nested symbols are expanded first.
+ Symbols that can not be expanded (corrupt, nested too deep, longer than max_length)
+ are marked with HUFF_SYMBOL_FALLBACK status, so that decompression
+ of such symbol may fail exactly as in recursive routine.
+ 
+ @param[in,out] huffcdic MOBIHuffCdic structure
+ @param[in] index Index of the symbol
+ @param[in] level Current level of nested symbols
+ @param[in] max_length Maximal length of expanded symbol
+ @param[in,out] data_size Size of symbols data
+ @param[in,out] data_capacity Size of memory allocated for symbols data
+ @return MOBI_RET status code (on success MOBI_SUCCESS)
+ */
+static MOBI_RET mobi_huffman_expand_symbol(MOBIHuffCdic *huffcdic, const uint32_t index, const size_t level, const size_t max_length, size_t *data_size, size_t *data_capacity) {
+    MOBIHuffSymbol *symbol = &huffcdic->symbol_table[index];
+    if (symbol->status != HUFF_SYMBOL_NEW) {
+        return MOBI_SUCCESS;
+    }
+    symbol->status = HUFF_SYMBOL_FALLBACK;
+    const uint16_t cdic_index = (uint16_t) (index >> huffcdic->code_length);
+    const uint32_t offset = huffcdic->symbol_offsets[index];
+    const unsigned char *in = huffcdic->symbols[cdic_index] + offset + 2;
+    uint32_t symbol_length = (uint32_t) huffcdic->symbols[cdic_index][offset] << 8 | (uint32_t) huffcdic->symbols[cdic_index][offset + 1];
+    const int is_decompressed = symbol_length >> 15;
+    symbol_length &= 0x7fff;
+    MOBI_RET ret;
+    if (is_decompressed) {
+        if (symbol_length > max_length) {
+            return MOBI_SUCCESS;
+        }
+        ret = mobi_huffman_reserve(huffcdic, *data_size, data_capacity, symbol_length);
+        if (ret != MOBI_SUCCESS) {
+            return ret == MOBI_BUFFER_END ? MOBI_SUCCESS : ret;
+        }
+        memcpy(huffcdic->symbol_data + *data_size, in, symbol_length);
+        symbol->offset = (uint32_t) *data_size;
+        symbol->length = (uint16_t) symbol_length;
+        symbol->depth = 0;
+        symbol->status = HUFF_SYMBOL_EXPANDED;
+        *data_size += symbol_length;
+        return MOBI_SUCCESS;
+    }
+    if (level > MOBI_HUFFMAN_MAXDEPTH) {
+        return MOBI_SUCCESS;
+    }
+    symbol->status = HUFF_SYMBOL_PENDING;
+    /* first pass: expand nested symbols */
+    const size_t bits_total = symbol_length * 8;
+    size_t bitpos = 0;
+    size_t length = 0;
+    uint8_t depth = 0;
+    while (true) {
+        const uint32_t code = mobi_huffman_peek32(in, symbol_length, bitpos);
+        uint8_t code_length;
+        uint32_t nested_index;
+        if (mobi_huffman_lookup_code(huffcdic, code, &code_length, &nested_index) != MOBI_SUCCESS) {
+            symbol->status = HUFF_SYMBOL_FALLBACK;
+            return MOBI_SUCCESS;
+        }
+        bitpos += code_length;
+        if (bitpos > bits_total) {
+            break;
+        }
+        if (nested_index >= huffcdic->index_count) {
+            symbol->status = HUFF_SYMBOL_FALLBACK;
+            return MOBI_SUCCESS;
+        }
+        ret = mobi_huffman_expand_symbol(huffcdic, nested_index, level + 1, max_length, data_size, data_capacity);
+        if (ret != MOBI_SUCCESS) {
+            return ret;
+        }
+        const MOBIHuffSymbol *nested = &huffcdic->symbol_table[nested_index];
+        length += nested->length;
+        if (nested->status != HUFF_SYMBOL_EXPANDED || length > max_length) {
+            symbol->status = HUFF_SYMBOL_FALLBACK;
+            return MOBI_SUCCESS;
+        }
+        if (nested->depth > depth) {
+            depth = nested->depth;
+        }
+    }
+    if (depth + 1 > MOBI_HUFFMAN_MAXDEPTH) {
+        symbol->status = HUFF_SYMBOL_FALLBACK;
+        return MOBI_SUCCESS;
+    }
+    ret = mobi_huffman_reserve(huffcdic, *data_size, data_capacity, length);
+    if (ret != MOBI_SUCCESS) {
+        symbol->status = HUFF_SYMBOL_FALLBACK;
+        return ret == MOBI_BUFFER_END ? MOBI_SUCCESS : ret;
+    }
+    /* second pass: concatenate nested symbols */
+    symbol->offset = (uint32_t) *data_size;
+    bitpos = 0;
+    while (true) {
+        const uint32_t code = mobi_huffman_peek32(in, symbol_length, bitpos);
+        uint8_t code_length;
+        uint32_t nested_index;
+        mobi_huffman_lookup_code(huffcdic, code, &code_length, &nested_index);
+        bitpos += code_length;
+        if (bitpos > bits_total) {
+            break;
+        }
+        const MOBIHuffSymbol *nested = &huffcdic->symbol_table[nested_index];
+        memcpy(huffcdic->symbol_data + *data_size, huffcdic->symbol_data + nested->offset, nested->length);
+        *data_size += nested->length;
+    }
+    symbol->length = (uint16_t) length;
+    symbol->depth = depth + 1;
+    symbol->status = HUFF_SYMBOL_EXPANDED;
+    return MOBI_SUCCESS;
+}
+
+/**
+ @brief Build huffman decoding tables from parsed HUFF/CDIC records
+ 
+ Fills lookup table resolving codes not longer than HUFF_LOOKUP_BITS
+ with a single access, and expands every CDIC symbol once
+ into a flat table of symbols.
+ 
+ @param[in,out] huffcdic MOBIHuffCdic structure with parsed data from huff/cdic records
+ @param[in] max_length Maximal length of decompressed text record
+ @return MOBI_RET status code (on success MOBI_SUCCESS)
+ */
+MOBI_RET mobi_build_huffcdic_tables(MOBIHuffCdic *huffcdic, const size_t max_length) {
+    if (huffcdic == NULL || huffcdic->symbol_offsets == NULL || huffcdic->symbols == NULL) {
+        debug_print("%s\n", "Huffcdic data not initialized");
+        return MOBI_INIT_FAILED;
+    }
+    const size_t lookup_size = 1U << HUFF_LOOKUP_BITS;
+    huffcdic->lookup_table = calloc(lookup_size, sizeof(*huffcdic->lookup_table));
+    huffcdic->symbol_table = calloc(huffcdic->index_count, sizeof(*huffcdic->symbol_table));
+    if (huffcdic->lookup_table == NULL || huffcdic->symbol_table == NULL) {
+        debug_print("%s\n", "Memory allocation failed");
+        return MOBI_MALLOC_FAILED;
+    }
+    for (uint32_t i = 0; i < lookup_size; i++) {
+        const uint32_t code = i << (32 - HUFF_LOOKUP_BITS);
+        uint8_t code_length;
+        uint32_t index;
+        if (mobi_huffman_decode_code(huffcdic, code, &code_length, &index) == MOBI_SUCCESS
+            && code_length <= HUFF_LOOKUP_BITS && index < huffcdic->index_count) {
+            huffcdic->lookup_table[i] = index << 5 | code_length;
+        }
+    }
+    /* symbol length is stored on 16 bits */
+    const size_t symbol_maxlen = max_length < UINT16_MAX ? max_length : UINT16_MAX;
+    size_t data_size = 0;
+    size_t data_capacity = 0;
+    for (uint32_t i = 0; i < huffcdic->index_count; i++) {
+        MOBI_RET ret = mobi_huffman_expand_symbol(huffcdic, i, 1, symbol_maxlen, &data_size, &data_capacity);
+        if (ret != MOBI_SUCCESS) {
+            return ret;
+        }
+    }
+    debug_print("Expanded huffman symbols: %zu bytes\n", data_size);
+    return MOBI_SUCCESS;
+}
+
+/**
+ @brief Decompress huff/cdic compressed text record using expanded symbols table
+ 
+ @param[out] out Decompressed destination data
+ @param[in] in Compressed source data
+ @param[in,out] len_out Size of the memory reserved for decompressed data.
+ On return it is set to actual size of decompressed data
+ @param[in] len_in Size of compressed data
+ @param[in] huffcdic MOBIHuffCdic structure with built decoding tables
+ @return MOBI_RET status code (on success MOBI_SUCCESS)
+ */
+static MOBI_RET mobi_decompress_huffman_table(unsigned char *out, const unsigned char *in, size_t *len_out, const size_t len_in, const MOBIHuffCdic *huffcdic) {
+    const size_t bits_total = len_in * 8;
+    const size_t out_max = *len_out;
+    size_t out_pos = 0;
+    size_t bitpos = 0;
+    MOBI_RET ret = MOBI_SUCCESS;
+    while (true) {
+        const uint32_t code = mobi_huffman_peek32(in, len_in, bitpos);
+        uint8_t code_length;
+        uint32_t index;
+        ret = mobi_huffman_lookup_code(huffcdic, code, &code_length, &index);
+        if (ret != MOBI_SUCCESS) {
+            break;
+        }
+        bitpos += code_length;
+        if (bitpos > bits_total) {
+            break;
+        }
+        if (index >= huffcdic->index_count) {
+            debug_print("Wrong symbol offsets index: %u\n", index);
+            ret = MOBI_DATA_CORRUPT;
+            break;
+        }
+        const MOBIHuffSymbol *symbol = &huffcdic->symbol_table[index];
+        if (symbol->status == HUFF_SYMBOL_EXPANDED) {
+            if (symbol->length > out_max - out_pos) {
+                debug_print("%s", "Buffer too small\n");
+                ret = MOBI_BUFFER_END;
+                break;
+            }
+            memcpy(out + out_pos, huffcdic->symbol_data + symbol->offset, symbol->length);
+            out_pos += symbol->length;
         } else {
-            /* symbol is compressed */
-            /* TODO cache uncompressed symbols? */
-            MOBIBuffer buf_sym;
-            buf_sym.data = huffcdic->symbols[cdic_index] + offset + 2;
-            buf_sym.offset = 0;
-            buf_sym.maxlen = symbol_length;
-            buf_sym.error = MOBI_SUCCESS;
-            ret = mobi_decompress_huffman_internal(buf_out, &buf_sym, huffcdic, depth + 1);
+            MOBIBuffer buf_out;
+            buf_out.data = out;
+            buf_out.offset = out_pos;
+            buf_out.maxlen = out_max;
+            buf_out.error = MOBI_SUCCESS;
+            ret = mobi_decompress_huffman_symbol(&buf_out, huffcdic, index, 1);
+            out_pos = buf_out.offset;
+            if (ret != MOBI_SUCCESS) {
+                break;
+            }
         }
     }
+    *len_out = out_pos;
     return ret;
 }
 
@@ -193,6 +906,9 @@ static MOBI_RET mobi_decompress_huffman_internal(MOBIBuffer *buf_out, MOBIBuffer
  perl EBook::Tools::Mobipocket
  python mobiunpack.py, calibre
  
+ If decoding tables were built with mobi_build_huffcdic_tables(),
+ expanded symbols are copied directly to output.
+ 
  @param[out] out Decompressed destination data
  @param[in] in Compressed source data
  @param[in,out] len_out Size of the memory reserved for decompressed data.
@@ -202,6 +918,9 @@ static MOBI_RET mobi_decompress_huffman_internal(MOBIBuffer *buf_out, MOBIBuffer
  @return MOBI_RET status code (on success MOBI_SUCCESS)
  */
 MOBI_RET mobi_decompress_huffman(unsigned char *out, const unsigned char *in, size_t *len_out, size_t len_in, const MOBIHuffCdic *huffcdic) {
+    if (huffcdic->lookup_table && huffcdic->symbol_table) {
+        return mobi_decompress_huffman_table(out, in, len_out, len_in, huffcdic);
+    }
     MOBIBuffer *buf_in = mobi_buffer_init_null((unsigned char *) in, len_in);
     if (buf_in == NULL) {
         debug_print("%s\n", "Memory allocation failed");
@@ -21,6 +21,24 @@
 /* FIXME: what is the reasonable value? */
 #define MOBI_HUFFMAN_MAXDEPTH 20 /**< Maximal recursion level for huffman decompression routine */
 #define HUFF_CODETABLE_SIZE 33 /**< Size of min- and maxcode tables */
+#define HUFF_LOOKUP_BITS 12 /**< Number of leading code bits resolved with a single lookup in huffman decoding table */
+#define HUFF_SYMBOLS_SIZEMAX (64 * 1024 * 1024) /**< Maximal total size of expanded huffman symbols */
+#define LZ77_HASH_BITS 12 /**< Size of hash table of LZ77 compressor is 2^LZ77_HASH_BITS */
+#define LZ77_WINDOW_SIZE 2048 /**< Size of LZ77 compressor history, power of 2 greater than maximal distance */
+#define LZ77_DISTANCE_MAX 2047 /**< Maximal distance of LZ77 back-reference */
+#define LZ77_LENGTH_MIN 3 /**< Minimal length of LZ77 back-reference */
+#define LZ77_LENGTH_MAX 10 /**< Maximal length of LZ77 back-reference */
+#define LZ77_LAZY_LEVEL 5 /**< Minimal LZ77 compression level using lazy matching */
+
+/**
+ @brief Huffman symbol expanded from CDIC record
+ */
+typedef struct {
+    uint32_t offset; /**< Offset of expanded symbol data in MOBIHuffCdic symbol_data */
+    uint16_t length; /**< Length of expanded symbol data */
+    uint8_t depth; /**< Number of nested compressed symbols that had to be decompressed to expand symbol */
+    uint8_t status; /**< Expansion status, only symbols with HUFF_SYMBOL_EXPANDED status may be used */
+} MOBIHuffSymbol;
 
 
 /**
@@ -35,9 +53,15 @@ typedef struct {
     uint32_t maxcode_table[HUFF_CODETABLE_SIZE]; /**< Table of big-endian maxcodes from HUFF record data2 */
     uint16_t *symbol_offsets; /**< Index of symbol offsets parsed from CDIC records (index_count entries) */
     unsigned char **symbols; /**< Array of pointers to start of symbols data in each CDIC record (index = number of CDIC record) */
+    uint32_t *lookup_table; /**< Decoding table indexed with HUFF_LOOKUP_BITS leading bits of code, NULL if not built */
+    MOBIHuffSymbol *symbol_table; /**< Table of expanded symbols (index_count entries), NULL if not built */
+    unsigned char *symbol_data; /**< Data of all expanded symbols */
 } MOBIHuffCdic;
 
 MOBI_RET mobi_decompress_lz77(unsigned char *out, const unsigned char *in, size_t *len_out, const size_t len_in);
+MOBI_RET mobi_decompress_lz77_reference(unsigned char *out, const unsigned char *in, size_t *len_out, const size_t len_in);
+MOBI_RET mobi_compress_lz77(unsigned char *out, const unsigned char *in, size_t *len_out, const size_t len_in, const int level);
+MOBI_RET mobi_build_huffcdic_tables(MOBIHuffCdic *huffcdic, const size_t max_length);
 MOBI_RET mobi_decompress_huffman(unsigned char *out, const unsigned char *in, size_t *len_out, size_t len_in, const MOBIHuffCdic *huffcdic);
 
 #endif
@@ -0,0 +1,1022 @@
+/** @file dict.c
+ *  @brief Dictionary lookups in orth and infl indices
+ *
+ * Copyright (c) 2026 Bartek Fabiszewski
+ * http://www.fabiszewski.net
+ *
+ * This file is part of libmobi.
+ * Licensed under LGPL, either version 3, or any later.
+ * See <http://www.gnu.org/licenses/>
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include "dict.h"
+#include "memory.h"
+#include "util.h"
+#include "debug.h"
+
+/**
+ @brief Append zero terminated string to strings buffer, buffer is enlarged if needed
+ 
+ @param[in,out] strings MOBIBuffer structure with strings
+ @param[in,out] offset Will be set to offset of the string in the buffer
+ @param[in] string String
+ @param[in] length Length of the string
+ @return MOBI_RET status code (on success MOBI_SUCCESS)
+ */
+static MOBI_RET mobi_dict_add_string(MOBIBuffer *strings, size_t *offset, const char *string, const size_t length) {
+    if (strings->offset + length + 1 > strings->maxlen) {
+        size_t new_size = strings->maxlen * 2;
+        while (new_size < strings->offset + length + 1) {
+            new_size *= 2;
+        }
+        mobi_buffer_resize(strings, new_size);
+        if (strings->error != MOBI_SUCCESS) {
+            return MOBI_MALLOC_FAILED;
+        }
+    }
+    *offset = strings->offset;
+    mobi_buffer_addraw(strings, (const unsigned char *) string, length);
+    mobi_buffer_add8(strings, 0);
+    return MOBI_SUCCESS;
+}
+
+/**
+ @brief Build trie of reversed inflected endings from old type infl index
+ 
+ Each infl entry label is an inflected ending, its tag values are pairs of length and CNCX offset
+ of base endings. Base endings are stored in strings buffer first, so that trie values
+ point to the final buffer.
+ 
+ @param[in,out] dict MOBIDict structure
+ @param[in] infl MOBIIndx structure with parsed infl index
+ @return MOBI_RET status code (on success MOBI_SUCCESS)
+ */
+static MOBI_RET mobi_dict_build_infl_trie(MOBIDict *dict, const MOBIIndx *infl) {
+    if (infl->cncx_record == NULL) {
+        debug_print("%s\n", "Missing cncx record");
+        return MOBI_DATA_CORRUPT;
+    }
+    for (size_t i = 0; i < infl->entries_count; i++) {
+        uint32_t *parts;
+        const size_t parts_count = mobi_get_indxentry_tagarray(&parts, &infl->entries[i], INDX_TAGARR_INFL_PARTS_V1);
+        for (size_t k = 0; k + 1 < parts_count; k += 2) {
+            char *base = mobi_get_cncx_string_flat(infl->cncx_record, parts[k + 1], parts[k]);
+            if (base == NULL) {
+                return MOBI_MALLOC_FAILED;
+            }
+            size_t offset;
+            MOBI_RET ret = mobi_dict_add_string(dict->strings, &offset, base, strlen(base));
+            free(base);
+            if (ret != MOBI_SUCCESS) {
+                return ret;
+            }
+        }
+    }
+    /* buffer is complete, insert endings in the same order */
+    char *base = (char *) dict->strings->data;
+    for (size_t i = 0; i < infl->entries_count; i++) {
+        uint32_t *parts;
+        const size_t parts_count = mobi_get_indxentry_tagarray(&parts, &infl->entries[i], INDX_TAGARR_INFL_PARTS_V1);
+        for (size_t k = 0; k + 1 < parts_count; k += 2) {
+            MOBI_RET ret = mobi_trie_insert_reversed(&dict->infl_trie, infl->entries[i].label, base);
+            if (ret != MOBI_SUCCESS) {
+                return ret;
+            }
+            base += strlen(base) + 1;
+        }
+    }
+    return MOBI_SUCCESS;
+}
+
+/**
+ @brief Apply inflection rule of new type infl index to headword given by positions of its characters
+ 
+ Rule is applied like in mobi_decode_infl(), but items are positions of headword characters,
+ so that inflected form may be mapped back to the headword.
+ Inserted characters are stored as negative values, deleted characters are stored at their positions
+ in headword in deleted array.
+ 
+ @param[in,out] items Array of INDX_INFLBUF_SIZEMAX items, on input positions of headword characters
+ @param[in,out] items_count Number of items, on input headword length
+ @param[in,out] deleted Zeroed array of headword length, will be filled with deleted characters
+ @param[in] rule Inflection rule
+ @return MOBI_RET status code (on success MOBI_SUCCESS)
+ */
+static MOBI_RET mobi_dict_apply_rule(int *items, size_t *items_count, unsigned char *deleted, const unsigned char *rule) {
+    int size = (int) *items_count;
+    int pos = size;
+    char mod = 'i';
+    char dir = '<';
+    char olddir;
+    unsigned char c;
+    while ((c = *rule++)) {
+        if (c <= 4) {
+            mod = (c <= 2) ? 'i' : 'd'; /* insert, delete */
+            olddir = dir;
+            dir = (c & 2) ? '<' : '>'; /* left, right */
+            if (olddir != dir && olddir) {
+                pos = (c & 2) ? size : 0;
+            }
+        }
+        else if (c > 10 && c < 20) {
+            if (dir == '>') {
+                pos = size;
+            }
+            pos -= c - 10;
+            dir = 0;
+        }
+        else if (mod == 'i') {
+            if (pos < 0 || pos > size || size >= INDX_INFLBUF_SIZEMAX) {
+                return MOBI_DATA_CORRUPT;
+            }
+            memmove(items + pos + 1, items + pos, (size_t) (size - pos) * sizeof(*items));
+            items[pos] = -c;
+            size++;
+            if (dir == '>') { pos++; }
+        } else {
+            if (dir == '<') { pos--; }
+            if (pos < 0 || pos >= size) {
+                return MOBI_DATA_CORRUPT;
+            }
+            if (items[pos] >= 0) {
+                deleted[items[pos]] = c;
+            } else if (items[pos] != -c) {
+                return MOBI_DATA_CORRUPT;
+            }
+            memmove(items + pos, items + pos + 1, (size_t) (size - pos - 1) * sizeof(*items));
+            size--;
+        }
+    }
+    *items_count = (size_t) size;
+    return MOBI_SUCCESS;
+}
+
+/**
+ @brief Get characters inserted by inflection rule of new type infl index at the end of headword
+ 
+ Rule is applied to headword long enough for changes at its start and its end not to overlap.
+ 
+ @param[in,out] ending Will be set to inserted ending, empty if rule does not end inflected form with inserted characters,
+ must hold INDX_INFLBUF_SIZEMAX + 1 characters
+ @param[in] rule Inflection rule
+ @return MOBI_RET status code (on success MOBI_SUCCESS)
+ */
+static MOBI_RET mobi_dict_rule_ending(char *ending, const unsigned char *rule) {
+    int items[INDX_INFLBUF_SIZEMAX];
+    unsigned char deleted[INDX_INFLBUF_SIZEMAX / 2] = { 0 };
+    size_t count = INDX_INFLBUF_SIZEMAX / 2;
+    for (size_t i = 0; i < count; i++) {
+        items[i] = (int) i;
+    }
+    MOBI_RET ret = mobi_dict_apply_rule(items, &count, deleted, rule);
+    if (ret != MOBI_SUCCESS) {
+        return ret;
+    }
+    size_t first = count;
+    while (first > 0 && items[first - 1] < 0) {
+        first--;
+    }
+    for (size_t i = first; i < count; i++) {
+        ending[i - first] = (char) -items[i];
+    }
+    ending[count - first] = '\0';
+    return MOBI_SUCCESS;
+}
+
+/**
+ @brief Get difference of lengths of inflected form and headword for inflection rule of new type infl index
+ 
+ @param[in] rule Inflection rule
+ @return Number of inserted characters less number of deleted characters
+ */
+static int mobi_dict_rule_delta(const unsigned char *rule) {
+    int delta = 0;
+    bool insert = true;
+    for (; *rule; rule++) {
+        if (*rule <= 4) {
+            insert = (*rule <= 2);
+        } else if (*rule < 11 || *rule > 19) {
+            delta += insert ? 1 : -1;
+        }
+    }
+    return delta;
+}
+
+/**
+ @brief Reverse inflection rule of new type infl index
+ 
+ Finds headword, which is inflected with the rule to the label.
+ 
+ @param[in,out] headword Will be set to headword, must hold INDX_INFLBUF_SIZEMAX + 1 characters
+ @param[in] label Inflected form, in encoding of orth labels
+ @param[in] rule Inflection rule
+ @return True if label is inflected form of found headword, false if label can not be inflected with the rule
+ */
+static bool mobi_dict_reverse_rule(char *headword, const char *label, const char *rule) {
+    const size_t label_length = strlen(label);
+    if (label_length > INDX_INFLBUF_SIZEMAX) {
+        return false;
+    }
+    const int length = (int) label_length - mobi_dict_rule_delta((const unsigned char *) rule);
+    if (length <= 0 || length > INDX_INFLBUF_SIZEMAX) {
+        return false;
+    }
+    int items[INDX_INFLBUF_SIZEMAX];
+    unsigned char deleted[INDX_INFLBUF_SIZEMAX] = { 0 };
+    size_t count = (size_t) length;
+    for (size_t i = 0; i < count; i++) {
+        items[i] = (int) i;
+    }
+    if (mobi_dict_apply_rule(items, &count, deleted, (const unsigned char *) rule) != MOBI_SUCCESS || count != label_length) {
+        return false;
+    }
+    for (size_t i = 0; i < count; i++) {
+        const unsigned char c = (unsigned char) label[i];
+        if (items[i] >= 0) {
+            headword[items[i]] = (char) c;
+        } else if (items[i] != -c) {
+            return false;
+        }
+    }
+    for (size_t i = 0; i < (size_t) length; i++) {
+        if (deleted[i]) {
+            headword[i] = (char) deleted[i];
+        }
+    }
+    headword[length] = '\0';
+    return true;
+}
+
+/**
+ @brief Build trie of reversed inflected endings from new type infl index
+ 
+ Rules referenced by infl groups are inserted into trie with endings they insert into inflected forms,
+ rule labels are trie values. Rules not ending inflected forms with inserted characters are stored separately,
+ they are reversed for every looked up word.
+ 
+ @param[in,out] dict MOBIDict structure with parsed infl index
+ @return MOBI_RET status code (on success MOBI_SUCCESS)
+ */
+static MOBI_RET mobi_dict_build_infl_rules(MOBIDict *dict) {
+    const MOBIIndx *infl = dict->infl;
+    if (infl->entries_count == 0) {
+        return MOBI_SUCCESS;
+    }
+    bool *is_rule = calloc(infl->entries_count, sizeof(*is_rule));
+    if (is_rule == NULL) {
+        debug_print("%s\n", "Memory allocation failed");
+        return MOBI_MALLOC_FAILED;
+    }
+    size_t rules_count = 0;
+    for (size_t i = 0; i < infl->entries_count; i++) {
+        uint32_t *parts;
+        const size_t parts_count = mobi_get_indxentry_tagarray(&parts, &infl->entries[i], INDX_TAGARR_INFL_PARTS_V2);
+        for (size_t k = 0; k < parts_count; k++) {
+            if (parts[k] >= infl->entries_count) {
+                debug_print("%s\n", "Invalid entry offset");
+                continue;
+            }
+            if (!is_rule[parts[k]]) {
+                is_rule[parts[k]] = true;
+                rules_count++;
+            }
+        }
+    }
+    MOBI_RET ret = MOBI_SUCCESS;
+    if (rules_count) {
+        dict->infl_rules = malloc(rules_count * sizeof(*dict->infl_rules));
+        if (dict->infl_rules == NULL) {
+            debug_print("%s\n", "Memory allocation failed");
+            ret = MOBI_MALLOC_FAILED;
+        }
+    }
+    for (size_t i = 0; ret == MOBI_SUCCESS && i < infl->entries_count; i++) {
+        if (!is_rule[i]) {
+            continue;
+        }
+        char *rule = infl->entries[i].label;
+        char ending[INDX_INFLBUF_SIZEMAX + 1];
+        if (mobi_dict_rule_ending(ending, (unsigned char *) rule) != MOBI_SUCCESS) {
+            debug_print("Skipping broken rule %zu\n", i);
+            continue;
+        }
+        if (*ending) {
+            ret = mobi_trie_insert_reversed(&dict->infl_trie, ending, rule);
+        } else {
+            dict->infl_rules[dict->infl_rules_count++] = rule;
+        }
+    }
+    free(is_rule);
+    return ret;
+}
+
+/**
+ @brief Prepare reverse inflection data of the dictionary
+ 
+ @param[in,out] dict MOBIDict structure
+ @param[in] infl_record_number Number of the first infl index record
+ @return MOBI_RET status code (on success MOBI_SUCCESS)
+ */
+static MOBI_RET mobi_dict_load_infl(MOBIDict *dict, const size_t infl_record_number) {
+    bool is_infl_v2 = false;
+    for (size_t i = 0; i < dict->orth->tagx->tags_count; i++) {
+        if (dict->orth->tagx->tags[i].tag == INDX_TAGARR_ORTH_INFL) {
+            is_infl_v2 = true;
+            break;
+        }
+    }
+    MOBIIndx *infl = mobi_init_indx();
+    if (infl == NULL) {
+        return MOBI_MALLOC_FAILED;
+    }
+    /* infl structure is freed by parser on failure */
+    MOBI_RET ret = mobi_parse_index(dict->m, infl, infl_record_number);
+    if (ret != MOBI_SUCCESS) {
+        return ret;
+    }
+    const bool is_infl_v1 = !is_infl_v2 && mobi_indx_has_tag(infl, INDX_TAGARR_INFL_PARTS_V1);
+    if (!is_infl_v1 && !is_infl_v2) {
+        debug_print("Unknown inflection scheme?%s", "\n");
+        mobi_free_indx(infl);
+        return MOBI_SUCCESS;
+    }
+    if (is_infl_v1) {
+        debug_print("%s\n", "Building trie for inflections (infl v1)");
+        dict->strings = mobi_buffer_init(MOBI_DICT_STRINGS_INITSIZE);
+        if (dict->strings == NULL) {
+            mobi_free_indx(infl);
+            return MOBI_MALLOC_FAILED;
+        }
+        ret = mobi_dict_build_infl_trie(dict, infl);
+        mobi_free_indx(infl);
+    } else {
+        debug_print("%s\n", "Building trie for inflection rules (infl v2)");
+        dict->infl = infl;
+        ret = mobi_dict_build_infl_rules(dict);
+    }
+    return ret;
+}
+
+/**
+ @brief Open dictionary for lookups
+ 
+ Orth index is opened for lazy access with mobi_open_index().
+ If infl index is present, data for finding headwords of inflected forms is prepared.
+ Document must stay loaded while dictionary is used.
+ Dictionary must be freed with mobi_dict_free().
+ 
+ @param[in,out] dict Will be set to opened dictionary, NULL on failure
+ @param[in] m MOBIData structure loaded with MOBI data
+ @return MOBI_RET status code (on success MOBI_SUCCESS)
+ */
+MOBI_RET mobi_dict_open(MOBIDict **dict, const MOBIData *m) {
+    if (dict == NULL) {
+        return MOBI_PARAM_ERR;
+    }
+    *dict = NULL;
+    if (m == NULL) {
+        debug_print("%s", "Mobi structure not initialized\n");
+        return MOBI_INIT_FAILED;
+    }
+    if (!mobi_is_dictionary(m)) {
+        debug_print("%s", "Document is not a dictionary\n");
+        return MOBI_FILE_UNSUPPORTED;
+    }
+    MOBIDict *mobi_dict = calloc(1, sizeof(MOBIDict));
+    if (mobi_dict == NULL) {
+        debug_print("%s\n", "Memory allocation failed");
+        return MOBI_MALLOC_FAILED;
+    }
+    mobi_dict->m = m;
+    const size_t offset = mobi_get_kf8offset(m);
+    const size_t orth_record_number = *m->mh->orth_index + offset;
+    MOBI_RET ret = mobi_open_index(m, &mobi_dict->orth, orth_record_number);
+    if (ret != MOBI_SUCCESS) {
+        mobi_dict_free(mobi_dict);
+        return ret;
+    }
+    mobi_dict->is_utf8 = mobi_indx_reader_is_utf8(mobi_dict->orth);
+    if (mobi_exists_infl(m)) {
+        const size_t infl_record_number = *m->mh->infl_index + offset;
+        ret = mobi_dict_load_infl(mobi_dict, infl_record_number);
+        if (ret != MOBI_SUCCESS) {
+            mobi_dict_free(mobi_dict);
+            return ret;
+        }
+    }
+    *dict = mobi_dict;
+    return MOBI_SUCCESS;
+}
+
+/**
+ @brief Append orth entry to lookup results, unless it is already present
+ 
+ @param[in,out] entries Array of results, may be reallocated
+ @param[in,out] count Number of results
+ @param[in,out] capacity Allocated capacity of results array
+ @param[in] dict MOBIDict structure
+ @param[in] number Sequential number of the entry in orth index
+ @param[in] is_inflection True if entry was found by inflected form
+ @return MOBI_RET status code (on success MOBI_SUCCESS)
+ */
+static MOBI_RET mobi_dict_add_entry(MOBIDictEntry **entries, size_t *count, size_t *capacity, const MOBIDict *dict, const size_t number, const bool is_inflection) {
+    for (size_t i = 0; i < *count; i++) {
+        if ((*entries)[i].number == number) {
+            return MOBI_SUCCESS;
+        }
+    }
+    MOBIIndexEntry orth_entry;
+    MOBI_RET ret = mobi_get_index_entry(dict->orth, &orth_entry, number);
+    if (ret != MOBI_SUCCESS) {
+        return ret;
+    }
+    const uint32_t offset = mobi_get_orth_entry_offset(&orth_entry);
+    if (offset == MOBI_NOTSET) {
+        /* skip broken entry */
+        debug_print("Missing position of orth entry %zu\n", number);
+        mobi_free_index_entry(&orth_entry);
+        return MOBI_SUCCESS;
+    }
+    const uint32_t length = mobi_get_orth_entry_length(&orth_entry);
+    if (*count == *capacity) {
+        const size_t new_capacity = *capacity ? *capacity * 2 : MOBI_DICT_ENTRIES_INITSIZE;
+        MOBIDictEntry *new_entries = realloc(*entries, new_capacity * sizeof(**entries));
+        if (new_entries == NULL) {
+            debug_print("%s\n", "Memory allocation failed");
+            mobi_free_index_entry(&orth_entry);
+            return MOBI_MALLOC_FAILED;
+        }
+        *entries = new_entries;
+        *capacity = new_capacity;
+    }
+    char *label;
+    if (dict->is_utf8) {
+        label = strdup(orth_entry.label);
+    } else {
+        const size_t label_length = strlen(orth_entry.label);
+        size_t label_size = 3 * label_length + 1;
+        label = malloc(label_size);
+        if (label) {
+            mobi_cp1252_to_utf8(label, orth_entry.label, &label_size, label_length);
+        }
+    }
+    mobi_free_index_entry(&orth_entry);
+    if (label == NULL) {
+        debug_print("%s\n", "Memory allocation failed");
+        return MOBI_MALLOC_FAILED;
+    }
+    MOBIDictEntry *entry = &(*entries)[(*count)++];
+    entry->label = label;
+    entry->number = number;
+    entry->offset = offset;
+    entry->length = (length == MOBI_NOTSET) ? 0 : length;
+    entry->is_inflection = is_inflection;
+    return MOBI_SUCCESS;
+}
+
+/**
+ @brief Convert letter to lower case
+ 
+ Letters of Basic Latin, Latin-1, Latin Extended-A, Greek and Cyrillic blocks are converted.
+ 
+ @param[in] c Code point
+ @return Code point of lower case letter, unchanged code point if there is none
+ */
+static uint32_t mobi_dict_tolower(const uint32_t c) {
+    if (c == 0x130) {
+        return 'i';
+    }
+    if (c == 0x178) {
+        return 0xff;
+    }
+    if ((c >= 'A' && c <= 'Z') || (c >= 0xc0 && c <= 0xde && c != 0xd7)
+        || (c >= 0x391 && c <= 0x3ab && c != 0x3a2) || (c >= 0x410 && c <= 0x42f)) {
+        return c + 0x20;
+    }
+    if (c >= 0x400 && c <= 0x40f) {
+        return c + 0x50;
+    }
+    if (((c >= 0x100 && c <= 0x137) || (c >= 0x14a && c <= 0x177)) && c % 2 == 0) {
+        return c + 1;
+    }
+    if (((c >= 0x139 && c <= 0x148) || (c >= 0x179 && c <= 0x17e)) && c % 2 == 1) {
+        return c + 1;
+    }
+    return c;
+}
+
+/**
+ @brief Convert letter to upper case
+ 
+ Letters of Basic Latin, Latin-1, Latin Extended-A, Greek and Cyrillic blocks are converted.
+ 
+ @param[in] c Code point
+ @return Code point of upper case letter, unchanged code point if there is none
+ */
+static uint32_t mobi_dict_toupper(const uint32_t c) {
+    if (c == 0x131) {
+        return 'I';
+    }
+    if (c == 0xff) {
+        return 0x178;
+    }
+    if (c == 0x3c2) {
+        return 0x3a3;
+    }
+    if ((c >= 'a' && c <= 'z') || (c >= 0xe0 && c <= 0xfe && c != 0xf7)
+        || (c >= 0x3b1 && c <= 0x3cb) || (c >= 0x430 && c <= 0x44f)) {
+        return c - 0x20;
+    }
+    if (c >= 0x450 && c <= 0x45f) {
+        return c - 0x50;
+    }
+    if (((c >= 0x101 && c <= 0x137) || (c >= 0x14b && c <= 0x177)) && c % 2 == 1) {
+        return c - 1;
+    }
+    if (((c >= 0x13a && c <= 0x148) || (c >= 0x17a && c <= 0x17e)) && c % 2 == 0) {
+        return c - 1;
+    }
+    return c;
+}
+
+/**
+ @brief Convert case of letters of UTF-8 word
+ 
+ @param[in,out] output Output buffer (INDX_LABEL_SIZEMAX + 1 bytes)
+ @param[in] word UTF-8 encoded word
+ @param[in] upper_first Convert first letter to upper case, otherwise to lower case
+ @param[in] upper_rest Convert other letters to upper case, otherwise to lower case
+ @return True on success, false if converted word is too long
+ */
+static bool mobi_dict_convert_case(char *output, const char *word, const bool upper_first, const bool upper_rest) {
+    const unsigned char *s = (const unsigned char *) word;
+    size_t length = 0;
+    bool upper = upper_first;
+    while (*s) {
+        const unsigned char *start = s;
+        const uint32_t c = mobi_indx_utf8_next(&s);
+        const uint32_t converted = upper ? mobi_dict_toupper(c) : mobi_dict_tolower(c);
+        upper = upper_rest;
+        if (converted == c) {
+            /* copy unchanged, also invalid sequences */
+            const size_t bytes = (size_t) (s - start);
+            if (length + bytes > INDX_LABEL_SIZEMAX) {
+                return false;
+            }
+            memcpy(output + length, start, bytes);
+            length += bytes;
+            continue;
+        }
+        /* converted letters are below U+0800 */
+        if (length + 2 > INDX_LABEL_SIZEMAX) {
+            return false;
+        }
+        if (converted < 0x80) {
+            output[length++] = (char) converted;
+        } else {
+            output[length++] = (char) (0xc0 | (converted >> 6));
+            output[length++] = (char) (0x80 | (converted & 0x3f));
+        }
+    }
+    output[length] = '\0';
+    return true;
+}
+
+/**
+ @brief Check if UTF-8 labels differ only in case
+ 
+ @param[in] label1 First label
+ @param[in] label2 Second label
+ @return True if labels are equal after conversion to lower case
+ */
+static bool mobi_dict_equal_nocase(const char *label1, const char *label2) {
+    const unsigned char *s1 = (const unsigned char *) label1;
+    const unsigned char *s2 = (const unsigned char *) label2;
+    while (*s1 && *s2) {
+        if (mobi_dict_tolower(mobi_indx_utf8_next(&s1)) != mobi_dict_tolower(mobi_indx_utf8_next(&s2))) {
+            return false;
+        }
+    }
+    return *s1 == *s2;
+}
+
+/**
+ @brief Check how label found in collation order matches looked up word
+ 
+ @param[in] dict MOBIDict structure
+ @param[in] label Label, in encoding of orth labels
+ @param[in] word Looked up word, UTF-8 encoded
+ @return Match of the label
+ */
+static MOBIDictMatch mobi_dict_match(const MOBIDict *dict, const char *label, const char *word) {
+    char utf8[3 * INDX_LABEL_SIZEMAX + 1];
+    if (!dict->is_utf8) {
+        size_t utf8_size = sizeof(utf8);
+        if (mobi_cp1252_to_utf8(utf8, label, &utf8_size, strlen(label)) != MOBI_SUCCESS) {
+            return MOBI_DICT_MATCH_COLLATION;
+        }
+        label = utf8;
+    }
+    if (strcmp(label, word) == 0) {
+        return MOBI_DICT_MATCH_EXACT;
+    }
+    if (mobi_dict_equal_nocase(label, word)) {
+        return MOBI_DICT_MATCH_NOCASE;
+    }
+    return MOBI_DICT_MATCH_COLLATION;
+}
+
+/**
+ @brief Prepare labels of the word and its case variants for searching in collation order
+ 
+ Case variants are the word in lower case, in upper case and with first letter in upper case.
+ They are needed for UTF-8 indices, in ORDT order or collation order letters beyond Latin-1 differing in case are not equal.
+ The word itself is the first label, duplicates and variants not fitting orth encoding are skipped.
+ 
+ @param[in,out] labels Array of MOBI_DICT_VARIANTS_MAX labels to be filled, in encoding of orth labels
+ @param[in,out] labels_count Will be set to number of labels
+ @param[in] dict MOBIDict structure
+ @param[in] word Looked up word, UTF-8 encoded
+ @param[in] all_cases If true, case variants are prepared also for CP1252 labels, for matching bytes of inflection rules
+ @return MOBI_RET status code (on success MOBI_SUCCESS)
+ */
+static MOBI_RET mobi_dict_variants(char labels[][INDX_LABEL_SIZEMAX + 1], size_t *labels_count, const MOBIDict *dict, const char *word, const bool all_cases) {
+    static const bool upper_first[MOBI_DICT_VARIANTS_MAX] = { false, false, true, true };
+    static const bool upper_rest[MOBI_DICT_VARIANTS_MAX] = { false, false, true, false };
+    *labels_count = 0;
+    /* collation order of CP1252 labels is already case insensitive */
+    const size_t variants_count = (dict->is_utf8 || all_cases) ? MOBI_DICT_VARIANTS_MAX : 1;
+    char variant[INDX_LABEL_SIZEMAX + 1];
+    for (size_t i = 0; i < variants_count; i++) {
+        const char *utf8 = word;
+        if (i > 0) {
+            if (!mobi_dict_convert_case(variant, word, upper_first[i], upper_rest[i])) {
+                continue;
+            }
+            utf8 = variant;
+        }
+        char *label = labels[*labels_count];
+        const size_t length = strlen(utf8);
+        if (dict->is_utf8) {
+            if (length > INDX_LABEL_SIZEMAX) {
+                debug_print("Word too long (%zu)\n", length);
+                return MOBI_PARAM_ERR;
+            }
+            memcpy(label, utf8, length + 1);
+        } else {
+            size_t label_size = INDX_LABEL_SIZEMAX + 1;
+            MOBI_RET ret = mobi_utf8_to_cp1252(label, utf8, &label_size, length);
+            if (ret != MOBI_SUCCESS) {
+                if (i == 0) {
+                    return ret;
+                }
+                continue;
+            }
+        }
+        bool is_duplicate = false;
+        for (size_t k = 0; k < *labels_count; k++) {
+            if (strcmp(labels[k], label) == 0) {
+                is_duplicate = true;
+                break;
+            }
+        }
+        if (!is_duplicate) {
+            (*labels_count)++;
+        }
+    }
+    return MOBI_SUCCESS;
+}
+
+/**
+ @brief Append orth entries best matching the word to lookup results
+ 
+ Ranges of entries equal in collation order to the word and its case variants are searched.
+ Entries with labels equal to the word are appended, if there are none, entries differing only in case,
+ if there are none, all entries of the ranges.
+ 
+ @param[in,out] entries Array of results, may be reallocated
+ @param[in,out] count Number of results
+ @param[in,out] capacity Allocated capacity of results array
+ @param[in] dict MOBIDict structure
+ @param[in] word Word, UTF-8 encoded
+ @param[in] is_inflection True if word is headword found by inflected form
+ @return MOBI_RET status code (on success MOBI_SUCCESS)
+ */
+static MOBI_RET mobi_dict_add_headwords(MOBIDictEntry **entries, size_t *count, size_t *capacity, const MOBIDict *dict, const char *word, const bool is_inflection) {
+    char labels[MOBI_DICT_VARIANTS_MAX][INDX_LABEL_SIZEMAX + 1];
+    size_t labels_count;
+    MOBI_RET ret = mobi_dict_variants(labels, &labels_count, dict, word, false);
+    size_t first[MOBI_DICT_VARIANTS_MAX];
+    size_t range[MOBI_DICT_VARIANTS_MAX];
+    MOBIDictMatch best = MOBI_DICT_MATCH_NONE;
+    char label[INDX_LABEL_SIZEMAX + 1];
+    for (size_t i = 0; ret == MOBI_SUCCESS && i < labels_count; i++) {
+        ret = mobi_find_index_range(dict->orth, &first[i], &range[i], labels[i]);
+        for (size_t j = first[i]; ret == MOBI_SUCCESS && j < first[i] + range[i]; j++) {
+            ret = mobi_get_index_label(dict->orth, label, j);
+            if (ret == MOBI_SUCCESS) {
+                const MOBIDictMatch match = mobi_dict_match(dict, label, word);
+                if (match > best) {
+                    best = match;
+                }
+            }
+        }
+    }
+    for (size_t i = 0; ret == MOBI_SUCCESS && best != MOBI_DICT_MATCH_NONE && i < labels_count; i++) {
+        for (size_t j = first[i]; ret == MOBI_SUCCESS && j < first[i] + range[i]; j++) {
+            ret = mobi_get_index_label(dict->orth, label, j);
+            if (ret == MOBI_SUCCESS && mobi_dict_match(dict, label, word) == best) {
+                ret = mobi_dict_add_entry(entries, count, capacity, dict, j, is_inflection);
+            }
+        }
+    }
+    return ret;
+}
+
+/**
+ @brief Check how inflected forms of orth entry match the word
+ 
+ Rules referenced by the entry are applied to its label, like in mobi_reconstruct_infl().
+ Only forms equal to the label in collation order are matched.
+ 
+ @param[in] dict MOBIDict structure
+ @param[in] orth_entry Orth entry
+ @param[in] label Inflected form, in encoding of orth labels
+ @param[in] word Looked up word, UTF-8 encoded
+ @return Best match of inflected forms
+ */
+static MOBIDictMatch mobi_dict_match_inflected(const MOBIDict *dict, const MOBIIndexEntry *orth_entry, const char *label, const char *word) {
+    MOBIDictMatch best = MOBI_DICT_MATCH_NONE;
+    const size_t label_length = strlen(orth_entry->label);
+    if (label_length > INDX_INFLBUF_SIZEMAX) {
+        debug_print("Entry label too long (%s)\n", orth_entry->label);
+        return best;
+    }
+    const MOBIIndx *infl = dict->infl;
+    uint32_t *infl_groups = NULL;
+    const size_t infl_count = mobi_get_indxentry_tagarray(&infl_groups, orth_entry, INDX_TAGARR_ORTH_INFL);
+    for (size_t j = 0; j < infl_count; j++) {
+        if (infl_groups[j] >= infl->entries_count) {
+            debug_print("%s\n", "Invalid entry offset");
+            continue;
+        }
+        uint32_t *parts;
+        const size_t part_count = mobi_get_indxentry_tagarray(&parts, &infl->entries[infl_groups[j]], INDX_TAGARR_INFL_PARTS_V2);
+        for (size_t k = 0; k < part_count; k++) {
+            if (parts[k] >= infl->entries_count) {
+                debug_print("%s\n", "Invalid entry offset");
+                continue;
+            }
+            unsigned char decoded[INDX_INFLBUF_SIZEMAX + 1];
+            memcpy(decoded, orth_entry->label, label_length);
+            int decoded_length = (int) label_length;
+            const unsigned char *rule = (unsigned char *) infl->entries[parts[k]].label;
+            MOBI_RET ret = mobi_decode_infl(decoded, &decoded_length, rule);
+            if (ret != MOBI_SUCCESS || decoded_length == 0) {
+                continue;
+            }
+            decoded[decoded_length] = '\0';
+            if (mobi_indx_label_collate((char *) decoded, label, dict->is_utf8) == 0) {
+                const MOBIDictMatch match = mobi_dict_match(dict, (char *) decoded, word);
+                if (match > best) {
+                    best = match;
+                }
+            }
+        }
+    }
+    return best;
+}
+
+/**
+ @brief Append headwords, which are inflected with the rule to the label, to found inflections
+ 
+ @param[in,out] found Array of found inflections, may be reallocated
+ @param[in,out] found_count Number of found inflections
+ @param[in,out] capacity Allocated capacity of found inflections array
+ @param[in] dict MOBIDict structure
+ @param[in] label Inflected form, in encoding of orth labels
+ @param[in] rule Inflection rule
+ @param[in] word Looked up word, UTF-8 encoded
+ @return MOBI_RET status code (on success MOBI_SUCCESS)
+ */
+static MOBI_RET mobi_dict_find_inflected(MOBIDictInflection **found, size_t *found_count, size_t *capacity, const MOBIDict *dict, const char *label, const char *rule, const char *word) {
+    char headword[INDX_INFLBUF_SIZEMAX + 1];
+    if (!mobi_dict_reverse_rule(headword, label, rule)) {
+        return MOBI_SUCCESS;
+    }
+    size_t first;
+    size_t range;
+    MOBI_RET ret = mobi_find_index_range(dict->orth, &first, &range, headword);
+    for (size_t j = first; ret == MOBI_SUCCESS && j < first + range; j++) {
+        MOBIIndexEntry orth_entry;
+        ret = mobi_get_index_entry(dict->orth, &orth_entry, j);
+        if (ret != MOBI_SUCCESS) {
+            break;
+        }
+        const MOBIDictMatch match = mobi_dict_match_inflected(dict, &orth_entry, label, word);
+        mobi_free_index_entry(&orth_entry);
+        if (match == MOBI_DICT_MATCH_NONE) {
+            continue;
+        }
+        if (*found_count == *capacity) {
+            const size_t new_capacity = *capacity ? *capacity * 2 : MOBI_DICT_ENTRIES_INITSIZE;
+            MOBIDictInflection *new_found = realloc(*found, new_capacity * sizeof(**found));
+            if (new_found == NULL) {
+                debug_print("%s\n", "Memory allocation failed");
+                return MOBI_MALLOC_FAILED;
+            }
+            *found = new_found;
+            *capacity = new_capacity;
+        }
+        (*found)[*found_count].number = j;
+        (*found)[*found_count].match = match;
+        (*found_count)++;
+    }
+    return ret;
+}
+
+/**
+ @brief Append headwords of inflected forms best matching the word to lookup results, for new type infl index
+ 
+ Rules inserting endings of the word and its case variants are found in trie, together with rules
+ not inserting endings they are reversed to get candidate headwords. Candidates are searched in orth index
+ and confirmed by applying rules referenced by found entries. Inflected forms are narrowed like headwords
+ in mobi_dict_add_headwords().
+ 
+ @param[in,out] entries Array of results, may be reallocated
+ @param[in,out] count Number of results
+ @param[in,out] capacity Allocated capacity of results array
+ @param[in] dict MOBIDict structure
+ @param[in] word Word, UTF-8 encoded
+ @return MOBI_RET status code (on success MOBI_SUCCESS)
+ */
+static MOBI_RET mobi_dict_add_inflected(MOBIDictEntry **entries, size_t *count, size_t *capacity, const MOBIDict *dict, const char *word) {
+    char labels[MOBI_DICT_VARIANTS_MAX][INDX_LABEL_SIZEMAX + 1];
+    size_t labels_count;
+    MOBI_RET ret = mobi_dict_variants(labels, &labels_count, dict, word, true);
+    MOBIDictInflection *found = NULL;
+    size_t found_count = 0;
+    size_t found_capacity = 0;
+    for (size_t i = 0; ret == MOBI_SUCCESS && i < labels_count; i++) {
+        const char *label = labels[i];
+        size_t length = strlen(label);
+        const MOBITrie *node = dict->infl_trie;
+        while (ret == MOBI_SUCCESS && node && length > 0) {
+            char **values = NULL;
+            size_t values_count = 0;
+            node = mobi_trie_get_next(&values, &values_count, node, label[--length]);
+            for (size_t j = 0; ret == MOBI_SUCCESS && j < values_count; j++) {
+                ret = mobi_dict_find_inflected(&found, &found_count, &found_capacity, dict, label, values[j], word);
+            }
+        }
+        for (size_t j = 0; ret == MOBI_SUCCESS && j < dict->infl_rules_count; j++) {
+            ret = mobi_dict_find_inflected(&found, &found_count, &found_capacity, dict, label, dict->infl_rules[j], word);
+        }
+    }
+    MOBIDictMatch best = MOBI_DICT_MATCH_NONE;
+    for (size_t i = 0; i < found_count; i++) {
+        if (found[i].match > best) {
+            best = found[i].match;
+        }
+    }
+    for (size_t i = 0; ret == MOBI_SUCCESS && i < found_count; i++) {
+        if (found[i].match == best) {
+            ret = mobi_dict_add_entry(entries, count, capacity, dict, found[i].number, true);
+        }
+    }
+    free(found);
+    return ret;
+}
+
+/**
+ @brief Look up a word in the dictionary
+ 
+ Headwords equal to the word are returned first, if there are none, headwords differing only in case,
+ if there are none, headwords equal in collation order of orth index
+ (ORDT order, or case and accent insensitive order ignoring punctuation).
+ They are followed by headwords the word is an inflected form of, found the same way.
+ Each headword entry is returned once.
+ Entries text may be read with mobi_dict_get_text().
+ Returned array must be freed with mobi_dict_free_entries().
+ 
+ @param[in,out] entries Will be set to array of found entries, NULL if none found
+ @param[in,out] count Will be set to number of found entries
+ @param[in] dict MOBIDict structure opened with mobi_dict_open()
+ @param[in] word Searched word, UTF-8 encoded, not empty
+ @return MOBI_RET status code (on success MOBI_SUCCESS)
+ */
+MOBI_RET mobi_dict_lookup(MOBIDictEntry **entries, size_t *count, const MOBIDict *dict, const char *word) {
+    if (entries == NULL || count == NULL) {
+        return MOBI_PARAM_ERR;
+    }
+    *entries = NULL;
+    *count = 0;
+    if (word == NULL || *word == '\0') {
+        debug_print("%s", "Empty word\n");
+        return MOBI_PARAM_ERR;
+    }
+    if (dict == NULL) {
+        debug_print("%s", "Dictionary not initialized\n");
+        return MOBI_INIT_FAILED;
+    }
+    size_t capacity = 0;
+    MOBI_RET ret = mobi_dict_add_headwords(entries, count, &capacity, dict, word, false);
+    if (ret == MOBI_SUCCESS && dict->infl) {
+        ret = mobi_dict_add_inflected(entries, count, &capacity, dict, word);
+    } else if (ret == MOBI_SUCCESS && dict->infl_trie) {
+        /* candidates are word with inflected endings replaced by base endings */
+        char label[INDX_LABEL_SIZEMAX + 1];
+        const size_t word_length = strlen(word);
+        if (dict->is_utf8) {
+            memcpy(label, word, word_length + 1);
+        } else {
+            size_t label_size = sizeof(label);
+            ret = mobi_utf8_to_cp1252(label, word, &label_size, word_length);
+        }
+        char *infl_strings[INDX_INFLSTRINGS_MAX];
+        const size_t infl_count = (ret == MOBI_SUCCESS) ? mobi_trie_get_inflgroups(infl_strings, dict->infl_trie, label) : 0;
+        for (size_t i = 0; i < infl_count; i++) {
+            if (ret == MOBI_SUCCESS && infl_strings[i] && *infl_strings[i]) {
+                const char *candidate = infl_strings[i];
+                char utf8[3 * INDX_LABEL_SIZEMAX + 1];
+                if (!dict->is_utf8) {
+                    size_t utf8_size = sizeof(utf8);
+                    ret = mobi_cp1252_to_utf8(utf8, candidate, &utf8_size, strlen(candidate));
+                    candidate = utf8;
+                }
+                if (ret == MOBI_SUCCESS) {
+                    ret = mobi_dict_add_headwords(entries, count, &capacity, dict, candidate, true);
+                }
+            }
+            /* allocated in mobi_trie_get_inflgroups() */
+            free(infl_strings[i]);
+        }
+    }
+    if (ret != MOBI_SUCCESS) {
+        mobi_dict_free_entries(*entries, *count);
+        *entries = NULL;
+        *count = 0;
+    }
+    return ret;
+}
+
+/**
+ @brief Read text of dictionary entry
+ 
+ Only text records covering the entry are decompressed, see mobi_get_text_range().
+ If entry length is not given in orth index, text up to the size of the buffer is read.
+ Output is not null-terminated.
+ 
+ @param[in] dict MOBIDict structure opened with mobi_dict_open()
+ @param[in] entry Entry returned by mobi_dict_lookup()
+ @param[in,out] text Memory area to be filled with entry text
+ @param[in,out] len Size of the memory area, on return set to length of the text
+ @return MOBI_RET status code (on success MOBI_SUCCESS)
+ */
+MOBI_RET mobi_dict_get_text(const MOBIDict *dict, const MOBIDictEntry *entry, char *text, size_t *len) {
+    if (dict == NULL || entry == NULL || text == NULL || len == NULL) {
+        return MOBI_PARAM_ERR;
+    }
+    size_t length = *len;
+    if (entry->length && entry->length < length) {
+        length = entry->length;
+    }
+    MOBI_RET ret = mobi_get_text_range(dict->m, entry->offset, text, &length);
+    *len = (ret == MOBI_SUCCESS) ? length : 0;
+    return ret;
+}
+
+/**
+ @brief Free array of entries returned by mobi_dict_lookup()
+ 
+ @param[in] entries Array of MOBIDictEntry structures
+ @param[in] count Number of entries
+ */
+void mobi_dict_free_entries(MOBIDictEntry *entries, const size_t count) {
+    if (entries == NULL) {
+        return;
+    }
+    for (size_t i = 0; i < count; i++) {
+        free(entries[i].label);
+    }
+    free(entries);
+}
+
+/**
+ @brief Free dictionary opened with mobi_dict_open()
+ 
+ @param[in] dict MOBIDict structure
+ */
+void mobi_dict_free(MOBIDict *dict) {
+    if (dict == NULL) {
+        return;
+    }
+    mobi_free_indx_reader(dict->orth);
+    mobi_trie_free(dict->infl_trie);
+    mobi_buffer_free(dict->strings);
+    mobi_free_indx(dict->infl);
+    free(dict->infl_rules);
+    free(dict);
+}
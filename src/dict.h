@@ -0,0 +1,62 @@
+/** @file dict.h
+ *
+ * Copyright (c) 2026 Bartek Fabiszewski
+ * http://www.fabiszewski.net
+ *
+ * This file is part of libmobi.
+ * Licensed under LGPL, either version 3, or any later.
+ * See <http://www.gnu.org/licenses/>
+ */
+
+#ifndef libmobi_dict_h
+#define libmobi_dict_h
+
+#include "config.h"
+#include "mobi.h"
+#include "buffer.h"
+#include "index.h"
+#include "structure.h"
+
+#define MOBI_DICT_STRINGS_INITSIZE 4096 /**< Initial size of buffer for strings of inflections */
+#define MOBI_DICT_ENTRIES_INITSIZE 8 /**< Initial capacity of lookup results array */
+#define MOBI_DICT_VARIANTS_MAX 4 /**< Maximal number of searched case variants of looked up word, including the word */
+
+/**
+ @brief Match of index label to looked up word, better matches have higher values
+ */
+typedef enum {
+    MOBI_DICT_MATCH_NONE = 0, /**< Label was not matched */
+    MOBI_DICT_MATCH_COLLATION, /**< Label is equal in collation order of the index */
+    MOBI_DICT_MATCH_NOCASE, /**< Label differs only in case */
+    MOBI_DICT_MATCH_EXACT /**< Label is equal */
+} MOBIDictMatch;
+
+/**
+ @brief Headword found by its inflected form, with rules of new type infl index
+ */
+typedef struct {
+    size_t number; /**< Sequential number of the headword entry in orth index */
+    MOBIDictMatch match; /**< Match of the inflected form to looked up word */
+} MOBIDictInflection;
+
+/**
+ @brief Dictionary opened for lookups
+ 
+ Orth index is accessed lazily, only labels visited by binary search are decoded.
+ Old type infl index (suffix rules) is loaded into trie of reversed inflected endings.
+ New type infl index (rules referenced by orth entries) is kept parsed, its rules are loaded into trie
+ of reversed endings they insert. Rules matching the looked up word are reversed to candidate headwords,
+ which are confirmed in orth index.
+ */
+struct MOBIDict {
+    const MOBIData *m; /**< Document, must stay loaded while dictionary is used */
+    MOBIIndxReader *orth; /**< Orth index opened with mobi_open_index() */
+    bool is_utf8; /**< True if orth labels are UTF-8 encoded, otherwise they are CP1252 encoded */
+    MOBITrie *infl_trie; /**< Trie of reversed inflected endings with base endings (old type infl) or rules (new type infl) as values, NULL if not used */
+    MOBIBuffer *strings; /**< Base endings of old type infl index, NULL if not used */
+    MOBIIndx *infl; /**< Parsed new type infl index, NULL if not used */
+    char **infl_rules; /**< Rules of new type infl index not inserting endings, point to infl labels, NULL if not used */
+    size_t infl_rules_count; /**< Number of rules not inserting endings */
+};
+
+#endif
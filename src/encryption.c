@@ -44,16 +44,22 @@
 #define VOUCHERSIZE 48
 #define VOUCHERS_COUNT_MAX 1024
 #define VOUCHERS_SIZE_MIN 288
-#define pk1_swap(a, b) { uint16_t tmp = a; (a) = b; (b) = tmp; }
 
 /**
  @brief Structure for PK1 routines
+ 
+ Every processed plain text byte is xored into all key bytes,
+ so key is always the initial key xored with a running xor of processed bytes.
+ Key mixing rounds depending only on the key are precomputed for all 256 values
+ of the running xor. Tables of document key are kept in MOBIDrm structure,
+ register state is kept by caller, on stack.
  */
-typedef struct {
-    uint16_t si, x1a2, x1a0[8];
+typedef struct MOBIPk1 {
+    uint16_t offsets[256][KEYSIZE / 2]; /**< Parts of x1a2 register in each round, depending only on the key */
+    uint16_t ax[256]; /**< Xor of ax registers from all rounds */
+    uint16_t si[256]; /**< Value of si register after all rounds */
 } MOBIPk1;
 
-
 /**
  @brief Structure for parsed drm record in record 0 header
  */
@@ -76,54 +82,87 @@ typedef struct {
 } MOBIExthDrm;
 
 /**
- @brief Helper function for PK1 encryption/decryption
+ @brief Powers of PK1 multiplier 0x4e35 modulo 2^16
+ */
+static const uint16_t mobi_pk1_powers[KEYSIZE / 2] = {
+    0x0001, 0x4e35, 0x56f9, 0xdf8d, 0x3e31, 0xce25, 0xf3a9, 0xeffd
+};
+
+/**
+ @brief Initialize PK1 tables
  
- @param[in,out] pk1 PK1 structure
- @param[in] i Iteration number
- @return PK1 inter
+ In round i register x1a2 is (x1a2 * 0x4e35 + si) * 0x4e35^i + offsets[i],
+ where x1a2 and si are register values from previous byte.
+ Arithmetic is done modulo 2^16, higher bits are ignored.
+ 
+ @param[out] pk1 PK1 structure
+ @param[in] key 128-bit key
  */
-static uint16_t mobi_pk1_code(MOBIPk1 *pk1, const uint8_t i) {
-    uint16_t dx = pk1->x1a2 + i;
-    uint16_t ax = pk1->x1a0[i];
-    uint16_t cx = 0x015a;
-    uint16_t bx = 0x4e35;
-    pk1_swap(ax, pk1->si);
-    pk1_swap(ax, dx);
-    if (ax) { ax *= bx; }
-    pk1_swap(ax, cx);
-    if (ax) {
-        ax *= pk1->si;
-        cx += ax;
-    }
-    pk1_swap(ax, pk1->si);
-    ax *= bx;
-    dx += cx;
-    ax += 1;
-    pk1->x1a2 = dx;
-    pk1->x1a0[i] = ax;
-    return ax ^ dx;
+static void mobi_pk1_init(MOBIPk1 *pk1, const unsigned char key[KEYSIZE]) {
+    uint16_t words[KEYSIZE / 2];
+    for (size_t i = 0; i < KEYSIZE / 2; i++) {
+        words[i] = (uint16_t) ((key[i * 2] << 8) | key[i * 2 + 1]);
+    }
+    for (uint32_t x = 0; x < 256; x++) {
+        const uint32_t mask = x * 0x0101U;
+        uint32_t ax = 0;
+        uint32_t ax_sum = 0;
+        uint32_t offset = 0;
+        uint32_t previous = 0;
+        for (uint32_t i = 0; i < KEYSIZE / 2; i++) {
+            const uint32_t word = ax ^ words[i] ^ mask;
+            ax = word * 0x4e35U + 1;
+            ax_sum ^= ax;
+            offset = offset * 0x4e35U + word * 0x015aU;
+            if (i) {
+                offset += i * 0x4e35U + previous * 0x015aU;
+            }
+            pk1->offsets[x][i] = (uint16_t) offset;
+            previous = word;
+        }
+        pk1->ax[x] = (uint16_t) ax_sum;
+        pk1->si[x] = (uint16_t) (previous * 0x015aU);
+    }
 }
 
 /**
- @brief Helper function for PK1 encryption/decryption
+ @brief Encrypt or decrypt buffer with PK1 algorithm
  
- @param[in,out] pk1 PK1 structure
- @param[in] key 128-bit key
- @return PK1 inter
+ Rounds of single byte are independent of each other,
+ only table lookup and two registers are carried to the next byte.
+ Input and output may point to the same buffer.
+ 
+ @param[in,out] out Output buffer
+ @param[in] in Input buffer
+ @param[in] length Buffer length
+ @param[in] pk1 Tables initialized with mobi_pk1_init()
+ @param[in] decrypt True for decryption, false for encryption
  */
-static uint16_t mobi_pk1_assemble(MOBIPk1 *pk1, const unsigned char key[KEYSIZE]) {
-    pk1->x1a0[0] = (key[0] * 256) + key[1];
-    uint16_t inter = mobi_pk1_code(pk1, 0);
-    for (uint8_t i = 1; i < (KEYSIZE / 2); i++) {
-        pk1->x1a0[i] = pk1->x1a0[i - 1] ^ ((key[i * 2] * 256) + key[i * 2 + 1]);
-        inter ^= mobi_pk1_code(pk1, i);
-    }
-    return inter;
+static void mobi_pk1_crypt(unsigned char *out, const unsigned char *in, size_t length, const MOBIPk1 *pk1, const bool decrypt) {
+    uint32_t si = 0;
+    uint32_t dx = 0;
+    uint8_t x = 0;
+    while (length--) {
+        const uint32_t base = dx * 0x4e35U + si;
+        const uint16_t *offsets = pk1->offsets[x];
+        uint32_t inter = pk1->ax[x];
+        for (size_t i = 0; i < KEYSIZE / 2; i++) {
+            dx = mobi_pk1_powers[i] * base + offsets[i];
+            inter ^= dx;
+        }
+        si = pk1->si[x];
+        const uint8_t c = *in++;
+        const uint8_t result = c ^ (uint8_t) ((inter >> 8) ^ inter);
+        x ^= decrypt ? result : c;
+        *out++ = result;
+    }
 }
 
 /**
  @brief Decrypt buffer with PK1 algorithm
  
+ Input and output may point to the same buffer.
+ 
  @param[in,out] out Decrypted buffer
  @param[in] in Encrypted buffer
  @param[in] length Buffer length
@@ -134,29 +173,19 @@ static MOBI_RET mobi_pk1_decrypt(unsigned char *out, const unsigned char *in, si
     if (!out || !in) {
         return MOBI_INIT_FAILED;
     }
-    unsigned char key_copy[KEYSIZE];
-    memcpy(key_copy, key, KEYSIZE);
-    MOBIPk1 *pk1 = calloc(1, sizeof(MOBIPk1));
-    while (length--) {
-        uint16_t inter = mobi_pk1_assemble(pk1, key_copy);
-        uint8_t cfc = inter >> 8;
-        uint8_t cfd = inter & 0xff;
-        uint8_t c = *in++;
-        c ^= (cfc ^ cfd);
-        for (size_t i = 0; i < KEYSIZE; i++) {
-            key_copy[i] ^= c;
-        }
-        *out++ = c;
-    }
-    free(pk1);
+    MOBIPk1 pk1;
+    mobi_pk1_init(&pk1, key);
+    mobi_pk1_crypt(out, in, length, &pk1, true);
     return MOBI_SUCCESS;
 }
 
 /**
  @brief Encrypt buffer with PK1 algorithm
  
- @param[in,out] out Decrypted buffer
- @param[in] in Encrypted buffer
+ Input and output may point to the same buffer.
+ 
+ @param[in,out] out Encrypted buffer
+ @param[in] in Decrypted buffer
  @param[in] length Buffer length
  @param[in] key Key
  @return MOBI_RET status code (on success MOBI_SUCCESS)
@@ -165,21 +194,9 @@ static MOBI_RET mobi_pk1_encrypt(unsigned char *out, const unsigned char *in, si
     if (!out || !in) {
         return MOBI_INIT_FAILED;
     }
-    MOBIPk1 *pk1 = calloc(1, sizeof(MOBIPk1));
-    unsigned char key_copy[KEYSIZE];
-    memcpy(key_copy, key, KEYSIZE);
-    while (length--) {
-        uint16_t inter = mobi_pk1_assemble(pk1, key_copy);
-        uint8_t cfc = inter >> 8;
-        uint8_t cfd = inter & 0xff;
-        uint8_t c = *in++;
-        for (size_t i = 0; i < KEYSIZE; i++) {
-            key_copy[i] ^= c;
-        }
-        c ^= (cfc ^ cfd);
-        *out++ = c;
-    }
-    free(pk1);
+    MOBIPk1 pk1;
+    mobi_pk1_init(&pk1, key);
+    mobi_pk1_crypt(out, in, length, &pk1, false);
     return MOBI_SUCCESS;
 }
 
@@ -198,6 +215,25 @@ static MOBIDrm * mobi_drm_init(void) {
     return drm;
 }
 
+/**
+ @brief Get DRM structure stored in document internals
+ 
+ @param[in] m MOBIData structure with raw data and metadata
+ @param[in] create If true, initialize DRM structure if not set yet
+ @return MOBIDrm structure, NULL if not set or on failure
+ */
+static MOBIDrm * mobi_drm_get(const MOBIData *m, const bool create) {
+    MOBIInternals *internals = m->internals;
+    if (internals == NULL) {
+        debug_print("%s", "Mobi structure not initialized\n");
+        return NULL;
+    }
+    if (internals->drm == NULL && create) {
+        internals->drm = mobi_drm_init();
+    }
+    return internals->drm;
+}
+
 /**
  @brief Free DRM cookie structure
  
@@ -219,12 +255,15 @@ static void mobi_free_cookie(MOBICookie *cookie) {
  @param[in,out] m MOBIData structure with raw data and metadata
  */
 void mobi_free_drm(MOBIData *m) {
-    if (m->internals) {
-        MOBIDrm *drm = m->internals;
+    MOBIInternals *internals = m->internals;
+    if (internals && internals->drm) {
+        MOBIDrm *drm = internals->drm;
         if (drm->key) {
             free(drm->key);
         }
         drm->key = NULL;
+        free(drm->pk1);
+        drm->pk1 = NULL;
         if (drm->cookies) {
             while (drm->cookies_count--) {
                 mobi_free_cookie(drm->cookies[drm->cookies_count]);
@@ -232,8 +271,8 @@ void mobi_free_drm(MOBIData *m) {
             free(drm->cookies);
         }
         drm->cookies = NULL;
-        free(m->internals);
-        m->internals = NULL;
+        free(internals->drm);
+        internals->drm = NULL;
     }
     
 }
@@ -246,10 +285,17 @@ void mobi_free_drm(MOBIData *m) {
  @return Number of parsed records
  */
 static MOBI_RET mobi_drmkey_init(MOBIData *m, const unsigned char key[KEYSIZE]) {
-    if (m->internals == NULL && (m->internals = mobi_drm_init()) == NULL) {
+    MOBIDrm *drm = mobi_drm_get(m, true);
+    if (drm == NULL) {
         return MOBI_MALLOC_FAILED;
     }
-    MOBIDrm *drm = m->internals;
+    if (drm->pk1 == NULL) {
+        drm->pk1 = malloc(sizeof(MOBIPk1));
+        if (drm->pk1 == NULL) {
+            debug_print("Memory allocation failed%s", "\n");
+            return MOBI_MALLOC_FAILED;
+        }
+    }
     if (drm->key == NULL) {
         drm->key = malloc(KEYSIZE);
         if (drm->key == NULL) {
@@ -258,6 +304,7 @@ static MOBI_RET mobi_drmkey_init(MOBIData *m, const unsigned char key[KEYSIZE])
         }
     }
     memcpy(drm->key, key, KEYSIZE);
+    mobi_pk1_init(drm->pk1, key);
     // remove in future versions, kept for backwards compatibility
     m->drm_key = drm->key;
     
@@ -559,8 +606,12 @@ MOBI_RET mobi_buffer_decrypt(unsigned char *out, const unsigned char *in, const
     if (m == NULL || !mobi_has_drmkey(m)) {
         return MOBI_INIT_FAILED;
     }
-    MOBIDrm *drm = m->internals;
-    return mobi_pk1_decrypt(out, in, length, drm->key);
+    const MOBIDrm *drm = mobi_drm_get(m, false);
+    if (drm->pk1 == NULL || !out || !in) {
+        return MOBI_INIT_FAILED;
+    }
+    mobi_pk1_crypt(out, in, length, drm->pk1, true);
+    return MOBI_SUCCESS;
 }
 
 /**
@@ -577,8 +628,12 @@ static MOBI_RET mobi_buffer_encrypt(unsigned char *out, const unsigned char *in,
         return MOBI_INIT_FAILED;
     }
     
-    MOBIDrm *drm = m->internals;
-    return mobi_pk1_encrypt(out, in, length, drm->key);
+    const MOBIDrm *drm = mobi_drm_get(m, false);
+    if (drm->pk1 == NULL || !out || !in) {
+        return MOBI_INIT_FAILED;
+    }
+    mobi_pk1_crypt(out, in, length, drm->pk1, false);
+    return MOBI_SUCCESS;
 }
 
 /**
@@ -881,10 +936,10 @@ static MOBI_RET mobi_cookie_add(MOBIData *m, const unsigned char *pid, const uin
     if (valid_from > valid_to) {
         return MOBI_PARAM_ERR;
     }
-    if (m->internals == NULL && (m->internals = mobi_drm_init()) == NULL) {
+    MOBIDrm *drm = mobi_drm_get(m, true);
+    if (drm == NULL) {
         return MOBI_MALLOC_FAILED;
     }
-    MOBIDrm *drm = m->internals;
     if (drm->cookies_count == VOUCHERS_COUNT_MAX) {
         debug_print("Maximum PID count reached (%d) %s", VOUCHERS_COUNT_MAX, "\n");
         return MOBI_PARAM_ERR;
@@ -1153,7 +1208,7 @@ static MOBI_RET mobi_drm_set(MOBIData *m, const uint16_t encryption_type) {
         }
         
         size_t drm_size = VOUCHERS_SIZE_MIN;
-        MOBIDrm *drm = m->internals;
+        MOBIDrm *drm = mobi_drm_get(m, false);
         if (drm->cookies_count * VOUCHERSIZE > VOUCHERS_SIZE_MIN) {
             drm_size = drm->cookies_count * VOUCHERSIZE;
         }
@@ -1193,9 +1248,61 @@ static void mobi_drm_unset(MOBIData *m) {
     mobi_drmkey_delete(m);
 }
 
+/**
+ @brief Range of text records decrypted or encrypted by single thread
+ */
+typedef struct {
+    const MOBIData *m; /**< MOBIData structure with loaded key */
+    MOBIPdbRecord **records; /**< Text records */
+    size_t first; /**< Index of first record in the range */
+    size_t last; /**< Index of record following the range */
+    uint16_t extra_flags; /**< Flags of trailing entries left unencrypted */
+    bool is_decryption; /**< Should we decrypt or encrypt */
+    MOBI_RET ret; /**< Status code of the range */
+} MOBIDrmTask;
+
+/**
+ @brief Decrypt or encrypt range of text records, run by mobi_run_tasks()
+ 
+ Records are processed in place, every record is encrypted separately with the same key.
+ 
+ @param[in,out] arg MOBIDrmTask structure
+ */
+static void mobi_drm_task(void *arg) {
+    MOBIDrmTask *task = arg;
+    task->ret = MOBI_SUCCESS;
+    for (size_t i = task->first; i < task->last; i++) {
+        MOBIPdbRecord *curr = task->records[i];
+        size_t extra_size = 0;
+        if (task->extra_flags) {
+            extra_size = mobi_get_record_extrasize(curr, task->extra_flags);
+            if (extra_size == MOBI_NOTSET || extra_size >= curr->size) {
+                task->ret = MOBI_DATA_CORRUPT;
+                return;
+            }
+        }
+        task->ret = mobi_record_make_writable(task->m, curr);
+        if (task->ret != MOBI_SUCCESS) {
+            return;
+        }
+        const size_t decrypt_size = curr->size - extra_size;
+        if (task->is_decryption) {
+            task->ret = mobi_buffer_decrypt(curr->data, curr->data, decrypt_size, task->m);
+        } else {
+            task->ret = mobi_buffer_encrypt(curr->data, curr->data, decrypt_size, task->m);
+        }
+        if (task->ret != MOBI_SUCCESS) {
+            return;
+        }
+    }
+}
+
 /**
  @brief Decrypt or encrypt records
  
+ Text records are split into contiguous ranges, each processed by separate thread
+ if number of threads was set with mobi_set_threads().
+ 
  @param[in,out] m MOBIData structure with raw data and metadata
  @param[in] is_decryption Should we decrypt or encrypt
  @return MOBI_RET status code (on success MOBI_SUCCESS)
@@ -1214,7 +1321,7 @@ static MOBI_RET mobi_drm_records(MOBIData *m, const bool is_decryption) {
         text_rec_index = 1 + offset;
     }
     
-    size_t text_rec_count = m->rh->text_record_count;
+    const size_t text_rec_count = m->rh->text_record_count;
     const uint16_t compression_type = m->rh->compression_type;
     uint16_t extra_flags = 0;
     if (m->mh && m->mh->extra_flags) {
@@ -1224,41 +1331,47 @@ static MOBI_RET mobi_drm_records(MOBIData *m, const bool is_decryption) {
         /* encrypt also multibyte extra data */
         extra_flags &= 0xfffe;
     }
-    /* get first text record */
-    const MOBIPdbRecord *curr = mobi_get_record_by_seqnumber(m, text_rec_index);
-    
-    while (text_rec_count-- && curr) {
-        size_t extra_size = 0;
-        if (extra_flags) {
-            extra_size = mobi_get_record_extrasize(curr, extra_flags);
-            if (extra_size == MOBI_NOTSET || extra_size >= curr->size) {
-                return MOBI_DATA_CORRUPT;
-            }
-        }
-        
-        size_t decrypt_size = curr->size - extra_size;;
-        unsigned char *decrypted = malloc(decrypt_size);
-        if (decrypted == NULL) {
-            debug_print("Memory allocation failed%s", "\n");
-            return MOBI_MALLOC_FAILED;
-        }
-        
-        MOBI_RET ret;
-        if (is_decryption) {
-            ret = mobi_buffer_decrypt(decrypted, curr->data, decrypt_size, m);
-        } else {
-            ret = mobi_buffer_encrypt(decrypted, curr->data, decrypt_size, m);
-        }
-        if (ret != MOBI_SUCCESS) {
-            free(decrypted);
-            return ret;
-        }
-        memcpy(curr->data, decrypted, decrypt_size);
-        free(decrypted);
-        curr = curr->next;
+    MOBIPdbRecord **records = malloc(text_rec_count * sizeof(*records));
+    if (records == NULL) {
+        debug_print("Memory allocation failed%s", "\n");
+        return MOBI_MALLOC_FAILED;
     }
-    
-    return MOBI_SUCCESS;
+    /* records data must be loaded before threads are started */
+    MOBIPdbRecord *curr = mobi_get_record_by_seqnumber(m, text_rec_index);
+    size_t count = 0;
+    while (count < text_rec_count && curr) {
+        records[count++] = curr;
+        curr = mobi_next_record(m, curr);
+    }
+    size_t threads = mobi_get_threads(m);
+    if (threads > count / MOBI_THREAD_MINRECORDS) {
+        threads = count / MOBI_THREAD_MINRECORDS;
+    }
+    if (threads == 0) {
+        threads = 1;
+    }
+    MOBIDrmTask *tasks = calloc(threads, sizeof(*tasks));
+    if (tasks == NULL) {
+        free(records);
+        debug_print("Memory allocation failed%s", "\n");
+        return MOBI_MALLOC_FAILED;
+    }
+    for (size_t i = 0; i < threads; i++) {
+        tasks[i].m = m;
+        tasks[i].records = records;
+        tasks[i].first = count * i / threads;
+        tasks[i].last = count * (i + 1) / threads;
+        tasks[i].extra_flags = extra_flags;
+        tasks[i].is_decryption = is_decryption;
+    }
+    mobi_run_tasks(tasks, sizeof(*tasks), threads, mobi_drm_task);
+    MOBI_RET ret = MOBI_SUCCESS;
+    for (size_t i = 0; i < threads && ret == MOBI_SUCCESS; i++) {
+        ret = tasks[i].ret;
+    }
+    free(tasks);
+    free(records);
+    return ret;
 }
 
 /**
@@ -1373,7 +1486,7 @@ static MOBI_RET mobi_voucher_serialize(MOBIBuffer *buf, const unsigned char *key
  @return MOBI_RET status code (on success MOBI_SUCCESS)
  */
 MOBI_RET mobi_drm_serialize_v2(MOBIBuffer *buf, const MOBIData *m) {
-    if (!m || !m->mh || m->internals == NULL) {
+    if (!m || !m->mh || mobi_drm_get(m, false) == NULL) {
         return MOBI_INIT_FAILED;
     }
     
@@ -1381,7 +1494,7 @@ MOBI_RET mobi_drm_serialize_v2(MOBIBuffer *buf, const MOBIData *m) {
     
     mobi_buffer_setpos(buf, *m->mh->drm_offset);
     
-    MOBIDrm *drm = m->internals;
+    MOBIDrm *drm = mobi_drm_get(m, false);
     for (size_t i = 0; i < drm->cookies_count; i++) {
         MOBI_RET ret = mobi_voucher_serialize(buf, drm->key, drm->cookies[i]);
         if (ret != MOBI_SUCCESS) {
@@ -1427,7 +1540,7 @@ MOBI_RET mobi_drm_serialize_v1(MOBIBuffer *buf, const MOBIData *m) {
         mobi_buffer_setpos(buf, 14);
     }
     
-    MOBIDrm *drm = m->internals;
+    MOBIDrm *drm = mobi_drm_get(m, false);
     
     uint8_t key_type = 1; // 1 - simple, 2 - verification password, 4 - verification key
     unsigned char *key_offset = buf->data + buf->offset;
@@ -1445,7 +1558,7 @@ MOBI_RET mobi_drm_serialize_v1(MOBIBuffer *buf, const MOBIData *m) {
     if (ret != MOBI_SUCCESS) {
         return ret;
     }
-    ret = mobi_pk1_encrypt(meta_offset, meta_offset, 34, drm->key);
+    ret = mobi_buffer_encrypt(meta_offset, meta_offset, 34, m);
     if (ret != MOBI_SUCCESS) {
         return ret;
     }
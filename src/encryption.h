@@ -29,6 +29,7 @@ typedef struct {
 
 typedef struct {
     unsigned char *key; /**< key for decryption, NULL if not set */
+    struct MOBIPk1 *pk1; /**< PK1 tables precomputed for the key, NULL if not set */
     uint32_t cookies_count; /**< Cookies count */
     MOBICookie **cookies; /**< DRM cookie */
 } MOBIDrm;
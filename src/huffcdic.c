@@ -0,0 +1,1328 @@
+/** @file huffcdic.c
+ *  @brief Huffman compressor producing HUFF/CDIC records
+ *
+ * Copyright (c) 2026 Bartek Fabiszewski
+ * http://www.fabiszewski.net
+ *
+ * This file is part of libmobi.
+ * Licensed under LGPL, either version 3, or any later.
+ * See <http://www.gnu.org/licenses/>
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include "huffcdic.h"
+#include "util.h"
+#include "debug.h"
+
+/**
+ @brief Maximal number of phrases in dictionary for each compression level
+ */
+static const size_t mobi_huffenc_phrases[MOBI_LZ77_LEVEL_BEST + 1] = { 0, 4096, 8192, 16384, 32768, 32768, 65536, 131072, 262144, 524288 };
+
+/**
+ @brief Maximal number of words and separators forming a phrase for each compression level
+ */
+static const size_t mobi_huffenc_tokens[MOBI_LZ77_LEVEL_BEST + 1] = { 0, 2, 3, 4, 4, 6, 8, 8, 10, 12 };
+
+#define HUFFENC_OPTIMAL_LEVEL 5 /**< Minimal compression level using code lengths to refine parsing of the text */
+#define HUFFENC_NODE_BITS 26 /**< Number of bits of trie node in trie edge, enough for all phrases of the largest dictionary */
+
+/**
+ @brief Phrase counted in hash table
+ */
+typedef struct {
+    uint64_t hash; /**< Hash of phrase */
+    size_t offset; /**< Offset of first occurrence of phrase in text */
+    uint32_t count; /**< Number of occurrences */
+    uint16_t length; /**< Length of phrase, 0 for empty slot */
+} MOBIPhraseEntry;
+
+/**
+ @brief Hash table of phrases
+ */
+typedef struct {
+    MOBIPhraseEntry *entries; /**< Open addressing table of entries */
+    size_t bits; /**< Table has 2^bits slots */
+    size_t used; /**< Number of used slots */
+    uint32_t prune_level; /**< Entries with this count or lower were removed when table got full */
+} MOBIPhraseTable;
+
+/**
+ @brief Phrase selected as dictionary candidate
+ */
+typedef struct {
+    const unsigned char *data; /**< Data of phrase */
+    uint64_t score; /**< Estimated number of bytes saved by phrase */
+    uint16_t length; /**< Length of phrase */
+} MOBIPhraseCandidate;
+
+/**
+ @brief Dictionary symbol of compressor
+ */
+typedef struct {
+    const unsigned char *data; /**< Data of symbol */
+    uint16_t length; /**< Length of symbol data */
+    bool enabled; /**< Whether symbol is used in parsing */
+    uint64_t freq; /**< Number of occurrences in parsed text */
+    uint8_t code_length; /**< Length of huffman code */
+    uint32_t code; /**< Huffman code */
+    uint32_t index; /**< Index of symbol in CDIC records */
+} MOBIHuffEncSymbol;
+
+/**
+ @brief Huffman compressor state
+ */
+typedef struct {
+    const unsigned char *text; /**< Text of all records */
+    size_t *offsets; /**< Offsets of records in text, count + 1 entries */
+    size_t count; /**< Number of records */
+    size_t max_size; /**< Size of largest record */
+    unsigned char bytes[256]; /**< Data of single byte symbols */
+    MOBIHuffEncSymbol *symbols; /**< Symbols, first 256 are single bytes */
+    size_t symbols_count; /**< Number of symbols */
+    int32_t *node_symbol; /**< Symbol ending in trie node, -1 if none */
+    size_t node_count; /**< Number of trie nodes, root is node 0, nodes 1-256 are its children */
+    uint64_t *edges; /**< Trie edges, key (parent node << 8 | byte) + 1 above HUFFENC_NODE_BITS bits of child node, 0 for empty slot */
+    size_t edges_bits; /**< Edges table has 2^edges_bits slots */
+} MOBIHuffEncoder;
+
+/**
+ @brief Check if byte is a part of a word
+ 
+ @param[in] byte Byte
+ @return True for ASCII letters and digits and for bytes of multibyte characters
+ */
+static MOBI_INLINE bool mobi_huffenc_is_word(const unsigned char byte) {
+    return (byte >= '0' && byte <= '9') || (byte >= 'A' && byte <= 'Z') || (byte >= 'a' && byte <= 'z') || byte >= 0x80;
+}
+
+/**
+ @brief Split text into tokens: words, words preceded by space and single other bytes
+ 
+ @param[in] data Text
+ @param[in] length Length of text
+ @param[out] ends Array of at least length entries, filled with end positions of tokens
+ @return Number of tokens
+ */
+static size_t mobi_huffenc_tokenize(const unsigned char *data, const size_t length, size_t *ends) {
+    size_t count = 0;
+    size_t pos = 0;
+    while (pos < length) {
+        if (data[pos] == ' ' && pos + 1 < length && mobi_huffenc_is_word(data[pos + 1])) {
+            pos++;
+        }
+        if (mobi_huffenc_is_word(data[pos])) {
+            while (pos < length && mobi_huffenc_is_word(data[pos])) {
+                pos++;
+            }
+        } else {
+            pos++;
+        }
+        ends[count++] = pos;
+    }
+    return count;
+}
+
+/**
+ @brief Initialize hash table of phrases
+ 
+ @param[in,out] table MOBIPhraseTable structure
+ @param[in] bits Table will have 2^bits slots
+ @return MOBI_RET status code (on success MOBI_SUCCESS)
+ */
+static MOBI_RET mobi_phrase_table_init(MOBIPhraseTable *table, const size_t bits) {
+    table->entries = calloc((size_t) 1 << bits, sizeof(*table->entries));
+    if (table->entries == NULL) {
+        debug_print("%s\n", "Memory allocation failed");
+        return MOBI_MALLOC_FAILED;
+    }
+    table->bits = bits;
+    table->used = 0;
+    table->prune_level = 0;
+    return MOBI_SUCCESS;
+}
+
+/**
+ @brief Find slot of phrase in hash table
+ 
+ @param[in] table MOBIPhraseTable structure
+ @param[in] text Text of all records
+ @param[in] hash Hash of phrase
+ @param[in] offset Offset of phrase in text
+ @param[in] length Length of phrase
+ @return Slot with the phrase or empty slot where it should be inserted
+ */
+static MOBIPhraseEntry * mobi_phrase_table_find(const MOBIPhraseTable *table, const unsigned char *text, const uint64_t hash, const size_t offset, const size_t length) {
+    const size_t mask = ((size_t) 1 << table->bits) - 1;
+    size_t slot = (size_t) (hash >> 32) & mask;
+    while (true) {
+        MOBIPhraseEntry *entry = &table->entries[slot];
+        if (entry->length == 0) {
+            return entry;
+        }
+        if (entry->hash == hash && entry->length == length && memcmp(text + entry->offset, text + offset, length) == 0) {
+            return entry;
+        }
+        slot = (slot + 1) & mask;
+    }
+}
+
+/**
+ @brief Remove rare phrases from full hash table
+ 
+ Each call removes entries with count not exceeding increased prune level,
+ until at most half of the slots is used.
+ 
+ @param[in,out] table MOBIPhraseTable structure
+ @param[in] text Text of all records
+ @return MOBI_RET status code (on success MOBI_SUCCESS)
+ */
+static MOBI_RET mobi_phrase_table_prune(MOBIPhraseTable *table, const unsigned char *text) {
+    const size_t size = (size_t) 1 << table->bits;
+    while (table->used > size / 2) {
+        const uint32_t prune_level = table->prune_level + 1;
+        MOBIPhraseEntry *old_entries = table->entries;
+        MOBI_RET ret = mobi_phrase_table_init(table, table->bits);
+        if (ret != MOBI_SUCCESS) {
+            table->entries = old_entries;
+            return ret;
+        }
+        table->prune_level = prune_level;
+        for (size_t i = 0; i < size; i++) {
+            const MOBIPhraseEntry *old = &old_entries[i];
+            if (old->length && old->count > prune_level) {
+                MOBIPhraseEntry *entry = mobi_phrase_table_find(table, text, old->hash, old->offset, old->length);
+                *entry = *old;
+                table->used++;
+            }
+        }
+        free(old_entries);
+    }
+    return MOBI_SUCCESS;
+}
+
+/**
+ @brief Add occurrence of phrase to hash table
+ 
+ @param[in,out] table MOBIPhraseTable structure
+ @param[in] text Text of all records
+ @param[in] hash Hash of phrase
+ @param[in] offset Offset of phrase in text
+ @param[in] length Length of phrase
+ @param[in] count Number of occurrences
+ @return MOBI_RET status code (on success MOBI_SUCCESS)
+ */
+static MOBI_RET mobi_phrase_table_add(MOBIPhraseTable *table, const unsigned char *text, const uint64_t hash, const size_t offset, const size_t length, const uint32_t count) {
+    MOBIPhraseEntry *entry = mobi_phrase_table_find(table, text, hash, offset, length);
+    if (entry->length) {
+        entry->count += count;
+        return MOBI_SUCCESS;
+    }
+    if (table->used + 1 > ((size_t) 3 << table->bits) / 4) {
+        MOBI_RET ret = mobi_phrase_table_prune(table, text);
+        if (ret != MOBI_SUCCESS) {
+            return ret;
+        }
+        entry = mobi_phrase_table_find(table, text, hash, offset, length);
+    }
+    entry->hash = hash;
+    entry->offset = offset;
+    entry->length = (uint16_t) length;
+    entry->count = count;
+    table->used++;
+    return MOBI_SUCCESS;
+}
+
+/**
+ @brief Phrases counting task, counts phrases in a range of records
+ */
+typedef struct {
+    const MOBIHuffEncoder *encoder; /**< Compressor state */
+    size_t first; /**< First record */
+    size_t last; /**< Record past last one */
+    size_t max_tokens; /**< Maximal number of tokens in phrase */
+    MOBIPhraseTable table; /**< Counted phrases */
+    MOBI_RET ret; /**< Status code */
+} MOBIPhraseCountTask;
+
+/**
+ @brief Count phrases formed by consecutive tokens of records, run by mobi_run_tasks()
+ 
+ @param[in,out] arg MOBIPhraseCountTask structure
+ */
+static void mobi_huffenc_count_task(void *arg) {
+    MOBIPhraseCountTask *task = arg;
+    const MOBIHuffEncoder *encoder = task->encoder;
+    size_t *ends = malloc(encoder->max_size * sizeof(*ends));
+    if (ends == NULL) {
+        debug_print("%s\n", "Memory allocation failed");
+        task->ret = MOBI_MALLOC_FAILED;
+        return;
+    }
+    for (size_t i = task->first; i < task->last && task->ret == MOBI_SUCCESS; i++) {
+        const size_t record_offset = encoder->offsets[i];
+        const unsigned char *data = encoder->text + record_offset;
+        const size_t tokens_count = mobi_huffenc_tokenize(data, encoder->offsets[i + 1] - record_offset, ends);
+        for (size_t k = 0; k < tokens_count && task->ret == MOBI_SUCCESS; k++) {
+            const size_t start = k ? ends[k - 1] : 0;
+            /* 64-bit FNV-1a, extended token by token */
+            uint64_t hash = 0xcbf29ce484222325ULL;
+            size_t pos = start;
+            for (size_t j = k; j < tokens_count && j < k + task->max_tokens; j++) {
+                if (ends[j] - start > HUFFENC_PHRASE_MAX) {
+                    break;
+                }
+                while (pos < ends[j]) {
+                    hash ^= data[pos++];
+                    hash *= 0x100000001b3ULL;
+                }
+                if (pos - start >= 2) {
+                    task->ret = mobi_phrase_table_add(&task->table, encoder->text, hash, record_offset + start, pos - start, 1);
+                    if (task->ret != MOBI_SUCCESS) {
+                        break;
+                    }
+                }
+            }
+        }
+    }
+    free(ends);
+}
+
+/**
+ @brief Compare candidates by score, descending, used with qsort()
+ 
+ Ties are resolved by length and data, so selection does not depend on order of candidates.
+ 
+ @param[in] a First candidate
+ @param[in] b Second candidate
+ @return Negative value if first candidate should be selected before second one
+ */
+static int mobi_huffenc_candidate_cmp(const void *a, const void *b) {
+    const MOBIPhraseCandidate *first = a;
+    const MOBIPhraseCandidate *second = b;
+    if (first->score != second->score) {
+        return first->score > second->score ? -1 : 1;
+    }
+    if (first->length != second->length) {
+        return first->length > second->length ? -1 : 1;
+    }
+    return memcmp(first->data, second->data, first->length);
+}
+
+/**
+ @brief Move best candidates to the beginning of array and sort them
+ 
+ Quickselect partitions candidates, so that only the selected ones need to be sorted.
+ 
+ @param[in,out] candidates Array of candidates
+ @param[in,out] count Number of candidates, on return number of selected candidates
+ @param[in] max_count Maximal number of selected candidates
+ */
+static void mobi_huffenc_select_best(MOBIPhraseCandidate *candidates, size_t *count, const size_t max_count) {
+    if (*count > max_count) {
+        size_t left = 0;
+        size_t right = *count - 1;
+        while (left < right) {
+            /* median of three pivot moved to the end */
+            const size_t middle = left + (right - left) / 2;
+            if (mobi_huffenc_candidate_cmp(&candidates[middle], &candidates[left]) < 0) {
+                MOBIPhraseCandidate tmp = candidates[middle]; candidates[middle] = candidates[left]; candidates[left] = tmp;
+            }
+            if (mobi_huffenc_candidate_cmp(&candidates[right], &candidates[left]) < 0) {
+                MOBIPhraseCandidate tmp = candidates[right]; candidates[right] = candidates[left]; candidates[left] = tmp;
+            }
+            if (mobi_huffenc_candidate_cmp(&candidates[middle], &candidates[right]) < 0) {
+                MOBIPhraseCandidate tmp = candidates[middle]; candidates[middle] = candidates[right]; candidates[right] = tmp;
+            }
+            size_t store = left;
+            for (size_t i = left; i < right; i++) {
+                if (mobi_huffenc_candidate_cmp(&candidates[i], &candidates[right]) < 0) {
+                    MOBIPhraseCandidate tmp = candidates[i]; candidates[i] = candidates[store]; candidates[store] = tmp;
+                    store++;
+                }
+            }
+            MOBIPhraseCandidate tmp = candidates[right]; candidates[right] = candidates[store]; candidates[store] = tmp;
+            if (store == max_count) {
+                break;
+            }
+            if (store < max_count) {
+                left = store + 1;
+            } else {
+                right = store - 1;
+            }
+        }
+        *count = max_count;
+    }
+    qsort(candidates, *count, sizeof(*candidates), mobi_huffenc_candidate_cmp);
+}
+
+/**
+ @brief Add phrases counted in a range of records to phrases counted in previous ranges
+ 
+ @param[in,out] merged Phrases counted in previous ranges
+ @param[in] table Phrases counted in a range of records
+ @param[in] text Text of all records
+ @return MOBI_RET status code (on success MOBI_SUCCESS)
+ */
+static MOBI_RET mobi_huffenc_merge_table(MOBIPhraseTable *merged, const MOBIPhraseTable *table, const unsigned char *text) {
+    const size_t size = (size_t) 1 << table->bits;
+    for (size_t j = 0; j < size; j++) {
+        const MOBIPhraseEntry *entry = &table->entries[j];
+        if (entry->length) {
+            MOBI_RET ret = mobi_phrase_table_add(merged, text, entry->hash, entry->offset, entry->length, entry->count);
+            if (ret != MOBI_SUCCESS) {
+                return ret;
+            }
+        }
+    }
+    return MOBI_SUCCESS;
+}
+
+/**
+ @brief Select phrases worth adding to dictionary from hash table
+ 
+ @param[in] table Counted phrases
+ @param[in] text Text of all records
+ @param[out] candidates Phrases worth adding to dictionary
+ @param[out] candidates_count Number of candidates
+ @return MOBI_RET status code (on success MOBI_SUCCESS)
+ */
+static MOBI_RET mobi_huffenc_candidates(const MOBIPhraseTable *table, const unsigned char *text, MOBIPhraseCandidate **candidates, size_t *candidates_count) {
+    *candidates_count = 0;
+    *candidates = malloc((table->used ? table->used : 1) * sizeof(**candidates));
+    if (*candidates == NULL) {
+        debug_print("%s\n", "Memory allocation failed");
+        return MOBI_MALLOC_FAILED;
+    }
+    const size_t size = (size_t) 1 << table->bits;
+    for (size_t j = 0; j < size; j++) {
+        const MOBIPhraseEntry *entry = &table->entries[j];
+        if (entry->length == 0 || entry->count < 2) {
+            continue;
+        }
+        /* every occurrence saves at least one byte, phrase costs its data and offset in CDIC record */
+        const uint64_t saved = (uint64_t) entry->count * (entry->length - 1U);
+        const uint64_t cost = entry->length + 4U;
+        if (saved > cost) {
+            MOBIPhraseCandidate *candidate = &(*candidates)[(*candidates_count)++];
+            candidate->data = text + entry->offset;
+            candidate->length = entry->length;
+            candidate->score = saved - cost;
+        }
+    }
+    return MOBI_SUCCESS;
+}
+
+/**
+ @brief Get number of threads for processing records
+ 
+ @param[in] threads Maximal number of threads
+ @param[in] count Number of records
+ @return Number of threads
+ */
+static size_t mobi_huffenc_threads(size_t threads, const size_t count) {
+    if (threads > count / MOBI_THREAD_MINRECORDS) {
+        threads = count / MOBI_THREAD_MINRECORDS;
+    }
+    return threads ? threads : 1;
+}
+
+/**
+ @brief Get number of bits of hash table counting phrases in text of given size
+ 
+ @param[in] size Size of text
+ @param[in] max_bits Maximal number of bits
+ @return Number of bits
+ */
+static size_t mobi_huffenc_table_bits(const size_t size, const size_t max_bits) {
+    size_t bits = 10;
+    while (bits < max_bits && ((size_t) 1 << bits) < 2 * size) {
+        bits++;
+    }
+    return bits;
+}
+
+/**
+ @brief Select phrases for dictionary
+ 
+ Phrases formed by consecutive tokens are counted in ranges of HUFFENC_COUNT_RECORDS records,
+ ranges are counted in parallel and merged in order of records.
+ Ranges do not depend on number of threads, so the same dictionary is built for any number of threads.
+ Phrases with the best estimated savings are selected.
+ 
+ @param[in] encoder Compressor state
+ @param[in] level Compression level
+ @param[in] threads Maximal number of threads
+ @param[out] candidates Selected phrases
+ @param[out] candidates_count Number of selected phrases
+ @return MOBI_RET status code (on success MOBI_SUCCESS)
+ */
+static MOBI_RET mobi_huffenc_select_phrases(const MOBIHuffEncoder *encoder, const int level, size_t threads, MOBIPhraseCandidate **candidates, size_t *candidates_count) {
+    *candidates = NULL;
+    *candidates_count = 0;
+    const size_t ranges = (encoder->count + HUFFENC_COUNT_RECORDS - 1) / HUFFENC_COUNT_RECORDS;
+    threads = mobi_huffenc_threads(threads, encoder->count);
+    if (threads > ranges) {
+        threads = ranges;
+    }
+    MOBIPhraseCountTask *count_tasks = calloc(threads, sizeof(*count_tasks));
+    if (count_tasks == NULL) {
+        debug_print("%s\n", "Memory allocation failed");
+        return MOBI_MALLOC_FAILED;
+    }
+    size_t max_phrases = mobi_huffenc_phrases[level];
+    /* dictionary should not outgrow the text */
+    const size_t text_size = encoder->offsets[encoder->count];
+    if (max_phrases > text_size / 16) {
+        max_phrases = text_size / 16;
+    }
+    MOBIPhraseTable merged;
+    MOBI_RET ret = mobi_phrase_table_init(&merged, mobi_huffenc_table_bits(text_size, HUFFENC_MERGED_BITS_MAX));
+    if (ret != MOBI_SUCCESS) {
+        free(count_tasks);
+        return ret;
+    }
+    for (size_t range = 0; range < ranges && ret == MOBI_SUCCESS; range += threads) {
+        const size_t tasks_count = (ranges - range < threads) ? ranges - range : threads;
+        for (size_t i = 0; i < tasks_count; i++) {
+            MOBIPhraseCountTask *task = &count_tasks[i];
+            task->encoder = encoder;
+            task->first = (range + i) * HUFFENC_COUNT_RECORDS;
+            task->last = task->first + HUFFENC_COUNT_RECORDS;
+            if (task->last > encoder->count) {
+                task->last = encoder->count;
+            }
+            task->max_tokens = mobi_huffenc_tokens[level];
+            task->ret = MOBI_SUCCESS;
+            const size_t size = encoder->offsets[task->last] - encoder->offsets[task->first];
+            if (ret == MOBI_SUCCESS) {
+                ret = mobi_phrase_table_init(&task->table, mobi_huffenc_table_bits(size, HUFFENC_COUNTER_BITS_MAX));
+            }
+        }
+        if (ret == MOBI_SUCCESS) {
+            mobi_run_tasks(count_tasks, sizeof(*count_tasks), tasks_count, mobi_huffenc_count_task);
+        }
+        for (size_t i = 0; i < tasks_count; i++) {
+            if (ret == MOBI_SUCCESS) {
+                ret = count_tasks[i].ret;
+            }
+            if (ret == MOBI_SUCCESS) {
+                ret = mobi_huffenc_merge_table(&merged, &count_tasks[i].table, encoder->text);
+            }
+            free(count_tasks[i].table.entries);
+            count_tasks[i].table.entries = NULL;
+        }
+    }
+    free(count_tasks);
+    if (ret == MOBI_SUCCESS) {
+        ret = mobi_huffenc_candidates(&merged, encoder->text, candidates, candidates_count);
+    }
+    free(merged.entries);
+    if (ret == MOBI_SUCCESS) {
+        mobi_huffenc_select_best(*candidates, candidates_count, max_phrases);
+    }
+    return ret;
+}
+
+/**
+ @brief Find slot of trie edge
+ 
+ @param[in] encoder Compressor state
+ @param[in] key Key of the edge
+ @return Slot with the edge or empty slot
+ */
+static MOBI_INLINE size_t mobi_huffenc_edge_slot(const MOBIHuffEncoder *encoder, const uint64_t key) {
+    const size_t mask = ((size_t) 1 << encoder->edges_bits) - 1;
+    size_t slot = (size_t) ((key * 0x9e3779b97f4a7c15ULL) >> (64 - encoder->edges_bits));
+    while (encoder->edges[slot] && (encoder->edges[slot] >> HUFFENC_NODE_BITS) != key) {
+        slot = (slot + 1) & mask;
+    }
+    return slot;
+}
+
+/**
+ @brief Get child of trie node
+ 
+ @param[in] encoder Compressor state
+ @param[in] node Trie node
+ @param[in] byte Byte of the edge
+ @return Child node, 0 if there is no such child
+ */
+static MOBI_INLINE uint32_t mobi_huffenc_child(const MOBIHuffEncoder *encoder, const uint32_t node, const unsigned char byte) {
+    if (node == 0) {
+        return 1U + byte;
+    }
+    const uint64_t key = ((uint64_t) node << 8 | byte) + 1;
+    const uint64_t edge = encoder->edges[mobi_huffenc_edge_slot(encoder, key)];
+    return (uint32_t) (edge & ((1U << HUFFENC_NODE_BITS) - 1));
+}
+
+/**
+ @brief Build trie of enabled symbols
+ 
+ Trie built earlier is replaced.
+ 
+ @param[in,out] encoder Compressor state
+ @return MOBI_RET status code (on success MOBI_SUCCESS)
+ */
+static MOBI_RET mobi_huffenc_build_trie(MOBIHuffEncoder *encoder) {
+    free(encoder->node_symbol);
+    free(encoder->edges);
+    size_t max_nodes = 257;
+    for (size_t i = 256; i < encoder->symbols_count; i++) {
+        if (encoder->symbols[i].enabled) {
+            max_nodes += encoder->symbols[i].length - 1U;
+        }
+    }
+    encoder->node_symbol = malloc(max_nodes * sizeof(*encoder->node_symbol));
+    encoder->edges_bits = 4;
+    while (((size_t) 1 << encoder->edges_bits) < 2 * max_nodes) {
+        encoder->edges_bits++;
+    }
+    encoder->edges = calloc((size_t) 1 << encoder->edges_bits, sizeof(*encoder->edges));
+    if (encoder->node_symbol == NULL || encoder->edges == NULL) {
+        debug_print("%s\n", "Memory allocation failed");
+        return MOBI_MALLOC_FAILED;
+    }
+    encoder->node_symbol[0] = -1;
+    for (size_t i = 0; i < 256; i++) {
+        encoder->node_symbol[i + 1] = (int32_t) i;
+    }
+    encoder->node_count = 257;
+    for (size_t i = 256; i < encoder->symbols_count; i++) {
+        const MOBIHuffEncSymbol *symbol = &encoder->symbols[i];
+        if (!symbol->enabled) {
+            continue;
+        }
+        uint32_t node = 1U + symbol->data[0];
+        for (size_t j = 1; j < symbol->length; j++) {
+            const uint64_t key = ((uint64_t) node << 8 | symbol->data[j]) + 1;
+            const size_t slot = mobi_huffenc_edge_slot(encoder, key);
+            if (encoder->edges[slot] == 0) {
+                encoder->edges[slot] = key << HUFFENC_NODE_BITS | encoder->node_count;
+                encoder->node_symbol[encoder->node_count++] = -1;
+            }
+            node = (uint32_t) (encoder->edges[slot] & ((1U << HUFFENC_NODE_BITS) - 1));
+        }
+        encoder->node_symbol[node] = (int32_t) i;
+    }
+    return MOBI_SUCCESS;
+}
+
+/**
+ @brief Build dictionary symbols and their trie from selected phrases
+ 
+ First 256 symbols are single bytes, so any text may be parsed.
+ 
+ @param[in,out] encoder Compressor state
+ @param[in] candidates Selected phrases
+ @param[in] candidates_count Number of selected phrases
+ @return MOBI_RET status code (on success MOBI_SUCCESS)
+ */
+static MOBI_RET mobi_huffenc_build_dictionary(MOBIHuffEncoder *encoder, const MOBIPhraseCandidate *candidates, const size_t candidates_count) {
+    encoder->symbols_count = 256 + candidates_count;
+    encoder->symbols = calloc(encoder->symbols_count, sizeof(*encoder->symbols));
+    if (encoder->symbols == NULL) {
+        debug_print("%s\n", "Memory allocation failed");
+        return MOBI_MALLOC_FAILED;
+    }
+    for (size_t i = 0; i < 256; i++) {
+        encoder->bytes[i] = (unsigned char) i;
+        MOBIHuffEncSymbol *symbol = &encoder->symbols[i];
+        symbol->data = &encoder->bytes[i];
+        symbol->length = 1;
+        symbol->enabled = true;
+    }
+    for (size_t i = 0; i < candidates_count; i++) {
+        MOBIHuffEncSymbol *symbol = &encoder->symbols[256 + i];
+        symbol->data = candidates[i].data;
+        symbol->length = candidates[i].length;
+        symbol->enabled = true;
+    }
+    return mobi_huffenc_build_trie(encoder);
+}
+
+/**
+ @brief Exclude phrases occurring less than given number of times and rebuild trie
+ 
+ @param[in,out] encoder Compressor state
+ @param[in] min_freq Minimal number of occurrences of phrase
+ @return MOBI_RET status code (on success MOBI_SUCCESS)
+ */
+static MOBI_RET mobi_huffenc_disable_rare(MOBIHuffEncoder *encoder, const uint64_t min_freq) {
+    for (size_t i = 256; i < encoder->symbols_count; i++) {
+        MOBIHuffEncSymbol *symbol = &encoder->symbols[i];
+        if (symbol->enabled && symbol->freq < min_freq) {
+            symbol->enabled = false;
+            symbol->code_length = 0;
+        }
+    }
+    return mobi_huffenc_build_trie(encoder);
+}
+
+/**
+ @brief Find longest enabled symbol matching text
+ 
+ @param[in] encoder Compressor state
+ @param[in] data Text
+ @param[in] length Length of text
+ @param[out] symbol_number Number of matched symbol
+ @return Length of matched symbol
+ */
+static size_t mobi_huffenc_match(const MOBIHuffEncoder *encoder, const unsigned char *data, const size_t length, uint32_t *symbol_number) {
+    /* single bytes are never disabled */
+    *symbol_number = data[0];
+    size_t best = 1;
+    uint32_t node = 1U + data[0];
+    const size_t max_length = length < HUFFENC_PHRASE_MAX ? length : HUFFENC_PHRASE_MAX;
+    for (size_t i = 1; i < max_length; i++) {
+        node = mobi_huffenc_child(encoder, node, data[i]);
+        if (node == 0) {
+            break;
+        }
+        const int32_t symbol = encoder->node_symbol[node];
+        if (symbol >= 0) {
+            *symbol_number = (uint32_t) symbol;
+            best = i + 1;
+        }
+    }
+    return best;
+}
+
+/**
+ @brief Parse text into symbols with minimal total length of huffman codes
+ 
+ @param[in] encoder Compressor state with code lengths of enabled symbols
+ @param[in] data Text
+ @param[in] length Length of text
+ @param[out] cost Array of length + 1 entries, cost[i] is length of codes of text from position i in bits
+ @param[out] choice Array of length entries, choice[i] is symbol starting at position i in best parsing
+ */
+static void mobi_huffenc_parse_optimal(const MOBIHuffEncoder *encoder, const unsigned char *data, const size_t length, uint64_t *cost, uint32_t *choice) {
+    cost[length] = 0;
+    size_t i = length;
+    while (i--) {
+        uint32_t node = 0;
+        uint64_t best = UINT64_MAX;
+        const size_t max_length = length - i < HUFFENC_PHRASE_MAX ? length - i : HUFFENC_PHRASE_MAX;
+        for (size_t j = 0; j < max_length; j++) {
+            node = mobi_huffenc_child(encoder, node, data[i + j]);
+            if (node == 0) {
+                break;
+            }
+            const int32_t symbol = encoder->node_symbol[node];
+            if (symbol >= 0) {
+                const uint64_t symbol_cost = encoder->symbols[symbol].code_length + cost[i + j + 1];
+                if (symbol_cost < best) {
+                    best = symbol_cost;
+                    choice[i] = (uint32_t) symbol;
+                }
+            }
+        }
+        cost[i] = best;
+    }
+}
+
+/**
+ @brief Parsing task, counts symbols or encodes a range of records
+ */
+typedef struct {
+    const MOBIHuffEncoder *encoder; /**< Compressor state */
+    size_t first; /**< First record */
+    size_t last; /**< Record past last one */
+    bool optimal; /**< Use optimal parsing with code lengths, greedy parsing otherwise */
+    uint64_t *freqs; /**< If not NULL, filled with numbers of occurrences of symbols */
+    MOBIHuffCdicOutput *output; /**< If not NULL, compressed records are stored in output texts */
+    MOBI_RET ret; /**< Status code */
+} MOBIHuffEncTask;
+
+/**
+ @brief Parse range of records, run by mobi_run_tasks()
+ 
+ @param[in,out] arg MOBIHuffEncTask structure
+ */
+static void mobi_huffenc_parse_task(void *arg) {
+    MOBIHuffEncTask *task = arg;
+    const MOBIHuffEncoder *encoder = task->encoder;
+    uint64_t *cost = NULL;
+    uint32_t *choice = NULL;
+    if (task->optimal) {
+        cost = malloc((encoder->max_size + 1) * sizeof(*cost));
+        choice = malloc((encoder->max_size + 1) * sizeof(*choice));
+        if (cost == NULL || choice == NULL) {
+            debug_print("%s\n", "Memory allocation failed");
+            free(cost);
+            free(choice);
+            task->ret = MOBI_MALLOC_FAILED;
+            return;
+        }
+    }
+    /* codes are at most HUFFENC_CODELEN_MAX bits long, each one encodes at least one byte */
+    const size_t max_out = encoder->max_size * HUFFENC_CODELEN_MAX / 8 + 8;
+    for (size_t i = task->first; i < task->last; i++) {
+        const unsigned char *data = encoder->text + encoder->offsets[i];
+        const size_t length = encoder->offsets[i + 1] - encoder->offsets[i];
+        if (task->optimal) {
+            mobi_huffenc_parse_optimal(encoder, data, length, cost, choice);
+        }
+        unsigned char *out = NULL;
+        if (task->output) {
+            out = malloc(max_out);
+            if (out == NULL) {
+                debug_print("%s\n", "Memory allocation failed");
+                task->ret = MOBI_MALLOC_FAILED;
+                break;
+            }
+        }
+        size_t out_size = 0;
+        uint64_t bits = 0;
+        size_t bits_count = 0;
+        size_t pos = 0;
+        while (pos < length) {
+            uint32_t symbol_number;
+            size_t symbol_length;
+            if (task->optimal) {
+                symbol_number = choice[pos];
+                symbol_length = encoder->symbols[symbol_number].length;
+            } else {
+                symbol_length = mobi_huffenc_match(encoder, data + pos, length - pos, &symbol_number);
+            }
+            pos += symbol_length;
+            if (task->freqs) {
+                task->freqs[symbol_number]++;
+            }
+            if (out) {
+                const MOBIHuffEncSymbol *symbol = &encoder->symbols[symbol_number];
+                bits = bits << symbol->code_length | symbol->code;
+                bits_count += symbol->code_length;
+                while (bits_count >= 8) {
+                    bits_count -= 8;
+                    out[out_size++] = (unsigned char) (bits >> bits_count);
+                }
+            }
+        }
+        if (out) {
+            /* padding is shorter than any code, longest codes consist of zero bits */
+            if (bits_count) {
+                out[out_size++] = (unsigned char) (bits << (8 - bits_count));
+            }
+            task->output->texts[i] = out;
+            task->output->text_sizes[i] = out_size;
+        }
+    }
+    free(cost);
+    free(choice);
+}
+
+/**
+ @brief Parse all records in parallel
+ 
+ @param[in,out] encoder Compressor state, if output is NULL frequencies of symbols are updated
+ @param[in] threads Maximal number of threads
+ @param[in] optimal Use optimal parsing with code lengths, greedy parsing otherwise
+ @param[in,out] output If not NULL, compressed records are stored in output texts
+ @return MOBI_RET status code (on success MOBI_SUCCESS)
+ */
+static MOBI_RET mobi_huffenc_parse(MOBIHuffEncoder *encoder, size_t threads, const bool optimal, MOBIHuffCdicOutput *output) {
+    threads = mobi_huffenc_threads(threads, encoder->count);
+    MOBIHuffEncTask *tasks = calloc(threads, sizeof(*tasks));
+    if (tasks == NULL) {
+        debug_print("%s\n", "Memory allocation failed");
+        return MOBI_MALLOC_FAILED;
+    }
+    MOBI_RET ret = MOBI_SUCCESS;
+    const size_t per_task = encoder->count / threads;
+    const size_t rest = encoder->count % threads;
+    size_t first = 0;
+    for (size_t i = 0; i < threads; i++) {
+        MOBIHuffEncTask *task = &tasks[i];
+        task->encoder = encoder;
+        task->first = first;
+        task->last = first + per_task + (i < rest ? 1 : 0);
+        task->optimal = optimal;
+        task->output = output;
+        task->ret = MOBI_SUCCESS;
+        first = task->last;
+        if (output == NULL) {
+            task->freqs = calloc(encoder->symbols_count, sizeof(*task->freqs));
+            if (task->freqs == NULL) {
+                debug_print("%s\n", "Memory allocation failed");
+                ret = MOBI_MALLOC_FAILED;
+            }
+        }
+    }
+    if (ret == MOBI_SUCCESS) {
+        mobi_run_tasks(tasks, sizeof(*tasks), threads, mobi_huffenc_parse_task);
+    }
+    for (size_t i = 0; i < threads; i++) {
+        if (ret == MOBI_SUCCESS) {
+            ret = tasks[i].ret;
+        }
+    }
+    if (ret == MOBI_SUCCESS && output == NULL) {
+        for (size_t j = 0; j < encoder->symbols_count; j++) {
+            uint64_t freq = 0;
+            for (size_t i = 0; i < threads; i++) {
+                freq += tasks[i].freqs[j];
+            }
+            encoder->symbols[j].freq = freq;
+        }
+    }
+    for (size_t i = 0; i < threads; i++) {
+        free(tasks[i].freqs);
+    }
+    free(tasks);
+    return ret;
+}
+
+/**
+ @brief Leaf of huffman tree
+ */
+typedef struct {
+    uint64_t freq; /**< Weight of the leaf */
+    uint32_t symbol; /**< Number of symbol */
+} MOBIHuffEncLeaf;
+
+/**
+ @brief Compare leaves by weight, used with qsort()
+ 
+ @param[in] a First leaf
+ @param[in] b Second leaf
+ @return Negative value if first leaf is lighter than second one
+ */
+static int mobi_huffenc_leaf_cmp(const void *a, const void *b) {
+    const MOBIHuffEncLeaf *first = a;
+    const MOBIHuffEncLeaf *second = b;
+    if (first->freq != second->freq) {
+        return first->freq < second->freq ? -1 : 1;
+    }
+    return first->symbol < second->symbol ? -1 : (first->symbol > second->symbol);
+}
+
+/**
+ @brief Compute huffman code lengths of enabled symbols
+ 
+ Single byte symbols get at least weight of one, so every text may be encoded.
+ If codes are longer than HUFFENC_CODELEN_MAX, weights are flattened and tree is rebuilt.
+ 
+ @param[in,out] encoder Compressor state
+ @return MOBI_RET status code (on success MOBI_SUCCESS)
+ */
+static MOBI_RET mobi_huffenc_code_lengths(MOBIHuffEncoder *encoder) {
+    size_t count = 0;
+    for (size_t i = 0; i < encoder->symbols_count; i++) {
+        if (encoder->symbols[i].enabled) {
+            count++;
+        }
+    }
+    if (count < 2) {
+        /* single bytes are always enabled */
+        return MOBI_DATA_CORRUPT;
+    }
+    MOBIHuffEncLeaf *leaves = malloc(count * sizeof(*leaves));
+    uint64_t *weights = malloc(2 * count * sizeof(*weights));
+    size_t *parents = malloc(2 * count * sizeof(*parents));
+    uint8_t *depths = malloc(2 * count * sizeof(*depths));
+    if (leaves == NULL || weights == NULL || parents == NULL || depths == NULL) {
+        debug_print("%s\n", "Memory allocation failed");
+        free(leaves);
+        free(weights);
+        free(parents);
+        free(depths);
+        return MOBI_MALLOC_FAILED;
+    }
+    size_t n = 0;
+    for (size_t i = 0; i < encoder->symbols_count; i++) {
+        if (encoder->symbols[i].enabled) {
+            const uint64_t freq = encoder->symbols[i].freq;
+            leaves[n].freq = freq ? freq : 1;
+            leaves[n].symbol = (uint32_t) i;
+            n++;
+        }
+    }
+    /* flattening weights keeps their order */
+    qsort(leaves, count, sizeof(*leaves), mobi_huffenc_leaf_cmp);
+    while (true) {
+        for (size_t i = 0; i < count; i++) {
+            weights[i] = leaves[i].freq;
+        }
+        /* leaves and internal nodes are both queues sorted by weight */
+        size_t leaf = 0;
+        size_t internal = count;
+        size_t next = count;
+        for (size_t k = 0; k + 1 < count; k++) {
+            size_t pair[2];
+            for (size_t j = 0; j < 2; j++) {
+                if (leaf < count && (internal == next || weights[leaf] <= weights[internal])) {
+                    pair[j] = leaf++;
+                } else {
+                    pair[j] = internal++;
+                }
+            }
+            weights[next] = weights[pair[0]] + weights[pair[1]];
+            parents[pair[0]] = next;
+            parents[pair[1]] = next;
+            next++;
+        }
+        const size_t root = next - 1;
+        depths[root] = 0;
+        bool too_long = false;
+        size_t node = root;
+        while (node--) {
+            const uint8_t depth = depths[parents[node]];
+            if (depth >= HUFFENC_CODELEN_MAX) {
+                too_long = true;
+                break;
+            }
+            depths[node] = depth + 1;
+        }
+        if (!too_long) {
+            for (size_t i = 0; i < count; i++) {
+                encoder->symbols[leaves[i].symbol].code_length = depths[i];
+            }
+            break;
+        }
+        for (size_t i = 0; i < count; i++) {
+            leaves[i].freq = (leaves[i].freq + 1) / 2;
+        }
+    }
+    free(leaves);
+    free(weights);
+    free(parents);
+    free(depths);
+    return MOBI_SUCCESS;
+}
+
+/**
+ @brief Get code length the decoder finds for given 32 bits of compressed data
+ 
+ @param[in] mincodes Table of mincodes for each length
+ @param[in] min_length Length of shortest code
+ @param[in] max_length Length of longest code
+ @param[in] code Next 32 bits of compressed data
+ @return Code length
+ */
+static size_t mobi_huffenc_decoded_length(const uint32_t *mincodes, const size_t min_length, const size_t max_length, const uint32_t code) {
+    size_t length = min_length;
+    while (length < max_length && code < ((uint64_t) mincodes[length] << (32 - length))) {
+        length++;
+    }
+    return length;
+}
+
+/**
+ @brief Append big-endian or little-endian 32-bit value to memory
+ 
+ @param[in,out] ptr Memory, on return pointer is moved past the value
+ @param[in] value Value
+ @param[in] big_endian True for big-endian order
+ */
+static void mobi_huffenc_put32(unsigned char **ptr, const uint32_t value, const bool big_endian) {
+    for (size_t i = 0; i < 4; i++) {
+        const size_t shift = big_endian ? 24 - 8 * i : 8 * i;
+        *(*ptr)++ = (unsigned char) (value >> shift);
+    }
+}
+
+/**
+ @brief Assign canonical huffman codes and indices to enabled symbols and build HUFF record
+ 
+ Symbols are indexed by code length, so that indices of codes of given length fit in the length.
+ Within every length codes decrease with increasing index, codes consisting of zero bits are the longest ones,
+ as decoder computes index as maxcode minus code.
+ 
+ @param[in,out] encoder Compressor state with code lengths
+ @param[in,out] output Output structure, HUFF record is stored as the first record
+ @param[out] order Array of symbol numbers sorted by index
+ @return Number of indexed symbols
+ */
+static size_t mobi_huffenc_assign_codes(MOBIHuffEncoder *encoder, MOBIHuffCdicOutput *output, uint32_t *order) {
+    size_t counts[HUFF_CODETABLE_SIZE] = { 0 };
+    for (size_t i = 0; i < encoder->symbols_count; i++) {
+        if (encoder->symbols[i].enabled) {
+            counts[encoder->symbols[i].code_length]++;
+        }
+    }
+    size_t starts[HUFF_CODETABLE_SIZE];
+    size_t total = 0;
+    size_t min_length = 0;
+    size_t max_length = 0;
+    for (size_t length = 1; length < HUFF_CODETABLE_SIZE; length++) {
+        starts[length] = total;
+        total += counts[length];
+        if (counts[length]) {
+            if (min_length == 0) {
+                min_length = length;
+            }
+            max_length = length;
+        }
+    }
+    uint32_t mincodes[HUFF_CODETABLE_SIZE] = { 0 };
+    uint32_t maxcodes[HUFF_CODETABLE_SIZE] = { 0 };
+    for (size_t length = max_length; length >= 1; length--) {
+        if (length < max_length) {
+            mincodes[length] = (uint32_t) ((mincodes[length + 1] + counts[length + 1]) >> 1);
+        }
+        maxcodes[length] = (uint32_t) (mincodes[length] + starts[length] + counts[length] - 1);
+    }
+    size_t next[HUFF_CODETABLE_SIZE];
+    memcpy(next, starts, sizeof(next));
+    for (size_t i = 0; i < encoder->symbols_count; i++) {
+        MOBIHuffEncSymbol *symbol = &encoder->symbols[i];
+        if (symbol->enabled) {
+            const size_t length = symbol->code_length;
+            symbol->index = (uint32_t) next[length]++;
+            symbol->code = (maxcodes[length] - symbol->index) & (uint32_t) (((uint64_t) 1 << length) - 1);
+            order[symbol->index] = (uint32_t) i;
+        }
+    }
+    uint32_t table1[256];
+    for (uint32_t byte = 0; byte < 256; byte++) {
+        const size_t length = mobi_huffenc_decoded_length(mincodes, min_length, max_length, byte << 24);
+        if (length <= 8) {
+            /* all codes starting with this byte have the same length */
+            table1[byte] = (maxcodes[length] & 0xffffffU) << 8 | 0x80 | (uint32_t) length;
+        } else {
+            table1[byte] = (uint32_t) mobi_huffenc_decoded_length(mincodes, min_length, max_length, byte << 24 | 0xffffffU);
+        }
+    }
+    unsigned char *huff = output->records[0];
+    unsigned char *ptr = huff;
+    memcpy(ptr, HUFF_MAGIC, 4);
+    ptr += 4;
+    const uint32_t offsets[4] = { HUFF_HEADER_LEN, HUFF_HEADER_LEN + 1024, HUFF_HEADER_LEN + 1280, HUFF_HEADER_LEN + 2304 };
+    mobi_huffenc_put32(&ptr, HUFF_HEADER_LEN, true);
+    for (size_t i = 0; i < 4; i++) {
+        mobi_huffenc_put32(&ptr, offsets[i], true);
+    }
+    /* tables are stored in big-endian, then in little-endian order */
+    for (size_t endian = 0; endian < 2; endian++) {
+        const bool big_endian = (endian == 0);
+        for (size_t i = 0; i < 256; i++) {
+            mobi_huffenc_put32(&ptr, table1[i], big_endian);
+        }
+        for (size_t length = 1; length < HUFF_CODETABLE_SIZE; length++) {
+            mobi_huffenc_put32(&ptr, mincodes[length], big_endian);
+            mobi_huffenc_put32(&ptr, maxcodes[length], big_endian);
+        }
+    }
+    output->record_sizes[0] = (size_t) (ptr - huff);
+    return total;
+}
+
+/**
+ @brief Check whether symbols fit in CDIC records of given code length
+ 
+ @param[in] encoder Compressor state
+ @param[in] order Array of symbol numbers sorted by index
+ @param[in] total Number of indexed symbols
+ @param[in] code_length Each CDIC record holds 2^code_length symbols
+ @return True if offsets of all symbols fit in 16 bits
+ */
+static bool mobi_huffenc_cdic_fits(const MOBIHuffEncoder *encoder, const uint32_t *order, const size_t total, const size_t code_length) {
+    const size_t per_record = (size_t) 1 << code_length;
+    if ((total + per_record - 1) / per_record > HUFF_RECORD_MAXCNT - 1) {
+        return false;
+    }
+    for (size_t first = 0; first < total; first += per_record) {
+        const size_t last = first + per_record < total ? first + per_record : total;
+        size_t offset = 2 * (last - first);
+        for (size_t i = first; i < last; i++) {
+            if (offset > HUFFENC_CDIC_DATA_MAX) {
+                return false;
+            }
+            offset += 2 + encoder->symbols[order[i]].length;
+        }
+    }
+    return true;
+}
+
+/**
+ @brief Write CDIC records
+ 
+ All symbols are stored uncompressed.
+ 
+ @param[in] encoder Compressor state
+ @param[in] order Array of symbol numbers sorted by index
+ @param[in] total Number of indexed symbols
+ @param[in,out] output Output structure, CDIC records are stored after HUFF record
+ @return MOBI_RET status code (on success MOBI_SUCCESS)
+ */
+static MOBI_RET mobi_huffenc_write_cdic(const MOBIHuffEncoder *encoder, const uint32_t *order, const size_t total, MOBIHuffCdicOutput *output) {
+    size_t code_length = HUFF_CODELEN_MAX;
+    while (code_length && !mobi_huffenc_cdic_fits(encoder, order, total, code_length)) {
+        code_length--;
+    }
+    if (code_length == 0) {
+        debug_print("%s\n", "Dictionary too large for CDIC records");
+        return MOBI_DATA_CORRUPT;
+    }
+    const size_t per_record = (size_t) 1 << code_length;
+    for (size_t first = 0; first < total; first += per_record) {
+        const size_t last = first + per_record < total ? first + per_record : total;
+        size_t size = CDIC_HEADER_LEN + 2 * (last - first);
+        for (size_t i = first; i < last; i++) {
+            size += 2 + encoder->symbols[order[i]].length;
+        }
+        unsigned char *cdic = malloc(size);
+        if (cdic == NULL) {
+            debug_print("%s\n", "Memory allocation failed");
+            return MOBI_MALLOC_FAILED;
+        }
+        output->records[output->record_count] = cdic;
+        output->record_sizes[output->record_count] = size;
+        output->record_count++;
+        unsigned char *ptr = cdic;
+        memcpy(ptr, CDIC_MAGIC, 4);
+        ptr += 4;
+        mobi_huffenc_put32(&ptr, CDIC_HEADER_LEN, true);
+        mobi_huffenc_put32(&ptr, (uint32_t) total, true);
+        mobi_huffenc_put32(&ptr, (uint32_t) code_length, true);
+        unsigned char *data = ptr + 2 * (last - first);
+        for (size_t i = first; i < last; i++) {
+            const MOBIHuffEncSymbol *symbol = &encoder->symbols[order[i]];
+            const size_t offset = (size_t) (data - cdic) - CDIC_HEADER_LEN;
+            *ptr++ = (unsigned char) (offset >> 8);
+            *ptr++ = (unsigned char) offset;
+            /* high bit marks uncompressed symbol */
+            const uint16_t header = 0x8000 | symbol->length;
+            *data++ = (unsigned char) (header >> 8);
+            *data++ = (unsigned char) header;
+            memcpy(data, symbol->data, symbol->length);
+            data += symbol->length;
+        }
+    }
+    return MOBI_SUCCESS;
+}
+
+/**
+ @brief Free output of huff/cdic compressor
+ 
+ @param[in,out] output MOBIHuffCdicOutput structure
+ */
+void mobi_free_huffcdic_output(MOBIHuffCdicOutput *output) {
+    if (output->records) {
+        for (size_t i = 0; i < output->record_count; i++) {
+            free(output->records[i]);
+        }
+    }
+    if (output->texts) {
+        for (size_t i = 0; i < output->text_count; i++) {
+            free(output->texts[i]);
+        }
+    }
+    free(output->records);
+    free(output->record_sizes);
+    free(output->texts);
+    free(output->text_sizes);
+    memset(output, 0, sizeof(*output));
+}
+
+/**
+ @brief Compress text records with huffman coding of phrases from dictionary
+ 
+ Dictionary of phrases is built from the text on multiple threads,
+ output is the same for any number of threads.
+ Phrases are parsed with HUFFENC_PHRASE_MAX bytes long trie, records are compressed in parallel.
+ Records of output may be parsed with mobi_parse_huffdic() and decompressed with mobi_decompress_huffman().
+ 
+ @param[out] output Output structure, must be freed with mobi_free_huffcdic_output()
+ @param[in] text Uncompressed text of all records
+ @param[in] sizes Array of sizes of uncompressed records
+ @param[in] count Number of records
+ @param[in] level Compression level from MOBI_LZ77_LEVEL_FAST to MOBI_LZ77_LEVEL_BEST
+ @param[in] threads Maximal number of threads
+ @return MOBI_RET status code (on success MOBI_SUCCESS)
+ */
+MOBI_RET mobi_compress_huffcdic(MOBIHuffCdicOutput *output, const unsigned char *text, const size_t *sizes, const size_t count, const int level, const size_t threads) {
+    memset(output, 0, sizeof(*output));
+    if (level < MOBI_LZ77_LEVEL_FAST || level > MOBI_LZ77_LEVEL_BEST) {
+        debug_print("Wrong compression level: %i\n", level);
+        return MOBI_PARAM_ERR;
+    }
+    if (count == 0) {
+        return MOBI_PARAM_ERR;
+    }
+    MOBIHuffEncoder encoder;
+    memset(&encoder, 0, sizeof(encoder));
+    encoder.text = text;
+    encoder.count = count;
+    encoder.offsets = malloc((count + 1) * sizeof(*encoder.offsets));
+    if (encoder.offsets == NULL) {
+        debug_print("%s\n", "Memory allocation failed");
+        return MOBI_MALLOC_FAILED;
+    }
+    encoder.offsets[0] = 0;
+    encoder.max_size = 1;
+    for (size_t i = 0; i < count; i++) {
+        encoder.offsets[i + 1] = encoder.offsets[i] + sizes[i];
+        if (sizes[i] > encoder.max_size) {
+            encoder.max_size = sizes[i];
+        }
+    }
+    MOBIPhraseCandidate *candidates = NULL;
+    size_t candidates_count = 0;
+    uint32_t *order = NULL;
+    MOBI_RET ret = mobi_huffenc_select_phrases(&encoder, level, threads, &candidates, &candidates_count);
+    if (ret == MOBI_SUCCESS) {
+        ret = mobi_huffenc_build_dictionary(&encoder, candidates, candidates_count);
+    }
+    free(candidates);
+    if (ret == MOBI_SUCCESS) {
+        /* drop phrases that are rarely chosen by parser, then count symbols again */
+        ret = mobi_huffenc_parse(&encoder, threads, false, NULL);
+        if (ret == MOBI_SUCCESS) {
+            ret = mobi_huffenc_disable_rare(&encoder, 2);
+        }
+    }
+    if (ret == MOBI_SUCCESS) {
+        ret = mobi_huffenc_parse(&encoder, threads, false, NULL);
+    }
+    if (ret == MOBI_SUCCESS && level >= HUFFENC_OPTIMAL_LEVEL) {
+        ret = mobi_huffenc_code_lengths(&encoder);
+        if (ret == MOBI_SUCCESS) {
+            ret = mobi_huffenc_parse(&encoder, threads, true, NULL);
+        }
+    }
+    if (ret == MOBI_SUCCESS) {
+        ret = mobi_huffenc_disable_rare(&encoder, 1);
+    }
+    if (ret == MOBI_SUCCESS) {
+        ret = mobi_huffenc_code_lengths(&encoder);
+    }
+    if (ret == MOBI_SUCCESS) {
+        order = malloc(encoder.symbols_count * sizeof(*order));
+        output->records = calloc(HUFF_RECORD_MAXCNT, sizeof(*output->records));
+        output->record_sizes = calloc(HUFF_RECORD_MAXCNT, sizeof(*output->record_sizes));
+        output->texts = calloc(count, sizeof(*output->texts));
+        output->text_sizes = calloc(count, sizeof(*output->text_sizes));
+        if (output->records) {
+            output->records[0] = malloc(HUFF_RECORD_MINSIZE);
+        }
+        if (order == NULL || output->records == NULL || output->record_sizes == NULL
+            || output->texts == NULL || output->text_sizes == NULL || output->records[0] == NULL) {
+            debug_print("%s\n", "Memory allocation failed");
+            ret = MOBI_MALLOC_FAILED;
+        } else {
+            output->record_count = 1;
+            output->text_count = count;
+        }
+    }
+    if (ret == MOBI_SUCCESS) {
+        const size_t total = mobi_huffenc_assign_codes(&encoder, output, order);
+        ret = mobi_huffenc_write_cdic(&encoder, order, total, output);
+    }
+    if (ret == MOBI_SUCCESS) {
+        ret = mobi_huffenc_parse(&encoder, threads, true, output);
+    }
+    free(order);
+    free(encoder.offsets);
+    free(encoder.symbols);
+    free(encoder.node_symbol);
+    free(encoder.edges);
+    if (ret != MOBI_SUCCESS) {
+        mobi_free_huffcdic_output(output);
+    }
+    return ret;
+}
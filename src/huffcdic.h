@@ -0,0 +1,39 @@
+/** @file huffcdic.h
+ *
+ * Copyright (c) 2026 Bartek Fabiszewski
+ * http://www.fabiszewski.net
+ *
+ * This file is part of libmobi.
+ * Licensed under LGPL, either version 3, or any later.
+ * See <http://www.gnu.org/licenses/>
+ */
+
+#ifndef libmobi_huffcdic_h
+#define libmobi_huffcdic_h
+
+#include "config.h"
+#include "mobi.h"
+
+#define HUFFENC_PHRASE_MAX 64 /**< Maximal length of phrase in compressor dictionary */
+#define HUFFENC_CODELEN_MAX 24 /**< Maximal length of huffman code produced by compressor */
+#define HUFFENC_COUNT_RECORDS 64 /**< Phrases are counted in ranges of this number of records, independently of number of threads */
+#define HUFFENC_COUNTER_BITS_MAX 20 /**< Hash table of phrases counted in single range of records has at most 2^HUFFENC_COUNTER_BITS_MAX slots */
+#define HUFFENC_MERGED_BITS_MAX 22 /**< Hash table of phrases merged from all ranges has at most 2^HUFFENC_MERGED_BITS_MAX slots */
+#define HUFFENC_CDIC_DATA_MAX 0xffff /**< Maximal offset of symbol in CDIC record data */
+
+/**
+ @brief Records produced by huff/cdic compressor
+ */
+typedef struct {
+    unsigned char **records; /**< HUFF record followed by CDIC records */
+    size_t *record_sizes; /**< Sizes of HUFF and CDIC records */
+    size_t record_count; /**< Number of HUFF and CDIC records */
+    unsigned char **texts; /**< Compressed text records, without trailing entries */
+    size_t *text_sizes; /**< Sizes of compressed text records */
+    size_t text_count; /**< Number of compressed text records */
+} MOBIHuffCdicOutput;
+
+MOBI_RET mobi_compress_huffcdic(MOBIHuffCdicOutput *output, const unsigned char *text, const size_t *sizes, const size_t count, const int level, const size_t threads);
+void mobi_free_huffcdic_output(MOBIHuffCdicOutput *output);
+
+#endif
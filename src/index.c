@@ -328,77 +328,122 @@ size_t mobi_getstring_ordt(const MOBIOrdt *ordt, MOBIBuffer *buf, unsigned char
 }
 
 /**
- @brief Parser of INDX index entry
+ @brief Read label of INDX index entry
  
- @param[in,out] indx MOBIIndx structure, to be filled with parsed data
- @param[in] idxt MOBIIdxt structure with parsed IDXT index
- @param[in] tagx MOBITagx structure with parsed TAGX index
- @param[in,out] buf MOBIBuffer structure with index data
- @param[in] curr_number Sequential number of an index entry for current record
+ On success buffer maxlen is limited to the end of the entry
+ and offset points at control bytes following the label.
+ 
+ @param[in,out] text Output buffer (INDX_LABEL_SIZEMAX + 1 bytes)
+ @param[in,out] label_length Will be set to length of the label (without null terminator)
+ @param[in,out] buf MOBIBuffer structure with index record data
+ @param[in] entry_offset Offset of the entry in the record
+ @param[in] entry_length Length of the entry
+ @param[in] ordt MOBIOrdt structure (ORDT data and metadata)
+ @param[in] has_ligatures Decode ligatures if true
  @return MOBI_RET status code (on success MOBI_SUCCESS)
  */
-static MOBI_RET mobi_parse_index_entry(MOBIIndx *indx, const MOBIIdxt idxt, const MOBITagx *tagx, const MOBIOrdt *ordt, MOBIBuffer *buf, const size_t curr_number) {
-    if (indx == NULL) {
-        debug_print("%s", "INDX structure not initialized\n");
-        return MOBI_INIT_FAILED;
-    }
-    const size_t entry_offset = indx->entries_count;
-    const size_t entry_length = idxt.offsets[curr_number + 1] - idxt.offsets[curr_number];
-    mobi_buffer_setpos(buf, idxt.offsets[curr_number]);
-    size_t entry_number = curr_number + entry_offset;
-    if (entry_number >= indx->total_entries_count) {
-        debug_print("Entry number beyond array: %zu\n", entry_number);
-        return MOBI_DATA_CORRUPT;
-    }
-    /* save original record maxlen */
-    const size_t buf_maxlen = buf->maxlen;
-    if (buf->offset + entry_length >= buf_maxlen) {
+static MOBI_RET mobi_parse_index_label(char *text, size_t *label_length, MOBIBuffer *buf, const size_t entry_offset, const size_t entry_length, const MOBIOrdt *ordt, const size_t has_ligatures) {
+    mobi_buffer_setpos(buf, entry_offset);
+    if (buf->offset + entry_length >= buf->maxlen) {
         debug_print("Entry length too long: %zu\n", entry_length);
         return MOBI_DATA_CORRUPT;
     }
     buf->maxlen = buf->offset + entry_length;
-    size_t label_length = mobi_buffer_get8(buf);
-    if (label_length > entry_length) {
-        debug_print("Label length too long: %zu\n", label_length);
+    size_t length = mobi_buffer_get8(buf);
+    if (length > entry_length) {
+        debug_print("Label length too long: %zu\n", length);
         return MOBI_DATA_CORRUPT;
     }
-    char text[INDX_LABEL_SIZEMAX + 1];
     /* FIXME: what is ORDT1 for? */
     if (ordt->ordt2) {
-        label_length = mobi_getstring_ordt(ordt, buf, (unsigned char*) text, label_length);
+        length = mobi_getstring_ordt(ordt, buf, (unsigned char*) text, length);
     } else {
-        label_length = mobi_indx_get_label((unsigned char*) text, buf, label_length, indx->ligt_entries_count);
+        length = mobi_indx_get_label((unsigned char*) text, buf, length, has_ligatures);
         if (buf->error != MOBI_SUCCESS) {
             debug_print("Buffer error reading label: %d\n", buf->error);
             return MOBI_DATA_CORRUPT;
         }
     }
-    indx->entries[entry_number].label = malloc(label_length + 1);
-    if (indx->entries[entry_number].label == NULL) {
-        debug_print("Memory allocation failed (%zu bytes)\n", label_length);
+    *label_length = length;
+    return MOBI_SUCCESS;
+}
+
+/**
+ @brief Reserve space in index entries pool array
+ 
+ Array capacity is doubled until it fits required count of items.
+ 
+ @param[in,out] array Pointer to pool array, may be reallocated
+ @param[in,out] capacity Allocated number of items, will be updated
+ @param[in] count Required number of items
+ @param[in] item_size Size of single item
+ @return MOBI_RET status code (on success MOBI_SUCCESS)
+ */
+static MOBI_RET mobi_indx_pool_reserve(void **array, size_t *capacity, const size_t count, const size_t item_size) {
+    if (count <= *capacity) {
+        return MOBI_SUCCESS;
+    }
+    size_t new_capacity = *capacity ? *capacity : INDX_POOL_INITSIZE;
+    while (new_capacity < count) {
+        new_capacity *= 2;
+    }
+    void *new_array = realloc(*array, new_capacity * item_size);
+    if (new_array == NULL) {
+        debug_print("Memory allocation failed (%zu bytes)\n", new_capacity * item_size);
         return MOBI_MALLOC_FAILED;
     }
-    strncpy(indx->entries[entry_number].label, text, label_length + 1);
-    //debug_print("tag label[%zu]: %s\n", entry_number, indx->entries[entry_number].label);
+    *array = new_array;
+    *capacity = new_capacity;
+    return MOBI_SUCCESS;
+}
+
+/**
+ @brief Decoder of INDX index entry
+ 
+ Label, tags and tag values are appended to the pool.
+ Only entry tags count is set, entry pointers are set when entries are linked to pool data
+ with mobi_indx_pool_link().
+ 
+ @param[in,out] entry MOBIIndexEntry structure, to be filled with decoded data
+ @param[in,out] pool MOBIIndxPool structure, decoded data will be appended
+ @param[in,out] buf MOBIBuffer structure with index record data
+ @param[in] entry_offset Offset of the entry in the record
+ @param[in] entry_length Length of the entry
+ @param[in] tagx MOBITagx structure with parsed TAGX index
+ @param[in] ordt MOBIOrdt structure (ORDT data and metadata)
+ @param[in] has_ligatures Decode ligatures if true
+ @return MOBI_RET status code (on success MOBI_SUCCESS)
+ */
+static MOBI_RET mobi_decode_index_entry(MOBIIndexEntry *entry, MOBIIndxPool *pool, MOBIBuffer *buf, const size_t entry_offset, const size_t entry_length, const MOBITagx *tagx, const MOBIOrdt *ordt, const size_t has_ligatures) {
+    /* save original record maxlen */
+    const size_t buf_maxlen = buf->maxlen;
+    char text[INDX_LABEL_SIZEMAX + 1];
+    size_t label_length;
+    entry->label = NULL;
+    entry->tags_count = 0;
+    entry->tags = NULL;
+    MOBI_RET ret = mobi_parse_index_label(text, &label_length, buf, entry_offset, entry_length, ordt, has_ligatures);
+    if (ret != MOBI_SUCCESS) {
+        return ret;
+    }
+    /* label is cut at first null character */
+    label_length = strlen(text);
+    ret = mobi_indx_pool_reserve((void **) &pool->labels, &pool->labels_capacity, pool->labels_size + label_length + 1, sizeof(*pool->labels));
+    if (ret != MOBI_SUCCESS) {
+        return ret;
+    }
+    memcpy(pool->labels + pool->labels_size, text, label_length + 1);
+    pool->labels_size += label_length + 1;
+    //debug_print("tag label: %s\n", text);
     unsigned char *control_bytes;
     control_bytes = buf->data + buf->offset;
     mobi_buffer_seek(buf, (int) tagx->control_byte_count);
-    indx->entries[entry_number].tags_count = 0;
-    indx->entries[entry_number].tags = NULL;
     if (tagx->tags_count > 0) {
-        typedef struct {
-            uint8_t tag;
-            uint8_t tag_value_count;
-            uint32_t value_count;
-            uint32_t value_bytes;
-        } MOBIPtagx;
-        MOBIPtagx *ptagx = malloc(tagx->tags_count * sizeof(MOBIPtagx));
-        if (ptagx == NULL) {
-            debug_print("Memory allocation failed (%zu bytes)\n", tagx->tags_count * sizeof(MOBIPtagx));
-            free(indx->entries[entry_number].label);
-            indx->entries[entry_number].label = NULL;
-            return MOBI_MALLOC_FAILED;
+        ret = mobi_indx_pool_reserve((void **) &pool->ptagx, &pool->ptagx_capacity, tagx->tags_count, sizeof(*pool->ptagx));
+        if (ret != MOBI_SUCCESS) {
+            return ret;
         }
+        MOBIPtagx *ptagx = pool->ptagx;
         uint32_t ptagx_count = 0;
         size_t len;
         size_t i = 0;
@@ -439,13 +484,9 @@ static MOBI_RET mobi_parse_index_entry(MOBIIndx *indx, const MOBIIdxt idxt, cons
             }
             i++;
         }
-        indx->entries[entry_number].tags = malloc(tagx->tags_count * sizeof(MOBIIndexTag));
-        if (indx->entries[entry_number].tags == NULL) {
-            debug_print("Memory allocation failed (%zu bytes)\n", tagx->tags_count * sizeof(MOBIIndexTag));
-            free(indx->entries[entry_number].label);
-            indx->entries[entry_number].label = NULL;
-            free(ptagx);
-            return MOBI_MALLOC_FAILED;
+        ret = mobi_indx_pool_reserve((void **) &pool->tags, &pool->tags_capacity, pool->tags_count + ptagx_count, sizeof(*pool->tags));
+        if (ret != MOBI_SUCCESS) {
+            return ret;
         }
         i = 0;
         while (i < ptagx_count) {
@@ -470,36 +511,85 @@ static MOBI_RET mobi_parse_index_entry(MOBIIndx *indx, const MOBIIdxt idxt, cons
                 }
             }
             if (tagvalues_count) {
-                const size_t arr_size = tagvalues_count * sizeof(*indx->entries[entry_number].tags[i].tagvalues);
-                indx->entries[entry_number].tags[i].tagvalues = malloc(arr_size);
-                if (indx->entries[entry_number].tags[i].tagvalues == NULL) {
-                    debug_print("Memory allocation failed (%zu bytes)\n", arr_size);
-                    free(indx->entries[entry_number].label);
-                    indx->entries[entry_number].label = NULL;
-                    for (size_t j = 0; j < i; j++) {
-                        free(indx->entries[entry_number].tags[j].tagvalues);
-                    }
-                    free(indx->entries[entry_number].tags);
-                    indx->entries[entry_number].tags = NULL;
-                    free(ptagx);
-                    return MOBI_MALLOC_FAILED;
+                ret = mobi_indx_pool_reserve((void **) &pool->tagvalues, &pool->tagvalues_capacity, pool->tagvalues_count + tagvalues_count, sizeof(*pool->tagvalues));
+                if (ret != MOBI_SUCCESS) {
+                    return ret;
                 }
-                memcpy(indx->entries[entry_number].tags[i].tagvalues, tagvalues, arr_size);
-            } else {
-                indx->entries[entry_number].tags[i].tagvalues = NULL;
+                memcpy(pool->tagvalues + pool->tagvalues_count, tagvalues, tagvalues_count * sizeof(*pool->tagvalues));
+                pool->tagvalues_count += tagvalues_count;
             }
-            indx->entries[entry_number].tags[i].tagid = ptagx[i].tag;
-            indx->entries[entry_number].tags[i].tagvalues_count = tagvalues_count;
-            indx->entries[entry_number].tags_count++;
+            MOBIIndexTag *tag = &pool->tags[pool->tags_count++];
+            tag->tagid = ptagx[i].tag;
+            tag->tagvalues_count = tagvalues_count;
+            tag->tagvalues = NULL;
+            entry->tags_count++;
             i++;
         }
-        free(ptagx);
     }
     /* restore buffer maxlen */
     buf->maxlen = buf_maxlen;
     return MOBI_SUCCESS;
 }
 
+/**
+ @brief Link decoded index entries to pool data
+ 
+ Entries must be decoded with mobi_decode_index_entry() in the same order into the same pool.
+ 
+ @param[in,out] entries Array of MOBIIndexEntry structures
+ @param[in] entries_count Number of entries
+ @param[in] pool MOBIIndxPool structure with entries data
+ */
+static void mobi_indx_pool_link(MOBIIndexEntry *entries, const size_t entries_count, const MOBIIndxPool *pool) {
+    char *label = pool->labels;
+    MOBIIndexTag *tag = pool->tags;
+    uint32_t *tagvalues = pool->tagvalues;
+    for (size_t i = 0; i < entries_count; i++) {
+        MOBIIndexEntry *entry = &entries[i];
+        entry->label = label;
+        label += strlen(label) + 1;
+        if (entry->tags_count == 0) {
+            entry->tags = NULL;
+            continue;
+        }
+        entry->tags = tag;
+        for (size_t j = 0; j < entry->tags_count; j++) {
+            if (tag->tagvalues_count) {
+                tag->tagvalues = tagvalues;
+                tagvalues += tag->tagvalues_count;
+            }
+            tag++;
+        }
+    }
+}
+
+/**
+ @brief Parser of INDX index entry
+ 
+ @param[in,out] indx MOBIIndx structure, to be filled with parsed data
+ @param[in,out] pool MOBIIndxPool structure, entry data will be appended
+ @param[in] idxt MOBIIdxt structure with parsed IDXT index
+ @param[in] tagx MOBITagx structure with parsed TAGX index
+ @param[in] ordt MOBIOrdt structure (ORDT data and metadata)
+ @param[in,out] buf MOBIBuffer structure with index data
+ @param[in] curr_number Sequential number of an index entry for current record
+ @return MOBI_RET status code (on success MOBI_SUCCESS)
+ */
+static MOBI_RET mobi_parse_index_entry(MOBIIndx *indx, MOBIIndxPool *pool, const MOBIIdxt idxt, const MOBITagx *tagx, const MOBIOrdt *ordt, MOBIBuffer *buf, const size_t curr_number) {
+    if (indx == NULL) {
+        debug_print("%s", "INDX structure not initialized\n");
+        return MOBI_INIT_FAILED;
+    }
+    const size_t entry_offset = indx->entries_count;
+    const size_t entry_length = idxt.offsets[curr_number + 1] - idxt.offsets[curr_number];
+    size_t entry_number = curr_number + entry_offset;
+    if (entry_number >= indx->total_entries_count) {
+        debug_print("Entry number beyond array: %zu\n", entry_number);
+        return MOBI_DATA_CORRUPT;
+    }
+    return mobi_decode_index_entry(&indx->entries[entry_number], pool, buf, idxt.offsets[curr_number], entry_length, tagx, ordt, indx->ligt_entries_count);
+}
+
 /**
  @brief Parser of INDX record
  
@@ -507,10 +597,11 @@ static MOBI_RET mobi_parse_index_entry(MOBIIndx *indx, const MOBIIdxt idxt, cons
  @param[in,out] indx MOBIIndx structure to be filled with parsed entries
  @param[in,out] tagx MOBITagx structure, will be filled with parsed TAGX section data if present in the INDX record, otherwise TAGX data will be used to parse the record
  @param[in,out] ordt MOBIOrdt structure, will be filled with parsed ORDT sections
+ @param[in,out] pool MOBIIndxPool structure, data of parsed entries will be appended
  @return MOBI_RET status code (on success MOBI_SUCCESS)
  */
-MOBI_RET mobi_parse_indx(const MOBIPdbRecord *indx_record, MOBIIndx *indx, MOBITagx *tagx, MOBIOrdt *ordt) {
-    if (indx_record == NULL || indx == NULL || tagx == NULL || ordt == NULL) {
+MOBI_RET mobi_parse_indx(const MOBIPdbRecord *indx_record, MOBIIndx *indx, MOBITagx *tagx, MOBIOrdt *ordt, MOBIIndxPool *pool) {
+    if (indx_record == NULL || indx == NULL || tagx == NULL || ordt == NULL || pool == NULL) {
         debug_print("%s", "index structure not initialized\n");
         return MOBI_INIT_FAILED;
     }
@@ -679,7 +770,7 @@ MOBI_RET mobi_parse_indx(const MOBIPdbRecord *indx_record, MOBIIndx *indx, MOBIT
             }
             size_t i = 0;
             while (i < entries_count) {
-                ret = mobi_parse_index_entry(indx, idxt, tagx, ordt, buf, i);
+                ret = mobi_parse_index_entry(indx, pool, idxt, tagx, ordt, buf, i);
                 if (ret != MOBI_SUCCESS) {
                     indx->entries_count += i;
                     mobi_buffer_free_null(buf);
@@ -696,9 +787,188 @@ MOBI_RET mobi_parse_indx(const MOBIPdbRecord *indx_record, MOBIIndx *indx, MOBIT
     return MOBI_SUCCESS;
 }
 
+/**
+ @brief Move entries data from pool to index
+ 
+ Pool arrays are shrunk to fit, entries are linked to them,
+ and their ownership is transferred to the index.
+ Pool scratch data is freed.
+ 
+ @param[in,out] indx MOBIIndx structure with decoded entries
+ @param[in,out] pool MOBIIndxPool structure with entries data
+ */
+void mobi_indx_pool_attach(MOBIIndx *indx, MOBIIndxPool *pool) {
+    if (pool->labels_size && pool->labels_size < pool->labels_capacity) {
+        char *labels = realloc(pool->labels, pool->labels_size);
+        if (labels) { pool->labels = labels; }
+    }
+    if (pool->tags_count && pool->tags_count < pool->tags_capacity) {
+        MOBIIndexTag *tags = realloc(pool->tags, pool->tags_count * sizeof(*pool->tags));
+        if (tags) { pool->tags = tags; }
+    }
+    if (pool->tagvalues_count && pool->tagvalues_count < pool->tagvalues_capacity) {
+        uint32_t *tagvalues = realloc(pool->tagvalues, pool->tagvalues_count * sizeof(*pool->tagvalues));
+        if (tagvalues) { pool->tagvalues = tagvalues; }
+    }
+    mobi_indx_pool_link(indx->entries, indx->entries_count, pool);
+    indx->labels = pool->labels;
+    indx->tags = pool->tags;
+    indx->tagvalues = pool->tagvalues;
+    pool->labels = NULL;
+    pool->tags = NULL;
+    pool->tagvalues = NULL;
+    mobi_free_indx_pool(pool);
+}
+
+/**
+ @brief Append entries data of one pool to another
+ 
+ @param[in,out] pool MOBIIndxPool structure, data will be appended
+ @param[in] other MOBIIndxPool structure with data of following entries
+ @return MOBI_RET status code (on success MOBI_SUCCESS)
+ */
+static MOBI_RET mobi_indx_pool_append(MOBIIndxPool *pool, const MOBIIndxPool *other) {
+    MOBI_RET ret = mobi_indx_pool_reserve((void **) &pool->labels, &pool->labels_capacity, pool->labels_size + other->labels_size, sizeof(*pool->labels));
+    if (ret != MOBI_SUCCESS) {
+        return ret;
+    }
+    ret = mobi_indx_pool_reserve((void **) &pool->tags, &pool->tags_capacity, pool->tags_count + other->tags_count, sizeof(*pool->tags));
+    if (ret != MOBI_SUCCESS) {
+        return ret;
+    }
+    ret = mobi_indx_pool_reserve((void **) &pool->tagvalues, &pool->tagvalues_capacity, pool->tagvalues_count + other->tagvalues_count, sizeof(*pool->tagvalues));
+    if (ret != MOBI_SUCCESS) {
+        return ret;
+    }
+    if (other->labels_size) {
+        memcpy(pool->labels + pool->labels_size, other->labels, other->labels_size);
+        pool->labels_size += other->labels_size;
+    }
+    if (other->tags_count) {
+        memcpy(pool->tags + pool->tags_count, other->tags, other->tags_count * sizeof(*pool->tags));
+        pool->tags_count += other->tags_count;
+    }
+    if (other->tagvalues_count) {
+        memcpy(pool->tagvalues + pool->tagvalues_count, other->tagvalues, other->tagvalues_count * sizeof(*pool->tagvalues));
+        pool->tagvalues_count += other->tagvalues_count;
+    }
+    return MOBI_SUCCESS;
+}
+
+/**
+ @brief Range of INDX data records parsed by single thread
+ */
+typedef struct {
+    const MOBIPdbRecord **records; /**< INDX data records */
+    size_t first; /**< Index of first record in the range */
+    size_t last; /**< Index of record following the range */
+    MOBIIndx indx; /**< Copy of index structure, entries_count holds number of next entry to be parsed */
+    MOBITagx *tagx; /**< Parsed TAGX section, read only */
+    MOBIOrdt *ordt; /**< Parsed ORDT sections, read only */
+    MOBIIndxPool pool; /**< Data of entries parsed in the range */
+    MOBI_RET ret; /**< Status code of the range */
+} MOBIIndxTask;
+
+/**
+ @brief Parse range of INDX data records, run by mobi_run_tasks()
+ 
+ @param[in,out] arg MOBIIndxTask structure
+ */
+static void mobi_indx_task(void *arg) {
+    MOBIIndxTask *task = arg;
+    task->ret = MOBI_SUCCESS;
+    for (size_t i = task->first; i < task->last; i++) {
+        task->ret = mobi_parse_indx(task->records[i], &task->indx, task->tagx, task->ordt, &task->pool);
+        if (task->ret != MOBI_SUCCESS) {
+            return;
+        }
+    }
+}
+
+/**
+ @brief Parse INDX data records in parallel
+ 
+ Every record header holds its entries count, so entries of each range of records
+ are decoded into known slice of indx->entries and into separate pool.
+ Pools are then appended in records order.
+ 
+ @param[in] m MOBIData structure
+ @param[in,out] indx MOBIIndx structure with parsed meta record, entries will be added
+ @param[in] tagx MOBITagx structure with parsed TAGX section
+ @param[in] ordt MOBIOrdt structure with parsed ORDT sections
+ @param[in,out] pool MOBIIndxPool structure, data of parsed entries will be appended
+ @param[in,out] record Meta INDX record, will be set to last data record
+ @param[in] count Number of data records
+ @param[in] threads Number of threads
+ @return MOBI_RET status code (on success MOBI_SUCCESS)
+ */
+static MOBI_RET mobi_parse_indx_records(const MOBIData *m, MOBIIndx *indx, MOBITagx *tagx, MOBIOrdt *ordt, MOBIIndxPool *pool, MOBIPdbRecord **record, const size_t count, const size_t threads) {
+    const MOBIPdbRecord **records = malloc(count * sizeof(*records));
+    size_t *first_entries = malloc(count * sizeof(*first_entries));
+    MOBIIndxTask *tasks = calloc(threads, sizeof(*tasks));
+    if (indx->entries == NULL) {
+        indx->entries = malloc(indx->total_entries_count * sizeof(MOBIIndexEntry));
+    }
+    if (records == NULL || first_entries == NULL || tasks == NULL || indx->entries == NULL) {
+        free(records);
+        free(first_entries);
+        free(tasks);
+        debug_print("%s\n", "Memory allocation failed");
+        return MOBI_MALLOC_FAILED;
+    }
+    /* records data must be loaded before threads are started */
+    MOBIPdbRecord *curr = *record;
+    size_t entries_count = 0;
+    for (size_t i = 0; i < count; i++) {
+        curr = mobi_next_record(m, curr);
+        records[i] = curr;
+        first_entries[i] = entries_count;
+        if (curr && curr->size >= 28) {
+            /* 24: entries count, validated by record parser */
+            const uint32_t record_entries_count = mobi_get32be(curr->data + 24);
+            if (record_entries_count <= INDX_RECORD_MAXCNT) {
+                entries_count += record_entries_count;
+            }
+        }
+        if (curr) {
+            *record = curr;
+        }
+    }
+    for (size_t i = 0; i < threads; i++) {
+        tasks[i].records = records;
+        tasks[i].first = count * i / threads;
+        tasks[i].last = count * (i + 1) / threads;
+        tasks[i].indx = *indx;
+        tasks[i].indx.entries_count = first_entries[tasks[i].first];
+        tasks[i].tagx = tagx;
+        tasks[i].ordt = ordt;
+    }
+    mobi_run_tasks(tasks, sizeof(*tasks), threads, mobi_indx_task);
+    MOBI_RET ret = MOBI_SUCCESS;
+    for (size_t i = 0; i < threads; i++) {
+        if (ret == MOBI_SUCCESS) {
+            ret = tasks[i].ret;
+        }
+        if (ret == MOBI_SUCCESS) {
+            ret = mobi_indx_pool_append(pool, &tasks[i].pool);
+        }
+        mobi_free_indx_pool(&tasks[i].pool);
+    }
+    if (ret == MOBI_SUCCESS) {
+        indx->entries_count = tasks[threads - 1].indx.entries_count;
+    }
+    free(records);
+    free(first_entries);
+    free(tasks);
+    return ret;
+}
+
 /**
  @brief Parser of a set of index records
  
+ Labels, tags and tag values of all entries are stored in three memory blocks
+ (indx->labels, indx->tags, indx->tagvalues), entries point into them.
+ 
  @param[in] m MOBIData structure containing MOBI file metadata and data
  @param[in,out] indx MOBIIndx structure to be filled with parsed entries
  @param[in] indx_record_number Number of the first record of the set
@@ -721,44 +991,694 @@ MOBI_RET mobi_parse_index(const MOBIData *m, MOBIIndx *indx, const size_t indx_r
         debug_print("%s\n", "Memory allocation failed");
         return MOBI_MALLOC_FAILED;
     }
+    /* pool arrays will be allocated while entries are parsed */
+    MOBIIndxPool pool;
+    memset(&pool, 0, sizeof(pool));
     /* parse first meta INDX record */
     MOBIPdbRecord *record = mobi_get_record_by_seqnumber(m, indx_record_number);
-    ret = mobi_parse_indx(record, indx, tagx, ordt);
+    ret = mobi_parse_indx(record, indx, tagx, ordt, &pool);
     if (ret != MOBI_SUCCESS) {
         mobi_free_indx(indx);
         mobi_free_tagx(tagx);
         mobi_free_ordt(ordt);
+        mobi_free_indx_pool(&pool);
         return ret;
     }
     /* parse remaining INDX records for the index */
     size_t count = indx->entries_count;
     indx->entries_count = 0;
-    while (count--) {
-        record = record->next;
-        ret = mobi_parse_indx(record, indx, tagx, ordt);
-        if (ret != MOBI_SUCCESS) {
-            mobi_free_indx(indx);
-            mobi_free_tagx(tagx);
-            mobi_free_ordt(ordt);
-            return ret;
+    size_t threads = mobi_get_threads(m);
+    if (threads > count / INDX_THREAD_MINRECORDS) {
+        threads = count / INDX_THREAD_MINRECORDS;
+    }
+    if (threads > 1 && indx->total_entries_count) {
+        ret = mobi_parse_indx_records(m, indx, tagx, ordt, &pool, &record, count, threads);
+    } else {
+        while (count-- && ret == MOBI_SUCCESS) {
+            record = mobi_next_record(m, record);
+            ret = mobi_parse_indx(record, indx, tagx, ordt, &pool);
         }
     }
+    if (ret != MOBI_SUCCESS) {
+        mobi_free_indx(indx);
+        mobi_free_tagx(tagx);
+        mobi_free_ordt(ordt);
+        mobi_free_indx_pool(&pool);
+        return ret;
+    }
     if (indx->entries_count != indx->total_entries_count) {
         debug_print("Entries count %zu != total entries count %zu\n", indx->entries_count, indx->total_entries_count);
         mobi_free_indx(indx);
         mobi_free_tagx(tagx);
         mobi_free_ordt(ordt);
+        mobi_free_indx_pool(&pool);
         return MOBI_DATA_CORRUPT;
     }
+    mobi_indx_pool_attach(indx, &pool);
     /* copy pointer to first cncx record if present and set info from first record */
     if (indx->cncx_records_count) {
-        indx->cncx_record = record->next;
+        indx->cncx_record = mobi_next_record(m, record);
     }
     mobi_free_tagx(tagx);
     mobi_free_ordt(ordt);
     return MOBI_SUCCESS;
 }
 
+/**
+ @brief Add data record to index opened with mobi_open_index()
+ 
+ Record header and IDXT section are validated, IDXT offsets are read from record data on demand.
+ Records without entries are skipped.
+ 
+ @param[in,out] reader MOBIIndxReader structure
+ @param[in] record INDX data record
+ @return MOBI_RET status code (on success MOBI_SUCCESS)
+ */
+static MOBI_RET mobi_indx_reader_add_record(MOBIIndxReader *reader, const MOBIPdbRecord *record) {
+    if (record == NULL || record->data == NULL) {
+        debug_print("%s", "Missing INDX record\n");
+        return MOBI_DATA_CORRUPT;
+    }
+    MOBIBuffer buf;
+    buf.data = record->data;
+    buf.offset = 0;
+    buf.maxlen = record->size;
+    buf.error = MOBI_SUCCESS;
+    char indx_magic[5];
+    mobi_buffer_getstring(indx_magic, &buf, 4); /* 0: INDX magic */
+    const uint32_t header_length = mobi_buffer_get32(&buf); /* 4: header length */
+    mobi_buffer_setpos(&buf, 20);
+    const uint32_t idxt_offset = mobi_buffer_get32(&buf); /* 20: IDXT offset */
+    const uint32_t entries_count = mobi_buffer_get32(&buf); /* 24: entries count */
+    if (buf.error != MOBI_SUCCESS || strncmp(indx_magic, INDX_MAGIC, 4) != 0 ||
+        header_length == 0 || header_length > record->size) {
+        debug_print("INDX wrong magic: %s or header length: %u\n", indx_magic, header_length);
+        return MOBI_DATA_CORRUPT;
+    }
+    if (entries_count > INDX_RECORD_MAXCNT) {
+        debug_print("Too many index entries (%u)\n", entries_count);
+        return MOBI_DATA_CORRUPT;
+    }
+    if (entries_count == 0) {
+        return MOBI_SUCCESS;
+    }
+    if (idxt_offset == 0 || idxt_offset + 2 * entries_count + 4 > record->size) {
+        debug_print("%s", "IDXT entries beyond record end\n");
+        return MOBI_DATA_CORRUPT;
+    }
+    if (!mobi_buffer_match_magic_offset(&buf, IDXT_MAGIC, idxt_offset)) {
+        debug_print("%s", "IDXT wrong magic\n");
+        return MOBI_DATA_CORRUPT;
+    }
+    size_t first_entry = 0;
+    if (reader->records_count) {
+        const MOBIIndxRecord *last = &reader->records[reader->records_count - 1];
+        first_entry = last->first_entry + last->entries_count;
+    }
+    if (first_entry + entries_count > reader->total_entries_count) {
+        debug_print("Entries count beyond total entries count %zu\n", reader->total_entries_count);
+        return MOBI_DATA_CORRUPT;
+    }
+    MOBIIndxRecord *indx_record = &reader->records[reader->records_count++];
+    indx_record->record = record;
+    indx_record->idxt_offset = idxt_offset;
+    indx_record->entries_count = entries_count;
+    indx_record->first_entry = first_entry;
+    return MOBI_SUCCESS;
+}
+
+/**
+ @brief Compare packed ORDT codes, used with qsort()
+ 
+ @param[in] a First code
+ @param[in] b Second code
+ @return Negative, zero or positive value if first code is lower, equal or greater than the second
+ */
+static int mobi_indx_ordt_code_cmp(const void *a, const void *b) {
+    const uint32_t code1 = *(const uint32_t *) a;
+    const uint32_t code2 = *(const uint32_t *) b;
+    return (code1 > code2) - (code1 < code2);
+}
+
+/**
+ @brief Prepare reverse ORDT2 lookup table for encoding labels in ORDT order
+ 
+ @param[in,out] reader MOBIIndxReader structure
+ @return MOBI_RET status code (on success MOBI_SUCCESS)
+ */
+static MOBI_RET mobi_indx_reader_init_ordt_codes(MOBIIndxReader *reader) {
+    const MOBIOrdt *ordt = reader->ordt;
+    if (ordt->ordt2 == NULL || ordt->offsets_count == 0) {
+        return MOBI_SUCCESS;
+    }
+    /* offsets are read as 8 or 16 bit values */
+    const size_t count = ordt->offsets_count < UINT16_MAX ? ordt->offsets_count : UINT16_MAX;
+    reader->ordt_codes = malloc(count * sizeof(*reader->ordt_codes));
+    if (reader->ordt_codes == NULL) {
+        debug_print("%s\n", "Memory allocation failed");
+        return MOBI_MALLOC_FAILED;
+    }
+    for (size_t i = 0; i < count; i++) {
+        reader->ordt_codes[i] = (uint32_t) ordt->ordt2[i] << 16 | (uint32_t) i;
+    }
+    qsort(reader->ordt_codes, count, sizeof(*reader->ordt_codes), mobi_indx_ordt_code_cmp);
+    return MOBI_SUCCESS;
+}
+
+/**
+ @brief Open index for lazy access
+ 
+ Unlike mobi_parse_index(), which decodes all entries,
+ only headers and TAGX, ORDT, IDXT sections are parsed.
+ Reader must be freed with mobi_free_indx_reader().
+ 
+ @param[in] m MOBIData structure containing MOBI file metadata and data
+ @param[in,out] reader Will be set to opened index, NULL on failure
+ @param[in] indx_record_number Number of the first record of the set
+ @return MOBI_RET status code (on success MOBI_SUCCESS)
+ */
+MOBI_RET mobi_open_index(const MOBIData *m, MOBIIndxReader **reader, const size_t indx_record_number) {
+    if (reader == NULL) {
+        return MOBI_PARAM_ERR;
+    }
+    *reader = NULL;
+    MOBIIndxReader *indx_reader = calloc(1, sizeof(MOBIIndxReader));
+    if (indx_reader == NULL) {
+        debug_print("%s\n", "Memory allocation failed");
+        return MOBI_MALLOC_FAILED;
+    }
+    /* tagx->tags array will be allocated in mobi_parse_tagx */
+    indx_reader->tagx = calloc(1, sizeof(MOBITagx));
+    /* ordt->ordt1 and ordt.ordt2 arrays will be allocated in mobi_parse_ordt */
+    indx_reader->ordt = calloc(1, sizeof(MOBIOrdt));
+    if (indx_reader->tagx == NULL || indx_reader->ordt == NULL) {
+        mobi_free_indx_reader(indx_reader);
+        debug_print("%s\n", "Memory allocation failed");
+        return MOBI_MALLOC_FAILED;
+    }
+    /* parse first meta INDX record, entries are not parsed */
+    MOBIIndx meta;
+    memset(&meta, 0, sizeof(meta));
+    MOBIPdbRecord *record = mobi_get_record_by_seqnumber(m, indx_record_number);
+    MOBIIndxPool pool;
+    memset(&pool, 0, sizeof(pool));
+    MOBI_RET ret = mobi_parse_indx(record, &meta, indx_reader->tagx, indx_reader->ordt, &pool);
+    mobi_free_index_entries(&meta);
+    mobi_free_indx_pool(&pool);
+    free(meta.orth_index_name);
+    if (ret != MOBI_SUCCESS) {
+        mobi_free_indx_reader(indx_reader);
+        return ret;
+    }
+    indx_reader->type = meta.type;
+    indx_reader->encoding = meta.encoding;
+    indx_reader->total_entries_count = meta.total_entries_count;
+    indx_reader->ligt_entries_count = meta.ligt_entries_count;
+    indx_reader->cncx_records_count = meta.cncx_records_count;
+    /* meta record entries count is number of data records */
+    size_t count = meta.entries_count;
+    if (count) {
+        indx_reader->records = malloc(count * sizeof(*indx_reader->records));
+        if (indx_reader->records == NULL) {
+            mobi_free_indx_reader(indx_reader);
+            debug_print("%s\n", "Memory allocation failed");
+            return MOBI_MALLOC_FAILED;
+        }
+    }
+    while (count--) {
+        record = mobi_next_record(m, record);
+        ret = mobi_indx_reader_add_record(indx_reader, record);
+        if (ret != MOBI_SUCCESS) {
+            mobi_free_indx_reader(indx_reader);
+            return ret;
+        }
+    }
+    size_t entries_count = 0;
+    if (indx_reader->records_count) {
+        const MOBIIndxRecord *last = &indx_reader->records[indx_reader->records_count - 1];
+        entries_count = last->first_entry + last->entries_count;
+    }
+    if (entries_count != indx_reader->total_entries_count) {
+        debug_print("Entries count %zu != total entries count %zu\n", entries_count, indx_reader->total_entries_count);
+        mobi_free_indx_reader(indx_reader);
+        return MOBI_DATA_CORRUPT;
+    }
+    /* copy pointer to first cncx record if present */
+    if (indx_reader->cncx_records_count) {
+        indx_reader->cncx_record = mobi_next_record(m, record);
+    }
+    ret = mobi_indx_reader_init_ordt_codes(indx_reader);
+    if (ret != MOBI_SUCCESS) {
+        mobi_free_indx_reader(indx_reader);
+        return ret;
+    }
+    *reader = indx_reader;
+    return MOBI_SUCCESS;
+}
+
+/**
+ @brief Get position of index entry in record data
+ 
+ @param[in,out] buf MOBIBuffer structure, will be set to record data
+ @param[in,out] entry_offset Will be set to offset of the entry
+ @param[in,out] entry_length Will be set to length of the entry
+ @param[in] indx_record MOBIIndxRecord structure
+ @param[in] index Index of the entry in the record
+ @return MOBI_RET status code (on success MOBI_SUCCESS)
+ */
+static MOBI_RET mobi_indx_record_locate(MOBIBuffer *buf, size_t *entry_offset, size_t *entry_length, const MOBIIndxRecord *indx_record, const size_t index) {
+    buf->data = indx_record->record->data;
+    buf->maxlen = indx_record->record->size;
+    buf->error = MOBI_SUCCESS;
+    /* offsets follow IDXT magic, last entry ends at IDXT section */
+    mobi_buffer_setpos(buf, indx_record->idxt_offset + 4 + 2 * index);
+    const size_t offset = mobi_buffer_get16(buf);
+    size_t end = indx_record->idxt_offset;
+    if (index + 1 < indx_record->entries_count) {
+        end = mobi_buffer_get16(buf);
+    }
+    if (buf->error != MOBI_SUCCESS || offset > end) {
+        debug_print("Wrong IDXT offset: %zu\n", offset);
+        return MOBI_DATA_CORRUPT;
+    }
+    *entry_offset = offset;
+    *entry_length = end - offset;
+    return MOBI_SUCCESS;
+}
+
+/**
+ @brief Find data record holding index entry
+ 
+ @param[in] reader MOBIIndxReader structure
+ @param[in] number Sequential number of the entry in the whole index
+ @return Data record, NULL if number is out of range
+ */
+static const MOBIIndxRecord * mobi_indx_reader_record(const MOBIIndxReader *reader, const size_t number) {
+    if (number >= reader->total_entries_count) {
+        return NULL;
+    }
+    size_t low = 0;
+    size_t high = reader->records_count;
+    while (high - low > 1) {
+        const size_t mid = low + (high - low) / 2;
+        if (reader->records[mid].first_entry <= number) {
+            low = mid;
+        } else {
+            high = mid;
+        }
+    }
+    return &reader->records[low];
+}
+
+/**
+ @brief Decode label of index entry in data record
+ 
+ @param[in] reader MOBIIndxReader structure
+ @param[in,out] label Output buffer (INDX_LABEL_SIZEMAX + 1 bytes)
+ @param[in] indx_record MOBIIndxRecord structure
+ @param[in] index Index of the entry in the record
+ @return MOBI_RET status code (on success MOBI_SUCCESS)
+ */
+static MOBI_RET mobi_indx_record_label(const MOBIIndxReader *reader, char *label, const MOBIIndxRecord *indx_record, const size_t index) {
+    MOBIBuffer buf;
+    size_t entry_offset;
+    size_t entry_length;
+    MOBI_RET ret = mobi_indx_record_locate(&buf, &entry_offset, &entry_length, indx_record, index);
+    if (ret != MOBI_SUCCESS) {
+        return ret;
+    }
+    size_t label_length;
+    return mobi_parse_index_label(label, &label_length, &buf, entry_offset, entry_length, reader->ordt, reader->ligt_entries_count);
+}
+
+/**
+ @brief Get label of index entry opened with mobi_open_index()
+ 
+ Only the label is decoded, no memory is allocated.
+ 
+ @param[in] reader MOBIIndxReader structure
+ @param[in,out] label Output buffer (INDX_LABEL_SIZEMAX + 1 bytes)
+ @param[in] number Sequential number of the entry
+ @return MOBI_RET status code (on success MOBI_SUCCESS)
+ */
+MOBI_RET mobi_get_index_label(const MOBIIndxReader *reader, char *label, const size_t number) {
+    if (reader == NULL || label == NULL) {
+        return MOBI_INIT_FAILED;
+    }
+    const MOBIIndxRecord *indx_record = mobi_indx_reader_record(reader, number);
+    if (indx_record == NULL) {
+        debug_print("Entry number beyond array: %zu\n", number);
+        return MOBI_PARAM_ERR;
+    }
+    return mobi_indx_record_label(reader, label, indx_record, number - indx_record->first_entry);
+}
+
+/**
+ @brief Decode index entry of index opened with mobi_open_index()
+ 
+ Entry data must be freed with mobi_free_index_entry().
+ Entry label, tags and tag values are allocated as three memory blocks.
+ 
+ @param[in] reader MOBIIndxReader structure
+ @param[in,out] entry MOBIIndexEntry structure to be filled with decoded data
+ @param[in] number Sequential number of the entry
+ @return MOBI_RET status code (on success MOBI_SUCCESS)
+ */
+MOBI_RET mobi_get_index_entry(const MOBIIndxReader *reader, MOBIIndexEntry *entry, const size_t number) {
+    if (reader == NULL || entry == NULL) {
+        return MOBI_INIT_FAILED;
+    }
+    const MOBIIndxRecord *indx_record = mobi_indx_reader_record(reader, number);
+    if (indx_record == NULL) {
+        debug_print("Entry number beyond array: %zu\n", number);
+        return MOBI_PARAM_ERR;
+    }
+    MOBIBuffer buf;
+    size_t entry_offset;
+    size_t entry_length;
+    MOBI_RET ret = mobi_indx_record_locate(&buf, &entry_offset, &entry_length, indx_record, number - indx_record->first_entry);
+    if (ret != MOBI_SUCCESS) {
+        return ret;
+    }
+    MOBIIndxPool pool;
+    memset(&pool, 0, sizeof(pool));
+    ret = mobi_decode_index_entry(entry, &pool, &buf, entry_offset, entry_length, reader->tagx, reader->ordt, reader->ligt_entries_count);
+    if (ret != MOBI_SUCCESS) {
+        entry->tags_count = 0;
+        mobi_free_indx_pool(&pool);
+        return ret;
+    }
+    mobi_indx_pool_link(entry, 1, &pool);
+    /* entry takes ownership of pool data, tag values block is owned by the first tag with values */
+    if (entry->tags == NULL) {
+        free(pool.tags);
+    }
+    if (pool.tagvalues_count == 0) {
+        free(pool.tagvalues);
+    }
+    free(pool.ptagx);
+    return MOBI_SUCCESS;
+}
+
+/**
+ @brief Decode next character of UTF-8 label
+ 
+ Bytes of invalid sequence are returned one by one.
+ 
+ @param[in,out] label Pointer to label, moved past returned character
+ @return Code point
+ */
+uint32_t mobi_indx_utf8_next(const unsigned char **label) {
+    const unsigned char *s = *label;
+    uint32_t c = *s++;
+    if (c >= 0xc0) {
+        const size_t bytes = (c >= 0xf0) ? 3 : (c >= 0xe0) ? 2 : 1;
+        uint32_t codepoint = c & (0x3f >> bytes);
+        size_t i = 0;
+        while (i < bytes && (s[i] & 0xc0) == 0x80) {
+            codepoint = (codepoint << 6) | (s[i++] & 0x3f);
+        }
+        if (i == bytes) {
+            c = codepoint;
+            s += bytes;
+        }
+    }
+    *label = s;
+    return c;
+}
+
+/**
+ @brief Get next character of index label in collation order of dictionary indices
+ 
+ ASCII letters are folded to lower case, Latin-1 letters to their base letters.
+ Other ASCII and Latin-1 characters than letters, digits and space are skipped.
+ 
+ @param[in,out] label Pointer to label, moved past returned character
+ @param[in] is_utf8 True if label is UTF-8 encoded, otherwise bytes are treated as CP1252 characters
+ @return Collation value of character, zero at the end of label
+ */
+static uint32_t mobi_indx_collation_char(const unsigned char **label, const bool is_utf8) {
+    static const unsigned char latin1_fold[64] = {
+        'a', 'a', 'a', 'a', 'a', 'a', 'a', 'c', 'e', 'e', 'e', 'e', 'i', 'i', 'i', 'i',
+        'd', 'n', 'o', 'o', 'o', 'o', 'o', 0, 'o', 'u', 'u', 'u', 'u', 'y', 0, 's',
+        'a', 'a', 'a', 'a', 'a', 'a', 'a', 'c', 'e', 'e', 'e', 'e', 'i', 'i', 'i', 'i',
+        'd', 'n', 'o', 'o', 'o', 'o', 'o', 0, 'o', 'u', 'u', 'u', 'u', 'y', 0, 'y'
+    };
+    const unsigned char *s = *label;
+    uint32_t c = 0;
+    while (*s) {
+        c = is_utf8 ? mobi_indx_utf8_next(&s) : *s++;
+        if (c >= 'A' && c <= 'Z') {
+            c += 'a' - 'A';
+            break;
+        }
+        if ((c >= 'a' && c <= 'z') || (c >= '0' && c <= '9') || c == ' ') {
+            break;
+        }
+        if (c >= 0xc0 && c <= 0xff) {
+            if (latin1_fold[c - 0xc0]) {
+                c = latin1_fold[c - 0xc0];
+            }
+            break;
+        }
+        if (c >= 0x80 && (c < 0xa0 || c > 0xff)) {
+            break;
+        }
+        /* skip punctuation and symbols */
+        c = 0;
+    }
+    *label = s;
+    return c;
+}
+
+/**
+ @brief Compare index labels in collation order of dictionary indices
+ 
+ Order is case and accent insensitive and ignores punctuation,
+ like in orth indices of dictionaries.
+ 
+ @param[in] label1 First label
+ @param[in] label2 Second label
+ @param[in] is_utf8 True if labels are UTF-8 encoded, otherwise they are CP1252 encoded
+ @return Negative, zero or positive value if first label sorts before, equal or after the second
+ */
+int mobi_indx_label_collate(const char *label1, const char *label2, const bool is_utf8) {
+    const unsigned char *s1 = (const unsigned char *) label1;
+    const unsigned char *s2 = (const unsigned char *) label2;
+    while (true) {
+        const uint32_t c1 = mobi_indx_collation_char(&s1, is_utf8);
+        const uint32_t c2 = mobi_indx_collation_char(&s2, is_utf8);
+        if (c1 != c2) {
+            return (c1 < c2) ? -1 : 1;
+        }
+        if (c1 == 0) {
+            return 0;
+        }
+    }
+}
+
+/**
+ @brief Encode UTF-16 code unit with ORDT table of the index
+ 
+ Unit is encoded with the lowest ORDT2 offset holding it.
+ Units missing from the table are encoded as themselves, like in mobi_ordt_lookup().
+ 
+ @param[in] reader MOBIIndxReader structure with ORDT codes
+ @param[in] unit UTF-16 code unit
+ @return ORDT code
+ */
+static uint32_t mobi_indx_ordt_encode(const MOBIIndxReader *reader, const uint16_t unit) {
+    const uint32_t key = (uint32_t) unit << 16;
+    size_t low = 0;
+    const size_t count = reader->ordt->offsets_count < UINT16_MAX ? reader->ordt->offsets_count : UINT16_MAX;
+    size_t high = count;
+    while (low < high) {
+        const size_t mid = low + (high - low) / 2;
+        if (reader->ordt_codes[mid] < key) {
+            low = mid + 1;
+        } else {
+            high = mid;
+        }
+    }
+    if (low < count && (reader->ordt_codes[low] & 0xffff0000) == key) {
+        return reader->ordt_codes[low] & 0xffff;
+    }
+    return unit;
+}
+
+/**
+ @brief Encode UTF-8 label with ORDT table of the index
+ 
+ Characters outside BMP are encoded as UTF-16 surrogate pairs.
+ 
+ @param[in,out] codes Output buffer (INDX_LABEL_SIZEMAX entries)
+ @param[in] reader MOBIIndxReader structure with ORDT codes
+ @param[in] label UTF-8 label
+ @return Number of codes
+ */
+static size_t mobi_indx_ordt_encode_label(uint32_t *codes, const MOBIIndxReader *reader, const char *label) {
+    const unsigned char *s = (const unsigned char *) label;
+    size_t count = 0;
+    while (*s && count + 1 < INDX_LABEL_SIZEMAX) {
+        const uint32_t codepoint = mobi_indx_utf8_next(&s);
+        if (codepoint > 0xffff) {
+            codes[count++] = mobi_indx_ordt_encode(reader, (uint16_t) (0xd7c0 + (codepoint >> 10)));
+            codes[count++] = mobi_indx_ordt_encode(reader, (uint16_t) (0xdc00 | (codepoint & 0x3ff)));
+        } else {
+            codes[count++] = mobi_indx_ordt_encode(reader, (uint16_t) codepoint);
+        }
+    }
+    return count;
+}
+
+/**
+ @brief Compare decoded labels of index opened with mobi_open_index() in order of index entries
+ 
+ Labels of indices with ORDT2 table are compared in order of their ORDT codes,
+ labels of other indices in collation order of mobi_indx_label_collate().
+ 
+ @param[in] reader MOBIIndxReader structure
+ @param[in] label1 First label
+ @param[in] label2 Second label
+ @return Negative, zero or positive value if first label sorts before, equal or after the second
+ */
+int mobi_indx_reader_collate(const MOBIIndxReader *reader, const char *label1, const char *label2) {
+    if (reader->ordt_codes == NULL) {
+        return mobi_indx_label_collate(label1, label2, mobi_indx_reader_is_utf8(reader));
+    }
+    uint32_t codes1[INDX_LABEL_SIZEMAX];
+    uint32_t codes2[INDX_LABEL_SIZEMAX];
+    const size_t count1 = mobi_indx_ordt_encode_label(codes1, reader, label1);
+    const size_t count2 = mobi_indx_ordt_encode_label(codes2, reader, label2);
+    for (size_t i = 0; i < count1 && i < count2; i++) {
+        if (codes1[i] != codes2[i]) {
+            return (codes1[i] < codes2[i]) ? -1 : 1;
+        }
+    }
+    return (count1 > count2) - (count1 < count2);
+}
+
+/**
+ @brief Check if decoded labels of index opened with mobi_open_index() are UTF-8 encoded
+ 
+ Labels decoded with ORDT tables are converted to UTF-8,
+ other labels are in index encoding.
+ 
+ @param[in] reader MOBIIndxReader structure
+ @return True if labels are UTF-8 encoded, false if they are CP1252 encoded
+ */
+bool mobi_indx_reader_is_utf8(const MOBIIndxReader *reader) {
+    return reader->ordt->ordt2 || reader->encoding == MOBI_UTF8;
+}
+
+/**
+ @brief Find range of index entries with labels equal to given label in collation order
+ 
+ Entries of orth indices are sorted by label in order of mobi_indx_reader_collate(),
+ so binary search over labels of last entries in each record finds the record,
+ then binary search over IDXT offsets of the record finds the first entry.
+ Only labels visited by the search are decoded.
+ Indices sorted in other order, like inflection indices, may not be searched.
+ 
+ @param[in] reader MOBIIndxReader structure
+ @param[in,out] first Will be set to sequential number of the first entry in the range
+ @param[in,out] count Will be set to number of entries in the range, 0 if label is not found
+ @param[in] label Label, in encoding of decoded index labels
+ @return MOBI_RET status code (on success MOBI_SUCCESS)
+ */
+MOBI_RET mobi_find_index_range(const MOBIIndxReader *reader, size_t *first, size_t *count, const char *label) {
+    if (reader == NULL || first == NULL || count == NULL || label == NULL) {
+        return MOBI_INIT_FAILED;
+    }
+    *first = 0;
+    *count = 0;
+    char text[INDX_LABEL_SIZEMAX + 1];
+    /* first record with last label not sorting before searched label */
+    size_t low = 0;
+    size_t high = reader->records_count;
+    while (low < high) {
+        const size_t mid = low + (high - low) / 2;
+        const MOBIIndxRecord *indx_record = &reader->records[mid];
+        MOBI_RET ret = mobi_indx_record_label(reader, text, indx_record, indx_record->entries_count - 1);
+        if (ret != MOBI_SUCCESS) {
+            return ret;
+        }
+        if (mobi_indx_reader_collate(reader, text, label) < 0) {
+            low = mid + 1;
+        } else {
+            high = mid;
+        }
+    }
+    if (low == reader->records_count) {
+        return MOBI_SUCCESS;
+    }
+    const MOBIIndxRecord *indx_record = &reader->records[low];
+    /* first entry in the record with label not sorting before searched label */
+    low = 0;
+    high = indx_record->entries_count - 1;
+    while (low < high) {
+        const size_t mid = low + (high - low) / 2;
+        MOBI_RET ret = mobi_indx_record_label(reader, text, indx_record, mid);
+        if (ret != MOBI_SUCCESS) {
+            return ret;
+        }
+        if (mobi_indx_reader_collate(reader, text, label) < 0) {
+            low = mid + 1;
+        } else {
+            high = mid;
+        }
+    }
+    *first = indx_record->first_entry + low;
+    /* count entries equal in collation order */
+    for (size_t i = *first; i < reader->total_entries_count; i++) {
+        MOBI_RET ret = mobi_get_index_label(reader, text, i);
+        if (ret != MOBI_SUCCESS) {
+            return ret;
+        }
+        if (mobi_indx_reader_collate(reader, text, label) != 0) {
+            break;
+        }
+        (*count)++;
+    }
+    return MOBI_SUCCESS;
+}
+
+/**
+ @brief Find index entry with given label
+ 
+ Range of entries equal in collation order (eg. differing only in case)
+ is found with mobi_find_index_range() and checked for exact match.
+ 
+ @param[in] reader MOBIIndxReader structure
+ @param[in,out] number Will be set to sequential number of the first entry with the label, MOBI_NOTSET if not found
+ @param[in] label Label, in encoding of decoded index labels
+ @return MOBI_RET status code (on success MOBI_SUCCESS)
+ */
+MOBI_RET mobi_find_index_entry(const MOBIIndxReader *reader, size_t *number, const char *label) {
+    if (reader == NULL || number == NULL || label == NULL) {
+        return MOBI_INIT_FAILED;
+    }
+    *number = MOBI_NOTSET;
+    size_t first;
+    size_t count;
+    MOBI_RET ret = mobi_find_index_range(reader, &first, &count, label);
+    if (ret != MOBI_SUCCESS) {
+        return ret;
+    }
+    char text[INDX_LABEL_SIZEMAX + 1];
+    for (size_t i = first; i < first + count; i++) {
+        ret = mobi_get_index_label(reader, text, i);
+        if (ret != MOBI_SUCCESS) {
+            return ret;
+        }
+        if (strcmp(text, label) == 0) {
+            *number = i;
+            break;
+        }
+    }
+    return MOBI_SUCCESS;
+}
+
 /**
  @brief Get a value of tag[tagid][tagindex] for given index entry
  
@@ -867,7 +1787,7 @@ bool mobi_indx_has_tag(const MOBIIndx *indx, const size_t tagid) {
 
 /**
  @brief Get compiled index entry string
-
+ 
  Allocates memory for the string. Must be freed by caller.
  
  @param[in] cncx_record MOBIPdbRecord structure with cncx record
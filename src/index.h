@@ -60,6 +60,8 @@
 #define INDX_RECORD_MAXCNT 10000 /* max index entries per record */
 #define INDX_TOTAL_MAXCNT ((size_t) INDX_RECORD_MAXCNT * 0xffff) /* max total index entries */
 #define INDX_NAME_SIZEMAX 0xff
+#define INDX_POOL_INITSIZE 64 /* initial items count of index entries pools */
+#define INDX_THREAD_MINRECORDS 4 /* min data records parsed by single thread */
 
 /**
  @brief Maximum value of tag values in index entry (MOBIIndexTag)
@@ -113,8 +115,78 @@ typedef struct {
     size_t offsets_count; /**< Offsets count */
 } MOBIOrdt;
 
+/**
+ @brief Tag of index entry with its value count read from control bytes (for internal INDX parsing)
+ */
+typedef struct {
+    uint8_t tag; /**< Tag */
+    uint8_t tag_value_count; /**< Number of values per tag from TAGX section */
+    uint32_t value_count; /**< Number of values, MOBI_NOTSET if value bytes are given */
+    uint32_t value_bytes; /**< Number of bytes of values, MOBI_NOTSET if value count is given */
+} MOBIPtagx;
+
+/**
+ @brief Memory pools of index entries (for internal INDX parsing)
+ 
+ Labels, tags and tag values of consecutive entries are appended to the pools,
+ entries are linked to pools data when all of them are decoded.
+ */
+typedef struct {
+    char *labels; /**< Packed zero terminated labels */
+    size_t labels_size; /**< Used size of labels pool */
+    size_t labels_capacity; /**< Allocated size of labels pool */
+    MOBIIndexTag *tags; /**< Tags of entries */
+    size_t tags_count; /**< Number of tags in the pool */
+    size_t tags_capacity; /**< Allocated number of tags */
+    uint32_t *tagvalues; /**< Tag values of entries */
+    size_t tagvalues_count; /**< Number of values in the pool */
+    size_t tagvalues_capacity; /**< Allocated number of values */
+    MOBIPtagx *ptagx; /**< Scratch array for tags of decoded entry */
+    size_t ptagx_capacity; /**< Allocated number of scratch tags */
+} MOBIIndxPool;
+
+/**
+ @brief Data record of index opened with mobi_open_index()
+ */
+typedef struct {
+    const MOBIPdbRecord *record; /**< INDX data record */
+    size_t idxt_offset; /**< Offset of IDXT section in record data */
+    size_t entries_count; /**< Number of index entries in the record */
+    size_t first_entry; /**< Sequential number of the first entry of the record in the whole index */
+} MOBIIndxRecord;
+
+/**
+ @brief Index opened for lazy access
+ 
+ Only INDX headers with TAGX, ORDT and IDXT sections are parsed when index is opened.
+ Entries are decoded from records data on demand, records must stay loaded while index is used.
+ */
+typedef struct {
+    size_t type; /**< Index type: 0 - normal, 2 - inflection */
+    MOBIEncoding encoding; /**< Index encoding */
+    size_t total_entries_count; /**< Total index entries count */
+    size_t ligt_entries_count; /**< LIGT index entries count */
+    size_t cncx_records_count; /**< Number of compiled NCX records */
+    const MOBIPdbRecord *cncx_record; /**< Link to CNCX record */
+    MOBITagx *tagx; /**< Parsed TAGX section */
+    MOBIOrdt *ordt; /**< Parsed ORDT sections */
+    uint32_t *ordt_codes; /**< Sorted ORDT2 values in upper 16 bits with their offsets in lower 16 bits, NULL without ORDT2 table */
+    MOBIIndxRecord *records; /**< Data records with at least one entry */
+    size_t records_count; /**< Number of data records */
+} MOBIIndxReader;
+
 MOBI_RET mobi_parse_index(const MOBIData *m, MOBIIndx *indx, const size_t indx_record_number);
-MOBI_RET mobi_parse_indx(const MOBIPdbRecord *indx_record, MOBIIndx *indx, MOBITagx *tagx, MOBIOrdt *ordt);
+MOBI_RET mobi_open_index(const MOBIData *m, MOBIIndxReader **reader, const size_t indx_record_number);
+MOBI_RET mobi_get_index_label(const MOBIIndxReader *reader, char *label, const size_t number);
+MOBI_RET mobi_get_index_entry(const MOBIIndxReader *reader, MOBIIndexEntry *entry, const size_t number);
+MOBI_RET mobi_find_index_entry(const MOBIIndxReader *reader, size_t *number, const char *label);
+MOBI_RET mobi_find_index_range(const MOBIIndxReader *reader, size_t *first, size_t *count, const char *label);
+bool mobi_indx_reader_is_utf8(const MOBIIndxReader *reader);
+uint32_t mobi_indx_utf8_next(const unsigned char **label);
+int mobi_indx_label_collate(const char *label1, const char *label2, const bool is_utf8);
+int mobi_indx_reader_collate(const MOBIIndxReader *reader, const char *label1, const char *label2);
+MOBI_RET mobi_parse_indx(const MOBIPdbRecord *indx_record, MOBIIndx *indx, MOBITagx *tagx, MOBIOrdt *ordt, MOBIIndxPool *pool);
+void mobi_indx_pool_attach(MOBIIndx *indx, MOBIIndxPool *pool);
 MOBI_RET mobi_get_indxentry_tagvalue(uint32_t *tagvalue, const MOBIIndexEntry *entry, const unsigned tag_arr[]);
 size_t mobi_get_indxentry_tagarray(uint32_t **tagarr, const MOBIIndexEntry *entry, const size_t tagid);
 bool mobi_indx_has_tag(const MOBIIndx *indx, const size_t tagid);
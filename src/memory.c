@@ -10,9 +10,16 @@
  */
 
 #include <stdlib.h>
+#include <string.h>
 #include "memory.h"
 #include "debug.h"
 #include "util.h"
+#ifdef HAVE_SYS_MMAN_H
+#include <sys/mman.h>
+#endif
+#ifdef HAVE_PREAD
+#include <unistd.h>
+#endif
 
 /**
  @brief Initializer for MOBIData structure
@@ -35,10 +42,228 @@ MOBIData * mobi_init(void) {
     m->eh = NULL;
     m->rec = NULL;
     m->next = NULL;
-    m->internals = NULL;
+    m->internals = mobi_init_internals();
+    if (m->internals == NULL) {
+        free(m);
+        return NULL;
+    }
     return m;
 }
 
+/**
+ @brief Initializer for MOBIInternals structure
+ 
+ It allocates memory for structure.
+ Memory should be freed with mobi_free_internals().
+ 
+ @return MOBIInternals on success, NULL otherwise
+ */
+MOBIInternals * mobi_init_internals(void) {
+    MOBIInternals *internals = calloc(1, sizeof(MOBIInternals));
+    if (internals == NULL) {
+        debug_print("%s", "Memory allocation for internals failed\n");
+        return NULL;
+    }
+    internals->drm = NULL;
+    internals->storage_type = MOBI_STORAGE_HEAP;
+    internals->storage = NULL;
+    internals->storage_size = 0;
+    internals->fd = -1;
+    internals->load_flags = MOBI_LOAD_DEFAULT;
+    internals->threads = 1;
+    internals->rectable = NULL;
+    internals->text_offsets = NULL;
+    internals->text_offsets_count = 0;
+    internals->text_offsets_index = 0;
+    internals->cache = NULL;
+    internals->cache_id = 0;
+    internals->huffcdic[0] = NULL;
+    internals->huffcdic[1] = NULL;
+    internals->sidecar_path = NULL;
+    internals->compression_type = MOBI_COMPRESSION_PALMDOC;
+    internals->compression_level = 0;
+#ifdef USE_THREADS
+    /* lock is recursive, functions holding it may look up and read records */
+    pthread_mutexattr_t attr;
+    if (pthread_mutexattr_init(&attr) != 0) {
+        debug_print("%s", "Initialization of internals lock failed\n");
+        free(internals);
+        return NULL;
+    }
+    int ret = pthread_mutexattr_settype(&attr, PTHREAD_MUTEX_RECURSIVE);
+    if (ret == 0) {
+        ret = pthread_mutex_init(&internals->lock, &attr);
+    }
+    pthread_mutexattr_destroy(&attr);
+    if (ret != 0) {
+        debug_print("%s", "Initialization of internals lock failed\n");
+        free(internals);
+        return NULL;
+    }
+#endif
+    return internals;
+}
+
+/**
+ @brief Lock data built on demand, shared by all users of the document
+ 
+ Lock is recursive, it may be taken again by the thread that holds it.
+ Lock is a no-op if library is built without threads support.
+ 
+ @param[in] m MOBIData structure
+ */
+void mobi_lock_internals(const MOBIData *m) {
+#ifdef USE_THREADS
+    if (m && m->internals) {
+        MOBIInternals *internals = m->internals;
+        pthread_mutex_lock(&internals->lock);
+    }
+#else
+    (void) m;
+#endif
+}
+
+/**
+ @brief Unlock data locked with mobi_lock_internals()
+ 
+ @param[in] m MOBIData structure
+ */
+void mobi_unlock_internals(const MOBIData *m) {
+#ifdef USE_THREADS
+    if (m && m->internals) {
+        MOBIInternals *internals = m->internals;
+        pthread_mutex_unlock(&internals->lock);
+    }
+#else
+    (void) m;
+#endif
+}
+
+/**
+ @brief Free index of palm database records
+ 
+ It must be called whenever records list is modified.
+ Index will be rebuilt on next lookup.
+ Offsets of text records and parsed huff/cdic data are also dropped.
+ 
+ @param[in] m MOBIData structure
+ */
+void mobi_free_rectable(const MOBIData *m) {
+    if (m == NULL || m->internals == NULL) {
+        return;
+    }
+    mobi_lock_internals(m);
+    MOBIInternals *internals = m->internals;
+    free(internals->text_offsets);
+    internals->text_offsets = NULL;
+    internals->text_offsets_count = 0;
+    for (size_t i = 0; i < 2; i++) {
+        mobi_free_huffcdic(internals->huffcdic[i]);
+        internals->huffcdic[i] = NULL;
+    }
+    if (internals->rectable) {
+        free(internals->rectable->records);
+        free(internals->rectable->uid_table);
+        free(internals->rectable);
+        internals->rectable = NULL;
+    }
+    mobi_unlock_internals(m);
+}
+
+/**
+ @brief Release memory area and file backing records data
+ 
+ @param[in,out] internals MOBIInternals structure
+ */
+void mobi_free_storage(MOBIInternals *internals) {
+    if (internals == NULL) {
+        return;
+    }
+#ifdef HAVE_PREAD
+    if (internals->fd != -1) {
+        close(internals->fd);
+        internals->fd = -1;
+    }
+#endif
+    if (internals->storage == NULL) {
+        return;
+    }
+#ifdef HAVE_SYS_MMAN_H
+    if (internals->storage_type == MOBI_STORAGE_MMAP) {
+        munmap(internals->storage, internals->storage_size);
+    }
+#endif
+    if (internals->storage_type == MOBI_STORAGE_ARENA) {
+        free(internals->storage);
+    }
+    internals->storage = NULL;
+    internals->storage_size = 0;
+    internals->storage_type = MOBI_STORAGE_HEAP;
+}
+
+/**
+ @brief Check whether record data points into memory area not owned by the record
+ 
+ Such data must not be freed, reallocated or modified in place.
+ 
+ @param[in] m MOBIData structure
+ @param[in] record MOBIPdbRecord structure
+ @return True if record data is borrowed, false otherwise
+ */
+bool mobi_record_is_borrowed(const MOBIData *m, const MOBIPdbRecord *record) {
+    if (m == NULL || record == NULL || record->data == NULL) {
+        return false;
+    }
+    const MOBIInternals *internals = m->internals;
+    if (internals == NULL || internals->storage == NULL) {
+        return false;
+    }
+    return record->data >= internals->storage && record->data <= internals->storage + internals->storage_size;
+}
+
+/**
+ @brief Make record data safe to be modified in place
+ 
+ Data borrowed from read-only storage is replaced with its private copy.
+ 
+ @param[in] m MOBIData structure
+ @param[in,out] record MOBIPdbRecord structure
+ @return MOBI_RET status code (on success MOBI_SUCCESS)
+ */
+MOBI_RET mobi_record_make_writable(const MOBIData *m, MOBIPdbRecord *record) {
+    if (!mobi_record_is_borrowed(m, record)) {
+        return MOBI_SUCCESS;
+    }
+    const MOBIInternals *internals = m->internals;
+    if (internals->storage_type == MOBI_STORAGE_ARENA) {
+        return MOBI_SUCCESS;
+    }
+    unsigned char *data = malloc(record->size);
+    if (data == NULL) {
+        debug_print("%s", "Memory allocation for pdb record data failed\n");
+        return MOBI_MALLOC_FAILED;
+    }
+    memcpy(data, record->data, record->size);
+    record->data = data;
+    return MOBI_SUCCESS;
+}
+
+/**
+ @brief Free record data, unless it is borrowed
+ 
+ @param[in] m MOBIData structure
+ @param[in,out] record MOBIPdbRecord structure
+ */
+void mobi_free_record_data(const MOBIData *m, MOBIPdbRecord *record) {
+    if (record == NULL) {
+        return;
+    }
+    if (!mobi_record_is_borrowed(m, record)) {
+        free(record->data);
+    }
+    record->data = NULL;
+}
+
 /**
  @brief Free MOBIMobiHeader structure
  
@@ -117,7 +342,8 @@ void mobi_free_mh(MOBIMobiHeader *mh) {
 /**
  @brief Free all MOBIPdbRecord structures and its respective data attached to MOBIData structure
  
- Each MOBIPdbRecord structure holds metadata and data for each pdb record
+ Each MOBIPdbRecord structure holds metadata and data for each pdb record.
+ Memory area backing records data (eg. records arena or file mapping) is released at once.
  
  @param[in,out] m MOBIData structure
  */
@@ -127,11 +353,13 @@ void mobi_free_rec(MOBIData *m) {
     while (curr != NULL) {
         tmp = curr;
         curr = curr->next;
-        free(tmp->data);
+        mobi_free_record_data(m, tmp);
         free(tmp);
         tmp = NULL;
     }
     m->rec = NULL;
+    mobi_free_rectable(m);
+    mobi_free_storage(m->internals);
 }
 
 /**
@@ -219,6 +447,9 @@ void mobi_free_huffcdic(MOBIHuffCdic *huffcdic) {
     }
     free(huffcdic->symbol_offsets);
     free(huffcdic->symbols);
+    free(huffcdic->lookup_table);
+    free(huffcdic->symbol_table);
+    free(huffcdic->symbol_data);
     free(huffcdic);
     huffcdic = NULL;
 }
@@ -296,23 +527,62 @@ MOBIIndx * mobi_init_indx(void) {
  @param[in] indx MOBIIndx structure that holds indx->entries
  */
 void mobi_free_index_entries(MOBIIndx *indx) {
-    if (indx == NULL || indx->entries == NULL) {
+    if (indx == NULL) {
+        return;
+    }
+    /* entries data is stored in shared memory blocks */
+    free(indx->labels);
+    indx->labels = NULL;
+    free(indx->tags);
+    indx->tags = NULL;
+    free(indx->tagvalues);
+    indx->tagvalues = NULL;
+    free(indx->entries);
+    indx->entries = NULL;
+}
+
+/**
+ @brief Free data of single index entry returned by mobi_get_index_entry(), structure itself is not freed
+ 
+ Tag values of all tags are stored in one memory block owned by the first tag with values.
+ 
+ @param[in,out] entry MOBIIndexEntry structure
+ */
+void mobi_free_index_entry(MOBIIndexEntry *entry) {
+    if (entry == NULL) {
         return;
     }
-    size_t i = 0;
-    while (i < indx->entries_count) {
-        free(indx->entries[i].label);
-        if (indx->entries[i].tags != NULL) {
-            size_t j = 0;
-            while (j < indx->entries[i].tags_count) {
-                free(indx->entries[i].tags[j++].tagvalues);
+    free(entry->label);
+    entry->label = NULL;
+    if (entry->tags != NULL) {
+        size_t j = 0;
+        while (j < entry->tags_count) {
+            if (entry->tags[j].tagvalues) {
+                free(entry->tags[j].tagvalues);
+                break;
             }
-            free(indx->entries[i].tags);
+            j++;
         }
-        i++;
+        free(entry->tags);
+        entry->tags = NULL;
     }
-    free(indx->entries);
-    indx->entries = NULL;
+    entry->tags_count = 0;
+}
+
+/**
+ @brief Free MOBIIndxPool structure children, structure itself is not freed
+ 
+ @param[in,out] pool MOBIIndxPool structure
+ */
+void mobi_free_indx_pool(MOBIIndxPool *pool) {
+    if (pool == NULL) {
+        return;
+    }
+    free(pool->labels);
+    free(pool->tags);
+    free(pool->tagvalues);
+    free(pool->ptagx);
+    memset(pool, 0, sizeof(MOBIIndxPool));
 }
 
 /**
@@ -361,6 +631,22 @@ void mobi_free_ordt(MOBIOrdt *ordt) {
     ordt = NULL;
 }
 
+/**
+ @brief Free MOBIIndxReader structure and all its children
+ 
+ @param[in] reader MOBIIndxReader structure
+ */
+void mobi_free_indx_reader(MOBIIndxReader *reader) {
+    if (reader == NULL) {
+        return;
+    }
+    mobi_free_tagx(reader->tagx);
+    mobi_free_ordt(reader->ordt);
+    free(reader->ordt_codes);
+    free(reader->records);
+    free(reader);
+}
+
 /**
  @brief Free MOBIPart structure
  
@@ -16,6 +16,65 @@
 #include "compression.h"
 #include "mobi.h"
 
+#ifdef USE_THREADS
+#include <pthread.h>
+#endif
+
+/**
+ @brief Type of storage backing records data
+ */
+typedef enum {
+    MOBI_STORAGE_HEAP = 0, /**< Data of each record allocated separately */
+    MOBI_STORAGE_MMAP, /**< Records data point into read-only file mapping */
+    MOBI_STORAGE_BORROWED, /**< Records data point into read-only memory owned by the caller */
+    MOBI_STORAGE_ARENA, /**< Records data point into single writable memory block owned by the library */
+} MOBIStorageType;
+
+/**
+ @brief Index of palm database records for constant time lookups
+ */
+typedef struct {
+    MOBIPdbRecord **records; /**< Records in sequential order */
+    size_t count; /**< Records count */
+    MOBIPdbRecord **uid_table; /**< Hash table of records keyed by uid, with linear probing */
+    size_t uid_table_bits; /**< Hash table size is 2^uid_table_bits */
+} MOBIRecTable;
+
+/**
+ @brief Internal data, shared by both parts of hybrid file
+ */
+typedef struct {
+    void *drm; /**< DRM data (MOBIDrm), NULL if not set */
+    MOBIStorageType storage_type; /**< Type of storage backing records data */
+    unsigned char *storage; /**< Memory area records data point into, NULL if not used */
+    size_t storage_size; /**< Size of memory area */
+    int fd; /**< Descriptor of the file records data is read from on demand, -1 if not used */
+    unsigned int load_flags; /**< Loading options, bitwise combination of MOBILoadFlags */
+    size_t threads; /**< Maximal number of threads used for processing */
+    MOBIRecTable *rectable; /**< Index of records, NULL if not built or outdated */
+    size_t *text_offsets; /**< Offsets of text records in decompressed text (text record count + 1 entries), NULL if not built or outdated */
+    size_t text_offsets_count; /**< Number of known text_offsets entries, table is extended as text records are decompressed */
+    size_t text_offsets_index; /**< Sequential number of first text record, text_offsets were built for */
+    MOBIRecordCache *cache; /**< Cache of decompressed text records, NULL if not used */
+    uint64_t cache_id; /**< Identity of the document in cache */
+    MOBIHuffCdic *huffcdic[2]; /**< Parsed huff/cdic data of KF7 (or the only) part and of KF8 part of hybrid file, NULL if not loaded or outdated */
+    char *sidecar_path; /**< Path of sidecar file with parsed indices, NULL if not used */
+    uint16_t compression_type; /**< Compression type used to recompress text records on write */
+    int compression_level; /**< Compression level used to recompress text records on write, 0 if not recompressed */
+#ifdef USE_THREADS
+    pthread_mutex_t lock; /**< Recursive lock guarding data built on demand and records read lazily */
+#endif
+} MOBIInternals;
+
+MOBIInternals * mobi_init_internals(void);
+void mobi_free_rectable(const MOBIData *m);
+void mobi_lock_internals(const MOBIData *m);
+void mobi_unlock_internals(const MOBIData *m);
+void mobi_free_storage(MOBIInternals *internals);
+bool mobi_record_is_borrowed(const MOBIData *m, const MOBIPdbRecord *record);
+MOBI_RET mobi_record_make_writable(const MOBIData *m, MOBIPdbRecord *record);
+void mobi_free_record_data(const MOBIData *m, MOBIPdbRecord *record);
+
 void mobi_free_mh(MOBIMobiHeader *mh);
 void mobi_free_rec(MOBIData *m);
 void mobi_free_eh(MOBIData *m);
@@ -29,5 +88,8 @@ void mobi_free_indx(MOBIIndx *indx);
 void mobi_free_tagx(MOBITagx *tagx);
 void mobi_free_ordt(MOBIOrdt *ordt);
 void mobi_free_index_entries(MOBIIndx *indx);
+void mobi_free_index_entry(MOBIIndexEntry *entry);
+void mobi_free_indx_reader(MOBIIndxReader *reader);
+void mobi_free_indx_pool(MOBIIndxPool *pool);
 
 #endif
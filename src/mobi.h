@@ -44,6 +44,12 @@
 #define MOBI_COMPRESSION_PALMDOC 2 /**< Text record compression type: palmdoc */
 #define MOBI_COMPRESSION_HUFFCDIC 17480 /**< Text record compression type: huff/cdic */
 
+#define MOBI_LZ77_LEVEL_FAST 1 /**< Palmdoc or huff/cdic compression level: fastest */
+#define MOBI_LZ77_LEVEL_DEFAULT 6 /**< Palmdoc or huff/cdic compression level: default */
+#define MOBI_LZ77_LEVEL_BEST 9 /**< Palmdoc or huff/cdic compression level: best ratio */
+
+#define MOBI_TITLE_SIZEMAX 1024 /**< Maximal size of document title */
+
 #ifdef __cplusplus
 extern "C"
 {
@@ -218,6 +224,17 @@ extern "C"
         MOBI_UTF16 = 65002, /**< utf-16 encoding */
     } MOBIEncoding;
 
+    /**
+     @brief Document loading options, may be combined with bitwise or
+     */
+    typedef enum {
+        MOBI_LOAD_DEFAULT = 0, /**< Read data of all records while loading */
+        MOBI_LOAD_LAZY = 1, /**< Read records data on first access (mobi_get_record_by_seqnumber(), mobi_get_record_by_uid(), mobi_next_record()) */
+        MOBI_LOAD_COPY = 2, /**< Copy caller's buffer passed to mobi_load_buffer() instead of borrowing it */
+        MOBI_LOAD_ARENA = 4, /**< Read data of all records with single read into one memory block (ignored with MOBI_LOAD_LAZY) */
+        MOBI_LOAD_SKIP_HYBRID = 8, /**< Read only records used by part of hybrid file selected with MOBIData::use_kf8, other records are read on first access */
+    } MOBILoadFlags;
+
     /** @} */
     
     /**
@@ -247,13 +264,17 @@ extern "C"
 
     /**
      @brief Metadata and data of a record. All records form a linked list.
+     
+     If document is loaded with MOBI_LOAD_LAZY or MOBI_LOAD_SKIP_HYBRID flag, data of records in the list may be NULL.
+     Such data is read by mobi_get_record_by_seqnumber(), mobi_get_record_by_uid() and mobi_next_record(),
+     which should be used to walk the list instead of MOBIPdbRecord::next.
      */
     typedef struct MOBIPdbRecord {
         uint32_t offset; /**< Offset of the record data from the start of the database */
         size_t size; /**< Calculated size of the record data */
         uint8_t attributes; /**< Record attributes */
         uint32_t uid; /**< Record unique id, usually sequential even numbers */
-        unsigned char *data; /**< Record data */
+        unsigned char *data; /**< Record data, NULL until first access if document is loaded lazily or its hybrid part is skipped */
         struct MOBIPdbRecord *next; /**< Pointer to the next record or NULL */
     } MOBIPdbRecord;
 
@@ -386,13 +407,67 @@ extern "C"
         MOBIRecord0Header *rh; /**< Record0 header structure or NULL if not loaded */
         MOBIMobiHeader *mh; /**< MOBI header structure or NULL if not loaded */
         MOBIExthHeader *eh; /**< Linked list of EXTH records or NULL if not loaded */
-        MOBIPdbRecord *rec; /**< Linked list of palmdoc database records or NULL if not loaded */
+        MOBIPdbRecord *rec; /**< Linked list of palmdoc database records or NULL if not loaded, records data may be NULL until first access (see MOBIPdbRecord) */
         struct MOBIData *next; /**< Pointer to the other part of hybrid file or NULL if not a hybrid file */
         void *internals;  /**< Used internally*/
     } MOBIData;
+
+    /**
+     @brief Basic document properties read by mobi_probe()
+     
+     For hybrid KF7/KF8 file properties describe KF8 part, as selected by default by mobi_load_filename().
+     */
+    typedef struct {
+        size_t version; /**< File version, 1 for ancient files without MOBI header, MOBI_NOTSET if unknown */
+        bool is_kf8; /**< Flag: file version is 8 or above */
+        bool is_hybrid; /**< Flag: hybrid KF7/KF8 file */
+        bool is_replica; /**< Flag: Print Replica file */
+        bool is_dictionary; /**< Flag: dictionary */
+        uint16_t encryption_type; /**< 0 - none, 1 - old mobipocket, 2 - mobipocket */
+        uint16_t compression_type; /**< 1 - none, 2 - PalmDOC, 17480 - HUFF/CDIC */
+        uint32_t text_length; /**< Uncompressed length of the text */
+        size_t rec_count; /**< Number of palm database records */
+        char title[MOBI_TITLE_SIZEMAX + 1]; /**< Title of the document, utf-8 encoded, zero terminated, possibly truncated */
+        size_t cover_seqnumber; /**< Sequential number of cover record or MOBI_NOTSET if not present */
+        uint32_t cover_offset; /**< Offset of cover record data in file or MOBI_NOTSET if not present */
+    } MOBIProbeInfo;
+
+    /**
+     @brief Range of source data to be read with MOBIIO read_ranges callback
+     */
+    typedef struct {
+        size_t offset; /**< Offset of the range from the start of the source */
+        size_t size; /**< Size of the range */
+        unsigned char *data; /**< Buffer of at least size bytes to be filled with data */
+    } MOBIIORange;
+
+    /**
+     @brief Callbacks for reading document from custom source with mobi_load_io()
+     
+     All callbacks receive context pointer passed to mobi_load_io().
+     */
+    typedef struct {
+        size_t (*read)(void *ctx, unsigned char *buf, const size_t size); /**< Read up to size bytes from current position into buf, return number of bytes read, 0 on end of data or error */
+        int (*seek)(void *ctx, const size_t offset); /**< Set current position to offset from the start of the source, return 0 on success */
+        size_t (*size)(void *ctx); /**< Return total size of the source, 0 on error */
+        int (*read_ranges)(void *ctx, const MOBIIORange *ranges, const size_t count); /**< Optional (may be NULL): fill all ranges with one batched read, return 0 on success */
+    } MOBIIO;
+
+    /**
+     @brief Callback receiving consecutive chunks of decompressed text from mobi_stream_rawml()
+     
+     Data is valid only during the call.
+     Callback returns 0 to continue, other value to stop streaming.
+     */
+    typedef int (*MOBIRawmlCallback)(const unsigned char *data, const size_t size, void *userdata);
+
+    /**
+     @brief Cache of decompressed text records, opaque structure created with mobi_cache_init()
+     */
+    typedef struct MOBIRecordCache MOBIRecordCache;
     
     /** @} */ // end of raw_structs group
-
+ 
     /**
      @defgroup parsed_structs Exported structures for the parsed records metadata and data
      @{
@@ -443,7 +518,26 @@ extern "C"
         MOBIPdbRecord *cncx_record; /**< Link to CNCX record */
         MOBIIndexEntry *entries; /**< Index entries array */
         char *orth_index_name; /**< Orth index name */
+        char *labels; /**< Labels of all entries packed into single memory block, entries labels point into it */
+        MOBIIndexTag *tags; /**< Tags of all entries in single memory block, entries tags point into it */
+        uint32_t *tagvalues; /**< Tag values of all entries in single memory block, tags values point into it */
     } MOBIIndx;
+
+    /**
+     @brief Dictionary opened for lookups with mobi_dict_open(), opaque structure
+     */
+    typedef struct MOBIDict MOBIDict;
+
+    /**
+     @brief Headword entry found with mobi_dict_lookup()
+     */
+    typedef struct {
+        char *label; /**< Headword, UTF-8 encoded, zero terminated */
+        size_t number; /**< Sequential number of the entry in orth index */
+        size_t offset; /**< Offset of the entry in decompressed text */
+        size_t length; /**< Length of the entry in decompressed text, 0 if not given in orth index */
+        bool is_inflection; /**< True if searched word was found as inflected form of the headword */
+    } MOBIDictEntry;
     
     /**
      @brief Reconstructed source file.
@@ -484,6 +578,11 @@ extern "C"
     MOBI_EXPORT const char * mobi_version(void);
     MOBI_EXPORT MOBI_RET mobi_load_file(MOBIData *m, FILE *file);
     MOBI_EXPORT MOBI_RET mobi_load_filename(MOBIData *m, const char *path);
+    MOBI_EXPORT MOBI_RET mobi_load_filename_mmap(MOBIData *m, const char *path);
+    MOBI_EXPORT MOBI_RET mobi_load_buffer(MOBIData *m, const unsigned char *data, const size_t size, const unsigned int flags);
+    MOBI_EXPORT MOBI_RET mobi_load_io(MOBIData *m, const MOBIIO *io, void *ctx);
+    MOBI_EXPORT MOBI_RET mobi_set_loadflags(MOBIData *m, const unsigned int flags);
+    MOBI_EXPORT MOBI_RET mobi_probe(const char *path, MOBIProbeInfo *info);
     
     MOBI_EXPORT MOBIData * mobi_init(void);
     MOBI_EXPORT void mobi_free(MOBIData *m);
@@ -494,7 +593,19 @@ extern "C"
     MOBI_EXPORT MOBI_RET mobi_parse_rawml(MOBIRawml *rawml, const MOBIData *m);
     MOBI_EXPORT MOBI_RET mobi_parse_rawml_opt(MOBIRawml *rawml, const MOBIData *m, bool parse_toc, bool parse_dict, bool reconstruct);
 
+    MOBI_EXPORT MOBI_RET mobi_set_threads(MOBIData *m, const size_t threads);
+    MOBI_EXPORT MOBIRecordCache * mobi_cache_init(const size_t max_size);
+    MOBI_EXPORT void mobi_cache_free(MOBIRecordCache *cache);
+    MOBI_EXPORT MOBI_RET mobi_set_cache(MOBIData *m, MOBIRecordCache *cache, const char *doc_id);
+    MOBI_EXPORT MOBI_RET mobi_set_sidecar(MOBIData *m, const char *path);
     MOBI_EXPORT MOBI_RET mobi_get_rawml(const MOBIData *m, char *text, size_t *len);
+    MOBI_EXPORT MOBI_RET mobi_stream_rawml(const MOBIData *m, MOBIRawmlCallback callback, void *userdata);
+    MOBI_EXPORT MOBI_RET mobi_get_text_range(const MOBIData *m, const size_t offset, char *text, size_t *len);
+    MOBI_EXPORT MOBI_RET mobi_dict_open(MOBIDict **dict, const MOBIData *m);
+    MOBI_EXPORT MOBI_RET mobi_dict_lookup(MOBIDictEntry **entries, size_t *count, const MOBIDict *dict, const char *word);
+    MOBI_EXPORT MOBI_RET mobi_dict_get_text(const MOBIDict *dict, const MOBIDictEntry *entry, char *text, size_t *len);
+    MOBI_EXPORT void mobi_dict_free_entries(MOBIDictEntry *entries, const size_t count);
+    MOBI_EXPORT void mobi_dict_free(MOBIDict *dict);
     MOBI_EXPORT MOBI_RET mobi_dump_rawml(const MOBIData *m, FILE *file);
     MOBI_EXPORT MOBI_RET mobi_decode_font_resource(unsigned char **decoded_font, size_t *decoded_size, MOBIPart *part);
     MOBI_EXPORT MOBI_RET mobi_decode_audio_resource(unsigned char **decoded_resource, size_t *decoded_size, MOBIPart *part);
@@ -504,6 +615,7 @@ extern "C"
     
     MOBI_EXPORT MOBIPdbRecord * mobi_get_record_by_uid(const MOBIData *m, const size_t uid);
     MOBI_EXPORT MOBIPdbRecord * mobi_get_record_by_seqnumber(const MOBIData *m, const size_t uid);
+    MOBI_EXPORT MOBIPdbRecord * mobi_next_record(const MOBIData *m, const MOBIPdbRecord *record);
     MOBI_EXPORT MOBIPart * mobi_get_flow_by_uid(const MOBIRawml *rawml, const size_t uid);
     MOBI_EXPORT MOBIPart * mobi_get_flow_by_fid(const MOBIRawml *rawml, const char *fid);
     MOBI_EXPORT MOBIPart * mobi_get_resource_by_uid(const MOBIRawml *rawml, const size_t uid);
@@ -614,6 +726,8 @@ extern "C"
     MOBI_EXPORT MOBI_RET mobi_drm_encrypt(MOBIData *m);
 
     MOBI_EXPORT MOBI_RET mobi_write_file(FILE *file, MOBIData *m);
+    MOBI_EXPORT MOBI_RET mobi_set_compression_level(MOBIData *m, const int level);
+    MOBI_EXPORT MOBI_RET mobi_set_compression(MOBIData *m, const uint16_t compression_type, const int level);
     /** @} */ // end of mobi_export group
     
 #ifdef __cplusplus
@@ -22,6 +22,7 @@
 #include "opf.h"
 #include "structure.h"
 #include "index.h"
+#include "sidecar.h"
 #include "debug.h"
 #if defined(__BIONIC__) && !defined(SIZE_MAX)
 #include <limits.h> /* for SIZE_MAX */
@@ -585,7 +586,7 @@ MOBI_RET mobi_reconstruct_resources(const MOBIData *m, MOBIRawml *rawml) {
     while (curr_record != NULL) {
         const MOBIFiletype filetype = mobi_determine_resource_type(curr_record);
         if (filetype == T_UNKNOWN) {
-            curr_record = curr_record->next;
+            curr_record = mobi_next_record(m, curr_record);
             i++;
             continue;
         }
@@ -623,7 +624,7 @@ MOBI_RET mobi_reconstruct_resources(const MOBIData *m, MOBIRawml *rawml) {
             curr_part->type = filetype;
         }
         
-        curr_record = curr_record->next;
+        curr_record = mobi_next_record(m, curr_record);
         
         if (ret != MOBI_SUCCESS) {
             free(curr_part);
@@ -2076,7 +2077,9 @@ MOBI_RET mobi_parse_rawml_opt(MOBIRawml *rawml, const MOBIData *m, bool parse_to
         return ret;
     }
     
-    if (mobi_exists_fdst(m)) {
+    /* FDST and indices stored in sidecar file are not parsed */
+    const size_t sidecar_count = mobi_sidecar_load(rawml, m, parse_toc, parse_dict);
+    if (mobi_exists_fdst(m) && rawml->fdst == NULL) {
         /* Skip parsing if section count less or equal than 1 */
         if (m->mh->fdst_section_count && *m->mh->fdst_section_count > 1) {
             ret = mobi_parse_fdst(m, rawml);
@@ -2097,7 +2100,7 @@ MOBI_RET mobi_parse_rawml_opt(MOBIRawml *rawml, const MOBIData *m, bool parse_to
     }
     const size_t offset = mobi_get_kf8offset(m);
     /* skeleton index */
-    if (mobi_exists_skel_indx(m) && mobi_exists_frag_indx(m)) {
+    if (mobi_exists_skel_indx(m) && mobi_exists_frag_indx(m) && rawml->skel == NULL) {
         const size_t indx_record_number = *m->mh->skeleton_index + offset;
         /* to be freed in mobi_free_rawml */
         MOBIIndx *skel_meta = mobi_init_indx();
@@ -2109,7 +2112,7 @@ MOBI_RET mobi_parse_rawml_opt(MOBIRawml *rawml, const MOBIData *m, bool parse_to
     }
     
     /* fragment index */
-    if (mobi_exists_frag_indx(m)) {
+    if (mobi_exists_frag_indx(m) && rawml->frag == NULL) {
         MOBIIndx *frag_meta = mobi_init_indx();
         const size_t indx_record_number = *m->mh->fragment_index + offset;
         ret = mobi_parse_index(m, frag_meta, indx_record_number);
@@ -2121,7 +2124,7 @@ MOBI_RET mobi_parse_rawml_opt(MOBIRawml *rawml, const MOBIData *m, bool parse_to
     
     if (parse_toc) {
         /* guide index */
-        if (mobi_exists_guide_indx(m)) {
+        if (mobi_exists_guide_indx(m) && rawml->guide == NULL) {
             MOBIIndx *guide_meta = mobi_init_indx();
             const size_t indx_record_number = *m->mh->guide_index + offset;
             ret = mobi_parse_index(m, guide_meta, indx_record_number);
@@ -2132,7 +2135,7 @@ MOBI_RET mobi_parse_rawml_opt(MOBIRawml *rawml, const MOBIData *m, bool parse_to
         }
         
         /* ncx index */
-        if (mobi_exists_ncx(m)) {
+        if (mobi_exists_ncx(m) && rawml->ncx == NULL) {
             MOBIIndx *ncx_meta = mobi_init_indx();
             const size_t indx_record_number = *m->mh->ncx_index + offset;
             ret = mobi_parse_index(m, ncx_meta, indx_record_number);
@@ -2145,17 +2148,19 @@ MOBI_RET mobi_parse_rawml_opt(MOBIRawml *rawml, const MOBIData *m, bool parse_to
     
     if (parse_dict && mobi_is_dictionary(m)) {
         /* orth */
-        MOBIIndx *orth_meta = mobi_init_indx();
-        size_t indx_record_number = *m->mh->orth_index + offset;
-        ret = mobi_parse_index(m, orth_meta, indx_record_number);
-        if (ret != MOBI_SUCCESS) {
-            return ret;
+        if (rawml->orth == NULL) {
+            MOBIIndx *orth_meta = mobi_init_indx();
+            const size_t indx_record_number = *m->mh->orth_index + offset;
+            ret = mobi_parse_index(m, orth_meta, indx_record_number);
+            if (ret != MOBI_SUCCESS) {
+                return ret;
+            }
+            rawml->orth = orth_meta;
         }
-        rawml->orth = orth_meta;
         /* infl */
-        if (mobi_exists_infl(m)) {
+        if (mobi_exists_infl(m) && rawml->infl == NULL) {
             MOBIIndx *infl_meta = mobi_init_indx();
-            indx_record_number = *m->mh->infl_index + offset;
+            const size_t indx_record_number = *m->mh->infl_index + offset;
             ret = mobi_parse_index(m, infl_meta, indx_record_number);
             if (ret != MOBI_SUCCESS) {
                 return ret;
@@ -2164,6 +2169,13 @@ MOBI_RET mobi_parse_rawml_opt(MOBIRawml *rawml, const MOBIData *m, bool parse_to
         }
     }
     
+    if (mobi_sidecar_count(rawml) > sidecar_count) {
+        /* some parts were parsed, (re)write sidecar */
+        if (mobi_sidecar_save(rawml, m) != MOBI_SUCCESS) {
+            debug_print("%s", "Writing sidecar failed\n");
+        }
+    }
+    
     ret = mobi_reconstruct_parts(rawml);
     if (ret != MOBI_SUCCESS) {
         return ret;
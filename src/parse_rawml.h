@@ -38,5 +38,12 @@ typedef enum {
 
 MOBI_RET mobi_get_id_by_posoff(uint32_t *file_number, char *id, const MOBIRawml *rawml, const size_t pos_fid, const size_t pos_off, MOBIAttrType *pref_attr);
 MOBI_RET mobi_find_attrvalue(MOBIResult *result, const unsigned char *data_start, const unsigned char *data_end, const MOBIFiletype type, const char *needle);
+MOBI_RET mobi_reconstruct_resources(const MOBIData *m, MOBIRawml *rawml);
+MOBI_RET mobi_reconstruct_flow(MOBIRawml *rawml, const char *text, const size_t length);
+MOBI_RET mobi_reconstruct_parts(MOBIRawml *rawml);
+MOBI_RET mobi_reconstruct_links(const MOBIRawml *rawml);
+MOBI_RET mobi_iterate_txtparts(MOBIRawml *rawml, MOBI_RET (*cb) (MOBIPart *));
+MOBI_RET mobi_markup_to_utf8(MOBIPart *part);
+MOBI_RET mobi_strip_mobitags(MOBIPart *part);
 
 #endif
@@ -17,6 +17,15 @@
 #include "util.h"
 #include "index.h"
 #include "debug.h"
+#if defined(HAVE_SYS_MMAN_H) || defined(HAVE_PREAD)
+#include <errno.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+#ifdef HAVE_SYS_MMAN_H
+#include <sys/mman.h>
+#endif
 
 /**
  @brief Read palm database header from file into MOBIData structure (MOBIPdbHeader)
@@ -43,10 +52,26 @@ MOBI_RET mobi_load_pdbheader(MOBIData *m, FILE *file) {
         mobi_buffer_free(buf);
         return MOBI_DATA_CORRUPT;
     }
+    const MOBI_RET ret = mobi_parse_pdbheader(m, buf);
+    mobi_buffer_free(buf);
+    return ret;
+}
+
+/**
+ @brief Parse palm database header from buffer into MOBIData structure (MOBIPdbHeader)
+ 
+ @param[in,out] m MOBIData structure to be filled with parsed data
+ @param[in,out] buf MOBIBuffer buffer to read from, offset pointing at the header
+ @return MOBI_RET status code (on success MOBI_SUCCESS)
+ */
+MOBI_RET mobi_parse_pdbheader(MOBIData *m, MOBIBuffer *buf) {
+    if (buf->offset + PALMDB_HEADER_LEN > buf->maxlen) {
+        debug_print("%s", "Palm database header too short\n");
+        return MOBI_DATA_CORRUPT;
+    }
     m->ph = calloc(1, sizeof(MOBIPdbHeader));
     if (m->ph == NULL) {
         debug_print("%s", "Memory allocation for pdb header failed\n");
-        mobi_buffer_free(buf);
         return MOBI_MALLOC_FAILED;
     }
     /* parse header */
@@ -64,7 +89,6 @@ MOBI_RET mobi_load_pdbheader(MOBIData *m, FILE *file) {
     m->ph->uid = mobi_buffer_get32(buf);
     m->ph->next_rec = mobi_buffer_get32(buf);
     m->ph->rec_count = mobi_buffer_get16(buf);
-    mobi_buffer_free(buf);
     return MOBI_SUCCESS;
 }
 
@@ -84,6 +108,34 @@ MOBI_RET mobi_load_reclist(MOBIData *m, FILE *file) {
         debug_print("%s", "File not ready\n");
         return MOBI_FILE_NOT_FOUND;
     }
+    const size_t reclist_size = (size_t) m->ph->rec_count * PALMDB_RECORD_INFO_SIZE;
+    MOBIBuffer *buf = mobi_buffer_init(reclist_size);
+    if (buf == NULL) {
+        debug_print("%s\n", "Memory allocation failed");
+        return MOBI_MALLOC_FAILED;
+    }
+    const size_t len = fread(buf->data, 1, reclist_size, file);
+    if (len != reclist_size) {
+        mobi_buffer_free(buf);
+        return MOBI_DATA_CORRUPT;
+    }
+    const MOBI_RET ret = mobi_parse_reclist(m, buf);
+    mobi_buffer_free(buf);
+    return ret;
+}
+
+/**
+ @brief Parse list of database records from buffer into MOBIData structure (MOBIPdbRecord)
+ 
+ @param[in,out] m MOBIData structure to be filled with parsed data
+ @param[in,out] buf MOBIBuffer buffer to read from, offset pointing at the records list
+ @return MOBI_RET status code (on success MOBI_SUCCESS)
+ */
+MOBI_RET mobi_parse_reclist(MOBIData *m, MOBIBuffer *buf) {
+    if (buf->offset + (size_t) m->ph->rec_count * PALMDB_RECORD_INFO_SIZE > buf->maxlen) {
+        debug_print("%s", "Records list too short\n");
+        return MOBI_DATA_CORRUPT;
+    }
     m->rec = calloc(1, sizeof(MOBIPdbRecord));
     if (m->rec == NULL) {
         debug_print("%s", "Memory allocation for pdb record failed\n");
@@ -91,21 +143,10 @@ MOBI_RET mobi_load_reclist(MOBIData *m, FILE *file) {
     }
     MOBIPdbRecord *curr = m->rec;
     for (int i = 0; i < m->ph->rec_count; i++) {
-        MOBIBuffer *buf = mobi_buffer_init(PALMDB_RECORD_INFO_SIZE);
-        if (buf == NULL) {
-            debug_print("%s\n", "Memory allocation failed");
-            return MOBI_MALLOC_FAILED;
-        }
-        const size_t len = fread(buf->data, 1, PALMDB_RECORD_INFO_SIZE, file);
-        if (len != PALMDB_RECORD_INFO_SIZE) {
-            mobi_buffer_free(buf);
-            return MOBI_DATA_CORRUPT;
-        }
         if (i > 0) {
             curr->next = calloc(1, sizeof(MOBIPdbRecord));
             if (curr->next == NULL) {
                 debug_print("%s", "Memory allocation for pdb record failed\n");
-                mobi_buffer_free(buf);
                 return MOBI_MALLOC_FAILED;
             }
             curr = curr->next;
@@ -116,14 +157,89 @@ MOBI_RET mobi_load_reclist(MOBIData *m, FILE *file) {
         const uint16_t l = mobi_buffer_get16(buf);
         curr->uid =  (uint32_t) h << 16 | l;
         curr->next = NULL;
-        mobi_buffer_free(buf);
+    }
+    return mobi_build_rectable(m);
+}
+
+/**
+ @brief Point records data into memory area holding palm database records
+ 
+ Records sizes are calculated from their offsets and the end of the area.
+ Records data is not copied, it must stay valid as long as records are used.
+ 
+ @param[in,out] m MOBIData structure with loaded records list
+ @param[in] data Memory area holding palm database starting at offset @p start
+ @param[in] start Offset in palm database of the first byte of memory area
+ @param[in] end Offset in palm database of the end of memory area
+ @return MOBI_RET status code (on success MOBI_SUCCESS)
+ */
+static MOBI_RET mobi_slice_rec(MOBIData *m, unsigned char *data, const size_t start, const size_t end) {
+    MOBIPdbRecord *curr = m->rec;
+    while (curr != NULL) {
+        const size_t rec_end = curr->next ? curr->next->offset : end;
+        if (curr->offset < start || curr->offset > rec_end || rec_end > end || (curr->next == NULL && rec_end == curr->offset)) {
+            debug_print("Wrong record %u size (offset: %u, end: %zu)\n", curr->uid, curr->offset, rec_end);
+            return MOBI_DATA_CORRUPT;
+        }
+        curr->size = rec_end - curr->offset;
+        curr->data = data + (curr->offset - start);
+        curr = curr->next;
     }
     return MOBI_SUCCESS;
 }
 
+/**
+ @brief Read data of all records with single read into one memory block
+ 
+ Records data point into the block, which is released at once with mobi_free_rec().
+ 
+ @param[in,out] m MOBIData structure with loaded records list
+ @param[in] file Filedescriptor to read from
+ @return MOBI_RET status code (on success MOBI_SUCCESS)
+ */
+static MOBI_RET mobi_load_rec_arena(MOBIData *m, FILE *file) {
+    MOBIInternals *internals = m->internals;
+    if (fseek(file, 0, SEEK_END) != 0) {
+        return MOBI_DATA_CORRUPT;
+    }
+    const long file_size = ftell(file);
+    const size_t start = m->rec->offset;
+    if (file_size <= 0 || (size_t) file_size <= start) {
+        debug_print("Wrong records offset: %zu\n", start);
+        return MOBI_DATA_CORRUPT;
+    }
+    const size_t end = (size_t) file_size;
+    if (fseek(file, (long) start, SEEK_SET) != 0) {
+        debug_print("Record %i not found\n", m->rec->uid);
+        return MOBI_DATA_CORRUPT;
+    }
+    unsigned char *arena = malloc(end - start);
+    if (arena == NULL) {
+        debug_print("%s", "Memory allocation for records data failed\n");
+        return MOBI_MALLOC_FAILED;
+    }
+    const size_t len = fread(arena, 1, end - start, file);
+    if (len < end - start) {
+        debug_print("%s", "Truncated records data\n");
+        free(arena);
+        return MOBI_DATA_CORRUPT;
+    }
+    internals->storage_type = MOBI_STORAGE_ARENA;
+    internals->storage = arena;
+    internals->storage_size = end - start;
+    const MOBI_RET ret = mobi_slice_rec(m, arena, start, end);
+    if (ret != MOBI_SUCCESS) {
+        mobi_free_rec(m);
+    }
+    return ret;
+}
+
 /**
  @brief Read record data and size from file into MOBIData structure (MOBIPdbRecord)
  
+ If document is loaded lazily, only records sizes are set.
+ Data is read on first access by mobi_load_recdata_lazy().
+ 
  @param[in,out] m MOBIData structure to be filled with read data
  @param[in] file Filedescriptor to read from
  @return MOBI_RET status code (on success MOBI_SUCCESS)
@@ -134,6 +250,11 @@ MOBI_RET mobi_load_rec(MOBIData *m, FILE *file) {
         debug_print("%s", "Mobi structure not initialized\n");
         return MOBI_INIT_FAILED;
     }
+    const MOBIInternals *internals = m->internals;
+    const bool lazy = internals && internals->fd != -1;
+    if (!lazy && internals && (internals->load_flags & MOBI_LOAD_ARENA) && m->rec && internals->storage == NULL) {
+        return mobi_load_rec_arena(m, file);
+    }
     MOBIPdbRecord *curr = m->rec;
     while (curr != NULL) {
         MOBIPdbRecord *next;
@@ -153,6 +274,14 @@ MOBI_RET mobi_load_rec(MOBIData *m, FILE *file) {
         }
 
         curr->size = size;
+        if (lazy) {
+            if (next && next->offset < curr->offset) {
+                debug_print("Wrong record uid %i size\n", curr->uid);
+                return MOBI_DATA_CORRUPT;
+            }
+            curr = next;
+            continue;
+        }
         ret = mobi_load_recdata(curr, file);
         if (ret  != MOBI_SUCCESS) {
             debug_print("Error loading record uid %i data\n", curr->uid);
@@ -190,6 +319,58 @@ MOBI_RET mobi_load_recdata(MOBIPdbRecord *rec, FILE *file) {
     return MOBI_SUCCESS;
 }
 
+/**
+ @brief Read record data on demand from file of lazily loaded document
+ 
+ Does nothing if record data is already present or document is not loaded lazily.
+ Record is filled under internals lock, so the document may be shared by threads.
+ 
+ @param[in] m MOBIData structure with loaded records list
+ @param[in,out] rec MOBIPdbRecord structure to be filled with read data
+ @return MOBI_RET status code (on success MOBI_SUCCESS)
+ */
+MOBI_RET mobi_load_recdata_lazy(const MOBIData *m, MOBIPdbRecord *rec) {
+    if (rec == NULL || rec->size == 0) {
+        return MOBI_SUCCESS;
+    }
+    const MOBIInternals *internals = m->internals;
+    if (internals == NULL || internals->fd == -1) {
+        return MOBI_SUCCESS;
+    }
+#ifdef HAVE_PREAD
+    mobi_lock_internals(m);
+    if (rec->data != NULL) {
+        mobi_unlock_internals(m);
+        return MOBI_SUCCESS;
+    }
+    unsigned char *data = malloc(rec->size);
+    if (data == NULL) {
+        debug_print("%s", "Memory allocation for pdb record data failed\n");
+        mobi_unlock_internals(m);
+        return MOBI_MALLOC_FAILED;
+    }
+    size_t len = 0;
+    while (len < rec->size) {
+        const ssize_t ret = pread(internals->fd, data + len, rec->size - len, (off_t) rec->offset + (off_t) len);
+        if (ret == -1 && errno == EINTR) {
+            continue;
+        }
+        if (ret <= 0) {
+            debug_print("Truncated data in record %i\n", rec->uid);
+            free(data);
+            mobi_unlock_internals(m);
+            return MOBI_DATA_CORRUPT;
+        }
+        len += (size_t) ret;
+    }
+    rec->data = data;
+    mobi_unlock_internals(m);
+    return MOBI_SUCCESS;
+#else
+    return MOBI_DATA_CORRUPT;
+#endif
+}
+
 /**
  @brief Parse EXTH header from Record 0 into MOBIData structure (MOBIExthHeader)
  
@@ -731,7 +912,7 @@ MOBI_RET mobi_parse_huffdic(const MOBIData *m, MOBIHuffCdic *huffcdic) {
         debug_print("%s", "HUFF parsing failed\n");
         return ret;
     }
-    curr = curr->next;
+    curr = mobi_next_record(m, curr);
     /* allocate memory for symbols data in each CDIC record */
     huffcdic->symbols = malloc((huff_rec_count - 1) * sizeof(*huffcdic->symbols));
     if (huffcdic->symbols == NULL) {
@@ -750,13 +931,14 @@ MOBI_RET mobi_parse_huffdic(const MOBIData *m, MOBIHuffCdic *huffcdic) {
             debug_print("%s", "CDIC parsing failed\n");
             return ret;
         }
-        curr = curr->next;
+        curr = mobi_next_record(m, curr);
     }
     if (huffcdic->index_count != huffcdic->index_read) {
         debug_print("CDIC: wrong read index count: %zu, total: %zu\n", huffcdic->index_read, huffcdic->index_count);
         return MOBI_DATA_CORRUPT;
     }
-    return MOBI_SUCCESS;
+    /* expand symbols once for all text records */
+    return mobi_build_huffcdic_tables(huffcdic, mobi_get_textrecord_maxsize(m));
 }
 
 /**
@@ -837,22 +1019,12 @@ MOBI_RET mobi_parse_fdst(const MOBIData *m, MOBIRawml *rawml) {
 }
 
 /**
- @brief Read MOBI document from file into MOBIData structure
+ @brief Check whether palm database header describes supported document
  
- @param[in,out] m MOBIData structure to be filled with read data
- @param[in] file File descriptor to read from
+ @param[in] m MOBIData structure with loaded palm database header
  @return MOBI_RET status code (on success MOBI_SUCCESS)
  */
-MOBI_RET mobi_load_file(MOBIData *m, FILE *file) {
-    MOBI_RET ret;
-    if (m == NULL) {
-        debug_print("%s", "Mobi structure not initialized\n");
-        return MOBI_INIT_FAILED;
-    }
-    ret = mobi_load_pdbheader(m, file);
-    if (ret != MOBI_SUCCESS) {
-        return ret;
-    }
+static MOBI_RET mobi_check_pdbheader(const MOBIData *m) {
     if (strcmp(m->ph->type, "BOOK") != 0 && strcmp(m->ph->type, "TEXt") != 0) {
         debug_print("Unsupported file type: %s\n", m->ph->type);
         return MOBI_FILE_UNSUPPORTED;
@@ -861,15 +1033,54 @@ MOBI_RET mobi_load_file(MOBIData *m, FILE *file) {
         debug_print("%s", "No records found\n");
         return MOBI_DATA_CORRUPT;
     }
-    ret = mobi_load_reclist(m, file);
-    if (ret != MOBI_SUCCESS) {
-        return ret;
+    return MOBI_SUCCESS;
+}
+
+/**
+ @brief Initialize KF8 part of hybrid KF7/KF8 file and parse its Record 0
+ 
+ Parts are swapped if MOBIData::use_kf8 flag is set.
+ 
+ @param[in,out] m MOBIData structure with parsed KF7 Record 0
+ @param[in] boundary_rec_number Sequential number of KF8 boundary record
+ @return MOBI_RET status code (on success MOBI_SUCCESS)
+ */
+static MOBI_RET mobi_parse_kf8_record0(MOBIData *m, const size_t boundary_rec_number) {
+    m->kf8_boundary_offset = (uint32_t) boundary_rec_number;
+    m->next = mobi_init();
+    if (m->next == NULL) {
+        debug_print("%s", "Memory allocation for KF8 part failed\n");
+        return MOBI_MALLOC_FAILED;
     }
-    ret = mobi_load_rec(m, file);
+    /* link pdb header, records data and internals to KF8data structure */
+    mobi_free_internals(m->next);
+    m->next->ph = m->ph;
+    m->next->rec = m->rec;
+    m->next->drm_key = m->drm_key;
+    m->next->internals = m->internals;
+    /* close next loop */
+    m->next->next = m;
+    const MOBI_RET ret = mobi_parse_record0(m->next, boundary_rec_number + 1);
     if (ret != MOBI_SUCCESS) {
         return ret;
     }
-    ret = mobi_parse_record0(m, 0);
+    /* swap to kf8 part if use_kf8 flag is set */
+    if (m->use_kf8) {
+        mobi_swap_mobidata(m);
+    }
+    return MOBI_SUCCESS;
+}
+
+/**
+ @brief Parse Record(s) 0 of document with loaded records into MOBIData structure
+ 
+ For hybrid KF7/KF8 file it also initializes and parses KF8 part.
+ 
+ @param[in,out] m MOBIData structure with loaded records
+ @return MOBI_RET status code (on success MOBI_SUCCESS)
+ */
+static MOBI_RET mobi_parse_headers(MOBIData *m) {
+    MOBI_RET ret = mobi_parse_record0(m, 0);
     if (ret != MOBI_SUCCESS) {
         return ret;
     }
@@ -883,28 +1094,160 @@ MOBI_RET mobi_load_file(MOBIData *m, FILE *file) {
         const size_t boundary_rec_number = mobi_get_kf8boundary_seqnumber(m);
         if (boundary_rec_number != MOBI_NOTSET && boundary_rec_number < UINT32_MAX) {
             /* it is a hybrid KF7/KF8 file */
-            m->kf8_boundary_offset = (uint32_t) boundary_rec_number;
-            m->next = mobi_init();
-            /* link pdb header and records data to KF8data structure */
-            m->next->ph = m->ph;
-            m->next->rec = m->rec;
-            m->next->drm_key = m->drm_key;
-            m->next->internals = m->internals;
-            /* close next loop */
-            m->next->next = m;
-            ret = mobi_parse_record0(m->next, boundary_rec_number + 1);
+            return mobi_parse_kf8_record0(m, boundary_rec_number);
+        }
+    }
+    return MOBI_SUCCESS;
+}
+
+/**
+ @brief Read data of records used by selected part of hybrid file, if requested with MOBI_LOAD_SKIP_HYBRID
+ 
+ For KF8 part records of KF7 text and indices are skipped (resources are shared by both parts),
+ for KF7 part all records starting from KF8 boundary are skipped.
+ Skipped records are read on first access. If the document is not hybrid,
+ all records are read and the file is closed.
+ 
+ @param[in,out] m MOBIData structure with parsed Record(s) 0 of lazily loaded document
+ @return MOBI_RET status code (on success MOBI_SUCCESS)
+ */
+static MOBI_RET mobi_load_hybrid_part(MOBIData *m) {
+    MOBIInternals *internals = m->internals;
+    if (internals == NULL || internals->fd == -1
+        || (internals->load_flags & MOBI_LOAD_LAZY) || !(internals->load_flags & MOBI_LOAD_SKIP_HYBRID)) {
+        return MOBI_SUCCESS;
+    }
+    /* range of skipped records [skip_start, skip_end) */
+    size_t skip_start = 0;
+    size_t skip_end = 0;
+    if (mobi_is_hybrid(m)) {
+        const size_t boundary = m->kf8_boundary_offset;
+        if (m->use_kf8) {
+            /* KF7 headers were swapped into next part */
+            const MOBIMobiHeader *mh_kf7 = m->next->mh;
+            skip_start = 1;
+            skip_end = boundary;
+            if (mh_kf7 && mh_kf7->image_index && *mh_kf7->image_index < boundary) {
+                skip_end = *mh_kf7->image_index;
+            }
+        } else {
+            skip_start = boundary;
+            skip_end = SIZE_MAX;
+        }
+    }
+    size_t seqnumber = 0;
+    MOBIPdbRecord *curr = m->rec;
+    while (curr != NULL) {
+        if (seqnumber < skip_start || seqnumber >= skip_end) {
+            const MOBI_RET ret = mobi_load_recdata_lazy(m, curr);
             if (ret != MOBI_SUCCESS) {
                 return ret;
             }
-            /* swap to kf8 part if use_kf8 flag is set */
-            if (m->use_kf8) {
-                mobi_swap_mobidata(m);
-            }
         }
+        seqnumber++;
+        curr = curr->next;
+    }
+#ifdef HAVE_PREAD
+    if (skip_start == skip_end) {
+        /* all records loaded */
+        close(internals->fd);
+        internals->fd = -1;
     }
+#endif
     return MOBI_SUCCESS;
 }
 
+/**
+ @brief Keep descriptor of the file for reading records on demand, if lazy loading was requested
+ 
+ On failure document is loaded as usual.
+ 
+ @param[in,out] m MOBIData structure
+ @param[in] file File descriptor of loaded document
+ */
+static void mobi_init_lazy(MOBIData *m, FILE *file) {
+#ifdef HAVE_PREAD
+    MOBIInternals *internals = m->internals;
+    if (internals && (internals->load_flags & (MOBI_LOAD_LAZY | MOBI_LOAD_SKIP_HYBRID)) && internals->fd == -1) {
+        internals->fd = dup(fileno(file));
+        if (internals->fd == -1) {
+            debug_print("%s", "Lazy loading not available, reading all records\n");
+        }
+    }
+#else
+    UNUSED(m);
+    UNUSED(file);
+#endif
+}
+
+/**
+ @brief Set options for loading document
+ 
+ Must be called before document is loaded.
+ With MOBI_LOAD_LAZY only palm database header, records list and Record(s) 0 are read
+ by mobi_load_file() and mobi_load_filename(). Other records data is read
+ on first access by mobi_get_record_by_seqnumber(), mobi_get_record_by_uid() or mobi_next_record().
+ The file is kept open until mobi_free() is called.
+ Records are read under internals lock, so lazily loaded document may be read by multiple threads.
+ Option is ignored if pread() is not available.
+ With MOBI_LOAD_ARENA records data is read by mobi_load_file() and mobi_load_filename()
+ with single read into one memory block instead of separate allocation for each record.
+ With MOBI_LOAD_SKIP_HYBRID, records of hybrid KF7/KF8 file used only by the part not selected
+ with MOBIData::use_kf8 flag are not read while loading, but on first access, as with MOBI_LOAD_LAZY.
+ Resources shared by both parts are read. The option is ignored if pread() is not available.
+ MOBI_LOAD_LAZY and MOBI_LOAD_SKIP_HYBRID are ignored by mobi_load_io().
+ 
+ @param[in,out] m MOBIData structure
+ @param[in] flags Bitwise combination of MOBILoadFlags
+ @return MOBI_RET status code (on success MOBI_SUCCESS)
+ */
+MOBI_RET mobi_set_loadflags(MOBIData *m, const unsigned int flags) {
+    if (m == NULL || m->internals == NULL) {
+        debug_print("%s", "Mobi structure not initialized\n");
+        return MOBI_INIT_FAILED;
+    }
+    MOBIInternals *internals = m->internals;
+    internals->load_flags = flags;
+    return MOBI_SUCCESS;
+}
+
+/**
+ @brief Read MOBI document from file into MOBIData structure
+ 
+ @param[in,out] m MOBIData structure to be filled with read data
+ @param[in] file File descriptor to read from
+ @return MOBI_RET status code (on success MOBI_SUCCESS)
+ */
+MOBI_RET mobi_load_file(MOBIData *m, FILE *file) {
+    MOBI_RET ret;
+    if (m == NULL) {
+        debug_print("%s", "Mobi structure not initialized\n");
+        return MOBI_INIT_FAILED;
+    }
+    ret = mobi_load_pdbheader(m, file);
+    if (ret != MOBI_SUCCESS) {
+        return ret;
+    }
+    ret = mobi_check_pdbheader(m);
+    if (ret != MOBI_SUCCESS) {
+        return ret;
+    }
+    ret = mobi_load_reclist(m, file);
+    if (ret != MOBI_SUCCESS) {
+        return ret;
+    }
+    mobi_init_lazy(m, file);
+    ret = mobi_load_rec(m, file);
+    if (ret != MOBI_SUCCESS) {
+        return ret;
+    }
+    ret = mobi_parse_headers(m);
+    if (ret != MOBI_SUCCESS) {
+        return ret;
+    }
+    return mobi_load_hybrid_part(m);
+}
+
 /**
  @brief Read MOBI document from a path into MOBIData structure
  
@@ -922,3 +1265,488 @@ MOBI_RET mobi_load_filename(MOBIData *m, const char *path) {
     fclose(file);
     return ret;
 }
+
+/**
+ @brief Read data of single record from file, setting its size from offset of the next record
+ 
+ @param[in,out] record MOBIPdbRecord structure to be filled with read data
+ @param[in] file File descriptor to read from
+ @return MOBI_RET status code (on success MOBI_SUCCESS)
+ */
+static MOBI_RET mobi_load_single_recdata(MOBIPdbRecord *record, FILE *file) {
+    size_t end;
+    if (record->next) {
+        end = record->next->offset;
+    } else {
+        fseek(file, 0, SEEK_END);
+        const long file_size = ftell(file);
+        end = file_size > 0 ? (size_t) file_size : 0;
+    }
+    if (end <= record->offset) {
+        debug_print("Wrong record %u size (offset: %u, end: %zu)\n", record->uid, record->offset, end);
+        return MOBI_DATA_CORRUPT;
+    }
+    record->size = end - record->offset;
+    return mobi_load_recdata(record, file);
+}
+
+/**
+ @brief Read palm database header, records list and Record 0 from file into MOBIData structure
+ 
+ Data of other records is not read.
+ 
+ @param[in,out] m MOBIData structure to be filled with read data
+ @param[in] file File descriptor to read from
+ @return MOBI_RET status code (on success MOBI_SUCCESS)
+ */
+static MOBI_RET mobi_load_record0_only(MOBIData *m, FILE *file) {
+    MOBI_RET ret = mobi_load_pdbheader(m, file);
+    if (ret != MOBI_SUCCESS) {
+        return ret;
+    }
+    ret = mobi_check_pdbheader(m);
+    if (ret != MOBI_SUCCESS) {
+        return ret;
+    }
+    ret = mobi_load_reclist(m, file);
+    if (ret != MOBI_SUCCESS) {
+        return ret;
+    }
+    ret = mobi_load_single_recdata(m->rec, file);
+    if (ret != MOBI_SUCCESS) {
+        return ret;
+    }
+    return mobi_parse_record0(m, 0);
+}
+
+/**
+ @brief Check whether record data starts with given magic string, reading only the magic from file
+ 
+ @param[in] record MOBIPdbRecord structure with unloaded data
+ @param[in] file File descriptor to read from
+ @param[in] magic Magic string
+ @return True if record data starts with magic
+ */
+static bool mobi_probe_magic(const MOBIPdbRecord *record, FILE *file, const char *magic) {
+    char buf[8];
+    const size_t len = strlen(magic);
+    if (record == NULL || len > sizeof(buf)) {
+        return false;
+    }
+    if (record->next && record->next->offset < record->offset + len) {
+        return false;
+    }
+    if (fseek(file, record->offset, SEEK_SET) != 0) {
+        return false;
+    }
+    if (fread(buf, 1, len, file) != len) {
+        return false;
+    }
+    return memcmp(buf, magic, len) == 0;
+}
+
+/**
+ @brief Read basic properties of MOBI document without loading whole document
+ 
+ Only palm database header, records list and Record 0 (with MOBI and EXTH headers) are read,
+ which makes it much faster than mobi_load_filename() for scanning large collections.
+ For hybrid KF7/KF8 file also KF8 Record 0 is read and properties of KF8 part are reported,
+ the same as mobi_load_filename() selects by default.
+ 
+ @param[in] path Path to a MOBI document on disk (eg. /home/me/test.mobi)
+ @param[out] info MOBIProbeInfo structure to be filled with document properties
+ @return MOBI_RET status code (on success MOBI_SUCCESS)
+ */
+MOBI_RET mobi_probe(const char *path, MOBIProbeInfo *info) {
+    if (path == NULL || info == NULL) {
+        return MOBI_PARAM_ERR;
+    }
+    memset(info, 0, sizeof(MOBIProbeInfo));
+    info->version = MOBI_NOTSET;
+    info->cover_seqnumber = MOBI_NOTSET;
+    info->cover_offset = MOBI_NOTSET;
+    FILE *file = fopen(path, "rb");
+    if (file == NULL) {
+        debug_print("%s", "File not found\n");
+        return MOBI_FILE_NOT_FOUND;
+    }
+    MOBIData *m = mobi_init();
+    if (m == NULL) {
+        fclose(file);
+        return MOBI_MALLOC_FAILED;
+    }
+    MOBI_RET ret = mobi_load_record0_only(m, file);
+    if (ret != MOBI_SUCCESS) {
+        mobi_free(m);
+        fclose(file);
+        return ret;
+    }
+    const MOBIExthHeader *exth = mobi_get_exthrecord_by_tag(m, EXTH_KF8BOUNDARY);
+    if (exth) {
+        const uint32_t boundary = mobi_decode_exthvalue(exth->data, exth->size) - 1;
+        info->is_hybrid = mobi_probe_magic(mobi_get_record_by_seqnumber(m, boundary), file, BOUNDARY_MAGIC);
+        MOBIPdbRecord *kf8_record0 = mobi_get_record_by_seqnumber(m, (size_t) boundary + 1);
+        if (info->is_hybrid && kf8_record0) {
+            ret = mobi_load_single_recdata(kf8_record0, file);
+            if (ret == MOBI_SUCCESS) {
+                ret = mobi_parse_kf8_record0(m, boundary);
+            }
+            if (ret != MOBI_SUCCESS) {
+                mobi_free(m);
+                fclose(file);
+                return ret;
+            }
+        }
+    }
+    info->version = mobi_get_fileversion(m);
+    info->is_kf8 = mobi_is_kf8(m);
+    if (m->rh && m->rh->compression_type == MOBI_COMPRESSION_NONE) {
+        info->is_replica = mobi_probe_magic(m->rec->next, file, REPLICA_MAGIC);
+    }
+    info->is_dictionary = mobi_is_dictionary(m);
+    if (m->rh) {
+        info->encryption_type = m->rh->encryption_type;
+        info->compression_type = m->rh->compression_type;
+        info->text_length = m->rh->text_length;
+    }
+    info->rec_count = m->ph->rec_count;
+    char *title = mobi_meta_get_title(m);
+    if (title) {
+        strncpy(info->title, title, MOBI_TITLE_SIZEMAX);
+        info->title[MOBI_TITLE_SIZEMAX] = '\0';
+        free(title);
+    }
+    exth = mobi_get_exthrecord_by_tag(m, EXTH_COVEROFFSET);
+    if (exth && m->mh && m->mh->image_index && *m->mh->image_index != MOBI_NOTSET) {
+        const size_t seqnumber = *m->mh->image_index + mobi_decode_exthvalue(exth->data, exth->size);
+        const MOBIPdbRecord *record = mobi_get_record_by_seqnumber(m, seqnumber);
+        if (record) {
+            info->cover_seqnumber = seqnumber;
+            info->cover_offset = record->offset;
+        }
+    }
+    mobi_free(m);
+    fclose(file);
+    return MOBI_SUCCESS;
+}
+
+/**
+ @brief Parse MOBI document held in internal storage into MOBIData structure
+ 
+ @param[in,out] m MOBIData structure with storage set
+ @return MOBI_RET status code (on success MOBI_SUCCESS)
+ */
+static MOBI_RET mobi_load_storage(MOBIData *m) {
+    const MOBIInternals *internals = m->internals;
+    MOBIBuffer *buf = mobi_buffer_init_null(internals->storage, internals->storage_size);
+    if (buf == NULL) {
+        debug_print("%s\n", "Memory allocation failed");
+        return MOBI_MALLOC_FAILED;
+    }
+    MOBI_RET ret = mobi_parse_pdbheader(m, buf);
+    if (ret == MOBI_SUCCESS) {
+        ret = mobi_check_pdbheader(m);
+    }
+    if (ret == MOBI_SUCCESS) {
+        ret = mobi_parse_reclist(m, buf);
+    }
+    mobi_buffer_free_null(buf);
+    if (ret != MOBI_SUCCESS) {
+        return ret;
+    }
+    ret = mobi_slice_rec(m, internals->storage, 0, internals->storage_size);
+    if (ret != MOBI_SUCCESS) {
+        return ret;
+    }
+    return mobi_parse_headers(m);
+}
+
+/**
+ @brief Read MOBI document from memory buffer into MOBIData structure
+ 
+ By default records data point directly into the buffer, which is not copied.
+ The buffer must stay valid and unchanged until mobi_free() is called.
+ It is never modified by the library, functions that modify records data in place
+ (eg. decryption) replace it with private copies.
+ With MOBI_LOAD_COPY flag the buffer is copied once and may be released after the call.
+ 
+ @param[in,out] m MOBIData structure to be filled with read data
+ @param[in] data Buffer holding whole MOBI document
+ @param[in] size Size of the buffer
+ @param[in] flags Bitwise combination of MOBILoadFlags
+ @return MOBI_RET status code (on success MOBI_SUCCESS)
+ */
+MOBI_RET mobi_load_buffer(MOBIData *m, const unsigned char *data, const size_t size, const unsigned int flags) {
+    if (m == NULL || m->internals == NULL) {
+        debug_print("%s", "Mobi structure not initialized\n");
+        return MOBI_INIT_FAILED;
+    }
+    if (data == NULL) {
+        return MOBI_PARAM_ERR;
+    }
+    MOBIInternals *internals = m->internals;
+    if (internals->storage) {
+        debug_print("%s", "Document already loaded\n");
+        return MOBI_INIT_FAILED;
+    }
+    if (size < PALMDB_HEADER_LEN) {
+        debug_print("%s", "Buffer too short\n");
+        return MOBI_DATA_CORRUPT;
+    }
+    if (flags & MOBI_LOAD_COPY) {
+        unsigned char *copy = malloc(size);
+        if (copy == NULL) {
+            debug_print("%s", "Memory allocation for document data failed\n");
+            return MOBI_MALLOC_FAILED;
+        }
+        memcpy(copy, data, size);
+        internals->storage_type = MOBI_STORAGE_ARENA;
+        internals->storage = copy;
+    } else {
+        internals->storage_type = MOBI_STORAGE_BORROWED;
+        internals->storage = (unsigned char *) data;
+    }
+    internals->storage_size = size;
+    return mobi_load_storage(m);
+}
+
+/**
+ @brief Read data at given offset from custom source
+ 
+ @param[in] io MOBIIO callbacks
+ @param[in] ctx Context passed to callbacks
+ @param[in] offset Offset of data from the start of the source
+ @param[out] data Buffer to be filled with data
+ @param[in] size Size of data
+ @return MOBI_RET status code (on success MOBI_SUCCESS)
+ */
+static MOBI_RET mobi_io_read_at(const MOBIIO *io, void *ctx, const size_t offset, unsigned char *data, const size_t size) {
+    if (io->seek(ctx, offset) != 0) {
+        debug_print("Seek to offset %zu failed\n", offset);
+        return MOBI_DATA_CORRUPT;
+    }
+    size_t total = 0;
+    while (total < size) {
+        const size_t len = io->read(ctx, data + total, size - total);
+        if (len == 0) {
+            debug_print("Truncated data at offset %zu\n", offset + total);
+            return MOBI_DATA_CORRUPT;
+        }
+        total += len;
+    }
+    return MOBI_SUCCESS;
+}
+
+/**
+ @brief Read part of custom source into MOBIBuffer and parse it with given function
+ 
+ @param[in,out] m MOBIData structure to be filled with parsed data
+ @param[in] io MOBIIO callbacks
+ @param[in] ctx Context passed to callbacks
+ @param[in] offset Offset of data from the start of the source
+ @param[in] size Size of data
+ @param[in] parse Parsing function
+ @return MOBI_RET status code (on success MOBI_SUCCESS)
+ */
+static MOBI_RET mobi_io_parse(MOBIData *m, const MOBIIO *io, void *ctx, const size_t offset, const size_t size,
+                              MOBI_RET (*parse)(MOBIData *m, MOBIBuffer *buf)) {
+    MOBIBuffer *buf = mobi_buffer_init(size);
+    if (buf == NULL) {
+        debug_print("%s\n", "Memory allocation failed");
+        return MOBI_MALLOC_FAILED;
+    }
+    MOBI_RET ret = mobi_io_read_at(io, ctx, offset, buf->data, size);
+    if (ret == MOBI_SUCCESS) {
+        ret = parse(m, buf);
+    }
+    mobi_buffer_free(buf);
+    return ret;
+}
+
+/**
+ @brief Read data of all records from custom source
+ 
+ With MOBI_LOAD_ARENA flag records region is read at once into one memory block.
+ Otherwise each record gets its own memory block and, if read_ranges callback is present,
+ all records are read with one batched call.
+ 
+ @param[in,out] m MOBIData structure with loaded records list
+ @param[in] io MOBIIO callbacks
+ @param[in] ctx Context passed to callbacks
+ @param[in] source_size Size of the source
+ @return MOBI_RET status code (on success MOBI_SUCCESS)
+ */
+static MOBI_RET mobi_io_load_rec(MOBIData *m, const MOBIIO *io, void *ctx, const size_t source_size) {
+    MOBIInternals *internals = m->internals;
+    const size_t start = m->rec->offset;
+    if (start >= source_size) {
+        debug_print("Wrong records offset: %zu\n", start);
+        return MOBI_DATA_CORRUPT;
+    }
+    if (internals->load_flags & MOBI_LOAD_ARENA) {
+        unsigned char *arena = malloc(source_size - start);
+        if (arena == NULL) {
+            debug_print("%s", "Memory allocation for records data failed\n");
+            return MOBI_MALLOC_FAILED;
+        }
+        internals->storage_type = MOBI_STORAGE_ARENA;
+        internals->storage = arena;
+        internals->storage_size = source_size - start;
+        const MOBI_RET ret = mobi_io_read_at(io, ctx, start, arena, source_size - start);
+        if (ret != MOBI_SUCCESS) {
+            return ret;
+        }
+        return mobi_slice_rec(m, arena, start, source_size);
+    }
+    size_t count = 0;
+    MOBIPdbRecord *curr = m->rec;
+    while (curr != NULL) {
+        const size_t end = curr->next ? curr->next->offset : source_size;
+        if (curr->offset > end || end > source_size || (curr->next == NULL && end == curr->offset)) {
+            debug_print("Wrong record %u size (offset: %u, end: %zu)\n", curr->uid, curr->offset, end);
+            return MOBI_DATA_CORRUPT;
+        }
+        curr->size = end - curr->offset;
+        curr->data = malloc(curr->size);
+        if (curr->data == NULL) {
+            debug_print("%s", "Memory allocation for pdb record data failed\n");
+            return MOBI_MALLOC_FAILED;
+        }
+        count++;
+        curr = curr->next;
+    }
+    if (io->read_ranges == NULL) {
+        curr = m->rec;
+        while (curr != NULL) {
+            const MOBI_RET ret = mobi_io_read_at(io, ctx, curr->offset, curr->data, curr->size);
+            if (ret != MOBI_SUCCESS) {
+                return ret;
+            }
+            curr = curr->next;
+        }
+        return MOBI_SUCCESS;
+    }
+    MOBIIORange *ranges = malloc(count * sizeof(MOBIIORange));
+    if (ranges == NULL) {
+        debug_print("%s", "Memory allocation failed\n");
+        return MOBI_MALLOC_FAILED;
+    }
+    size_t i = 0;
+    curr = m->rec;
+    while (curr != NULL) {
+        ranges[i++] = (MOBIIORange) { curr->offset, curr->size, curr->data };
+        curr = curr->next;
+    }
+    const int io_ret = io->read_ranges(ctx, ranges, count);
+    free(ranges);
+    if (io_ret != 0) {
+        debug_print("%s", "Reading records data failed\n");
+        return MOBI_DATA_CORRUPT;
+    }
+    return MOBI_SUCCESS;
+}
+
+/**
+ @brief Read MOBI document from custom source into MOBIData structure
+ 
+ Source is accessed only through callbacks in MOBIIO structure and only during the call.
+ Loading options set with mobi_set_loadflags() apply, except for MOBI_LOAD_LAZY and MOBI_LOAD_SKIP_HYBRID,
+ which are ignored, as records can not be read from the source after the call returns.
+ 
+ @param[in,out] m MOBIData structure to be filled with read data
+ @param[in] io MOBIIO structure with read, seek, size and optional read_ranges callbacks
+ @param[in] ctx Context pointer passed to callbacks
+ @return MOBI_RET status code (on success MOBI_SUCCESS)
+ */
+MOBI_RET mobi_load_io(MOBIData *m, const MOBIIO *io, void *ctx) {
+    if (m == NULL || m->internals == NULL) {
+        debug_print("%s", "Mobi structure not initialized\n");
+        return MOBI_INIT_FAILED;
+    }
+    if (io == NULL || io->read == NULL || io->seek == NULL || io->size == NULL) {
+        return MOBI_PARAM_ERR;
+    }
+    const MOBIInternals *internals = m->internals;
+    if (internals->storage) {
+        debug_print("%s", "Document already loaded\n");
+        return MOBI_INIT_FAILED;
+    }
+    const size_t source_size = io->size(ctx);
+    if (source_size < PALMDB_HEADER_LEN) {
+        debug_print("%s", "Source too short\n");
+        return MOBI_DATA_CORRUPT;
+    }
+    MOBI_RET ret = mobi_io_parse(m, io, ctx, 0, PALMDB_HEADER_LEN, mobi_parse_pdbheader);
+    if (ret != MOBI_SUCCESS) {
+        return ret;
+    }
+    ret = mobi_check_pdbheader(m);
+    if (ret != MOBI_SUCCESS) {
+        return ret;
+    }
+    const size_t reclist_size = (size_t) m->ph->rec_count * PALMDB_RECORD_INFO_SIZE;
+    ret = mobi_io_parse(m, io, ctx, PALMDB_HEADER_LEN, reclist_size, mobi_parse_reclist);
+    if (ret != MOBI_SUCCESS) {
+        return ret;
+    }
+    ret = mobi_io_load_rec(m, io, ctx, source_size);
+    if (ret != MOBI_SUCCESS) {
+        return ret;
+    }
+    return mobi_parse_headers(m);
+}
+
+/**
+ @brief Read MOBI document from a path into MOBIData structure using memory mapping
+ 
+ File is mapped read-only and records data point directly into the mapping,
+ so no copy of the file is made and mapped pages may be shared between processes.
+ Functions that modify records data in place (eg. decryption) replace it with private copies.
+ The mapping is released with mobi_free().
+ If memory mapping is not available, it falls back to mobi_load_filename().
+ 
+ @param[in,out] m MOBIData structure to be filled with read data
+ @param[in] path Path to a MOBI document on disk (eg. /home/me/test.mobi)
+ @return MOBI_RET status code (on success MOBI_SUCCESS)
+ */
+MOBI_RET mobi_load_filename_mmap(MOBIData *m, const char *path) {
+#ifdef HAVE_SYS_MMAN_H
+    if (m == NULL || m->internals == NULL) {
+        debug_print("%s", "Mobi structure not initialized\n");
+        return MOBI_INIT_FAILED;
+    }
+    MOBIInternals *internals = m->internals;
+    if (internals->storage) {
+        debug_print("%s", "Document already loaded\n");
+        return MOBI_INIT_FAILED;
+    }
+    const int fd = open(path, O_RDONLY);
+    if (fd == -1) {
+        debug_print("%s", "File not found\n");
+        return MOBI_FILE_NOT_FOUND;
+    }
+    struct stat st;
+    if (fstat(fd, &st) == -1) {
+        close(fd);
+        return MOBI_FILE_NOT_FOUND;
+    }
+    if (st.st_size < PALMDB_HEADER_LEN) {
+        close(fd);
+        return MOBI_DATA_CORRUPT;
+    }
+    const size_t size = (size_t) st.st_size;
+    void *data = mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (data == MAP_FAILED) {
+        debug_print("%s", "Memory mapping failed, reading file\n");
+        return mobi_load_filename(m, path);
+    }
+    internals->storage_type = MOBI_STORAGE_MMAP;
+    internals->storage = data;
+    internals->storage_size = size;
+    return mobi_load_storage(m);
+#else
+    debug_print("%s", "Memory mapping not supported, reading file\n");
+    return mobi_load_filename(m, path);
+#endif
+}
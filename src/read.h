@@ -15,14 +15,20 @@
 #include "mobi.h"
 #include "memory.h"
 #include "compression.h"
+#include "buffer.h"
 
 #define MOBI_EXTH_MAXCNT 1024
 
 MOBI_RET mobi_parse_fdst(const MOBIData *m, MOBIRawml *rawml);
 MOBI_RET mobi_parse_huffdic(const MOBIData *m, MOBIHuffCdic *cdic);
+MOBI_RET mobi_parse_huff(MOBIHuffCdic *huffcdic, const MOBIPdbRecord *record);
+MOBI_RET mobi_parse_cdic(MOBIHuffCdic *huffcdic, const MOBIPdbRecord *record, const size_t num);
 MOBI_RET mobi_load_pdbheader(MOBIData *m, FILE *file);
+MOBI_RET mobi_parse_pdbheader(MOBIData *m, MOBIBuffer *buf);
 MOBI_RET mobi_load_reclist(MOBIData *m, FILE *file);
+MOBI_RET mobi_parse_reclist(MOBIData *m, MOBIBuffer *buf);
 MOBI_RET mobi_load_rec(MOBIData *m, FILE *file);
 MOBI_RET mobi_load_recdata(MOBIPdbRecord *rec, FILE *file);
+MOBI_RET mobi_load_recdata_lazy(const MOBIData *m, MOBIPdbRecord *rec);
 
 #endif
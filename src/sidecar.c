@@ -0,0 +1,832 @@
+/** @file sidecar.c
+ *  @brief Sidecar file with parsed indices and FDST record
+ *
+ * Copyright (c) 2026 Bartek Fabiszewski
+ * http://www.fabiszewski.net
+ *
+ * This file is part of libmobi.
+ * Licensed under LGPL, either version 3, or any later.
+ * See <http://www.gnu.org/licenses/>
+ */
+
+#define _GNU_SOURCE 1
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "sidecar.h"
+#include "index.h"
+#include "memory.h"
+#include "util.h"
+#include "debug.h"
+#ifdef HAVE_SYS_MMAN_H
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include <unistd.h>
+#endif
+#if defined(HAVE_MKSTEMP) && defined(HAVE_UNISTD_H)
+#include <unistd.h>
+#endif
+
+/**
+ @brief Round size up to sections alignment of sidecar file
+ 
+ @param[in] size Size
+ @return Aligned size
+ */
+static size_t mobi_sidecar_align(const size_t size) {
+    return (size + MOBI_SIDECAR_ALIGN - 1) & ~((size_t) MOBI_SIDECAR_ALIGN - 1);
+}
+
+/**
+ @brief Update 64-bit hash with data
+ 
+ Data is consumed in 8-byte words, remaining bytes with FNV-1a.
+ 
+ @param[in] hash Current hash
+ @param[in] data Data
+ @param[in] size Size of data
+ @return Updated hash
+ */
+static uint64_t mobi_sidecar_hash(uint64_t hash, const unsigned char *data, const size_t size) {
+    size_t i = 0;
+    while (i + 8 <= size) {
+        uint64_t word;
+        memcpy(&word, data + i, 8);
+        hash = (hash ^ word) * 0x9e3779b97f4a7c15ULL;
+        hash ^= hash >> 32;
+        i += 8;
+    }
+    while (i < size) {
+        hash = (hash ^ data[i++]) * 0x100000001b3ULL;
+    }
+    hash = (hash ^ size) * 0x9e3779b97f4a7c15ULL;
+    return hash ^ (hash >> 29);
+}
+
+/**
+ @brief Update hash with record data
+ 
+ @param[in] hash Current hash
+ @param[in] record MOBIPdbRecord structure, may be NULL
+ @return Updated hash
+ */
+static uint64_t mobi_sidecar_hash_record(const uint64_t hash, const MOBIPdbRecord *record) {
+    if (record == NULL || record->data == NULL) {
+        return mobi_sidecar_hash(hash, NULL, 0) ^ 1;
+    }
+    return mobi_sidecar_hash(hash, record->data, record->size);
+}
+
+/**
+ @brief Get key of the document
+ 
+ Key is a hash of records holding document headers (and indices record numbers) and FDST record.
+ 
+ @param[in] m MOBIData structure
+ @return Key
+ */
+static uint64_t mobi_sidecar_document_key(const MOBIData *m) {
+    uint64_t key = mobi_sidecar_hash_record(0xcbf29ce484222325ULL, mobi_get_record_by_seqnumber(m, 0));
+    const size_t offset = mobi_get_kf8offset(m);
+    if (offset) {
+        key = mobi_sidecar_hash_record(key, mobi_get_record_by_seqnumber(m, offset));
+    }
+    if (mobi_exists_fdst(m)) {
+        const size_t fdst_record_number = mobi_get_fdst_record_number(m);
+        if (fdst_record_number != MOBI_NOTSET) {
+            key = mobi_sidecar_hash_record(key, mobi_get_record_by_seqnumber(m, fdst_record_number));
+        }
+    }
+    return key;
+}
+
+/**
+ @brief Get key of the index
+ 
+ Key is a hash of meta record and sizes of data records of the index.
+ Meta record holds the last label and entries count of each data record,
+ so that data records themselves are not hashed on every load.
+ 
+ @param[in] m MOBIData structure
+ @param[in] record_number Sequential number of the first index record
+ @param[out] last Will be set to last data record, NULL if not found
+ @return Key
+ */
+static uint64_t mobi_sidecar_index_key(const MOBIData *m, const size_t record_number, MOBIPdbRecord **last) {
+    MOBIPdbRecord *record = mobi_get_record_by_seqnumber(m, record_number);
+    uint64_t key = mobi_sidecar_hash_record(0xcbf29ce484222325ULL, record);
+    *last = record;
+    if (record == NULL || record->data == NULL || record->size < 28) {
+        return key;
+    }
+    /* 24: data records count */
+    size_t count = mobi_get32be(record->data + 24);
+    while (count-- && record) {
+        record = mobi_next_record(m, record);
+        const uint64_t size = record ? record->size : 0;
+        key = mobi_sidecar_hash(key, (const unsigned char *) &size, sizeof(size));
+    }
+    *last = record;
+    return key;
+}
+
+/**
+ @brief Get sequential number of the first record of the index
+ 
+ @param[in] m MOBIData structure
+ @param[in] kind Kind of index
+ @return Record number, MOBI_NOTSET if index is not present in the document
+ */
+static size_t mobi_sidecar_record_number(const MOBIData *m, const MOBISidecarKind kind) {
+    const size_t offset = mobi_get_kf8offset(m);
+    switch (kind) {
+        case MOBI_SIDECAR_SKEL:
+            return mobi_exists_skel_indx(m) ? *m->mh->skeleton_index + offset : MOBI_NOTSET;
+        case MOBI_SIDECAR_FRAG:
+            return mobi_exists_frag_indx(m) ? *m->mh->fragment_index + offset : MOBI_NOTSET;
+        case MOBI_SIDECAR_GUIDE:
+            return mobi_exists_guide_indx(m) ? *m->mh->guide_index + offset : MOBI_NOTSET;
+        case MOBI_SIDECAR_NCX:
+            return mobi_exists_ncx(m) ? *m->mh->ncx_index + offset : MOBI_NOTSET;
+        case MOBI_SIDECAR_ORTH:
+            return mobi_exists_orth(m) ? *m->mh->orth_index + offset : MOBI_NOTSET;
+        case MOBI_SIDECAR_INFL:
+            return mobi_exists_infl(m) ? *m->mh->infl_index + offset : MOBI_NOTSET;
+        default:
+            return MOBI_NOTSET;
+    }
+}
+
+/**
+ @brief Get path of sidecar file set with mobi_set_sidecar()
+ 
+ @param[in] m MOBIData structure
+ @return Path, NULL if not set
+ */
+static const char * mobi_sidecar_path(const MOBIData *m) {
+    if (m == NULL || m->internals == NULL) {
+        return NULL;
+    }
+    const MOBIInternals *internals = m->internals;
+    return internals->sidecar_path;
+}
+
+/**
+ @brief Map sidecar file into memory
+ 
+ If memory mapping is not available, file is read into allocated memory.
+ 
+ @param[in] path Path of sidecar file
+ @param[out] size Will be set to size of the file
+ @return Pointer to file data, NULL on failure
+ */
+static unsigned char * mobi_sidecar_map(const char *path, size_t *size) {
+#ifdef HAVE_SYS_MMAN_H
+    const int fd = open(path, O_RDONLY);
+    if (fd == -1) {
+        return NULL;
+    }
+    struct stat st;
+    if (fstat(fd, &st) == -1 || st.st_size < (off_t) sizeof(MOBISidecarHeader)) {
+        close(fd);
+        return NULL;
+    }
+    *size = (size_t) st.st_size;
+    void *data = mmap(NULL, *size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (data == MAP_FAILED) {
+        debug_print("%s", "Memory mapping of sidecar failed\n");
+        return NULL;
+    }
+    return data;
+#else
+    FILE *file = fopen(path, "rb");
+    if (file == NULL) {
+        return NULL;
+    }
+    unsigned char *data = NULL;
+    if (fseek(file, 0, SEEK_END) == 0) {
+        const long file_size = ftell(file);
+        if (file_size >= (long) sizeof(MOBISidecarHeader) && fseek(file, 0, SEEK_SET) == 0) {
+            *size = (size_t) file_size;
+            data = malloc(*size);
+            if (data && fread(data, 1, *size, file) != *size) {
+                free(data);
+                data = NULL;
+            }
+        }
+    }
+    fclose(file);
+    return data;
+#endif
+}
+
+/**
+ @brief Release sidecar file data mapped with mobi_sidecar_map()
+ 
+ @param[in] data File data
+ @param[in] size Size of the file
+ */
+static void mobi_sidecar_unmap(unsigned char *data, const size_t size) {
+#ifdef HAVE_SYS_MMAN_H
+    munmap(data, size);
+#else
+    UNUSED(size);
+    free(data);
+#endif
+}
+
+/**
+ @brief Check whether array fits in sidecar file
+ 
+ @param[in] file_size Size of sidecar file
+ @param[in] offset Offset of the array
+ @param[in] count Number of items
+ @param[in] item_size Size of single item
+ @return True if array is aligned and within file
+ */
+static bool mobi_sidecar_check_section(const size_t file_size, const uint64_t offset, const uint64_t count, const size_t item_size) {
+    return offset % MOBI_SIDECAR_ALIGN == 0 && offset <= file_size && count <= (file_size - offset) / item_size;
+}
+
+/**
+ @brief Load FDST record from sidecar file
+ 
+ @param[in,out] rawml MOBIRawml structure, FDST will be set
+ @param[in] data Sidecar file data
+ @param[in] header Sidecar file header
+ @return MOBI_RET status code (on success MOBI_SUCCESS)
+ */
+static MOBI_RET mobi_sidecar_load_fdst(MOBIRawml *rawml, const unsigned char *data, const MOBISidecarHeader *header) {
+    const size_t count = (size_t) header->fdst_count;
+    if (!mobi_sidecar_check_section(header->file_size, header->fdst_offset, header->fdst_count, 2 * sizeof(uint32_t))) {
+        debug_print("%s", "Sidecar FDST beyond file end\n");
+        return MOBI_DATA_CORRUPT;
+    }
+    MOBIFdst *fdst = malloc(sizeof(MOBIFdst));
+    if (fdst == NULL) {
+        debug_print("%s\n", "Memory allocation failed");
+        return MOBI_MALLOC_FAILED;
+    }
+    fdst->fdst_section_count = count;
+    fdst->fdst_section_starts = malloc(count * sizeof(*fdst->fdst_section_starts));
+    fdst->fdst_section_ends = malloc(count * sizeof(*fdst->fdst_section_ends));
+    if (fdst->fdst_section_starts == NULL || fdst->fdst_section_ends == NULL) {
+        debug_print("%s\n", "Memory allocation failed");
+        free(fdst->fdst_section_starts);
+        free(fdst->fdst_section_ends);
+        free(fdst);
+        return MOBI_MALLOC_FAILED;
+    }
+    const unsigned char *starts = data + header->fdst_offset;
+    memcpy(fdst->fdst_section_starts, starts, count * sizeof(uint32_t));
+    memcpy(fdst->fdst_section_ends, starts + count * sizeof(uint32_t), count * sizeof(uint32_t));
+    rawml->fdst = fdst;
+    return MOBI_SUCCESS;
+}
+
+/**
+ @brief Validate index stored in sidecar file
+ 
+ Entries data must be consistent, so that entries may be linked to it without bounds checks.
+ 
+ @param[in] data Sidecar file data
+ @param[in] file_size Size of sidecar file
+ @param[in] index MOBISidecarIndex structure
+ @return True if index is valid
+ */
+static bool mobi_sidecar_check_index(const unsigned char *data, const size_t file_size, const MOBISidecarIndex *index) {
+    if (index->entries_count != index->total_entries_count || index->entries_count > INDX_TOTAL_MAXCNT
+        || index->cncx_records_count > CNCX_RECORD_MAXCNT || index->name_size >= INDX_NAME_SIZEMAX
+        || !mobi_sidecar_check_section(file_size, index->entries_offset, index->entries_count, sizeof(uint32_t))
+        || !mobi_sidecar_check_section(file_size, index->tags_offset, index->tags_count, 2 * sizeof(uint32_t))
+        || !mobi_sidecar_check_section(file_size, index->tagvalues_offset, index->tagvalues_count, sizeof(uint32_t))
+        || !mobi_sidecar_check_section(file_size, index->labels_offset, index->labels_size, 1)
+        || !mobi_sidecar_check_section(file_size, index->name_offset, index->name_size, 1)) {
+        return false;
+    }
+    /* every entry has zero terminated label */
+    const unsigned char *labels = data + index->labels_offset;
+    if (index->labels_size && labels[index->labels_size - 1] != 0) {
+        return false;
+    }
+    uint64_t labels_count = 0;
+    const unsigned char *label = labels;
+    const unsigned char *labels_end = labels + index->labels_size;
+    while (label < labels_end) {
+        label = memchr(label, 0, (size_t) (labels_end - label));
+        label++;
+        labels_count++;
+    }
+    if (labels_count != index->entries_count) {
+        return false;
+    }
+    const uint32_t *tags_counts = (const uint32_t *) (data + index->entries_offset);
+    uint64_t tags_count = 0;
+    for (size_t i = 0; i < index->entries_count; i++) {
+        tags_count += tags_counts[i];
+    }
+    if (tags_count != index->tags_count) {
+        return false;
+    }
+    const uint32_t *tags = (const uint32_t *) (data + index->tags_offset);
+    uint64_t tagvalues_count = 0;
+    for (size_t i = 0; i < index->tags_count; i++) {
+        tagvalues_count += tags[2 * i + 1];
+    }
+    return tagvalues_count == index->tagvalues_count;
+}
+
+/**
+ @brief Check whether index stored in sidecar file is valid and up to date
+ 
+ @param[out] last Will be set to last data record of the index
+ @param[in] m MOBIData structure
+ @param[in] data Sidecar file data
+ @param[in] file_size Size of sidecar file
+ @param[in] index MOBISidecarIndex structure
+ @return True if index may be loaded
+ */
+static bool mobi_sidecar_check_stored_index(MOBIPdbRecord **last, const MOBIData *m, const unsigned char *data, const size_t file_size, const MOBISidecarIndex *index) {
+    const size_t record_number = mobi_sidecar_record_number(m, (MOBISidecarKind) index->kind);
+    if (record_number == MOBI_NOTSET || index->record_number != record_number) {
+        return false;
+    }
+    if (index->key != mobi_sidecar_index_key(m, record_number, last)) {
+        debug_print("Sidecar index %zu is outdated\n", (size_t) index->kind);
+        return false;
+    }
+    if (!mobi_sidecar_check_index(data, file_size, index)) {
+        debug_print("Sidecar index %zu is invalid\n", (size_t) index->kind);
+        return false;
+    }
+    return true;
+}
+
+/**
+ @brief Get checksum of sidecar file header and table of stored indices
+ 
+ Entries data of indices is not hashed, it is validated before index is loaded.
+ 
+ @param[in] header Sidecar file header
+ @param[in] data Sidecar file data, with table of stored indices within file bounds
+ @return Checksum
+ */
+static uint64_t mobi_sidecar_checksum(const MOBISidecarHeader *header, const unsigned char *data) {
+    MOBISidecarHeader hashed = *header;
+    hashed.checksum = 0;
+    const uint64_t hash = mobi_sidecar_hash(0, (const unsigned char *) &hashed, sizeof(hashed));
+    return mobi_sidecar_hash(hash, data + header->indices_offset, (size_t) header->indices_count * sizeof(MOBISidecarIndex));
+}
+
+/**
+ @brief Check whether sidecar file was written for the document and is not damaged
+ 
+ @param[out] header Will be filled with sidecar file header
+ @param[in] data Sidecar file data
+ @param[in] size Size of sidecar file
+ @param[in] m MOBIData structure
+ @return True if header is valid
+ */
+static bool mobi_sidecar_check_header(MOBISidecarHeader *header, const unsigned char *data, const size_t size, const MOBIData *m) {
+    memcpy(header, data, sizeof(*header));
+    const size_t data_offset = mobi_sidecar_align(sizeof(*header));
+    return memcmp(header->magic, MOBI_SIDECAR_MAGIC, sizeof(header->magic)) == 0
+        && header->version == MOBI_SIDECAR_VERSION && header->byte_order == MOBI_SIDECAR_BYTEORDER
+        && header->file_size == size && size >= data_offset && header->indices_count <= MOBI_SIDECAR_KINDS
+        && mobi_sidecar_check_section(size, header->indices_offset, header->indices_count, sizeof(MOBISidecarIndex))
+        && header->key == mobi_sidecar_document_key(m)
+        && header->checksum == mobi_sidecar_checksum(header, data);
+}
+
+/**
+ @brief Load index from sidecar file
+ 
+ Labels and tag values are copied in single blocks, entries and tags are linked to them.
+ 
+ @param[in,out] indx Will be set to loaded index
+ @param[in] data Sidecar file data
+ @param[in] index Validated MOBISidecarIndex structure
+ @param[in] cncx_record Record following index data records
+ @return MOBI_RET status code (on success MOBI_SUCCESS)
+ */
+static MOBI_RET mobi_sidecar_load_index(MOBIIndx **indx, const unsigned char *data, const MOBISidecarIndex *index, MOBIPdbRecord *cncx_record) {
+    MOBIIndx *loaded = mobi_init_indx();
+    if (loaded == NULL) {
+        return MOBI_MALLOC_FAILED;
+    }
+    loaded->type = (size_t) index->type;
+    loaded->encoding = (MOBIEncoding) index->encoding;
+    loaded->entries_count = (size_t) index->entries_count;
+    loaded->total_entries_count = (size_t) index->total_entries_count;
+    loaded->ordt_offset = (size_t) index->ordt_offset;
+    loaded->ligt_offset = (size_t) index->ligt_offset;
+    loaded->ligt_entries_count = (size_t) index->ligt_entries_count;
+    loaded->cncx_records_count = (size_t) index->cncx_records_count;
+    if (loaded->cncx_records_count) {
+        loaded->cncx_record = cncx_record;
+    }
+    MOBIIndxPool pool;
+    memset(&pool, 0, sizeof(pool));
+    pool.labels_size = pool.labels_capacity = (size_t) index->labels_size;
+    pool.tags_count = pool.tags_capacity = (size_t) index->tags_count;
+    pool.tagvalues_count = pool.tagvalues_capacity = (size_t) index->tagvalues_count;
+    if (index->name_size) {
+        loaded->orth_index_name = malloc((size_t) index->name_size + 1);
+    }
+    if (index->entries_count) {
+        loaded->entries = malloc((size_t) index->entries_count * sizeof(MOBIIndexEntry));
+        pool.labels = malloc(pool.labels_size);
+    }
+    if (index->tags_count) {
+        pool.tags = malloc(pool.tags_count * sizeof(*pool.tags));
+    }
+    if (index->tagvalues_count) {
+        pool.tagvalues = malloc(pool.tagvalues_count * sizeof(*pool.tagvalues));
+    }
+    if ((index->name_size && loaded->orth_index_name == NULL)
+        || (index->entries_count && (loaded->entries == NULL || pool.labels == NULL))
+        || (index->tags_count && pool.tags == NULL)
+        || (index->tagvalues_count && pool.tagvalues == NULL)) {
+        debug_print("%s\n", "Memory allocation failed");
+        mobi_free_indx_pool(&pool);
+        mobi_free_indx(loaded);
+        return MOBI_MALLOC_FAILED;
+    }
+    if (loaded->orth_index_name) {
+        memcpy(loaded->orth_index_name, data + index->name_offset, (size_t) index->name_size);
+        loaded->orth_index_name[index->name_size] = '\0';
+    }
+    if (pool.labels_size) {
+        memcpy(pool.labels, data + index->labels_offset, pool.labels_size);
+    }
+    if (pool.tagvalues_count) {
+        memcpy(pool.tagvalues, data + index->tagvalues_offset, pool.tagvalues_count * sizeof(*pool.tagvalues));
+    }
+    const uint32_t *tags = (const uint32_t *) (data + index->tags_offset);
+    for (size_t i = 0; i < pool.tags_count; i++) {
+        pool.tags[i].tagid = tags[2 * i];
+        pool.tags[i].tagvalues_count = tags[2 * i + 1];
+        pool.tags[i].tagvalues = NULL;
+    }
+    const uint32_t *tags_counts = (const uint32_t *) (data + index->entries_offset);
+    for (size_t i = 0; i < loaded->entries_count; i++) {
+        loaded->entries[i].tags_count = tags_counts[i];
+    }
+    mobi_indx_pool_attach(loaded, &pool);
+    *indx = loaded;
+    return MOBI_SUCCESS;
+}
+
+/**
+ @brief Load FDST record and indices from sidecar file set with mobi_set_sidecar()
+ 
+ Only parts requested by parsing options are loaded,
+ and only if sidecar was written for the same content of source records.
+ Parts already present in rawml structure are not replaced.
+ 
+ @param[in,out] rawml MOBIRawml structure
+ @param[in] m MOBIData structure
+ @param[in] parse_toc Load content indices if true
+ @param[in] parse_dict Load dictionary indices if true
+ @return Number of loaded parts, 0 if sidecar is not used, missing or outdated
+ */
+size_t mobi_sidecar_load(MOBIRawml *rawml, const MOBIData *m, const bool parse_toc, const bool parse_dict) {
+    const char *path = mobi_sidecar_path(m);
+    if (path == NULL || rawml == NULL) {
+        return 0;
+    }
+    size_t size = 0;
+    unsigned char *data = mobi_sidecar_map(path, &size);
+    if (data == NULL) {
+        debug_print("Sidecar %s not found\n", path);
+        return 0;
+    }
+    MOBISidecarHeader header;
+    if (!mobi_sidecar_check_header(&header, data, size, m)) {
+        debug_print("Sidecar %s is outdated or invalid\n", path);
+        mobi_sidecar_unmap(data, size);
+        return 0;
+    }
+    size_t loaded = 0;
+    if (header.fdst_count && rawml->fdst == NULL) {
+        if (mobi_sidecar_load_fdst(rawml, data, &header) == MOBI_SUCCESS) {
+            loaded++;
+        }
+    }
+    bool requested[MOBI_SIDECAR_KINDS] = { true, true, parse_toc, parse_toc, parse_dict, parse_dict };
+    if (!mobi_is_dictionary(m)) {
+        requested[MOBI_SIDECAR_ORTH] = requested[MOBI_SIDECAR_INFL] = false;
+    }
+    MOBIIndx **slots[MOBI_SIDECAR_KINDS] = { &rawml->skel, &rawml->frag, &rawml->guide, &rawml->ncx, &rawml->orth, &rawml->infl };
+    for (size_t i = 0; i < header.indices_count; i++) {
+        MOBISidecarIndex index;
+        memcpy(&index, data + header.indices_offset + i * sizeof(index), sizeof(index));
+        if (index.kind >= MOBI_SIDECAR_KINDS || !requested[index.kind] || *slots[index.kind]) {
+            continue;
+        }
+        MOBIPdbRecord *last = NULL;
+        if (!mobi_sidecar_check_stored_index(&last, m, data, size, &index)) {
+            continue;
+        }
+        MOBIPdbRecord *cncx_record = index.cncx_records_count ? mobi_next_record(m, last) : NULL;
+        if (mobi_sidecar_load_index(slots[index.kind], data, &index, cncx_record) == MOBI_SUCCESS) {
+            loaded++;
+        }
+    }
+    mobi_sidecar_unmap(data, size);
+    debug_print("Loaded %zu parts from sidecar %s\n", loaded, path);
+    return loaded;
+}
+
+/**
+ @brief Count parts of rawml structure stored in sidecar file
+ 
+ @param[in] rawml MOBIRawml structure
+ @return Number of parsed indices and FDST record
+ */
+size_t mobi_sidecar_count(const MOBIRawml *rawml) {
+    if (rawml == NULL) {
+        return 0;
+    }
+    const MOBIIndx *indices[MOBI_SIDECAR_KINDS] = { rawml->skel, rawml->frag, rawml->guide, rawml->ncx, rawml->orth, rawml->infl };
+    size_t count = rawml->fdst ? 1 : 0;
+    for (size_t i = 0; i < MOBI_SIDECAR_KINDS; i++) {
+        if (indices[i]) {
+            count++;
+        }
+    }
+    return count;
+}
+
+/**
+ @brief Fill index description with sizes of entries data
+ 
+ @param[in,out] index MOBISidecarIndex structure
+ @param[in] indx MOBIIndx structure
+ */
+static void mobi_sidecar_index_sizes(MOBISidecarIndex *index, const MOBIIndx *indx) {
+    index->type = indx->type;
+    index->encoding = indx->encoding;
+    index->entries_count = indx->entries_count;
+    index->total_entries_count = indx->total_entries_count;
+    index->ordt_offset = indx->ordt_offset;
+    index->ligt_offset = indx->ligt_offset;
+    index->ligt_entries_count = indx->ligt_entries_count;
+    index->cncx_records_count = indx->cncx_records_count;
+    index->name_size = indx->orth_index_name ? strlen(indx->orth_index_name) : 0;
+    for (size_t i = 0; i < indx->entries_count; i++) {
+        const MOBIIndexEntry *entry = &indx->entries[i];
+        index->labels_size += (entry->label ? strlen(entry->label) : 0) + 1;
+        index->tags_count += entry->tags_count;
+        for (size_t j = 0; j < entry->tags_count; j++) {
+            index->tagvalues_count += entry->tags[j].tagvalues_count;
+        }
+    }
+}
+
+/**
+ @brief Copy entries data of index into sidecar file data
+ 
+ @param[in,out] data Sidecar file data
+ @param[in] index MOBISidecarIndex structure with offsets of sections
+ @param[in] indx MOBIIndx structure
+ */
+static void mobi_sidecar_index_fill(unsigned char *data, const MOBISidecarIndex *index, const MOBIIndx *indx) {
+    uint32_t *tags_counts = (uint32_t *) (data + index->entries_offset);
+    uint32_t *tags = (uint32_t *) (data + index->tags_offset);
+    uint32_t *tagvalues = (uint32_t *) (data + index->tagvalues_offset);
+    unsigned char *labels = data + index->labels_offset;
+    for (size_t i = 0; i < indx->entries_count; i++) {
+        const MOBIIndexEntry *entry = &indx->entries[i];
+        const char *label = entry->label ? entry->label : "";
+        const size_t label_size = strlen(label) + 1;
+        memcpy(labels, label, label_size);
+        labels += label_size;
+        *tags_counts++ = (uint32_t) entry->tags_count;
+        for (size_t j = 0; j < entry->tags_count; j++) {
+            const MOBIIndexTag *tag = &entry->tags[j];
+            *tags++ = (uint32_t) tag->tagid;
+            *tags++ = (uint32_t) tag->tagvalues_count;
+            if (tag->tagvalues_count) {
+                memcpy(tagvalues, tag->tagvalues, tag->tagvalues_count * sizeof(*tagvalues));
+                tagvalues += tag->tagvalues_count;
+            }
+        }
+    }
+    if (index->name_size) {
+        memcpy(data + index->name_offset, indx->orth_index_name, (size_t) index->name_size);
+    }
+}
+
+/**
+ @brief Copy entries data of index stored in previous sidecar file into new sidecar file data
+ 
+ @param[in,out] data New sidecar file data
+ @param[in] index MOBISidecarIndex structure with offsets of sections in new file
+ @param[in] old_data Previous sidecar file data
+ @param[in] old_index Validated MOBISidecarIndex structure with offsets of sections in previous file
+ */
+static void mobi_sidecar_index_copy(unsigned char *data, const MOBISidecarIndex *index, const unsigned char *old_data, const MOBISidecarIndex *old_index) {
+    memcpy(data + index->entries_offset, old_data + old_index->entries_offset, (size_t) index->entries_count * sizeof(uint32_t));
+    memcpy(data + index->tags_offset, old_data + old_index->tags_offset, (size_t) index->tags_count * 2 * sizeof(uint32_t));
+    memcpy(data + index->tagvalues_offset, old_data + old_index->tagvalues_offset, (size_t) index->tagvalues_count * sizeof(uint32_t));
+    memcpy(data + index->labels_offset, old_data + old_index->labels_offset, (size_t) index->labels_size);
+    memcpy(data + index->name_offset, old_data + old_index->name_offset, (size_t) index->name_size);
+}
+
+/**
+ @brief Open temporary file in directory of sidecar file
+ 
+ File name is made unique with mkstemp(), where it is not available fixed name is used.
+ 
+ @param[out] file Will be set to file opened for writing, NULL on failure
+ @param[out] tmp_path Will be set to allocated path of temporary file, NULL on failure
+ @param[in] path Path of sidecar file
+ @return MOBI_RET status code (on success MOBI_SUCCESS)
+ */
+static MOBI_RET mobi_sidecar_open_tmp(FILE **file, char **tmp_path, const char *path) {
+    *file = NULL;
+    const size_t path_length = strlen(path);
+    *tmp_path = malloc(path_length + sizeof(MOBI_SIDECAR_TMPSUFFIX));
+    if (*tmp_path == NULL) {
+        debug_print("%s\n", "Memory allocation failed");
+        return MOBI_MALLOC_FAILED;
+    }
+    memcpy(*tmp_path, path, path_length);
+    memcpy(*tmp_path + path_length, MOBI_SIDECAR_TMPSUFFIX, sizeof(MOBI_SIDECAR_TMPSUFFIX));
+#if defined(HAVE_MKSTEMP) && defined(HAVE_UNISTD_H)
+    const int fd = mkstemp(*tmp_path);
+    if (fd != -1) {
+        *file = fdopen(fd, "wb");
+        if (*file == NULL) {
+            close(fd);
+            remove(*tmp_path);
+        }
+    }
+#else
+    *file = fopen(*tmp_path, "wb");
+#endif
+    if (*file == NULL) {
+        debug_print("Could not open sidecar %s for writing\n", *tmp_path);
+        free(*tmp_path);
+        *tmp_path = NULL;
+        return MOBI_WRITE_FAILED;
+    }
+    return MOBI_SUCCESS;
+}
+
+/**
+ @brief Write FDST record and indices of rawml structure to sidecar file set with mobi_set_sidecar()
+ 
+ Valid parts of existing sidecar file, which are not present in rawml structure, are kept.
+ File is written under unique temporary name in the same directory and renamed to sidecar path,
+ so that readers never see partially written sidecar.
+ 
+ @param[in] rawml MOBIRawml structure with parsed indices
+ @param[in] m MOBIData structure
+ @return MOBI_RET status code (on success MOBI_SUCCESS)
+ */
+MOBI_RET mobi_sidecar_save(const MOBIRawml *rawml, const MOBIData *m) {
+    const char *path = mobi_sidecar_path(m);
+    if (path == NULL || rawml == NULL) {
+        return MOBI_SUCCESS;
+    }
+    const MOBIIndx *indices[MOBI_SIDECAR_KINDS] = { rawml->skel, rawml->frag, rawml->guide, rawml->ncx, rawml->orth, rawml->infl };
+    MOBISidecarIndex index[MOBI_SIDECAR_KINDS];
+    memset(index, 0, sizeof(index));
+    /* existing sidecar written for the same document */
+    size_t old_size = 0;
+    MOBISidecarHeader old_header;
+    unsigned char *old_data = mobi_sidecar_map(path, &old_size);
+    if (old_data && !mobi_sidecar_check_header(&old_header, old_data, old_size, m)) {
+        mobi_sidecar_unmap(old_data, old_size);
+        old_data = NULL;
+    }
+    /* indices kept from existing sidecar, with offsets of their sections in it */
+    MOBISidecarIndex old_index[MOBI_SIDECAR_KINDS];
+    bool is_kept[MOBI_SIDECAR_KINDS] = { false };
+    MOBISidecarHeader header;
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, MOBI_SIDECAR_MAGIC, sizeof(header.magic));
+    header.version = MOBI_SIDECAR_VERSION;
+    header.byte_order = MOBI_SIDECAR_BYTEORDER;
+    header.key = mobi_sidecar_document_key(m);
+    /* layout of sections */
+    const size_t data_offset = mobi_sidecar_align(sizeof(header));
+    size_t offset = data_offset;
+    size_t count = 0;
+    for (size_t i = 0; i < MOBI_SIDECAR_KINDS; i++) {
+        const size_t record_number = mobi_sidecar_record_number(m, (MOBISidecarKind) i);
+        if (record_number == MOBI_NOTSET) {
+            continue;
+        }
+        MOBISidecarIndex *curr = &index[count];
+        MOBIPdbRecord *last = NULL;
+        if (indices[i]) {
+            curr->kind = i;
+            curr->record_number = record_number;
+            curr->key = mobi_sidecar_index_key(m, record_number, &last);
+            mobi_sidecar_index_sizes(curr, indices[i]);
+            count++;
+            continue;
+        }
+        for (size_t j = 0; old_data && j < old_header.indices_count; j++) {
+            memcpy(&old_index[count], old_data + old_header.indices_offset + j * sizeof(MOBISidecarIndex), sizeof(MOBISidecarIndex));
+            if (old_index[count].kind == i && mobi_sidecar_check_stored_index(&last, m, old_data, old_size, &old_index[count])) {
+                *curr = old_index[count];
+                is_kept[count] = true;
+                count++;
+                break;
+            }
+        }
+    }
+    header.indices_count = count;
+    header.indices_offset = offset;
+    offset += mobi_sidecar_align(count * sizeof(MOBISidecarIndex));
+    const unsigned char *fdst_starts = NULL;
+    const unsigned char *fdst_ends = NULL;
+    if (rawml->fdst) {
+        header.fdst_count = rawml->fdst->fdst_section_count;
+        fdst_starts = (const unsigned char *) rawml->fdst->fdst_section_starts;
+        fdst_ends = (const unsigned char *) rawml->fdst->fdst_section_ends;
+    } else if (old_data && old_header.fdst_count
+               && mobi_sidecar_check_section(old_size, old_header.fdst_offset, old_header.fdst_count, 2 * sizeof(uint32_t))) {
+        header.fdst_count = old_header.fdst_count;
+        fdst_starts = old_data + old_header.fdst_offset;
+        fdst_ends = fdst_starts + old_header.fdst_count * sizeof(uint32_t);
+    }
+    if (header.fdst_count) {
+        header.fdst_offset = offset;
+        offset += mobi_sidecar_align(2 * (size_t) header.fdst_count * sizeof(uint32_t));
+    }
+    for (size_t i = 0; i < count; i++) {
+        MOBISidecarIndex *curr = &index[i];
+        curr->entries_offset = offset;
+        offset += mobi_sidecar_align((size_t) curr->entries_count * sizeof(uint32_t));
+        curr->tags_offset = offset;
+        offset += mobi_sidecar_align((size_t) curr->tags_count * 2 * sizeof(uint32_t));
+        curr->tagvalues_offset = offset;
+        offset += mobi_sidecar_align((size_t) curr->tagvalues_count * sizeof(uint32_t));
+        curr->labels_offset = offset;
+        offset += mobi_sidecar_align((size_t) curr->labels_size);
+        curr->name_offset = offset;
+        offset += mobi_sidecar_align((size_t) curr->name_size);
+    }
+    header.file_size = offset;
+    /* sections data, padding is zeroed */
+    unsigned char *data = calloc(1, offset);
+    if (data == NULL) {
+        debug_print("Memory allocation failed (%zu bytes)\n", offset);
+        if (old_data) {
+            mobi_sidecar_unmap(old_data, old_size);
+        }
+        return MOBI_MALLOC_FAILED;
+    }
+    memcpy(data + header.indices_offset, index, count * sizeof(MOBISidecarIndex));
+    if (header.fdst_count) {
+        const size_t fdst_size = (size_t) header.fdst_count * sizeof(uint32_t);
+        memcpy(data + header.fdst_offset, fdst_starts, fdst_size);
+        memcpy(data + header.fdst_offset + fdst_size, fdst_ends, fdst_size);
+    }
+    for (size_t i = 0; i < count; i++) {
+        if (is_kept[i]) {
+            mobi_sidecar_index_copy(data, &index[i], old_data, &old_index[i]);
+        } else {
+            mobi_sidecar_index_fill(data, &index[i], indices[index[i].kind]);
+        }
+    }
+    if (old_data) {
+        mobi_sidecar_unmap(old_data, old_size);
+    }
+    header.checksum = mobi_sidecar_checksum(&header, data);
+    memcpy(data, &header, sizeof(header));
+    /* write under temporary name */
+    FILE *file;
+    char *tmp_path;
+    MOBI_RET ret = mobi_sidecar_open_tmp(&file, &tmp_path, path);
+    if (ret != MOBI_SUCCESS) {
+        free(data);
+        return ret;
+    }
+    const size_t written = fwrite(data, 1, offset, file);
+    if (fclose(file) != 0 || written != offset) {
+        debug_print("Writing sidecar %s failed\n", tmp_path);
+        ret = MOBI_WRITE_FAILED;
+    }
+    if (ret == MOBI_SUCCESS && rename(tmp_path, path) != 0) {
+        /* rename does not replace existing file on some platforms */
+        remove(path);
+        if (rename(tmp_path, path) != 0) {
+            debug_print("Renaming sidecar %s failed\n", tmp_path);
+            ret = MOBI_WRITE_FAILED;
+        }
+    }
+    if (ret != MOBI_SUCCESS) {
+        remove(tmp_path);
+    }
+    free(tmp_path);
+    free(data);
+    return ret;
+}
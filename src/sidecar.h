@@ -0,0 +1,90 @@
+/** @file sidecar.h
+ *
+ * Copyright (c) 2026 Bartek Fabiszewski
+ * http://www.fabiszewski.net
+ *
+ * This file is part of libmobi.
+ * Licensed under LGPL, either version 3, or any later.
+ * See <http://www.gnu.org/licenses/>
+ */
+
+#ifndef libmobi_sidecar_h
+#define libmobi_sidecar_h
+
+#include "config.h"
+#include "mobi.h"
+
+#define MOBI_SIDECAR_MAGIC "MOBISIDE" /**< Magic string of sidecar file */
+#define MOBI_SIDECAR_VERSION 1 /**< Version of sidecar file format */
+#define MOBI_SIDECAR_BYTEORDER 0x01020304 /**< Written in native byte order, sidecar is rejected on mismatch */
+#define MOBI_SIDECAR_ALIGN 8 /**< Alignment of sections in sidecar file */
+#define MOBI_SIDECAR_TMPSUFFIX ".XXXXXX" /**< Template suffix of temporary file renamed to sidecar path when written */
+
+/**
+ @brief Kind of index stored in sidecar file
+ */
+typedef enum {
+    MOBI_SIDECAR_SKEL = 0, /**< Skeleton index */
+    MOBI_SIDECAR_FRAG, /**< Fragments index */
+    MOBI_SIDECAR_GUIDE, /**< Guide index */
+    MOBI_SIDECAR_NCX, /**< NCX index */
+    MOBI_SIDECAR_ORTH, /**< Orth index */
+    MOBI_SIDECAR_INFL, /**< Infl index */
+    MOBI_SIDECAR_KINDS /**< Number of index kinds */
+} MOBISidecarKind;
+
+/**
+ @brief Header of sidecar file
+ 
+ Sidecar file holds parsed FDST record and parsed indices of the document.
+ All values are stored in native byte order, sections are aligned to MOBI_SIDECAR_ALIGN bytes,
+ so that arrays of mapped file may be read in place. Loaded indices own copies of labels and tag values,
+ so that file is unmapped after loading.
+ */
+typedef struct {
+    char magic[8]; /**< MOBI_SIDECAR_MAGIC */
+    uint32_t version; /**< MOBI_SIDECAR_VERSION */
+    uint32_t byte_order; /**< MOBI_SIDECAR_BYTEORDER */
+    uint64_t key; /**< Hash of document header records and FDST record */
+    uint64_t file_size; /**< Size of sidecar file */
+    uint64_t checksum; /**< Hash of the header and MOBISidecarIndex array */
+    uint64_t fdst_count; /**< Number of FDST sections, 0 if FDST is not stored */
+    uint64_t fdst_offset; /**< Offset of FDST section starts array followed by section ends array (uint32_t) */
+    uint64_t indices_count; /**< Number of stored indices */
+    uint64_t indices_offset; /**< Offset of MOBISidecarIndex array */
+} MOBISidecarHeader;
+
+/**
+ @brief Index stored in sidecar file
+ 
+ Entries data is stored the same way parsed index keeps it in memory:
+ packed zero terminated labels, tags of all entries and tag values of all tags, in entries order.
+ */
+typedef struct {
+    uint64_t kind; /**< MOBISidecarKind */
+    uint64_t record_number; /**< Sequential number of the first index record */
+    uint64_t key; /**< Hash of meta record and sizes of data records of the index */
+    uint64_t type; /**< Index type */
+    uint64_t encoding; /**< Index encoding */
+    uint64_t entries_count; /**< Index entries count */
+    uint64_t total_entries_count; /**< Total index entries count */
+    uint64_t ordt_offset; /**< ORDT offset */
+    uint64_t ligt_offset; /**< LIGT offset */
+    uint64_t ligt_entries_count; /**< LIGT index entries count */
+    uint64_t cncx_records_count; /**< Number of compiled NCX records */
+    uint64_t entries_offset; /**< Offset of tags count of each entry (uint32_t) */
+    uint64_t tags_count; /**< Number of tags of all entries */
+    uint64_t tags_offset; /**< Offset of tags as pairs of tag id and values count (uint32_t) */
+    uint64_t tagvalues_count; /**< Number of values of all tags */
+    uint64_t tagvalues_offset; /**< Offset of tag values (uint32_t) */
+    uint64_t labels_size; /**< Size of packed labels */
+    uint64_t labels_offset; /**< Offset of packed labels */
+    uint64_t name_size; /**< Length of orth index name, 0 if not present */
+    uint64_t name_offset; /**< Offset of orth index name, not zero terminated */
+} MOBISidecarIndex;
+
+size_t mobi_sidecar_load(MOBIRawml *rawml, const MOBIData *m, const bool parse_toc, const bool parse_dict);
+size_t mobi_sidecar_count(const MOBIRawml *rawml);
+MOBI_RET mobi_sidecar_save(const MOBIRawml *rawml, const MOBIData *m);
+
+#endif
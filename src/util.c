@@ -20,6 +20,7 @@
 #include "util.h"
 #include "parse_rawml.h"
 #include "index.h"
+#include "cache.h"
 #include "debug.h"
 
 #ifdef USE_ENCRYPTION
@@ -30,6 +31,10 @@
 #include "opf.h"
 #endif
 
+#ifdef USE_THREADS
+#include <pthread.h>
+#endif
+
 #define MOBI_FONT_OBFUSCATED_BUFFER_COUNT 52
 
 /** @brief Lookup table for cp1252 to utf8 encoding conversion */
@@ -842,20 +847,138 @@ MOBI_RET mobi_set_pdbname(MOBIData *m, const char *name) {
 }
 
 /**
- @brief Get palm database record with given unique id
+ @brief Get hash table slot for given record uid
  
- @param[in] m MOBIData structure with loaded data
  @param[in] uid Unique id
- @return Pointer to MOBIPdbRecord record structure, NULL on failure
+ @param[in] bits Hash table size is 2^bits
+ @return Slot index
  */
-MOBIPdbRecord * mobi_get_record_by_uid(const MOBIData *m, const size_t uid) {
-    if (m == NULL) {
+static size_t mobi_rectable_slot(const size_t uid, const size_t bits) {
+    return (size_t) (((uint32_t) uid * 2654435761U) >> (32 - bits));
+}
+
+/**
+ @brief Build index of palm database records
+ 
+ Index holds array of records in sequential order and hash table of records keyed by uid.
+ It is shared by both parts of hybrid file and freed with mobi_free_rectable().
+ It is built under internals lock.
+ 
+ @param[in] m MOBIData structure with loaded records list
+ @return MOBI_RET status code (on success MOBI_SUCCESS)
+ */
+MOBI_RET mobi_build_rectable(const MOBIData *m) {
+    if (m == NULL || m->internals == NULL) {
         debug_print("%s", "Mobi structure not initialized\n");
+        return MOBI_INIT_FAILED;
+    }
+    mobi_lock_internals(m);
+    MOBIInternals *internals = m->internals;
+    if (internals->rectable) {
+        mobi_free_rectable(m);
+    }
+    size_t count = 0;
+    const MOBIPdbRecord *curr = m->rec;
+    while (curr != NULL) {
+        count++;
+        curr = curr->next;
+    }
+    if (count == 0) {
+        mobi_unlock_internals(m);
+        return MOBI_SUCCESS;
+    }
+    size_t bits = 4;
+    while (((size_t) 1 << bits) < 2 * count && bits < 31) {
+        bits++;
+    }
+    const size_t table_size = (size_t) 1 << bits;
+    MOBIRecTable *rectable = calloc(1, sizeof(MOBIRecTable));
+    if (rectable == NULL) {
+        debug_print("%s", "Memory allocation for records index failed\n");
+        mobi_unlock_internals(m);
+        return MOBI_MALLOC_FAILED;
+    }
+    rectable->records = malloc(count * sizeof(*rectable->records));
+    rectable->uid_table = calloc(table_size, sizeof(*rectable->uid_table));
+    if (rectable->records == NULL || rectable->uid_table == NULL) {
+        debug_print("%s", "Memory allocation for records index failed\n");
+        free(rectable->records);
+        free(rectable->uid_table);
+        free(rectable);
+        mobi_unlock_internals(m);
+        return MOBI_MALLOC_FAILED;
+    }
+    rectable->count = count;
+    rectable->uid_table_bits = bits;
+    MOBIPdbRecord *record = m->rec;
+    size_t i = 0;
+    while (record != NULL) {
+        rectable->records[i++] = record;
+        /* keep first record with given uid, like sequential search does */
+        size_t slot = mobi_rectable_slot(record->uid, bits);
+        while (rectable->uid_table[slot] != NULL && rectable->uid_table[slot]->uid != record->uid) {
+            slot = (slot + 1) & (table_size - 1);
+        }
+        if (rectable->uid_table[slot] == NULL) {
+            rectable->uid_table[slot] = record;
+        }
+        record = record->next;
+    }
+    internals->rectable = rectable;
+    mobi_unlock_internals(m);
+    return MOBI_SUCCESS;
+}
+
+/**
+ @brief Get index of palm database records, build it if needed
+ 
+ Must be called with internals locked, index may be rebuilt by other threads otherwise.
+ 
+ @param[in] m MOBIData structure with loaded records list
+ @return MOBIRecTable structure, NULL if index could not be built
+ */
+static const MOBIRecTable * mobi_get_rectable(const MOBIData *m) {
+    const MOBIInternals *internals = m->internals;
+    if (internals == NULL || m->rec == NULL) {
         return NULL;
     }
-    if (m->rec == NULL) {
+    if (internals->rectable && internals->rectable->records[0] != m->rec) {
+        /* records list head changed outside of library functions */
+        mobi_free_rectable(m);
+    }
+    if (internals->rectable == NULL && mobi_build_rectable(m) != MOBI_SUCCESS) {
         return NULL;
     }
+    return internals->rectable;
+}
+
+/**
+ @brief Find palm database record with given unique id, without reading its data
+ 
+ @param[in] m MOBIData structure with loaded records list
+ @param[in] uid Unique id
+ @return Pointer to MOBIPdbRecord record structure, NULL if not found
+ */
+static MOBIPdbRecord * mobi_find_record_by_uid(const MOBIData *m, const size_t uid) {
+    mobi_lock_internals(m);
+    const MOBIRecTable *rectable = mobi_get_rectable(m);
+    if (rectable) {
+        MOBIPdbRecord *record = NULL;
+        if (uid <= UINT32_MAX) {
+            const size_t mask = ((size_t) 1 << rectable->uid_table_bits) - 1;
+            size_t slot = mobi_rectable_slot(uid, rectable->uid_table_bits);
+            while (rectable->uid_table[slot] != NULL) {
+                if (rectable->uid_table[slot]->uid == uid) {
+                    record = rectable->uid_table[slot];
+                    break;
+                }
+                slot = (slot + 1) & mask;
+            }
+        }
+        mobi_unlock_internals(m);
+        return record;
+    }
+    mobi_unlock_internals(m);
     MOBIPdbRecord *curr = m->rec;
     while (curr != NULL) {
         if (curr->uid == uid) {
@@ -866,6 +989,57 @@ MOBIPdbRecord * mobi_get_record_by_uid(const MOBIData *m, const size_t uid) {
     return NULL;
 }
 
+/**
+ @brief Find palm database record with given sequential number, without reading its data
+ 
+ @param[in] m MOBIData structure with loaded records list
+ @param[in] num Sequential number
+ @return Pointer to MOBIPdbRecord record structure, NULL if not found
+ */
+static MOBIPdbRecord * mobi_find_record_by_seqnumber(const MOBIData *m, const size_t num) {
+    mobi_lock_internals(m);
+    const MOBIRecTable *rectable = mobi_get_rectable(m);
+    if (rectable) {
+        MOBIPdbRecord *record = num < rectable->count ? rectable->records[num] : NULL;
+        mobi_unlock_internals(m);
+        return record;
+    }
+    mobi_unlock_internals(m);
+    MOBIPdbRecord *curr = m->rec;
+    size_t i = 0;
+    while (curr != NULL) {
+        if (i++ == num) {
+            return curr;
+        }
+        curr = curr->next;
+    }
+    return NULL;
+}
+
+/**
+ @brief Get palm database record with given unique id
+ 
+ If document is loaded lazily, record data is read on first access.
+ 
+ @param[in] m MOBIData structure with loaded data
+ @param[in] uid Unique id
+ @return Pointer to MOBIPdbRecord record structure, NULL on failure
+ */
+MOBIPdbRecord * mobi_get_record_by_uid(const MOBIData *m, const size_t uid) {
+    if (m == NULL) {
+        debug_print("%s", "Mobi structure not initialized\n");
+        return NULL;
+    }
+    if (m->rec == NULL) {
+        return NULL;
+    }
+    MOBIPdbRecord *curr = mobi_find_record_by_uid(m, uid);
+    if (mobi_load_recdata_lazy(m, curr) != MOBI_SUCCESS) {
+        return NULL;
+    }
+    return curr;
+}
+
 /**
  @brief Get rawml->markup MOBIPart part by uid
  
@@ -1008,6 +1182,8 @@ MOBIFiletype mobi_get_resourcetype_by_uid(const MOBIRawml *rawml, const size_t u
 /**
  @brief Get palm database record with given sequential number (first record has number 0)
  
+ If document is loaded lazily, record data is read on first access.
+ 
  @param[in] m MOBIData structure with loaded data
  @param[in] num Sequential number
  @return Pointer to MOBIPdbRecord record structure, NULL on failure
@@ -1020,15 +1196,32 @@ MOBIPdbRecord * mobi_get_record_by_seqnumber(const MOBIData *m, const size_t num
     if (m->rec == NULL) {
         return NULL;
     }
-    MOBIPdbRecord *curr = m->rec;
-    size_t i = 0;
-    while (curr != NULL) {
-        if (i++ == num) {
-            return curr;
-        }
-        curr = curr->next;
+    MOBIPdbRecord *curr = mobi_find_record_by_seqnumber(m, num);
+    if (mobi_load_recdata_lazy(m, curr) != MOBI_SUCCESS) {
+        return NULL;
     }
-    return NULL;
+    return curr;
+}
+
+/**
+ @brief Get palm database record following given record
+ 
+ If document is loaded lazily, record data is read on first access.
+ Use it instead of record->next to iterate over records of lazily loaded document.
+ 
+ @param[in] m MOBIData structure with loaded data
+ @param[in] record Current record
+ @return Pointer to next MOBIPdbRecord record structure, NULL if last or on failure
+ */
+MOBIPdbRecord * mobi_next_record(const MOBIData *m, const MOBIPdbRecord *record) {
+    if (m == NULL || record == NULL) {
+        return NULL;
+    }
+    MOBIPdbRecord *next = record->next;
+    if (mobi_load_recdata_lazy(m, next) != MOBI_SUCCESS) {
+        return NULL;
+    }
+    return next;
 }
 
 /**
@@ -1044,12 +1237,12 @@ MOBIPdbRecord * mobi_get_record_by_magic(const MOBIData *m, const unsigned char
         return NULL;
     }
 
-    MOBIPdbRecord *curr = m->rec;
+    MOBIPdbRecord *curr = mobi_get_record_by_seqnumber(m, 0);
     while (curr != NULL) {
-        if (curr->size >= 4 && memcmp(curr->data, magic, 4) != 0) {
+        if (curr->size >= 4 && memcmp(curr->data, magic, 4) == 0) {
             return curr;
         }
-        curr = curr->next;
+        curr = mobi_next_record(m, curr);
     }
     return NULL;
 }
@@ -1076,7 +1269,7 @@ MOBIPdbRecord * mobi_extract_records_by_seqnumber(MOBIData *m, const size_t num,
     MOBIPdbRecord *prev = NULL;
     MOBIPdbRecord *curr = NULL;
     if (num > 0) {
-        root = mobi_get_record_by_seqnumber(m, num - 1);
+        root = mobi_find_record_by_seqnumber(m, num - 1);
         if (root) {
             curr = root->next;
         }
@@ -1103,6 +1296,7 @@ MOBIPdbRecord * mobi_extract_records_by_seqnumber(MOBIData *m, const size_t num,
         root->next = prev->next;
     }
     prev->next = NULL;
+    mobi_free_rectable(m);
     
     *count = i;
     if (m->ph->rec_count >= i) {
@@ -1152,7 +1346,7 @@ MOBI_RET mobi_insert_records_by_seqnumber(MOBIData *m, MOBIPdbRecord *record, co
         next = m->rec;
         m->rec = record;
     } else {
-        MOBIPdbRecord *prev = mobi_get_record_by_seqnumber(m, num - 1);
+        MOBIPdbRecord *prev = mobi_find_record_by_seqnumber(m, num - 1);
         if (prev == NULL) {
             debug_print("%s", "Insert point not found\n");
             return MOBI_DATA_CORRUPT;
@@ -1161,6 +1355,7 @@ MOBI_RET mobi_insert_records_by_seqnumber(MOBIData *m, MOBIPdbRecord *record, co
         prev->next = record;
     }
     curr->next = next;
+    mobi_free_rectable(m);
     m->ph->rec_count += count;
 
     debug_print("Inserted %zu records at index = %zu\n", count, num);
@@ -1187,7 +1382,7 @@ MOBI_RET mobi_delete_records_by_seqnumber(MOBIData *m, const size_t num, size_t
     while (curr != NULL) {
         MOBIPdbRecord *tmp = curr;
         curr = curr->next;
-        free(tmp->data);
+        mobi_free_record_data(m, tmp);
         free(tmp);
         tmp = NULL;
     }
@@ -1785,10 +1980,603 @@ int mobi_bitcount(const uint8_t byte) {
     return setbits[byte];
 }
 
+/**
+ @brief Set maximal number of threads used for processing document
+ 
+ With more than one thread, text records are decompressed in parallel
+ by mobi_get_rawml(), mobi_dump_rawml() and mobi_parse_rawml(),
+ decrypted by mobi_drm_decrypt() and encrypted by mobi_drm_encrypt().
+ Data records of large indices are parsed in parallel by mobi_parse_rawml().
+ Option is ignored if library was built without threads support.
+ 
+ @param[in,out] m MOBIData structure
+ @param[in] threads Number of threads, 1 (default) processes everything in calling thread
+ @return MOBI_RET status code (on success MOBI_SUCCESS)
+ */
+MOBI_RET mobi_set_threads(MOBIData *m, const size_t threads) {
+    if (m == NULL || m->internals == NULL) {
+        debug_print("%s", "Mobi structure not initialized\n");
+        return MOBI_INIT_FAILED;
+    }
+    if (threads == 0 || threads > MOBI_THREADS_MAX) {
+        debug_print("Wrong number of threads: %zu\n", threads);
+        return MOBI_PARAM_ERR;
+    }
+    MOBIInternals *internals = m->internals;
+    internals->threads = threads;
+    return MOBI_SUCCESS;
+}
+
+/**
+ @brief Get maximal number of threads used for processing document
+ 
+ @param[in] m MOBIData structure
+ @return Number of threads, 1 if threads are not supported
+ */
+size_t mobi_get_threads(const MOBIData *m) {
+#ifdef USE_THREADS
+    if (m && m->internals) {
+        const MOBIInternals *internals = m->internals;
+        return internals->threads;
+    }
+#else
+    UNUSED(m);
+#endif
+    return 1;
+}
+
+#ifdef USE_THREADS
+/**
+ @brief Task started in a separate thread by mobi_run_tasks()
+ */
+typedef struct {
+    void (*function)(void *task); /**< Task function */
+    void *task; /**< Task data */
+    pthread_t thread; /**< Thread running the task */
+    bool started; /**< Whether thread was started */
+} MOBIThreadTask;
+
+/**
+ @brief Thread start routine for mobi_run_tasks()
+ 
+ @param[in,out] arg MOBIThreadTask structure
+ @return NULL
+ */
+static void * mobi_thread_start(void *arg) {
+    MOBIThreadTask *thread_task = arg;
+    thread_task->function(thread_task->task);
+    return NULL;
+}
+#endif
+
+/**
+ @brief Run tasks in parallel and wait for all of them to finish
+ 
+ Every task except the first one is started in a new thread,
+ the first one is run in calling thread.
+ If library was built without threads support or thread could not be created,
+ task is run in calling thread.
+ 
+ @param[in,out] tasks Array of task structures
+ @param[in] task_size Size of single task structure
+ @param[in] count Number of tasks
+ @param[in] function Function called with pointer to each task
+ */
+void mobi_run_tasks(void *tasks, const size_t task_size, const size_t count, void (*function)(void *task)) {
+    unsigned char *task = tasks;
+#ifdef USE_THREADS
+    MOBIThreadTask *threads = NULL;
+    if (count > 1) {
+        threads = calloc(count, sizeof(*threads));
+        if (threads == NULL) {
+            debug_print("%s\n", "Memory allocation failed, running tasks in calling thread");
+        }
+    }
+    if (threads) {
+        for (size_t i = 1; i < count; i++) {
+            threads[i].function = function;
+            threads[i].task = task + i * task_size;
+            threads[i].started = (pthread_create(&threads[i].thread, NULL, mobi_thread_start, &threads[i]) == 0);
+            if (!threads[i].started) {
+                debug_print("Creating thread for task %zu failed\n", i);
+            }
+        }
+        function(task);
+        for (size_t i = 1; i < count; i++) {
+            if (threads[i].started) {
+                pthread_join(threads[i].thread, NULL);
+            } else {
+                function(task + i * task_size);
+            }
+        }
+        free(threads);
+        return;
+    }
+#endif
+    for (size_t i = 0; i < count; i++) {
+        function(task + i * task_size);
+    }
+}
+
+/**
+ @brief Decompress single text record
+ 
+ @param[in] m MOBIData structure loaded with MOBI data
+ @param[in] record Text record
+ @param[in] extra_size Size of extra data at the end of the record
+ @param[out] out Memory area for decompressed data
+ @param[in,out] out_size Size of the memory area, on return set to decompressed data size
+ @param[in] huffcdic MOBIHuffCdic structure with parsed data from huff/cdic records, NULL for other compression types
+ @return MOBI_RET status code (on success MOBI_SUCCESS)
+ */
+static MOBI_RET mobi_decompress_record(const MOBIData *m, const MOBIPdbRecord *record, const size_t extra_size, unsigned char *out, size_t *out_size, const MOBIHuffCdic *huffcdic) {
+    if (extra_size > record->size) {
+        debug_print("Wrong record size: -%zu\n", extra_size - record->size);
+        return MOBI_DATA_CORRUPT;
+    }
+    const size_t record_size = record->size - extra_size;
+    MOBI_RET ret = MOBI_SUCCESS;
+    switch (m->rh->compression_type) {
+        case MOBI_COMPRESSION_NONE:
+            /* no compression */
+            if (record_size > *out_size) {
+                debug_print("Record too large: %zu\n", record_size);
+                return MOBI_DATA_CORRUPT;
+            }
+            memcpy(out, record->data, record_size);
+            *out_size = record_size;
+            if (mobi_exists_mobiheader(m) && mobi_get_fileversion(m) <= 3) {
+                /* workaround for some old files with null characters inside record */
+                mobi_remove_zeros(out, out_size);
+            }
+            break;
+        case MOBI_COMPRESSION_PALMDOC:
+            /* palmdoc lz77 compression */
+            ret = mobi_decompress_lz77(out, record->data, out_size, record_size);
+            break;
+        case MOBI_COMPRESSION_HUFFCDIC:
+            /* mobi huffman compression */
+            ret = mobi_decompress_huffman(out, record->data, out_size, record_size, huffcdic);
+            break;
+        default:
+            debug_print("%s", "Unknown compression type\n");
+            ret = MOBI_DATA_CORRUPT;
+    }
+    return ret;
+}
+
+/**
+ @brief Decompress single text record without modifying record data
+ 
+ Encrypted record is decrypted into scratch buffer before decompression.
+ 
+ @param[in] m MOBIData structure loaded with MOBI data
+ @param[in] record Text record
+ @param[out] out Memory area for decompressed data of mobi_get_textrecord_maxsize() size
+ @param[out] out_size Decompressed data size, 0 for empty record
+ @param[in] huffcdic MOBIHuffCdic structure with parsed data from huff/cdic records, NULL for other compression types
+ @param[in,out] scratch Buffer for decrypted data, reallocated if too small, must be freed by caller
+ @param[in,out] scratch_size Size of scratch buffer
+ @return MOBI_RET status code (on success MOBI_SUCCESS)
+ */
+static MOBI_RET mobi_decompress_text_record(const MOBIData *m, const MOBIPdbRecord *record, unsigned char *out, size_t *out_size, const MOBIHuffCdic *huffcdic, unsigned char **scratch, size_t *scratch_size) {
+    uint16_t extra_flags = 0;
+    if (m->mh && m->mh->extra_flags) {
+        extra_flags = *m->mh->extra_flags;
+    }
+    size_t extra_size = 0;
+    if (extra_flags) {
+        extra_size = mobi_get_record_extrasize(record, extra_flags);
+        if (extra_size == MOBI_NOTSET) {
+            return MOBI_DATA_CORRUPT;
+        }
+    }
+#ifdef USE_ENCRYPTION
+    if (mobi_is_encrypted(m) && mobi_has_drmkey(m)) {
+        const uint16_t compression_type = m->rh->compression_type;
+        if (compression_type != MOBI_COMPRESSION_HUFFCDIC) {
+            /* decrypt also multibyte extra data */
+            extra_size = mobi_get_record_extrasize(record, extra_flags & 0xfffe);
+        }
+        if (extra_size == MOBI_NOTSET || extra_size > record->size) {
+            return MOBI_DATA_CORRUPT;
+        }
+        if (record->size > *scratch_size) {
+            unsigned char *tmp = realloc(*scratch, record->size);
+            if (tmp == NULL) {
+                debug_print("%s\n", "Memory allocation failed");
+                return MOBI_MALLOC_FAILED;
+            }
+            *scratch = tmp;
+            *scratch_size = record->size;
+        }
+        const size_t decrypt_size = record->size - extra_size;
+        if (decrypt_size) {
+            MOBI_RET ret = mobi_buffer_decrypt(*scratch, record->data, decrypt_size, m);
+            if (ret != MOBI_SUCCESS) {
+                return ret;
+            }
+        }
+        memcpy(*scratch + decrypt_size, record->data + decrypt_size, extra_size);
+        MOBIPdbRecord decrypted = *record;
+        decrypted.data = *scratch;
+        if (compression_type != MOBI_COMPRESSION_HUFFCDIC && (extra_flags & 1)) {
+            /* update multibyte data size after decryption */
+            extra_size = mobi_get_record_extrasize(&decrypted, extra_flags);
+            if (extra_size == MOBI_NOTSET) {
+                return MOBI_DATA_CORRUPT;
+            }
+        }
+        if (extra_size == decrypted.size) {
+            *out_size = 0;
+            return MOBI_SUCCESS;
+        }
+        *out_size = mobi_get_textrecord_maxsize(m);
+        return mobi_decompress_record(m, &decrypted, extra_size, out, out_size, huffcdic);
+    }
+#else
+    UNUSED(scratch);
+    UNUSED(scratch_size);
+#endif
+    if (extra_size == record->size) {
+        *out_size = 0;
+        return MOBI_SUCCESS;
+    }
+    *out_size = mobi_get_textrecord_maxsize(m);
+    return mobi_decompress_record(m, record, extra_size, out, out_size, huffcdic);
+}
+
+/**
+ @brief Load huff/cdic tables, if text is compressed with huffman coding
+ 
+ Tables are parsed once and kept in internals for each part of hybrid file,
+ until document is freed or its records are modified.
+ 
+ @param[in] m MOBIData structure loaded with MOBI data
+ @param[out] huffcdic MOBIHuffCdic structure with parsed data, NULL for other compression types,
+ owned by the document, must not be freed
+ @return MOBI_RET status code (on success MOBI_SUCCESS)
+ */
+static MOBI_RET mobi_load_huffcdic(const MOBIData *m, MOBIHuffCdic **huffcdic) {
+    *huffcdic = NULL;
+    if (m->rh->compression_type != MOBI_COMPRESSION_HUFFCDIC) {
+        return MOBI_SUCCESS;
+    }
+    MOBIInternals *internals = m->internals;
+    const size_t part = mobi_get_kf8offset(m) ? 1 : 0;
+    MOBI_RET ret = MOBI_SUCCESS;
+    mobi_lock_internals(m);
+    if (internals->huffcdic[part] == NULL) {
+        MOBIHuffCdic *tables = mobi_init_huffcdic();
+        if (tables == NULL) {
+            debug_print("%s\n", "Memory allocation failed");
+            ret = MOBI_MALLOC_FAILED;
+        } else {
+            ret = mobi_parse_huffdic(m, tables);
+            if (ret == MOBI_SUCCESS) {
+                internals->huffcdic[part] = tables;
+            } else {
+                mobi_free_huffcdic(tables);
+            }
+        }
+    }
+    *huffcdic = internals->huffcdic[part];
+    mobi_unlock_internals(m);
+    return ret;
+}
+
+/**
+ @brief State of text records decompression, used by single thread
+ */
+typedef struct {
+    const MOBIData *m; /**< MOBIData structure loaded with MOBI data */
+    MOBIHuffCdic *huffcdic; /**< Parsed huff/cdic data owned by the document, NULL until first needed or for other compression types */
+    unsigned char *scratch; /**< Buffer for decrypted data */
+    size_t scratch_size; /**< Size of scratch buffer */
+    MOBIRecordCache *cache; /**< Cache of decompressed records, NULL if not used */
+    uint64_t cache_id; /**< Identity of the document in cache */
+} MOBITextReader;
+
+/**
+ @brief Initialize MOBITextReader structure
+ 
+ @param[out] reader MOBITextReader structure
+ @param[in] m MOBIData structure loaded with MOBI data
+ @param[in] huffcdic Already parsed huff/cdic data, NULL to load it on first use
+ */
+static void mobi_text_reader_init(MOBITextReader *reader, const MOBIData *m, MOBIHuffCdic *huffcdic) {
+    const MOBIInternals *internals = m->internals;
+    reader->m = m;
+    reader->huffcdic = huffcdic;
+    reader->scratch = NULL;
+    reader->scratch_size = 0;
+    reader->cache = internals ? internals->cache : NULL;
+    reader->cache_id = internals ? internals->cache_id : 0;
+}
+
+/**
+ @brief Free data allocated by MOBITextReader
+ 
+ @param[in,out] reader MOBITextReader structure
+ */
+static void mobi_text_reader_free(MOBITextReader *reader) {
+    reader->huffcdic = NULL;
+    free(reader->scratch);
+    reader->scratch = NULL;
+    reader->scratch_size = 0;
+}
+
+/**
+ @brief Get decompressed text record, from cache if available, with options
+ 
+ Record data is not modified, also for encrypted documents.
+ Huff/cdic tables are loaded only if record is not found in cache.
+ 
+ @param[in,out] reader MOBITextReader structure
+ @param[in] record Text record
+ @param[in] seqnumber Sequential number of the record
+ @param[out] out Memory area for decompressed data of mobi_get_textrecord_maxsize() size
+ @param[out] out_size Decompressed data size, 0 for empty record
+ @param[in] store If true, decompressed record is stored in cache
+ @return MOBI_RET status code (on success MOBI_SUCCESS)
+ */
+static MOBI_RET mobi_read_text_record_opt(MOBITextReader *reader, const MOBIPdbRecord *record, const size_t seqnumber,
+                                          unsigned char *out, size_t *out_size, const bool store) {
+    const MOBIData *m = reader->m;
+    if (reader->cache) {
+        *out_size = mobi_get_textrecord_maxsize(m);
+        if (mobi_cache_get(reader->cache, reader->cache_id, seqnumber, out, out_size)) {
+            return MOBI_SUCCESS;
+        }
+    }
+    if (reader->huffcdic == NULL && m->rh->compression_type == MOBI_COMPRESSION_HUFFCDIC) {
+        MOBI_RET ret = mobi_load_huffcdic(m, &reader->huffcdic);
+        if (ret != MOBI_SUCCESS) {
+            return ret;
+        }
+    }
+    MOBI_RET ret = mobi_decompress_text_record(m, record, out, out_size, reader->huffcdic, &reader->scratch, &reader->scratch_size);
+    if (ret == MOBI_SUCCESS && store && reader->cache && *out_size) {
+        mobi_cache_put(reader->cache, reader->cache_id, seqnumber, out, *out_size);
+    }
+    return ret;
+}
+
+/**
+ @brief Get decompressed text record, from cache if available
+ 
+ Record data is not modified, also for encrypted documents.
+ Huff/cdic tables are loaded only if record is not found in cache.
+ Decompressed record is stored in cache.
+ 
+ @param[in,out] reader MOBITextReader structure
+ @param[in] record Text record
+ @param[in] seqnumber Sequential number of the record
+ @param[out] out Memory area for decompressed data of mobi_get_textrecord_maxsize() size
+ @param[out] out_size Decompressed data size, 0 for empty record
+ @return MOBI_RET status code (on success MOBI_SUCCESS)
+ */
+static MOBI_RET mobi_read_text_record(MOBITextReader *reader, const MOBIPdbRecord *record, const size_t seqnumber, unsigned char *out, size_t *out_size) {
+    return mobi_read_text_record_opt(reader, record, seqnumber, out, out_size, true);
+}
+
+/**
+ @brief Set cache of decompressed text records used by the document
+ 
+ Cache is used by mobi_get_rawml(), mobi_dump_rawml(), mobi_stream_rawml(),
+ mobi_get_text_range() and rawml reconstruction.
+ Records are keyed by document id and record number, so documents loaded
+ from the same file with the same id share cached records.
+ Cache must not be freed before the document.
+ 
+ @param[in,out] m MOBIData structure
+ @param[in] cache MOBIRecordCache structure initialized with mobi_cache_init(), NULL to stop using cache
+ @param[in] doc_id Id string identifying the document (eg. file path or checksum),
+ NULL to use identity unique to this MOBIData structure
+ @return MOBI_RET status code (on success MOBI_SUCCESS)
+ */
+MOBI_RET mobi_set_cache(MOBIData *m, MOBIRecordCache *cache, const char *doc_id) {
+    if (m == NULL || m->internals == NULL) {
+        debug_print("%s", "Mobi structure not initialized\n");
+        return MOBI_INIT_FAILED;
+    }
+    MOBIInternals *internals = m->internals;
+    internals->cache = cache;
+    internals->cache_id = cache ? mobi_cache_identity(cache, doc_id) : 0;
+    return MOBI_SUCCESS;
+}
+
+/**
+ @brief Set path of sidecar file with parsed indices used by the document
+ 
+ mobi_parse_rawml() and mobi_parse_rawml_opt() load FDST record and indices from the sidecar
+ instead of parsing them, if sidecar was written for the same content of source records.
+ Missing or outdated sidecar is (re)written after parsing.
+ Sidecar is keyed by hash of document headers, FDST record, index meta records and sizes of index data records,
+ so it may be kept next to the document or in separate cache directory.
+ 
+ @param[in,out] m MOBIData structure
+ @param[in] path Path of sidecar file (eg. /var/cache/reader/book.mobi.idx), NULL to stop using sidecar
+ @return MOBI_RET status code (on success MOBI_SUCCESS)
+ */
+MOBI_RET mobi_set_sidecar(MOBIData *m, const char *path) {
+    if (m == NULL || m->internals == NULL) {
+        debug_print("%s", "Mobi structure not initialized\n");
+        return MOBI_INIT_FAILED;
+    }
+    MOBIInternals *internals = m->internals;
+    free(internals->sidecar_path);
+    internals->sidecar_path = NULL;
+    if (path) {
+        const size_t length = strlen(path);
+        internals->sidecar_path = malloc(length + 1);
+        if (internals->sidecar_path == NULL) {
+            debug_print("%s", "Memory allocation failed\n");
+            return MOBI_MALLOC_FAILED;
+        }
+        memcpy(internals->sidecar_path, path, length + 1);
+    }
+    return MOBI_SUCCESS;
+}
+
+#ifdef USE_THREADS
+/**
+ @brief Range of text records decompressed by single thread
+ */
+typedef struct {
+    const MOBIData *m; /**< MOBIData structure loaded with MOBI data */
+    MOBIPdbRecord **records; /**< Array of all text records */
+    size_t *sizes; /**< Array of decompressed sizes of all text records */
+    size_t text_rec_index; /**< Sequential number of first text record */
+    size_t first; /**< Index of first record in the range */
+    size_t last; /**< Index past last record in the range */
+    MOBIHuffCdic *huffcdic; /**< Parsed huff/cdic data, NULL for other compression types */
+    unsigned char *out; /**< Shared output, record with index i is decompressed at (i - base) * mobi_get_textrecord_maxsize() offset */
+    size_t base; /**< Index of record decompressed at the start of output */
+    MOBI_RET ret; /**< Status code of decompression */
+} MOBIDecompressTask;
+
+/**
+ @brief Decompress range of text records, run by mobi_run_tasks()
+ 
+ Each record is decompressed directly into its slot in shared output.
+ 
+ @param[in,out] arg MOBIDecompressTask structure
+ */
+static void mobi_decompress_task(void *arg) {
+    MOBIDecompressTask *task = arg;
+    const size_t max_size = mobi_get_textrecord_maxsize(task->m);
+    task->ret = MOBI_SUCCESS;
+    MOBITextReader reader;
+    mobi_text_reader_init(&reader, task->m, task->huffcdic);
+    for (size_t i = task->first; i < task->last; i++) {
+        unsigned char *out = task->out + (i - task->base) * max_size;
+        task->ret = mobi_read_text_record(&reader, task->records[i], task->text_rec_index + i, out, &task->sizes[i]);
+        if (task->ret != MOBI_SUCCESS) {
+            break;
+        }
+    }
+    mobi_text_reader_free(&reader);
+}
+
+/**
+ @brief Decompress text records in parallel (internal).
+ 
+ Text records are split into contiguous ranges, each decompressed by separate thread.
+ Every record is decompressed into a slot of text record size in shared output,
+ without intermediate buffers.
+ Text string must be large enough to hold slots of all records, it is compacted in place.
+ When writing to a file, records are decompressed in batches into single buffer,
+ so memory use does not depend on text length.
+ 
+ @param[in] m MOBIData structure loaded with MOBI data
+ @param[in] curr First text record
+ @param[in] text_rec_index Sequential number of first text record
+ @param[in] text_rec_count Number of text records
+ @param[in] threads Maximal number of threads
+ @param[in,out] text Memory area to be filled with decompressed output
+ @param[in,out] file If not NULL output is written to the file, otherwise to text string
+ @param[in,out] len Length of the memory allocated for the text string, on return set to decompressed text length
+ @return MOBI_RET status code (on success MOBI_SUCCESS)
+ */
+static MOBI_RET mobi_decompress_content_parallel(const MOBIData *m, MOBIPdbRecord *curr, const size_t text_rec_index, const size_t text_rec_count, size_t threads, char *text, FILE *file, size_t *len) {
+    const size_t max_size = mobi_get_textrecord_maxsize(m);
+    MOBIPdbRecord **records = malloc(text_rec_count * sizeof(*records));
+    size_t *sizes = calloc(text_rec_count, sizeof(*sizes));
+    if (records == NULL || sizes == NULL) {
+        free(records);
+        free(sizes);
+        debug_print("%s\n", "Memory allocation failed");
+        return MOBI_MALLOC_FAILED;
+    }
+    /* records data must be loaded before threads are started */
+    size_t count = 0;
+    while (count < text_rec_count && curr) {
+        records[count++] = curr;
+        curr = mobi_next_record(m, curr);
+    }
+    if (threads > count / MOBI_THREAD_MINRECORDS) {
+        threads = count / MOBI_THREAD_MINRECORDS;
+    }
+    if (threads == 0) {
+        threads = 1;
+    }
+    /* text string holds all records at once, file output is written in batches */
+    size_t batch = count;
+    unsigned char *out = (unsigned char *) text;
+    if (file) {
+        batch = threads * MOBI_THREAD_MINRECORDS;
+        out = malloc(batch * max_size);
+    } else if (count * max_size > *len) {
+        debug_print("%s", "Text buffer too small\n");
+        out = NULL;
+    }
+    /* huff/cdic tables are shared by all threads */
+    MOBIHuffCdic *huffcdic = NULL;
+    MOBI_RET ret = MOBI_PARAM_ERR;
+    if (out) {
+        ret = mobi_load_huffcdic(m, &huffcdic);
+    } else if (file) {
+        debug_print("%s\n", "Memory allocation failed");
+        ret = MOBI_MALLOC_FAILED;
+    }
+    MOBIDecompressTask *tasks = NULL;
+    if (ret == MOBI_SUCCESS) {
+        tasks = calloc(threads, sizeof(*tasks));
+        if (tasks == NULL) {
+            debug_print("%s\n", "Memory allocation failed");
+            ret = MOBI_MALLOC_FAILED;
+        }
+    }
+    size_t text_length = 0;
+    for (size_t start = 0; start < count && ret == MOBI_SUCCESS; start += batch) {
+        const size_t end = start + batch < count ? start + batch : count;
+        for (size_t i = 0; i < threads; i++) {
+            tasks[i].m = m;
+            tasks[i].records = records;
+            tasks[i].sizes = sizes;
+            tasks[i].text_rec_index = text_rec_index;
+            tasks[i].first = start + (end - start) * i / threads;
+            tasks[i].last = start + (end - start) * (i + 1) / threads;
+            tasks[i].huffcdic = huffcdic;
+            tasks[i].out = out;
+            tasks[i].base = start;
+        }
+        mobi_run_tasks(tasks, sizeof(*tasks), threads, mobi_decompress_task);
+        for (size_t i = 0; i < threads && ret == MOBI_SUCCESS; i++) {
+            ret = tasks[i].ret;
+        }
+        /* join decompressed records in order */
+        for (size_t i = start; i < end && ret == MOBI_SUCCESS; i++) {
+            const unsigned char *data = out + (i - start) * max_size;
+            if (file) {
+                fwrite(data, 1, sizes[i], file);
+            } else if (sizes[i]) {
+                /* slots are never before compacted text */
+                memmove(text + text_length, data, sizes[i]);
+                text_length += sizes[i];
+            }
+        }
+    }
+    if (file) {
+        free(out);
+    } else if (ret == MOBI_SUCCESS) {
+        text[text_length] = '\0';
+    }
+    free(tasks);
+    free(sizes);
+    free(records);
+    if (ret == MOBI_SUCCESS && len) {
+        *len = text_length;
+    }
+    return ret;
+}
+#endif
+
 /**
  @brief Decompress text record (internal).
  
- Internal function for mobi_get_rawml and mobi_dump_rawml. 
+ Internal function for mobi_get_rawml and mobi_dump_rawml.
  Decompressed output is stored either in a file or in a text string
  
  @param[in] m MOBIData structure loaded with MOBI data
@@ -1816,170 +2604,57 @@ static MOBI_RET mobi_decompress_content(const MOBIData *m, char *text, FILE *fil
         return MOBI_DATA_CORRUPT;
     }
     const size_t text_rec_index = 1 + offset;
-    size_t text_rec_count = m->rh->text_record_count;
-    const uint16_t compression_type = m->rh->compression_type;
-    /* check for extra data at the end of text files */
-    uint16_t extra_flags = 0;
-    if (m->mh && m->mh->extra_flags) {
-        extra_flags = *m->mh->extra_flags;
-    }
+    const size_t text_rec_count = m->rh->text_record_count;
     /* get first text record */
-    const MOBIPdbRecord *curr = mobi_get_record_by_seqnumber(m, text_rec_index);
-    MOBIHuffCdic *huffcdic = NULL;
-    if (compression_type == MOBI_COMPRESSION_HUFFCDIC) {
-        /* load huff/cdic tables */
-        huffcdic = mobi_init_huffcdic();
-        if (huffcdic == NULL) {
-            debug_print("%s\n", "Memory allocation failed");
-            return MOBI_MALLOC_FAILED;
-        }
-        MOBI_RET ret = mobi_parse_huffdic(m, huffcdic);
-        if (ret != MOBI_SUCCESS) {
-            mobi_free_huffcdic(huffcdic);
-            return ret;
-        }
+    MOBIPdbRecord *curr = mobi_get_record_by_seqnumber(m, text_rec_index);
+#ifdef USE_THREADS
+    const size_t threads = mobi_get_threads(m);
+    /* text is decompressed in place in parallel only if buffer fits all records */
+    if (threads > 1 && (dump || text_rec_count * mobi_get_textrecord_maxsize(m) <= *len)) {
+        return mobi_decompress_content_parallel(m, curr, text_rec_index, text_rec_count, threads, text, file, len);
     }
-    /* get following CDIC records */
-    size_t text_length = 0;
-    while (text_rec_count-- && curr) {
-        size_t extra_size = 0;
-        if (extra_flags) {
-            extra_size = mobi_get_record_extrasize(curr, extra_flags);
-            if (extra_size == MOBI_NOTSET) {
-                mobi_free_huffcdic(huffcdic);
-                return MOBI_DATA_CORRUPT;
-            }
-        }
-        size_t decompressed_size = mobi_get_textrecord_maxsize(m);
-        unsigned char *decompressed = malloc(decompressed_size);
-        if (decompressed == NULL) {
-            mobi_free_huffcdic(huffcdic);
-            debug_print("Memory allocation failed%s", "\n");
-            return MOBI_MALLOC_FAILED;
-        }
-        MOBI_RET ret = MOBI_SUCCESS;
-#ifdef USE_ENCRYPTION
-        if (mobi_is_encrypted(m) && mobi_has_drmkey(m)) {
-            if (compression_type != MOBI_COMPRESSION_HUFFCDIC) {
-                /* decrypt also multibyte extra data */
-                extra_size = mobi_get_record_extrasize(curr, extra_flags & 0xfffe);
-            }
-            if (extra_size == MOBI_NOTSET || extra_size > curr->size) {
-                mobi_free_huffcdic(huffcdic);
-                free(decompressed);
-                return MOBI_DATA_CORRUPT;
-            }
-            const size_t decrypt_size = curr->size - extra_size;
-            if (decrypt_size > decompressed_size) {
-                if (decrypt_size <= curr->size) {
-                    unsigned char *tmp = realloc(decompressed, decrypt_size);
-                    if (tmp == NULL) {
-                        debug_print("%s\n", "Memory allocation failed");
-                        mobi_free_huffcdic(huffcdic);
-                        free(decompressed);
-                        return MOBI_MALLOC_FAILED;
-                    }
-                    decompressed = tmp;
-                } else {
-                    debug_print("Record too large: %zu\n", decrypt_size);
-                    mobi_free_huffcdic(huffcdic);
-                    free(decompressed);
-                    return MOBI_DATA_CORRUPT;
-                }
-            }
-            if (decrypt_size) {
-                ret = mobi_buffer_decrypt(decompressed, curr->data, decrypt_size, m);
-                if (ret != MOBI_SUCCESS) {
-                    mobi_free_huffcdic(huffcdic);
-                    free(decompressed);
-                    return ret;
-                }
-                memcpy(curr->data, decompressed, decrypt_size);
-            }
-            if (compression_type != MOBI_COMPRESSION_HUFFCDIC && (extra_flags & 1)) {
-                // update multibyte data size after decryption
-                extra_size = mobi_get_record_extrasize(curr, extra_flags);
-                if (extra_size == MOBI_NOTSET) {
-                    free(decompressed);
-                    return MOBI_DATA_CORRUPT;
-                }
-            }
-        }
 #endif
-        if (extra_size > curr->size) {
-            debug_print("Wrong record size: -%zu\n", extra_size - curr->size);
-            mobi_free_huffcdic(huffcdic);
-            free(decompressed);
-            return MOBI_DATA_CORRUPT;
+    /* buffer reused for all records */
+    unsigned char *decompressed = malloc(mobi_get_textrecord_maxsize(m));
+    if (decompressed == NULL) {
+        debug_print("Memory allocation failed%s", "\n");
+        return MOBI_MALLOC_FAILED;
+    }
+    MOBITextReader reader;
+    mobi_text_reader_init(&reader, m, NULL);
+    MOBI_RET ret = MOBI_SUCCESS;
+    size_t text_length = 0;
+    for (size_t i = 0; i < text_rec_count && curr; i++) {
+        size_t decompressed_size;
+        ret = mobi_read_text_record(&reader, curr, text_rec_index + i, decompressed, &decompressed_size);
+        if (ret != MOBI_SUCCESS) {
+            break;
         }
-        if (extra_size == curr->size) {
+        curr = mobi_next_record(m, curr);
+        if (decompressed_size == 0) {
             debug_print("Skipping empty record%s", "\n");
-            free(decompressed);
-            curr = curr->next;
             continue;
         }
-        const size_t record_size = curr->size - extra_size;
-        switch (compression_type) {
-            case MOBI_COMPRESSION_NONE:
-                /* no compression */
-                if (record_size > decompressed_size) {
-                    debug_print("Record too large: %zu\n", record_size);
-                    free(decompressed);
-                    return MOBI_DATA_CORRUPT;
-                }
-                memcpy(decompressed, curr->data, record_size);
-                decompressed_size = record_size;
-                if (mobi_exists_mobiheader(m) && mobi_get_fileversion(m) <= 3) {
-                    /* workaround for some old files with null characters inside record */
-                    mobi_remove_zeros(decompressed, &decompressed_size);
-                }
-                break;
-            case MOBI_COMPRESSION_PALMDOC:
-                /* palmdoc lz77 compression */
-                ret = mobi_decompress_lz77(decompressed, curr->data, &decompressed_size, record_size);
-                if (ret != MOBI_SUCCESS) {
-                    free(decompressed);
-                    return ret;
-                }
-                break;
-            case MOBI_COMPRESSION_HUFFCDIC:
-                /* mobi huffman compression */
-                ret = mobi_decompress_huffman(decompressed, curr->data, &decompressed_size, record_size, huffcdic);
-                if (ret != MOBI_SUCCESS) {
-                    free(decompressed);
-                    mobi_free_huffcdic(huffcdic);
-                    return ret;
-                }
-                break;
-            default:
-                debug_print("%s", "Unknown compression type\n");
-                mobi_free_huffcdic(huffcdic);
-                free(decompressed);
-                return MOBI_DATA_CORRUPT;
-        }
-        curr = curr->next;
         if (dump) {
             fwrite(decompressed, 1, decompressed_size, file);
         } else {
             if (text_length + decompressed_size > *len) {
                 debug_print("%s", "Text buffer too small\n");
-                /* free huff/cdic tables */
-                mobi_free_huffcdic(huffcdic);
-                free(decompressed);
-                return MOBI_PARAM_ERR;
+                ret = MOBI_PARAM_ERR;
+                break;
             }
             memcpy(text + text_length, decompressed, decompressed_size);
             text_length += decompressed_size;
             text[text_length] = '\0';
         }
-        free(decompressed);
     }
+    free(decompressed);
     /* free huff/cdic tables */
-    mobi_free_huffcdic(huffcdic);
-    if (len) {
+    mobi_text_reader_free(&reader);
+    if (ret == MOBI_SUCCESS && len) {
         *len = text_length;
     }
-    return MOBI_SUCCESS;
+    return ret;
 }
 
 /**
@@ -2003,6 +2678,245 @@ MOBI_RET mobi_get_rawml(const MOBIData *m, char *text, size_t *len) {
     return mobi_decompress_content(m, text, NULL, len);
 }
 
+/**
+ @brief Decompress text record by record, passing each record to callback
+ 
+ Text is decompressed into single buffer of text record size, reused for all records,
+ so memory use does not depend on text length.
+ Record data is not modified, also for encrypted documents.
+ Empty records are skipped.
+ 
+ @param[in] m MOBIData structure loaded with MOBI data
+ @param[in] callback Function receiving decompressed data of each record
+ @param[in] userdata Pointer passed to callback
+ @return MOBI_RET status code (on success MOBI_SUCCESS), MOBI_ERROR if callback stopped streaming
+ */
+MOBI_RET mobi_stream_rawml(const MOBIData *m, MOBIRawmlCallback callback, void *userdata) {
+    if (callback == NULL) {
+        debug_print("%s", "Parameter error: callback is NULL\n");
+        return MOBI_PARAM_ERR;
+    }
+    if (m == NULL) {
+        debug_print("%s", "Mobi structure not initialized\n");
+        return MOBI_INIT_FAILED;
+    }
+    if (mobi_is_encrypted(m) && !mobi_has_drmkey(m)) {
+        debug_print("%s", "Document is encrypted\n");
+        return MOBI_FILE_ENCRYPTED;
+    }
+    if (m->rh == NULL || m->rh->text_record_count == 0) {
+        debug_print("%s", "Text records not found in MOBI header\n");
+        return MOBI_DATA_CORRUPT;
+    }
+    const size_t text_rec_index = 1 + mobi_get_kf8offset(m);
+    const size_t text_rec_count = m->rh->text_record_count;
+    unsigned char *decompressed = malloc(mobi_get_textrecord_maxsize(m));
+    if (decompressed == NULL) {
+        debug_print("%s\n", "Memory allocation failed");
+        return MOBI_MALLOC_FAILED;
+    }
+    MOBITextReader reader;
+    mobi_text_reader_init(&reader, m, NULL);
+    MOBI_RET ret = MOBI_SUCCESS;
+    const MOBIPdbRecord *curr = mobi_get_record_by_seqnumber(m, text_rec_index);
+    for (size_t i = 0; i < text_rec_count && curr; i++) {
+        size_t decompressed_size;
+        ret = mobi_read_text_record(&reader, curr, text_rec_index + i, decompressed, &decompressed_size);
+        if (ret != MOBI_SUCCESS) {
+            break;
+        }
+        if (decompressed_size && callback(decompressed, decompressed_size, userdata) != 0) {
+            debug_print("%s", "Streaming stopped by callback\n");
+            ret = MOBI_ERROR;
+            break;
+        }
+        curr = mobi_next_record(m, curr);
+    }
+    free(decompressed);
+    mobi_text_reader_free(&reader);
+    return ret;
+}
+
+/**
+ @brief Find text record containing offset in table of text records offsets
+ 
+ Table is created on first use and extended as text records are decompressed,
+ see mobi_text_offsets_add(). Must be called with internals locked.
+ 
+ @param[in] m MOBIData structure loaded with MOBI data
+ @param[in] text_rec_index Sequential number of first text record
+ @param[in] offset Offset in decompressed text
+ @param[out] index Index of the text record containing offset,
+ or of the first record with unknown offset, if offset is not covered by the table
+ @param[out] position Offset of the text record in decompressed text
+ @param[out] covered True if offset is covered by the table
+ @return MOBI_RET status code (on success MOBI_SUCCESS)
+ */
+static MOBI_RET mobi_text_offsets_find(const MOBIData *m, const size_t text_rec_index, const size_t offset,
+                                       size_t *index, size_t *position, bool *covered) {
+    MOBIInternals *internals = m->internals;
+    if (internals->text_offsets == NULL || internals->text_offsets_index != text_rec_index) {
+        const size_t text_rec_count = m->rh->text_record_count;
+        size_t *offsets = malloc((text_rec_count + 1) * sizeof(*offsets));
+        if (offsets == NULL) {
+            debug_print("%s\n", "Memory allocation failed");
+            return MOBI_MALLOC_FAILED;
+        }
+        offsets[0] = 0;
+        free(internals->text_offsets);
+        internals->text_offsets = offsets;
+        internals->text_offsets_count = 1;
+        internals->text_offsets_index = text_rec_index;
+    }
+    const size_t *offsets = internals->text_offsets;
+    size_t low = 0;
+    size_t high = internals->text_offsets_count - 1;
+    *covered = offset < offsets[high];
+    if (!*covered) {
+        *index = high;
+        *position = offsets[high];
+        return MOBI_SUCCESS;
+    }
+    while (high - low > 1) {
+        const size_t mid = low + (high - low) / 2;
+        if (offsets[mid] <= offset) {
+            low = mid;
+        } else {
+            high = mid;
+        }
+    }
+    *index = low;
+    *position = offsets[low];
+    return MOBI_SUCCESS;
+}
+
+/**
+ @brief Add offset of text record end to table of text records offsets
+ 
+ Offset is added only if it follows the last known one.
+ 
+ @param[in] m MOBIData structure loaded with MOBI data
+ @param[in] text_rec_index Sequential number of first text record
+ @param[in] index Index of the text record
+ @param[in] end Offset of the end of text record in decompressed text
+ */
+static void mobi_text_offsets_add(const MOBIData *m, const size_t text_rec_index, const size_t index, const size_t end) {
+    MOBIInternals *internals = m->internals;
+    mobi_lock_internals(m);
+    if (internals->text_offsets && internals->text_offsets_index == text_rec_index
+        && internals->text_offsets_count == index + 1 && index < m->rh->text_record_count) {
+        internals->text_offsets[index + 1] = end;
+        internals->text_offsets_count++;
+    }
+    mobi_unlock_internals(m);
+}
+
+/**
+ @brief Decompress part of the text to a text buffer.
+ 
+ Only text records overlapping requested range are decompressed.
+ Records do not decompress to equal sizes, so offsets of text records
+ are kept in a table, which is extended up to the record covering the range.
+ Preceding records, which were not decompressed yet, are decompressed once
+ to get their sizes, without storing them in cache.
+ The table is kept until the document is freed.
+ Record data is not modified, also for encrypted documents.
+ Output is not null-terminated.
+ 
+ @param[in] m MOBIData structure loaded with MOBI data
+ @param[in] offset Offset of the range in decompressed text
+ @param[in,out] text Memory area to be filled with decompressed output
+ @param[in,out] len Length of the range, on return set to length of decompressed output,
+ which is shorter if range exceeds text end
+ @return MOBI_RET status code (on success MOBI_SUCCESS)
+ */
+MOBI_RET mobi_get_text_range(const MOBIData *m, const size_t offset, char *text, size_t *len) {
+    if (text == NULL || len == NULL) {
+        debug_print("%s", "Parameter error: text or len is NULL\n");
+        return MOBI_PARAM_ERR;
+    }
+    if (m == NULL || m->internals == NULL) {
+        debug_print("%s", "Mobi structure not initialized\n");
+        return MOBI_INIT_FAILED;
+    }
+    if (mobi_is_encrypted(m) && !mobi_has_drmkey(m)) {
+        debug_print("%s", "Document is encrypted\n");
+        return MOBI_FILE_ENCRYPTED;
+    }
+    if (m->rh == NULL || m->rh->text_record_count == 0) {
+        debug_print("%s", "Text records not found in MOBI header\n");
+        return MOBI_DATA_CORRUPT;
+    }
+    const size_t text_rec_index = 1 + mobi_get_kf8offset(m);
+    const size_t text_rec_count = m->rh->text_record_count;
+    unsigned char *decompressed = malloc(mobi_get_textrecord_maxsize(m));
+    if (decompressed == NULL) {
+        debug_print("%s\n", "Memory allocation failed");
+        return MOBI_MALLOC_FAILED;
+    }
+    MOBITextReader reader;
+    mobi_text_reader_init(&reader, m, NULL);
+    /* find record containing offset */
+    size_t i = 0;
+    size_t position = 0;
+    bool covered = false;
+    mobi_lock_internals(m);
+    MOBI_RET ret = mobi_text_offsets_find(m, text_rec_index, offset, &i, &position, &covered);
+    mobi_unlock_internals(m);
+    const MOBIPdbRecord *curr = NULL;
+    if (ret == MOBI_SUCCESS && i < text_rec_count) {
+        curr = mobi_get_record_by_seqnumber(m, text_rec_index + i);
+    }
+    /* extend table up to the record containing offset,
+       the last decompressed record is used for the range */
+    size_t decompressed_size = 0;
+    bool have_decompressed = false;
+    while (!covered && i < text_rec_count && curr) {
+        ret = mobi_read_text_record_opt(&reader, curr, text_rec_index + i, decompressed, &decompressed_size, false);
+        if (ret != MOBI_SUCCESS) {
+            break;
+        }
+        const size_t next = position + decompressed_size;
+        mobi_text_offsets_add(m, text_rec_index, i, next);
+        if (next > offset) {
+            have_decompressed = true;
+            break;
+        }
+        position = next;
+        curr = mobi_next_record(m, curr);
+        i++;
+    }
+    size_t length = 0;
+    while (ret == MOBI_SUCCESS && length < *len && i < text_rec_count && curr) {
+        if (!have_decompressed) {
+            ret = mobi_read_text_record(&reader, curr, text_rec_index + i, decompressed, &decompressed_size);
+            if (ret != MOBI_SUCCESS) {
+                break;
+            }
+        }
+        have_decompressed = false;
+        const size_t next = position + decompressed_size;
+        mobi_text_offsets_add(m, text_rec_index, i, next);
+        if (next > offset + length) {
+            size_t count = next - (offset + length);
+            if (count > *len - length) {
+                count = *len - length;
+            }
+            memcpy(text + length, decompressed + (offset + length - position), count);
+            length += count;
+        }
+        position = next;
+        curr = mobi_next_record(m, curr);
+        i++;
+    }
+    free(decompressed);
+    mobi_text_reader_free(&reader);
+    if (ret == MOBI_SUCCESS) {
+        *len = length;
+    }
+    return ret;
+}
+
 /**
  @brief Decompress text record to an open file descriptor.
  
@@ -2750,7 +3664,8 @@ bool mobi_has_drmkey(const MOBIData *m) {
         debug_print("%s", "Mobi structure not initialized\n");
         return false;
     }
-    MOBIDrm *drm = m->internals;
+    const MOBIInternals *internals = m->internals;
+    const MOBIDrm *drm = internals ? internals->drm : NULL;
     return drm != NULL && drm->key != NULL;
 #else
     UNUSED(m);
@@ -2770,7 +3685,8 @@ bool mobi_has_drmcookies(const MOBIData *m) {
         debug_print("%s", "Mobi structure not initialized\n");
         return false;
     }
-    MOBIDrm *drm = m->internals;
+    const MOBIInternals *internals = m->internals;
+    const MOBIDrm *drm = internals ? internals->drm : NULL;
     return drm != NULL && drm->cookies_count > 0;
 #else
     UNUSED(m);
@@ -2790,7 +3706,7 @@ bool mobi_is_replica(const MOBIData *m) {
         return false;
     }
     if (m->rec && m->rh && m->rh->compression_type == MOBI_COMPRESSION_NONE) {
-        MOBIPdbRecord *rec = m->rec->next;
+        MOBIPdbRecord *rec = mobi_next_record(m, m->rec);
         if (rec && rec->size >= sizeof(REPLICA_MAGIC)) {
             return memcmp(rec->data, REPLICA_MAGIC, sizeof(REPLICA_MAGIC) - 1) == 0;
         }
@@ -3097,7 +4013,13 @@ uint32_t mobi_get_drmsize(const MOBIData *m) {
  */
 uint16_t mobi_get_records_count(const MOBIData *m) {
     size_t count = 0;
-    if (m->rec) {
+    mobi_lock_internals(m);
+    const MOBIRecTable *rectable = mobi_get_rectable(m);
+    if (rectable) {
+        count = rectable->count;
+    }
+    mobi_unlock_internals(m);
+    if (rectable == NULL && m->rec) {
         MOBIPdbRecord *curr = m->rec;
         while (curr) {
             count++;
@@ -3344,15 +4266,17 @@ MOBI_RET mobi_remove_part_kf8(MOBIData *m) {
             if (curr->data && curr->size > 4 &&
                 (memcmp(curr->data, FONT_MAGIC, 4) == 0 ||
                  memcmp(curr->data, RESC_MAGIC, 4) == 0)) {
-                unsigned char *tmp = realloc(curr->data, 4);
-                if (tmp == NULL) {
-                    debug_print("%s\n", "Memory allocation failed");
-                    return MOBI_MALLOC_FAILED;
+                if (!mobi_record_is_borrowed(m, curr)) {
+                    unsigned char *tmp = realloc(curr->data, 4);
+                    if (tmp == NULL) {
+                        debug_print("%s\n", "Memory allocation failed");
+                        return MOBI_MALLOC_FAILED;
+                    }
+                    curr->data = tmp;
                 }
-                curr->data = tmp;
                 curr->size = 4;
             }
-            curr = curr->next;
+            curr = mobi_next_record(m, curr);
         }
     }
     
@@ -3525,11 +4449,21 @@ MOBI_RET mobi_drm_delkey(MOBIData *m) {
  @param[in,out] m MOBIData structure with raw data and metadata
  */
 void mobi_free_internals(MOBIData *m) {
+    if (m == NULL || m->internals == NULL) {
+        return;
+    }
 #ifdef USE_ENCRYPTION
     mobi_free_drm(m);
-#else
-    UNUSED(m);
 #endif
+    mobi_free_rectable(m);
+    mobi_free_storage(m->internals);
+    MOBIInternals *internals = m->internals;
+    free(internals->sidecar_path);
+#ifdef USE_THREADS
+    pthread_mutex_destroy(&internals->lock);
+#endif
+    free(m->internals);
+    m->internals = NULL;
 }
 
 /**
@@ -61,6 +61,9 @@
 /** @brief Difference in seconds between epoch time and mac time */
 #define EPOCH_MAC_DIFF 2082844800UL
 
+#define MOBI_THREADS_MAX 256 /**< Maximal number of threads accepted by mobi_set_threads() */
+#define MOBI_THREAD_MINRECORDS 16 /**< Minimal number of text records decompressed by single thread */
+
 /** 
  @defgroup mobi_pdb Params for pdb record header structure
  @{
@@ -125,8 +128,6 @@
 
 #define ARRAYSIZE(arr) (sizeof(arr) / sizeof(arr[0]))
 
-#define MOBI_TITLE_SIZEMAX 1024
-
 int mobi_bitcount(const uint8_t byte);
 MOBI_RET mobi_delete_record_by_seqnumber(MOBIData *m, const size_t num);
 MOBI_RET mobi_swap_mobidata(MOBIData *m);
@@ -146,12 +147,15 @@ uint32_t mobi_get_exthsize(const MOBIData *m);
 uint32_t mobi_get_drmsize(const MOBIData *m);
 uint16_t mobi_get_records_count(const MOBIData *m);
 void mobi_remove_zeros(unsigned char *buffer, size_t *len);
+size_t mobi_get_threads(const MOBIData *m);
+void mobi_run_tasks(void *tasks, const size_t task_size, const size_t count, void (*function)(void *task));
 MOBI_RET mobi_add_audio_resource(MOBIPart *part);
 MOBI_RET mobi_add_video_resource(MOBIPart *part);
 MOBI_RET mobi_add_font_resource(MOBIPart *part);
 MOBI_RET mobi_set_fullname(MOBIData *m, const char *fullname);
 MOBI_RET mobi_set_pdbname(MOBIData *m, const char *name);
 void mobi_free_internals(MOBIData *m);
+MOBI_RET mobi_build_rectable(const MOBIData *m);
 uint32_t mobi_get32be(const unsigned char buf[4]);
 uint32_t mobi_get32le(const unsigned char buf[4]);
 #endif
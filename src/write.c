@@ -15,6 +15,7 @@
 
 #include "write.h"
 #include "util.h"
+#include "huffcdic.h"
 #include "debug.h"
 #ifdef USE_ENCRYPTION
 #include "encryption.h"
@@ -421,9 +422,7 @@ MOBI_RET mobi_update_record0(MOBIData *m, const size_t seqnumber) {
     memcpy(data, buf->data, buf->offset);
     record0->size = buf->offset;
     mobi_buffer_free(buf);
-    if (record0->data) {
-        free(record0->data);
-    }
+    mobi_free_record_data(m, record0);
     record0->data = data;
     return MOBI_SUCCESS;
 }
@@ -450,6 +449,8 @@ MOBI_RET mobi_write_records(FILE *file, const MOBIData *m) {
     uint32_t offset = (uint32_t) pos;
     /* 8 bytes per record meta plus 2 bytes padding */
     offset += 8 * m->ph->rec_count + 2;
+    /* records uids will be renumbered */
+    mobi_free_rectable(m);
     MOBIPdbRecord *curr = m->rec;
     uint32_t i = 0;
     while (curr) {
@@ -488,6 +489,10 @@ MOBI_RET mobi_write_records(FILE *file, const MOBIData *m) {
     
     curr = m->rec;
     while (curr) {
+        MOBI_RET ret = mobi_load_recdata_lazy(m, curr);
+        if (ret != MOBI_SUCCESS) {
+            return ret;
+        }
         written = fwrite(curr->data, 1, curr->size, file);
         if (written != curr->size) {
             debug_print("Writing failed (%s)\n", strerror(errno));
@@ -498,10 +503,389 @@ MOBI_RET mobi_write_records(FILE *file, const MOBIData *m) {
     return MOBI_SUCCESS;
 }
 
+/**
+ @brief Set palmdoc compression level used by mobi_write_file()
+ 
+ With level greater than zero, text records are recompressed with palmdoc (LZ77) compression
+ on write and compression type in record 0 is updated.
+ Trailing entries of records are kept.
+ 
+ @param[in,out] m MOBIData structure
+ @param[in] level Compression level from MOBI_LZ77_LEVEL_FAST to MOBI_LZ77_LEVEL_BEST, 0 to write text records unchanged
+ @return MOBI_RET status code (MOBI_SUCCESS on success)
+ */
+MOBI_RET mobi_set_compression_level(MOBIData *m, const int level) {
+    return mobi_set_compression(m, MOBI_COMPRESSION_PALMDOC, level);
+}
+
+/**
+ @brief Set compression type and level used by mobi_write_file()
+ 
+ With level greater than zero, text records are recompressed on write
+ and compression type in record 0 is updated.
+ Huff/cdic compression builds dictionary of phrases from the whole text,
+ it is suited for large documents, like dictionaries.
+ Its HUFF and CDIC records are stored before the end of file record.
+ Trailing entries of records are kept.
+ Encrypted documents can not be recompressed.
+ Huff/cdic compression requires loaded document with mobi header, plain palmdoc documents are rejected.
+ Compressed output does not depend on number of threads set with mobi_set_threads().
+ 
+ @param[in,out] m MOBIData structure
+ @param[in] compression_type MOBI_COMPRESSION_PALMDOC or MOBI_COMPRESSION_HUFFCDIC
+ @param[in] level Compression level from MOBI_LZ77_LEVEL_FAST to MOBI_LZ77_LEVEL_BEST, 0 to write text records unchanged
+ @return MOBI_RET status code (MOBI_SUCCESS on success)
+ */
+MOBI_RET mobi_set_compression(MOBIData *m, const uint16_t compression_type, const int level) {
+    if (m == NULL || m->internals == NULL) {
+        debug_print("%s", "Mobi structure not initialized\n");
+        return MOBI_INIT_FAILED;
+    }
+    if (compression_type != MOBI_COMPRESSION_PALMDOC && compression_type != MOBI_COMPRESSION_HUFFCDIC) {
+        debug_print("Unsupported compression type: %u\n", compression_type);
+        return MOBI_PARAM_ERR;
+    }
+    if (level < 0 || level > MOBI_LZ77_LEVEL_BEST) {
+        debug_print("Wrong compression level: %i\n", level);
+        return MOBI_PARAM_ERR;
+    }
+    if (level > 0 && mobi_is_encrypted(m)) {
+        debug_print("%s", "Encrypted document can not be recompressed\n");
+        return MOBI_FILE_ENCRYPTED;
+    }
+    if (level > 0 && compression_type == MOBI_COMPRESSION_HUFFCDIC) {
+        /* both hybrid parts are recompressed, each one needs mobi header with huff/cdic fields */
+        const MOBIData *parts[] = { m, mobi_is_hybrid(m) ? m->next : NULL };
+        for (size_t i = 0; i < ARRAYSIZE(parts) && parts[i]; i++) {
+            const MOBIData *part = parts[i];
+            if (part->rh == NULL || part->mh == NULL || part->mh->huff_rec_index == NULL || part->mh->huff_rec_count == NULL) {
+                debug_print("%s", "Document has no mobi header with huff/cdic fields\n");
+                return MOBI_PARAM_ERR;
+            }
+        }
+    }
+    MOBIInternals *internals = m->internals;
+    internals->compression_type = compression_type;
+    internals->compression_level = level;
+    return MOBI_SUCCESS;
+}
+
+/**
+ @brief State of text records recompression
+ */
+typedef struct {
+    const MOBIData *m; /**< MOBIData structure */
+    MOBIPdbRecord *curr; /**< Next text record */
+    size_t count; /**< Number of text records left */
+    uint16_t extra_flags; /**< Flags of extra data at the end of text records */
+    int level; /**< Compression level */
+    unsigned char *compressed; /**< Buffer for compressed data */
+    size_t compressed_size; /**< Size of the buffer */
+    unsigned char *text; /**< Decompressed text of all records, for huff/cdic compression */
+    size_t text_size; /**< Size of decompressed text */
+    size_t text_capacity; /**< Size of memory allocated for text */
+    size_t *sizes; /**< Sizes of decompressed records, for huff/cdic compression */
+    size_t sizes_count; /**< Number of decompressed records */
+    size_t sizes_capacity; /**< Number of entries allocated for sizes */
+    MOBI_RET ret; /**< Status code of recompression */
+} MOBIRecompressState;
+
+/**
+ @brief Replace data of next non-empty text record with compressed data
+ 
+ Trailing entries of the record are appended to compressed data.
+ 
+ @param[in,out] state MOBIRecompressState structure
+ @param[in] data Compressed data
+ @param[in] size Size of compressed data
+ @return MOBI_RET status code (MOBI_SUCCESS on success)
+ */
+static MOBI_RET mobi_replace_text_record(MOBIRecompressState *state, const unsigned char *data, const size_t size) {
+    size_t extra_size = 0;
+    /* empty records are not passed by mobi_stream_rawml() */
+    while (state->curr && state->count) {
+        extra_size = 0;
+        if (state->extra_flags) {
+            extra_size = mobi_get_record_extrasize(state->curr, state->extra_flags);
+            if (extra_size == MOBI_NOTSET || extra_size > state->curr->size) {
+                return MOBI_DATA_CORRUPT;
+            }
+        }
+        if (extra_size < state->curr->size) {
+            break;
+        }
+        state->curr = mobi_next_record(state->m, state->curr);
+        state->count--;
+    }
+    if (state->curr == NULL || state->count == 0) {
+        return MOBI_DATA_CORRUPT;
+    }
+    MOBIPdbRecord *record = state->curr;
+    unsigned char *record_data = malloc(size + extra_size);
+    if (record_data == NULL) {
+        debug_print("%s\n", "Memory allocation failed");
+        return MOBI_MALLOC_FAILED;
+    }
+    memcpy(record_data, data, size);
+    memcpy(record_data + size, record->data + record->size - extra_size, extra_size);
+    mobi_free_record_data(state->m, record);
+    record->data = record_data;
+    record->size = size + extra_size;
+    state->curr = mobi_next_record(state->m, record);
+    state->count--;
+    return MOBI_SUCCESS;
+}
+
+/**
+ @brief Replace text record with its compressed data, run by mobi_stream_rawml() for each non-empty record
+ 
+ @param[in] data Decompressed record
+ @param[in] size Size of decompressed record
+ @param[in,out] userdata MOBIRecompressState structure
+ @return 0 on success, 1 on failure
+ */
+static int mobi_recompress_record(const unsigned char *data, const size_t size, void *userdata) {
+    MOBIRecompressState *state = userdata;
+    const size_t max_size = size + (size + 7) / 8;
+    if (max_size > state->compressed_size) {
+        unsigned char *tmp = realloc(state->compressed, max_size);
+        if (tmp == NULL) {
+            debug_print("%s\n", "Memory allocation failed");
+            state->ret = MOBI_MALLOC_FAILED;
+            return 1;
+        }
+        state->compressed = tmp;
+        state->compressed_size = max_size;
+    }
+    size_t compressed_size = state->compressed_size;
+    state->ret = mobi_compress_lz77(state->compressed, data, &compressed_size, size, state->level);
+    if (state->ret != MOBI_SUCCESS) {
+        return 1;
+    }
+    state->ret = mobi_replace_text_record(state, state->compressed, compressed_size);
+    return state->ret == MOBI_SUCCESS ? 0 : 1;
+}
+
+/**
+ @brief Append decompressed record to text, run by mobi_stream_rawml() for each non-empty record
+ 
+ @param[in] data Decompressed record
+ @param[in] size Size of decompressed record
+ @param[in,out] userdata MOBIRecompressState structure
+ @return 0 on success, 1 on failure
+ */
+static int mobi_collect_record(const unsigned char *data, const size_t size, void *userdata) {
+    MOBIRecompressState *state = userdata;
+    if (state->text_size + size > state->text_capacity) {
+        size_t capacity = state->text_capacity ? 2 * state->text_capacity : 0x100000;
+        while (capacity < state->text_size + size) {
+            capacity *= 2;
+        }
+        unsigned char *tmp = realloc(state->text, capacity);
+        if (tmp == NULL) {
+            debug_print("%s\n", "Memory allocation failed");
+            state->ret = MOBI_MALLOC_FAILED;
+            return 1;
+        }
+        state->text = tmp;
+        state->text_capacity = capacity;
+    }
+    if (state->sizes_count == state->sizes_capacity) {
+        const size_t capacity = state->sizes_capacity ? 2 * state->sizes_capacity : 256;
+        size_t *tmp = realloc(state->sizes, capacity * sizeof(*state->sizes));
+        if (tmp == NULL) {
+            debug_print("%s\n", "Memory allocation failed");
+            state->ret = MOBI_MALLOC_FAILED;
+            return 1;
+        }
+        state->sizes = tmp;
+        state->sizes_capacity = capacity;
+    }
+    memcpy(state->text + state->text_size, data, size);
+    state->text_size += size;
+    state->sizes[state->sizes_count++] = size;
+    return 0;
+}
+
+/**
+ @brief Store HUFF and CDIC records in the document
+ 
+ If document already has at least as many huff/cdic records, their data is replaced,
+ otherwise new records with unique ids are inserted before end of file record.
+ Records data is moved from output to the document.
+ 
+ @param[in,out] m MOBIData structure
+ @param[in,out] output Output of huff/cdic compressor
+ @return MOBI_RET status code (MOBI_SUCCESS on success)
+ */
+static MOBI_RET mobi_store_huffcdic_records(MOBIData *m, MOBIHuffCdicOutput *output) {
+    const size_t offset = mobi_get_kf8offset(m);
+    MOBIPdbRecord *curr = NULL;
+    if (m->rh->compression_type == MOBI_COMPRESSION_HUFFCDIC && *m->mh->huff_rec_count >= output->record_count) {
+        curr = mobi_get_record_by_seqnumber(m, *m->mh->huff_rec_index + offset);
+    }
+    if (curr) {
+        for (size_t i = 0; i < output->record_count && curr; i++) {
+            mobi_free_record_data(m, curr);
+            curr->data = output->records[i];
+            curr->size = output->record_sizes[i];
+            output->records[i] = NULL;
+            curr = curr->next;
+        }
+        /* cached huff/cdic tables refer to replaced records */
+        mobi_free_rectable(m);
+        *m->mh->huff_rec_count = (uint32_t) output->record_count;
+        return MOBI_SUCCESS;
+    }
+    /* find last record and the one preceding it */
+    MOBIPdbRecord *prev = NULL;
+    MOBIPdbRecord *last = m->rec;
+    size_t seqnumber = 0;
+    while (last->next) {
+        prev = last;
+        last = last->next;
+        seqnumber++;
+    }
+    const unsigned char eof_magic[] = EOF_MAGIC;
+    if (mobi_load_recdata_lazy(m, last) != MOBI_SUCCESS) {
+        return MOBI_DATA_CORRUPT;
+    }
+    if (prev && last->size == 4 && memcmp(last->data, eof_magic, 4) == 0) {
+        last = prev;
+    } else {
+        seqnumber++;
+    }
+    if (seqnumber < offset) {
+        return MOBI_DATA_CORRUPT;
+    }
+    /* new records get unique ids following the highest one */
+    size_t uid = 0;
+    for (const MOBIPdbRecord *rec = m->rec; rec; rec = rec->next) {
+        if (rec->uid > uid) {
+            uid = rec->uid;
+        }
+    }
+    for (size_t i = 0; i < output->record_count; i++) {
+        MOBIPdbRecord *record = calloc(1, sizeof(MOBIPdbRecord));
+        if (record == NULL) {
+            debug_print("%s\n", "Memory allocation failed");
+            mobi_free_rectable(m);
+            return MOBI_MALLOC_FAILED;
+        }
+        record->data = output->records[i];
+        record->size = output->record_sizes[i];
+        uid += 2;
+        record->uid = uid;
+        output->records[i] = NULL;
+        record->next = last->next;
+        last->next = record;
+        last = record;
+    }
+    /* records were inserted */
+    mobi_free_rectable(m);
+    *m->mh->huff_rec_index = (uint32_t) (seqnumber - offset);
+    *m->mh->huff_rec_count = (uint32_t) output->record_count;
+    return MOBI_SUCCESS;
+}
+
+/**
+ @brief Recompress text records with huff/cdic compression
+ 
+ @param[in,out] m MOBIData structure
+ @param[in,out] state MOBIRecompressState structure
+ @return MOBI_RET status code (MOBI_SUCCESS on success)
+ */
+static MOBI_RET mobi_recompress_huffcdic(MOBIData *m, MOBIRecompressState *state) {
+    if (m->mh == NULL || m->mh->huff_rec_index == NULL || m->mh->huff_rec_count == NULL) {
+        debug_print("%s", "Mobi header has no huff/cdic fields\n");
+        return MOBI_FILE_UNSUPPORTED;
+    }
+    MOBI_RET ret = mobi_stream_rawml(m, mobi_collect_record, state);
+    if (ret == MOBI_ERROR) {
+        ret = state->ret;
+    }
+    if (ret != MOBI_SUCCESS || state->sizes_count == 0) {
+        return ret;
+    }
+    MOBIHuffCdicOutput output;
+    ret = mobi_compress_huffcdic(&output, state->text, state->sizes, state->sizes_count, state->level, mobi_get_threads(m));
+    if (ret != MOBI_SUCCESS) {
+        return ret;
+    }
+    for (size_t i = 0; i < output.text_count && ret == MOBI_SUCCESS; i++) {
+        ret = mobi_replace_text_record(state, output.texts[i], output.text_sizes[i]);
+    }
+    if (ret == MOBI_SUCCESS) {
+        ret = mobi_store_huffcdic_records(m, &output);
+    }
+    mobi_free_huffcdic_output(&output);
+    return ret;
+}
+
+/**
+ @brief Recompress text records
+ 
+ Records are decompressed one by one, compressed data replaces record data
+ and compression type in record 0 header is updated.
+ Huff/cdic records of huffman compressed document are left in place, but are no longer referenced,
+ unless they are reused by huff/cdic compression.
+ 
+ @param[in,out] m MOBIData structure
+ @param[in] compression_type Compression type
+ @param[in] level Compression level
+ @return MOBI_RET status code (MOBI_SUCCESS on success)
+ */
+static MOBI_RET mobi_recompress_text(MOBIData *m, const uint16_t compression_type, const int level) {
+    if (m->rh == NULL || m->rh->text_record_count == 0) {
+        return MOBI_SUCCESS;
+    }
+    if (mobi_is_encrypted(m)) {
+        debug_print("%s", "Encrypted document can not be recompressed\n");
+        return MOBI_FILE_ENCRYPTED;
+    }
+    MOBIRecompressState state;
+    memset(&state, 0, sizeof(state));
+    state.m = m;
+    state.curr = mobi_get_record_by_seqnumber(m, 1 + mobi_get_kf8offset(m));
+    state.count = m->rh->text_record_count;
+    if (m->mh && m->mh->extra_flags) {
+        state.extra_flags = *m->mh->extra_flags;
+    }
+    state.level = level;
+    state.ret = MOBI_SUCCESS;
+    MOBI_RET ret;
+    if (compression_type == MOBI_COMPRESSION_HUFFCDIC) {
+        ret = mobi_recompress_huffcdic(m, &state);
+    } else {
+        ret = mobi_stream_rawml(m, mobi_recompress_record, &state);
+        if (ret == MOBI_ERROR) {
+            ret = state.ret;
+        }
+    }
+    free(state.compressed);
+    free(state.text);
+    free(state.sizes);
+    if (ret != MOBI_SUCCESS) {
+        return ret;
+    }
+    if (compression_type == MOBI_COMPRESSION_PALMDOC && m->rh->compression_type == MOBI_COMPRESSION_HUFFCDIC && m->mh) {
+        if (m->mh->huff_rec_index) {
+            *m->mh->huff_rec_index = 0;
+        }
+        if (m->mh->huff_rec_count) {
+            *m->mh->huff_rec_count = 0;
+        }
+    }
+    m->rh->compression_type = compression_type;
+    return MOBI_SUCCESS;
+}
+
 /**
  @brief Write mobi document to file.
  
  Serializes metadata from MOBIData into raw records also stored in MOBIData (m->rec).
+ If compression level was set with mobi_set_compression() or mobi_set_compression_level(),
+ text records are recompressed first.
  Later writes palm database to file.
  
  @param[in,out] file File descriptor
@@ -509,6 +893,21 @@ MOBI_RET mobi_write_records(FILE *file, const MOBIData *m) {
  @return MOBI_RET status code (MOBI_SUCCESS on success)
  */
 MOBI_RET mobi_write_file(FILE *file, MOBIData *m) {
+    if (m && m->internals) {
+        const MOBIInternals *internals = m->internals;
+        const uint16_t compression_type = internals->compression_type;
+        const int level = internals->compression_level;
+        /* recompress text of both hybrid parts before anything is written */
+        if (level) {
+            MOBI_RET ret = mobi_recompress_text(m, compression_type, level);
+            if (ret == MOBI_SUCCESS && mobi_is_hybrid(m) && m->next) {
+                ret = mobi_recompress_text(m->next, compression_type, level);
+            }
+            if (ret != MOBI_SUCCESS) {
+                return ret;
+            }
+        }
+    }
     MOBI_RET ret = mobi_write_pdbheader(file, m);
     if (ret != MOBI_SUCCESS) {
         return ret;
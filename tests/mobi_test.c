@@ -0,0 +1,1191 @@
+/** @file mobi_test.c
+ *
+ * @brief mobi_test
+ *
+ * Program checking library api on a sample document.
+ * Document is loaded with every loader and results are compared
+ * with document loaded with mobi_load_filename().
+ * Properties read by mobi_probe() are compared with loaded document.
+ * PalmDOC text records and malformed data are decoded with both LZ77 decoders.
+ * Text of unencrypted documents decompressed with mobi_get_rawml()
+ * is compared with text returned by other functions.
+ * Reconstructed documents are compared with document reconstructed
+ * with one thread and without sidecar file.
+ * It is run by test.sh for every sample, after markup checksums are verified.
+ * Returns 0 on success, 1 on failure, 77 if sample can not be tested.
+ *
+ * Copyright (c) 2026 Bartek Fabiszewski
+ * http://www.fabiszewski.net
+ *
+ * Licensed under LGPL, either version 3, or any later.
+ * See <http://www.gnu.org/licenses/>
+ */
+
+#include <stdio.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <stdarg.h>
+#include <string.h>
+#include <mobi.h>
+#include "compression.h"
+#include "index.h"
+
+#define TEST_SKIP 77 /**< Exit status of skipped test */
+#define TEST_WORD_SIZEMAX 2048 /**< Size of buffer for headword converted to utf-8 */
+#define TEST_LZ77_SIZEMAX 4096 /**< Size of output buffer for LZ77 decoders, maximal size of text record */
+#define TEST_LZ77_RANDOM_COUNT 256 /**< Number of random inputs for LZ77 decoders */
+
+static const char *sample_path; /**< Path of tested sample */
+static const char *tmp_dir = "."; /**< Directory for temporary files */
+static size_t failures; /**< Number of failed checks */
+
+/**
+ @brief Report failed check
+
+ @param[in] format Format string of message
+ */
+static void test_fail(const char *format, ...) {
+    va_list args;
+    va_start(args, format);
+    fprintf(stderr, "%s: ", sample_path);
+    vfprintf(stderr, format, args);
+    fprintf(stderr, "\n");
+    va_end(args);
+    failures++;
+}
+
+/**
+ @brief Read whole file into memory
+
+ @param[out] size Size of read data
+ @param[in] path Path of the file
+ @return Allocated data, NULL on failure
+ */
+static unsigned char * test_read_file(size_t *size, const char *path) {
+    FILE *file = fopen(path, "rb");
+    if (file == NULL) {
+        return NULL;
+    }
+    unsigned char *data = NULL;
+    long length = -1;
+    if (fseek(file, 0, SEEK_END) == 0) {
+        length = ftell(file);
+    }
+    if (length > 0 && fseek(file, 0, SEEK_SET) == 0) {
+        data = malloc((size_t) length);
+        if (data && fread(data, 1, (size_t) length, file) != (size_t) length) {
+            free(data);
+            data = NULL;
+        }
+    }
+    fclose(file);
+    *size = (size_t) length;
+    return data;
+}
+
+/**
+ @brief Load document with mobi_load_filename()
+
+ @param[in] path Path of the document
+ @return Loaded document, NULL on failure
+ */
+static MOBIData * test_load(const char *path) {
+    MOBIData *m = mobi_init();
+    if (m == NULL) {
+        return NULL;
+    }
+    MOBI_RET ret = mobi_load_filename(m, path);
+    if (ret != MOBI_SUCCESS) {
+        test_fail("mobi_load_filename() failed (%i)", ret);
+        mobi_free(m);
+        return NULL;
+    }
+    return m;
+}
+
+/**
+ @brief Compare records of two documents
+
+ Records are walked with mobi_next_record(), so that lazily loaded data is read.
+
+ @param[in] m Reference document
+ @param[in] n Compared document
+ @param[in] loader Name of loader used for compared document
+ */
+static void test_compare_records(const MOBIData *m, const MOBIData *n, const char *loader) {
+    if (mobi_is_hybrid(m) != mobi_is_hybrid(n) || (m->rh == NULL) != (n->rh == NULL) || (m->mh == NULL) != (n->mh == NULL)) {
+        test_fail("%s: headers differ", loader);
+        return;
+    }
+    const MOBIPdbRecord *a = mobi_get_record_by_seqnumber(m, 0);
+    const MOBIPdbRecord *b = mobi_get_record_by_seqnumber(n, 0);
+    size_t i = 0;
+    while (a && b) {
+        if (a->uid != b->uid || a->size != b->size || (a->size && memcmp(a->data, b->data, a->size) != 0)) {
+            test_fail("%s: record %zu differs", loader, i);
+            return;
+        }
+        a = mobi_next_record(m, a);
+        b = mobi_next_record(n, b);
+        i++;
+    }
+    if (a || b) {
+        test_fail("%s: records count differs", loader);
+    }
+    /* parts of hybrid file share records list */
+    if ((m->next == NULL) != (n->next == NULL)
+        || (m->next && n->next && (m->next->rh == NULL || n->next->rh == NULL
+                                   || m->next->rh->text_length != n->next->rh->text_length))) {
+        test_fail("%s: other part of hybrid file differs", loader);
+    }
+}
+
+/**
+ @brief Function loading sample into initialized document
+
+ @param[in,out] n Initialized document
+ @param[in] data Sample file data
+ @param[in] size Size of sample file data
+ @return MOBI_RET status code (on success MOBI_SUCCESS)
+ */
+typedef MOBI_RET (*TestLoader)(MOBIData *n, const unsigned char *data, const size_t size);
+
+/**
+ @brief Load sample with mobi_load_filename_mmap()
+ */
+static MOBI_RET test_load_mmap(MOBIData *n, const unsigned char *data, const size_t size) {
+    (void) data;
+    (void) size;
+    return mobi_load_filename_mmap(n, sample_path);
+}
+
+/**
+ @brief Load sample with mobi_load_filename() and loading options
+
+ @param[in,out] n Initialized document
+ @param[in] flags Bitwise combination of MOBILoadFlags
+ @return MOBI_RET status code (on success MOBI_SUCCESS)
+ */
+static MOBI_RET test_load_flags(MOBIData *n, const unsigned int flags) {
+    MOBI_RET ret = mobi_set_loadflags(n, flags);
+    if (ret == MOBI_SUCCESS) {
+        ret = mobi_load_filename(n, sample_path);
+    }
+    return ret;
+}
+
+/**
+ @brief Load sample lazily
+ */
+static MOBI_RET test_load_lazy(MOBIData *n, const unsigned char *data, const size_t size) {
+    (void) data;
+    (void) size;
+    return test_load_flags(n, MOBI_LOAD_LAZY);
+}
+
+/**
+ @brief Load sample with mobi_load_buffer() borrowing the buffer
+ */
+static MOBI_RET test_load_buffer(MOBIData *n, const unsigned char *data, const size_t size) {
+    return mobi_load_buffer(n, data, size, MOBI_LOAD_DEFAULT);
+}
+
+/**
+ @brief Load sample with mobi_load_buffer() copying the buffer
+
+ Copied buffer is cleared and freed after loading,
+ document must not refer to it.
+ */
+static MOBI_RET test_load_buffer_copy(MOBIData *n, const unsigned char *data, const size_t size) {
+    unsigned char *copy = malloc(size);
+    if (copy == NULL) {
+        return MOBI_MALLOC_FAILED;
+    }
+    memcpy(copy, data, size);
+    MOBI_RET ret = mobi_load_buffer(n, copy, size, MOBI_LOAD_COPY);
+    memset(copy, 0, size);
+    free(copy);
+    return ret;
+}
+
+/**
+ @brief Load sample with single read into arena
+ */
+static MOBI_RET test_load_arena(MOBIData *n, const unsigned char *data, const size_t size) {
+    (void) data;
+    (void) size;
+    return test_load_flags(n, MOBI_LOAD_ARENA);
+}
+
+/**
+ @brief Context of MOBIIO callbacks reading from file
+ */
+typedef struct {
+    FILE *file; /**< File handler */
+} TestIO;
+
+/**
+ @brief MOBIIO read callback
+ */
+static size_t test_io_read(void *ctx, unsigned char *buf, const size_t size) {
+    return fread(buf, 1, size, ((TestIO *) ctx)->file);
+}
+
+/**
+ @brief MOBIIO seek callback
+ */
+static int test_io_seek(void *ctx, const size_t offset) {
+    return fseek(((TestIO *) ctx)->file, (long) offset, SEEK_SET);
+}
+
+/**
+ @brief MOBIIO size callback
+ */
+static size_t test_io_size(void *ctx) {
+    FILE *file = ((TestIO *) ctx)->file;
+    if (fseek(file, 0, SEEK_END) != 0) {
+        return 0;
+    }
+    const long size = ftell(file);
+    return size > 0 ? (size_t) size : 0;
+}
+
+/**
+ @brief MOBIIO read_ranges callback
+ */
+static int test_io_read_ranges(void *ctx, const MOBIIORange *ranges, const size_t count) {
+    for (size_t i = 0; i < count; i++) {
+        if (test_io_seek(ctx, ranges[i].offset) != 0
+            || test_io_read(ctx, ranges[i].data, ranges[i].size) != ranges[i].size) {
+            return 1;
+        }
+    }
+    return 0;
+}
+
+/**
+ @brief Load sample with mobi_load_io()
+
+ @param[in,out] n Initialized document
+ @param[in] batched Use read_ranges callback
+ @return MOBI_RET status code (on success MOBI_SUCCESS)
+ */
+static MOBI_RET test_load_io(MOBIData *n, const bool batched) {
+    TestIO ctx = { fopen(sample_path, "rb") };
+    if (ctx.file == NULL) {
+        return MOBI_FILE_NOT_FOUND;
+    }
+    const MOBIIO io = { test_io_read, test_io_seek, test_io_size, batched ? test_io_read_ranges : NULL };
+    MOBI_RET ret = mobi_load_io(n, &io, &ctx);
+    fclose(ctx.file);
+    return ret;
+}
+
+/**
+ @brief Load sample with mobi_load_io()
+ */
+static MOBI_RET test_load_io_plain(MOBIData *n, const unsigned char *data, const size_t size) {
+    (void) data;
+    (void) size;
+    return test_load_io(n, false);
+}
+
+/**
+ @brief Load sample with mobi_load_io() reading records with read_ranges callback
+ */
+static MOBI_RET test_load_io_batched(MOBIData *n, const unsigned char *data, const size_t size) {
+    (void) data;
+    (void) size;
+    return test_load_io(n, true);
+}
+
+/**
+ @brief Load sample with mobi_load_io() and lazy loading option, which is ignored
+ */
+static MOBI_RET test_load_io_lazy(MOBIData *n, const unsigned char *data, const size_t size) {
+    (void) data;
+    (void) size;
+    MOBI_RET ret = mobi_set_loadflags(n, MOBI_LOAD_LAZY);
+    if (ret == MOBI_SUCCESS) {
+        ret = test_load_io(n, false);
+    }
+    return ret;
+}
+
+/**
+ @brief Load sample skipping records of unused part of hybrid file
+ */
+static MOBI_RET test_load_skip_hybrid(MOBIData *n, const unsigned char *data, const size_t size) {
+    (void) data;
+    (void) size;
+    return test_load_flags(n, MOBI_LOAD_SKIP_HYBRID);
+}
+
+/**
+ @brief Load sample with mobi_load_io() and skip hybrid option, which is ignored
+ */
+static MOBI_RET test_load_io_skip_hybrid(MOBIData *n, const unsigned char *data, const size_t size) {
+    (void) data;
+    (void) size;
+    MOBI_RET ret = mobi_set_loadflags(n, MOBI_LOAD_SKIP_HYBRID);
+    if (ret == MOBI_SUCCESS) {
+        ret = test_load_io(n, false);
+    }
+    return ret;
+}
+
+/**
+ @brief Check that all loaders read the same records as mobi_load_filename()
+
+ @param[in] m Reference document
+ */
+static void test_loaders(const MOBIData *m) {
+    const struct {
+        const char *name;
+        TestLoader load;
+    } loaders[] = {
+        { "mmap", test_load_mmap },
+        { "lazy", test_load_lazy },
+        { "buffer", test_load_buffer },
+        { "buffer copy", test_load_buffer_copy },
+        { "arena", test_load_arena },
+        { "io", test_load_io_plain },
+        { "io batched", test_load_io_batched },
+        { "io lazy flag", test_load_io_lazy },
+        { "skip hybrid", test_load_skip_hybrid },
+        { "io skip hybrid flag", test_load_io_skip_hybrid },
+    };
+    size_t size = 0;
+    unsigned char *data = test_read_file(&size, sample_path);
+    if (data == NULL) {
+        test_fail("reading sample failed");
+        return;
+    }
+    for (size_t i = 0; i < sizeof(loaders) / sizeof(loaders[0]); i++) {
+        MOBIData *n = mobi_init();
+        if (n == NULL) {
+            test_fail("mobi_init() failed");
+            break;
+        }
+        MOBI_RET ret = loaders[i].load(n, data, size);
+        if (ret != MOBI_SUCCESS) {
+            test_fail("%s: loading failed (%i)", loaders[i].name, ret);
+        } else {
+            test_compare_records(m, n, loaders[i].name);
+        }
+        mobi_free(n);
+    }
+    free(data);
+}
+
+/**
+ @brief Check that mobi_probe() reports the same properties as full load
+
+ @param[in] m Reference document
+ */
+static void test_probe(const MOBIData *m) {
+    MOBIProbeInfo info;
+    MOBI_RET ret = mobi_probe(sample_path, &info);
+    if (ret != MOBI_SUCCESS) {
+        test_fail("mobi_probe() failed (%i)", ret);
+        return;
+    }
+    if (info.version != mobi_get_fileversion(m) || info.is_kf8 != mobi_is_kf8(m)
+        || info.is_hybrid != mobi_is_hybrid(m) || info.is_replica != mobi_is_replica(m)
+        || info.is_dictionary != mobi_is_dictionary(m) || info.rec_count != m->ph->rec_count) {
+        test_fail("probe: document type differs");
+    }
+    if (m->rh && (info.encryption_type != m->rh->encryption_type || info.compression_type != m->rh->compression_type
+                  || info.text_length != m->rh->text_length)) {
+        test_fail("probe: record0 header differs");
+    }
+    char *title = mobi_meta_get_title(m);
+    if (title && strncmp(info.title, title, MOBI_TITLE_SIZEMAX) != 0) {
+        test_fail("probe: title differs (%s != %s)", info.title, title);
+    }
+    free(title);
+    size_t cover_seqnumber = MOBI_NOTSET;
+    const MOBIExthHeader *exth = mobi_get_exthrecord_by_tag(m, EXTH_COVEROFFSET);
+    if (exth && m->mh && m->mh->image_index && *m->mh->image_index != MOBI_NOTSET) {
+        const size_t seqnumber = *m->mh->image_index + mobi_decode_exthvalue(exth->data, exth->size);
+        const MOBIPdbRecord *record = mobi_get_record_by_seqnumber(m, seqnumber);
+        if (record) {
+            cover_seqnumber = seqnumber;
+            if (info.cover_offset != record->offset) {
+                test_fail("probe: cover offset differs");
+            }
+        }
+    }
+    if (info.cover_seqnumber != cover_seqnumber) {
+        test_fail("probe: cover differs");
+    }
+}
+
+/**
+ @brief Check that LZ77 decoders return the same status and data
+
+ @param[in] in Compressed data
+ @param[in] len_in Size of compressed data
+ @param[in] len_out Size of output buffer, at most TEST_LZ77_SIZEMAX
+ @param[in] what Description of compressed data
+ @return True if results are the same, false otherwise
+ */
+static bool test_lz77_compare(const unsigned char *in, const size_t len_in, const size_t len_out, const char *what) {
+    unsigned char out[TEST_LZ77_SIZEMAX];
+    unsigned char out_reference[TEST_LZ77_SIZEMAX];
+    /* zero distance back-reference leaves output unchanged */
+    memset(out, 0, sizeof(out));
+    memset(out_reference, 0, sizeof(out_reference));
+    size_t len = len_out;
+    size_t len_reference = len_out;
+    const MOBI_RET ret = mobi_decompress_lz77(out, in, &len, len_in);
+    const MOBI_RET ret_reference = mobi_decompress_lz77_reference(out_reference, in, &len_reference, len_in);
+    if (ret != ret_reference || len != len_reference || memcmp(out, out_reference, len) != 0) {
+        test_fail("lz77: %s (%zu bytes into %zu) decoded differently (%i, %zu != %i, %zu)",
+                  what, len_in, len_out, ret, len, ret_reference, len_reference);
+        return false;
+    }
+    return true;
+}
+
+/**
+ @brief Check that LZ77 decoders return the same results for malformed data
+
+ Random and crafted data is decoded into full and into short output buffer.
+ */
+static void test_lz77_malformed(void) {
+    const struct {
+        const char *data;
+        size_t size;
+    } crafted[] = {
+        { "\x80", 1 }, /* back-reference without second byte */
+        { "\x80\x08", 2 }, /* back-reference before start of output */
+        { "ab\x80\x00", 4 }, /* zero distance back-reference */
+        { "ab\x80\x10\x80\x17", 6 }, /* overlapping back-references */
+        { "\x05" "abc", 4 }, /* literal run past end of input */
+        { "a\xc1\x00\x08", 4 }, /* byte pair, null and single char */
+    };
+    for (size_t i = 0; i < sizeof(crafted) / sizeof(crafted[0]); i++) {
+        const unsigned char *in = (const unsigned char *) crafted[i].data;
+        for (size_t len_out = 0; len_out <= 4; len_out++) {
+            test_lz77_compare(in, crafted[i].size, len_out, "crafted data");
+        }
+        test_lz77_compare(in, crafted[i].size, TEST_LZ77_SIZEMAX, "crafted data");
+    }
+    /* xorshift generator with fixed seed, so that failures are reproducible */
+    uint32_t state = 2463534242U;
+    unsigned char in[TEST_LZ77_SIZEMAX / 4];
+    for (size_t i = 0; i < TEST_LZ77_RANDOM_COUNT; i++) {
+        const size_t len_in = 1 + i * (sizeof(in) - 1) / (TEST_LZ77_RANDOM_COUNT - 1);
+        for (size_t j = 0; j < len_in; j++) {
+            state ^= state << 13;
+            state ^= state >> 17;
+            state ^= state << 5;
+            /* more back-references than in uniform data */
+            in[j] = (unsigned char) ((state & 0x300) ? state : state | 0x80);
+        }
+        if (!test_lz77_compare(in, len_in, TEST_LZ77_SIZEMAX, "random data")
+            || !test_lz77_compare(in, len_in, len_in, "random data")) {
+            break;
+        }
+    }
+}
+
+/**
+ @brief Check that LZ77 decoders return the same results for text records
+
+ Every text record is decoded whole, truncated, and into short output buffer.
+
+ @param[in] m Document with palmdoc compression
+ */
+static void test_lz77(const MOBIData *m) {
+    const uint16_t extra_flags = (m->mh && m->mh->extra_flags) ? *m->mh->extra_flags : 0;
+    const size_t offset = mobi_get_kf8offset(m);
+    for (size_t i = 1; i <= m->rh->text_record_count; i++) {
+        const MOBIPdbRecord *record = mobi_get_record_by_seqnumber(m, offset + i);
+        if (record == NULL) {
+            test_fail("text record %zu not found", i);
+            return;
+        }
+        const size_t extra_size = mobi_get_record_extrasize(record, extra_flags);
+        if (extra_size == MOBI_NOTSET || extra_size > record->size) {
+            test_fail("text record %zu corrupt", i);
+            return;
+        }
+        const size_t size = record->size - extra_size;
+        if (!test_lz77_compare(record->data, size, TEST_LZ77_SIZEMAX, "text record")
+            || !test_lz77_compare(record->data, size, size, "text record")
+            || !test_lz77_compare(record->data, size / 2, TEST_LZ77_SIZEMAX, "truncated text record")
+            || (size && !test_lz77_compare(record->data, size - 1, TEST_LZ77_SIZEMAX, "truncated text record"))) {
+            return;
+        }
+    }
+}
+
+/**
+ @brief Decompress whole text with mobi_get_rawml()
+
+ @param[in] m Document
+ @param[out] len Length of decompressed text
+ @return Allocated text, NULL on failure
+ */
+static char * test_get_rawml(const MOBIData *m, size_t *len) {
+    const size_t maxlen = mobi_get_text_maxsize(m);
+    if (maxlen == MOBI_NOTSET) {
+        test_fail("mobi_get_text_maxsize() failed");
+        return NULL;
+    }
+    char *text = malloc(maxlen + 1);
+    if (text == NULL) {
+        test_fail("memory allocation failed");
+        return NULL;
+    }
+    *len = maxlen;
+    MOBI_RET ret = mobi_get_rawml(m, text, len);
+    if (ret != MOBI_SUCCESS) {
+        test_fail("mobi_get_rawml() failed (%i)", ret);
+        free(text);
+        return NULL;
+    }
+    return text;
+}
+
+/**
+ @brief Check that mobi_get_rawml() returns reference text
+
+ @param[in] n Checked document
+ @param[in] text Reference text
+ @param[in] length Length of the reference text
+ @param[in] what Description of checked document
+ */
+static void test_check_rawml(const MOBIData *n, const char *text, const size_t length, const char *what) {
+    size_t len = 0;
+    char *checked_text = test_get_rawml(n, &len);
+    if (checked_text && (len != length || memcmp(checked_text, text, len) != 0)) {
+        test_fail("text %s differs", what);
+    }
+    free(checked_text);
+}
+
+/**
+ @brief Check that text decompressed with different numbers of threads is the same
+
+ @param[in] text Text decompressed with mobi_get_rawml()
+ @param[in] length Length of the text
+ */
+static void test_threads(const char *text, const size_t length) {
+    const size_t threads[] = { 1, 4 };
+    for (size_t i = 0; i < sizeof(threads) / sizeof(threads[0]); i++) {
+        MOBIData *n = test_load(sample_path);
+        if (n == NULL) {
+            return;
+        }
+        MOBI_RET ret = mobi_set_threads(n, threads[i]);
+        if (ret != MOBI_SUCCESS) {
+            test_fail("mobi_set_threads() failed (%i)", ret);
+        } else {
+            test_check_rawml(n, text, length, threads[i] == 1 ? "decompressed with 1 thread" : "decompressed with 4 threads");
+        }
+        mobi_free(n);
+    }
+}
+
+/**
+ @brief Check that mobi_get_text_range() returns parts of the text
+
+ Ranges of various lengths start at offsets spread over the text,
+ the last range exceeds text end.
+
+ @param[in] m Document
+ @param[in] text Text decompressed with mobi_get_rawml()
+ @param[in] length Length of the text
+ */
+static void test_text_range(const MOBIData *m, const char *text, const size_t length) {
+    const size_t sizes[] = { 1, 100, 4095, 4096, 10000, 50000 };
+    const size_t sizes_count = sizeof(sizes) / sizeof(sizes[0]);
+    char *range = malloc(sizes[sizes_count - 1]);
+    if (range == NULL) {
+        test_fail("memory allocation failed");
+        return;
+    }
+    size_t i = 0;
+    for (size_t offset = 0; offset < length; offset += 7919) {
+        size_t len = sizes[i++ % sizes_count];
+        const size_t expected = (offset + len > length) ? length - offset : len;
+        MOBI_RET ret = mobi_get_text_range(m, offset, range, &len);
+        if (ret != MOBI_SUCCESS || len != expected || memcmp(range, text + offset, len) != 0) {
+            test_fail("text range at %zu differs (%i)", offset, ret);
+            break;
+        }
+    }
+    const size_t offset = length > 10 ? length - 10 : 0;
+    size_t len = 100;
+    MOBI_RET ret = mobi_get_text_range(m, offset, range, &len);
+    if (ret != MOBI_SUCCESS || len != length - offset || memcmp(range, text + offset, len) != 0) {
+        test_fail("text range at text end differs (%i)", ret);
+    }
+    free(range);
+}
+
+/**
+ @brief State of mobi_stream_rawml() callback comparing streamed data with text
+ */
+typedef struct {
+    const char *text; /**< Text decompressed with mobi_get_rawml() */
+    size_t length; /**< Length of the text */
+    size_t offset; /**< Offset of next streamed data */
+    bool differs; /**< Set if streamed data differs from text */
+} TestStream;
+
+/**
+ @brief mobi_stream_rawml() callback
+ */
+static int test_stream_callback(const unsigned char *data, const size_t size, void *userdata) {
+    TestStream *stream = userdata;
+    if (stream->offset + size > stream->length || memcmp(stream->text + stream->offset, data, size) != 0) {
+        stream->differs = true;
+        return 1;
+    }
+    stream->offset += size;
+    return 0;
+}
+
+/**
+ @brief Check that mobi_stream_rawml() passes the whole text
+
+ @param[in] m Document
+ @param[in] text Text decompressed with mobi_get_rawml()
+ @param[in] length Length of the text
+ */
+static void test_stream(const MOBIData *m, const char *text, const size_t length) {
+    TestStream stream = { text, length, 0, false };
+    MOBI_RET ret = mobi_stream_rawml(m, test_stream_callback, &stream);
+    if (ret != MOBI_SUCCESS || stream.differs || stream.offset != length) {
+        test_fail("streamed text differs (%i)", ret);
+    }
+}
+
+/**
+ @brief Check that documents sharing cache of decompressed records return the same text
+
+ Two documents loaded from the sample use the same cache and document id,
+ so that the second one reads records cached by the first one,
+ also after the first one is freed.
+ Small cache budget forces eviction of records.
+
+ @param[in] text Text decompressed with mobi_get_rawml()
+ @param[in] length Length of the text
+ */
+static void test_cache(const char *text, const size_t length) {
+    const size_t budgets[] = { 64 * 1024 * 1024, 8192 };
+    for (size_t i = 0; i < sizeof(budgets) / sizeof(budgets[0]); i++) {
+        MOBIRecordCache *cache = mobi_cache_init(budgets[i]);
+        if (cache == NULL) {
+            test_fail("mobi_cache_init() failed");
+            return;
+        }
+        MOBIData *first = test_load(sample_path);
+        MOBIData *second = test_load(sample_path);
+        if (first && second) {
+            MOBI_RET ret = mobi_set_cache(first, cache, sample_path);
+            if (ret == MOBI_SUCCESS) {
+                ret = mobi_set_cache(second, cache, sample_path);
+            }
+            if (ret != MOBI_SUCCESS) {
+                test_fail("mobi_set_cache() failed (%i)", ret);
+            } else {
+                const char *what = i == 0 ? "read with large cache" : "read with small cache";
+                test_check_rawml(first, text, length, what);
+                test_check_rawml(second, text, length, what);
+                mobi_free(first);
+                first = NULL;
+                test_check_rawml(second, text, length, what);
+            }
+        }
+        mobi_free(first);
+        mobi_free(second);
+        mobi_cache_free(cache);
+    }
+}
+
+/**
+ @brief Build path of temporary file in tmp_dir
+
+ @param[out] path Buffer of FILENAME_MAX bytes for the path
+ @param[in] suffix Suffix appended to sample file name
+ */
+static void test_tmp_path(char *path, const char *suffix) {
+    const char *basename = strrchr(sample_path, '/');
+    basename = basename ? basename + 1 : sample_path;
+    snprintf(path, FILENAME_MAX, "%s/%s%s", tmp_dir, basename, suffix);
+}
+
+/**
+ @brief Recompress text records, save document and check reloaded text
+
+ @param[in] text Text decompressed with mobi_get_rawml()
+ @param[in] length Length of the text
+ @param[in] compression_type Compression type
+ @param[in] level Compression level
+ @param[in] threads Number of threads used for compression
+ @param[out] size Size of saved document
+ @return Data of saved document, NULL on failure or if document can not be recompressed
+ */
+static unsigned char * test_recompress(const char *text, const size_t length, const uint16_t compression_type,
+                                       const int level, const size_t threads, size_t *size) {
+    MOBIData *n = test_load(sample_path);
+    if (n == NULL) {
+        return NULL;
+    }
+    MOBI_RET ret = mobi_set_threads(n, threads);
+    if (ret == MOBI_SUCCESS) {
+        ret = mobi_set_compression(n, compression_type, level);
+    }
+    if (ret != MOBI_SUCCESS) {
+        /* huff/cdic compression requires mobi header */
+        if (compression_type != MOBI_COMPRESSION_HUFFCDIC || n->mh || ret != MOBI_PARAM_ERR) {
+            test_fail("mobi_set_compression(%u, %i) failed (%i)", compression_type, level, ret);
+        }
+        mobi_free(n);
+        return NULL;
+    }
+    char path[FILENAME_MAX];
+    test_tmp_path(path, compression_type == MOBI_COMPRESSION_HUFFCDIC ? "-huffcdic.mobi" : "-palmdoc.mobi");
+    FILE *file = fopen(path, "wb");
+    if (file == NULL) {
+        test_fail("could not open %s", path);
+        mobi_free(n);
+        return NULL;
+    }
+    ret = mobi_write_file(file, n);
+    fclose(file);
+    mobi_free(n);
+    unsigned char *data = NULL;
+    if (ret != MOBI_SUCCESS) {
+        test_fail("mobi_write_file() failed (%i)", ret);
+    } else if ((n = test_load(path))) {
+        if (n->rh == NULL || n->rh->compression_type != compression_type) {
+            test_fail("compression type %u not set", compression_type);
+        }
+        test_check_rawml(n, text, length, compression_type == MOBI_COMPRESSION_HUFFCDIC ? "recompressed with huff/cdic" : "recompressed with palmdoc");
+        mobi_free(n);
+        data = test_read_file(size, path);
+    }
+    remove(path);
+    return data;
+}
+
+/**
+ @brief Check that text recompressed with palmdoc compression is the same after reload
+
+ @param[in] text Text decompressed with mobi_get_rawml()
+ @param[in] length Length of the text
+ */
+static void test_palmdoc(const char *text, const size_t length) {
+    const int levels[] = { MOBI_LZ77_LEVEL_FAST, MOBI_LZ77_LEVEL_BEST };
+    for (size_t i = 0; i < sizeof(levels) / sizeof(levels[0]); i++) {
+        size_t size = 0;
+        free(test_recompress(text, length, MOBI_COMPRESSION_PALMDOC, levels[i], 1, &size));
+    }
+}
+
+/**
+ @brief Check that text recompressed with huff/cdic compression is the same after reload
+
+ Documents compressed with one and more threads must be identical.
+
+ @param[in] text Text decompressed with mobi_get_rawml()
+ @param[in] length Length of the text
+ */
+static void test_huffcdic(const char *text, const size_t length) {
+    size_t size = 0;
+    unsigned char *data = test_recompress(text, length, MOBI_COMPRESSION_HUFFCDIC, MOBI_LZ77_LEVEL_FAST, 1, &size);
+    if (data == NULL) {
+        return;
+    }
+    size_t threads_size = 0;
+    unsigned char *threads_data = test_recompress(text, length, MOBI_COMPRESSION_HUFFCDIC, MOBI_LZ77_LEVEL_FAST, 4, &threads_size);
+    if (threads_data && (threads_size != size || memcmp(threads_data, data, size) != 0)) {
+        test_fail("huff/cdic output depends on number of threads");
+    }
+    free(threads_data);
+    free(data);
+}
+
+/**
+ @brief Convert cp1252 encoded label to utf-8
+
+ Only ascii and latin-1 characters are converted.
+
+ @param[out] word Buffer for converted label, at least twice the length of the label
+ @param[in] label Label
+ @return True on success, false if label contains other characters
+ */
+static bool test_label_to_utf8(char *word, const char *label) {
+    const unsigned char *in = (const unsigned char *) label;
+    unsigned char *out = (unsigned char *) word;
+    while (*in) {
+        if (*in < 0x80) {
+            *out++ = *in;
+        } else if (*in >= 0xa0) {
+            *out++ = (unsigned char) (0xc0 | (*in >> 6));
+            *out++ = (unsigned char) (0x80 | (*in & 0x3f));
+        } else {
+            return false;
+        }
+        in++;
+    }
+    *out = '\0';
+    return true;
+}
+
+/**
+ @brief Check that headwords are found with mobi_dict_lookup() by their inflected forms
+ 
+ Forms are generated with rules of new type infl index, like in mobi_reconstruct_infl().
+ 
+ @param[in] dict Opened dictionary
+ @param[in] orth Parsed orth index
+ @param[in] infl Parsed infl index
+ */
+static void test_dict_infl(const MOBIDict *dict, const MOBIIndx *orth, const MOBIIndx *infl) {
+    size_t failed = 0;
+    for (size_t i = 0; i < orth->entries_count && failed < 10; i++) {
+        const char *label = orth->entries[i].label;
+        const size_t label_length = strlen(label);
+        if (label_length >= TEST_WORD_SIZEMAX / 2 || label_length > INDX_INFLBUF_SIZEMAX) {
+            continue;
+        }
+        uint32_t *groups;
+        const size_t groups_count = mobi_get_indxentry_tagarray(&groups, &orth->entries[i], INDX_TAGARR_ORTH_INFL);
+        for (size_t j = 0; j < groups_count && groups[j] < infl->entries_count; j++) {
+            uint32_t *parts;
+            const size_t parts_count = mobi_get_indxentry_tagarray(&parts, &infl->entries[groups[j]], INDX_TAGARR_INFL_PARTS_V2);
+            for (size_t k = 0; k < parts_count && parts[k] < infl->entries_count; k++) {
+                unsigned char form[INDX_INFLBUF_SIZEMAX + 1];
+                memcpy(form, label, label_length);
+                int form_length = (int) label_length;
+                if (mobi_decode_infl(form, &form_length, (unsigned char *) infl->entries[parts[k]].label) != MOBI_SUCCESS || form_length == 0) {
+                    continue;
+                }
+                form[form_length] = '\0';
+                char word[TEST_WORD_SIZEMAX];
+                if (orth->encoding == MOBI_CP1252) {
+                    if (!test_label_to_utf8(word, (char *) form)) {
+                        continue;
+                    }
+                } else {
+                    strcpy(word, (char *) form);
+                }
+                MOBIDictEntry *entries = NULL;
+                size_t count = 0;
+                MOBI_RET ret = mobi_dict_lookup(&entries, &count, dict, word);
+                bool found = false;
+                for (size_t n = 0; n < count; n++) {
+                    if (entries[n].number == i) {
+                        found = true;
+                    }
+                }
+                mobi_dict_free_entries(entries, count);
+                if (!found) {
+                    test_fail("headword %s not found by inflected form %s (%i)", label, word, ret);
+                    failed++;
+                }
+            }
+        }
+    }
+}
+
+/**
+ @brief Check that every headword of dictionary is found with mobi_dict_lookup()
+
+ Headword must be found exactly, inflected forms may be returned as well.
+ Text of the first entry is compared with decompressed text.
+
+ @param[in] m Document
+ @param[in] text Text decompressed with mobi_get_rawml()
+ @param[in] length Length of the text
+ */
+static void test_dict(const MOBIData *m, const char *text, const size_t length) {
+    MOBIDict *dict = NULL;
+    MOBI_RET ret = mobi_dict_open(&dict, m);
+    if (ret != MOBI_SUCCESS) {
+        test_fail("mobi_dict_open() failed (%i)", ret);
+        return;
+    }
+    MOBIDictEntry *entries = NULL;
+    size_t count = 0;
+    if (mobi_dict_lookup(&entries, &count, dict, "") != MOBI_PARAM_ERR) {
+        test_fail("lookup of empty word did not fail");
+        mobi_dict_free_entries(entries, count);
+    }
+    MOBIRawml *rawml = mobi_init_rawml(m);
+    ret = rawml ? mobi_parse_rawml_opt(rawml, m, false, true, false) : MOBI_MALLOC_FAILED;
+    if (ret != MOBI_SUCCESS || rawml->orth == NULL) {
+        test_fail("parsing orth index failed (%i)", ret);
+        mobi_free_rawml(rawml);
+        mobi_dict_free(dict);
+        return;
+    }
+    const MOBIIndx *orth = rawml->orth;
+    size_t failed = 0;
+    for (size_t i = 0; i < orth->entries_count && failed < 10; i++) {
+        const char *label = orth->entries[i].label;
+        char word[TEST_WORD_SIZEMAX];
+        if (strlen(label) >= TEST_WORD_SIZEMAX / 2) {
+            continue;
+        }
+        if (orth->encoding == MOBI_CP1252) {
+            if (!test_label_to_utf8(word, label)) {
+                continue;
+            }
+        } else {
+            strcpy(word, label);
+        }
+        ret = mobi_dict_lookup(&entries, &count, dict, word);
+        bool found = (ret == MOBI_SUCCESS && count > 0);
+        for (size_t j = 0; found && j < count; j++) {
+            if (!entries[j].is_inflection && strcmp(entries[j].label, word) != 0) {
+                found = false;
+            }
+        }
+        if (!found) {
+            test_fail("headword %s not found (%i)", word, ret);
+            failed++;
+        } else if (entries[0].offset < length) {
+            char entry_text[256];
+            size_t len = sizeof(entry_text);
+            ret = mobi_dict_get_text(dict, &entries[0], entry_text, &len);
+            if (ret != MOBI_SUCCESS || len > length - entries[0].offset
+                || memcmp(entry_text, text + entries[0].offset, len) != 0) {
+                test_fail("text of headword %s differs (%i)", word, ret);
+                failed++;
+            }
+        }
+        mobi_dict_free_entries(entries, count);
+    }
+    if (rawml->infl && mobi_indx_has_tag(orth, INDX_TAGARR_ORTH_INFL)) {
+        test_dict_infl(dict, orth, rawml->infl);
+    }
+    mobi_free_rawml(rawml);
+    mobi_dict_free(dict);
+}
+
+/**
+ @brief Compare parsed indices
+
+ @param[in] a Reference index
+ @param[in] b Compared index
+ @return True if indices are equal
+ */
+static bool test_indx_equal(const MOBIIndx *a, const MOBIIndx *b) {
+    if (a == NULL || b == NULL) {
+        return a == b;
+    }
+    if (a->entries_count != b->entries_count || a->total_entries_count != b->total_entries_count
+        || a->encoding != b->encoding || a->type != b->type) {
+        return false;
+    }
+    for (size_t i = 0; i < a->entries_count; i++) {
+        const MOBIIndexEntry *ea = &a->entries[i];
+        const MOBIIndexEntry *eb = &b->entries[i];
+        if (strcmp(ea->label, eb->label) != 0 || ea->tags_count != eb->tags_count) {
+            return false;
+        }
+        for (size_t j = 0; j < ea->tags_count; j++) {
+            const MOBIIndexTag *ta = &ea->tags[j];
+            const MOBIIndexTag *tb = &eb->tags[j];
+            if (ta->tagid != tb->tagid || ta->tagvalues_count != tb->tagvalues_count
+                || (ta->tagvalues_count && memcmp(ta->tagvalues, tb->tagvalues, ta->tagvalues_count * sizeof(*ta->tagvalues)) != 0)) {
+                return false;
+            }
+        }
+    }
+    return true;
+}
+
+/**
+ @brief Compare lists of reconstructed parts
+
+ @param[in] a Reference list
+ @param[in] b Compared list
+ @return True if lists are equal
+ */
+static bool test_parts_equal(const MOBIPart *a, const MOBIPart *b) {
+    while (a && b) {
+        if (a->uid != b->uid || a->type != b->type || a->size != b->size
+            || (a->size && memcmp(a->data, b->data, a->size) != 0)) {
+            return false;
+        }
+        a = a->next;
+        b = b->next;
+    }
+    return a == b;
+}
+
+/**
+ @brief Compare reconstructed documents
+
+ @param[in] a Reference document
+ @param[in] b Compared document
+ @param[in] what Description of compared document
+ */
+static void test_compare_rawml(const MOBIRawml *a, const MOBIRawml *b, const char *what) {
+    if ((a->fdst == NULL) != (b->fdst == NULL)
+        || (a->fdst && (a->fdst->fdst_section_count != b->fdst->fdst_section_count
+                        || memcmp(a->fdst->fdst_section_starts, b->fdst->fdst_section_starts, a->fdst->fdst_section_count * sizeof(uint32_t)) != 0
+                        || memcmp(a->fdst->fdst_section_ends, b->fdst->fdst_section_ends, a->fdst->fdst_section_count * sizeof(uint32_t)) != 0))) {
+        test_fail("fdst %s differs", what);
+    }
+    const MOBIIndx *indices_a[] = { a->skel, a->frag, a->guide, a->ncx, a->orth, a->infl };
+    const MOBIIndx *indices_b[] = { b->skel, b->frag, b->guide, b->ncx, b->orth, b->infl };
+    const char *names[] = { "skel", "frag", "guide", "ncx", "orth", "infl" };
+    for (size_t i = 0; i < sizeof(names) / sizeof(names[0]); i++) {
+        if (!test_indx_equal(indices_a[i], indices_b[i])) {
+            test_fail("%s index %s differs", names[i], what);
+        }
+    }
+    if (!test_parts_equal(a->flow, b->flow) || !test_parts_equal(a->markup, b->markup)
+        || !test_parts_equal(a->resources, b->resources)) {
+        test_fail("reconstructed parts %s differ", what);
+    }
+}
+
+/**
+ @brief Reconstruct document with mobi_parse_rawml()
+
+ Reconstructed resources point to records data,
+ so the document must be freed after reconstructed document.
+
+ @param[out] n Document loaded from sample
+ @param[in] path Path of sidecar file or NULL
+ @param[in] threads Number of threads used for parsing
+ @return Reconstructed document, NULL on failure
+ */
+static MOBIRawml * test_parse_rawml(MOBIData **n, const char *path, const size_t threads) {
+    *n = test_load(sample_path);
+    if (*n == NULL) {
+        return NULL;
+    }
+    MOBIRawml *rawml = NULL;
+    MOBI_RET ret = mobi_set_threads(*n, threads);
+    if (ret == MOBI_SUCCESS) {
+        ret = mobi_set_sidecar(*n, path);
+    }
+    if (ret == MOBI_SUCCESS) {
+        rawml = mobi_init_rawml(*n);
+        ret = rawml ? mobi_parse_rawml(rawml, *n) : MOBI_MALLOC_FAILED;
+    }
+    if (ret != MOBI_SUCCESS) {
+        test_fail("reconstruction failed (%i)", ret);
+        mobi_free_rawml(rawml);
+        rawml = NULL;
+    }
+    return rawml;
+}
+
+/**
+ @brief Check that document reconstructed with more threads is the same
+
+ Records of indices are parsed in parallel.
+
+ @param[in] rawml Document reconstructed with one thread
+ */
+static void test_parse_threads(const MOBIRawml *rawml) {
+    MOBIData *n = NULL;
+    MOBIRawml *threads_rawml = test_parse_rawml(&n, NULL, 4);
+    if (threads_rawml) {
+        test_compare_rawml(rawml, threads_rawml, "parsed with 4 threads");
+        mobi_free_rawml(threads_rawml);
+    }
+    mobi_free(n);
+}
+
+/**
+ @brief Check that document reconstructed with sidecar file is the same
+
+ First reconstruction writes sidecar file, second one reads indices from it.
+
+ @param[in] rawml Document reconstructed without sidecar file
+ */
+static void test_sidecar(const MOBIRawml *rawml) {
+    char path[FILENAME_MAX];
+    test_tmp_path(path, ".idx");
+    remove(path);
+    MOBIData *n = NULL;
+    MOBIRawml *cold = test_parse_rawml(&n, path, 1);
+    if (cold) {
+        test_compare_rawml(rawml, cold, "written to sidecar");
+        mobi_free_rawml(cold);
+    }
+    mobi_free(n);
+    const bool has_indices = rawml->fdst || rawml->skel || rawml->frag || rawml->guide
+                             || rawml->ncx || rawml->orth || rawml->infl;
+    FILE *file = fopen(path, "rb");
+    if (file) {
+        fclose(file);
+    } else if (has_indices) {
+        test_fail("sidecar file %s not written", path);
+    }
+    MOBIRawml *warm = test_parse_rawml(&n, path, 1);
+    if (warm) {
+        test_compare_rawml(rawml, warm, "read from sidecar");
+        mobi_free_rawml(warm);
+    }
+    mobi_free(n);
+    remove(path);
+}
+
+/**
+ @brief Main
+ */
+int main(int argc, char *argv[]) {
+    if (argc < 2) {
+        printf("usage: %s sample [tmpdir]\n", argv[0]);
+        return TEST_SKIP;
+    }
+    sample_path = argv[1];
+    if (argc > 2) {
+        tmp_dir = argv[2];
+    }
+    MOBIData *m = test_load(sample_path);
+    if (m == NULL) {
+        return EXIT_FAILURE;
+    }
+    test_loaders(m);
+    test_probe(m);
+    test_lz77_malformed();
+    if (!mobi_is_encrypted(m) && m->rh && m->rh->compression_type == MOBI_COMPRESSION_PALMDOC) {
+        test_lz77(m);
+    }
+    if (!mobi_is_encrypted(m) && m->rh) {
+        size_t length = 0;
+        char *text = test_get_rawml(m, &length);
+        if (text) {
+            test_threads(text, length);
+            test_text_range(m, text, length);
+            test_stream(m, text, length);
+            test_cache(text, length);
+            test_palmdoc(text, length);
+            test_huffcdic(text, length);
+            if (mobi_is_dictionary(m)) {
+                test_dict(m, text, length);
+            }
+            MOBIData *n = NULL;
+            MOBIRawml *rawml = test_parse_rawml(&n, NULL, 1);
+            if (rawml) {
+                test_parse_threads(rawml);
+                test_sidecar(rawml);
+                mobi_free_rawml(rawml);
+            }
+            mobi_free(n);
+            free(text);
+        }
+    }
+    mobi_free(m);
+    if (failures) {
+        fprintf(stderr, "%s: %zu checks failed\n", sample_path, failures);
+        return EXIT_FAILURE;
+    }
+    return EXIT_SUCCESS;
+}
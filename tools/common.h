@@ -57,6 +57,14 @@
 
 #define FULLNAME_MAX 1024
 
+#define EPUB_CONTAINER "<?xml version=\"1.0\" encoding=\"UTF-8\"?>\n\
+<container version=\"1.0\" xmlns=\"urn:oasis:names:tc:opendocument:xmlns:container\">\n\
+  <rootfiles>\n\
+    <rootfile full-path=\"OEBPS/content.opf\" media-type=\"application/oebps-package+xml\"/>\n\
+  </rootfiles>\n\
+</container>"
+#define EPUB_MIMETYPE "application/epub+zip"
+
 extern const char separator;
 extern bool outdir_opt;
 extern char outdir[FILENAME_MAX];
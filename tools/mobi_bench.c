@@ -0,0 +1,1383 @@
+/** @file mobi_bench.c
+ *
+ * @brief mobi_bench
+ *
+ * Program for measuring libmobi performance.
+ * Library sources are compiled into the program, so that each stage
+ * of document processing may be timed separately.
+ * Results are printed as tab separated values, one line per measurement.
+ * Bytes column holds size of processed data: document size for loading,
+ * size of INDX records for index parsing and lookups, size of packed files for EPUB creation,
+ * decompressed text size for other stages.
+ * Records column holds number of processed items: records for loading and decompression,
+ * index entries for index parsing, labels for lookups, parts for reconstruction stages,
+ * files for EPUB creation.
+ * Seconds, allocations and allocated bytes are given per single iteration.
+ * Allocations are counted for library code only, zlib and libxml2 allocations are not included.
+ *
+ * Copyright (c) 2026 Bartek Fabiszewski
+ * http://www.fabiszewski.net
+ *
+ * Licensed under LGPL, either version 3, or any later.
+ * See <http://www.gnu.org/licenses/>
+ */
+
+#include <stdio.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <ctype.h>
+#include <string.h>
+#include <time.h>
+#include <mobi.h>
+
+#include "common.h"
+/* miniz file is needed for EPUB creation, it must precede library headers limiting miniz api */
+#ifdef USE_XMLWRITER
+# define MINIZ_HEADER_FILE_ONLY
+# define MINIZ_NO_ZLIB_COMPATIBLE_NAMES
+# include "../src/miniz.c"
+#endif
+/* internal functions of library sources compiled into the benchmark */
+#include "compression.h"
+#include "huffcdic.h"
+#include "index.h"
+#include "memory.h"
+#include "parse_rawml.h"
+#include "read.h"
+#include "sidecar.h"
+#include "util.h"
+#ifdef USE_XMLWRITER
+# include "opf.h"
+#endif
+
+#define ITERATIONS_DEFAULT 50
+#define SYNTHETIC_RECORD_SIZE RECORD0_TEXT_SIZE_MAX /**< Size of synthetic text records */
+#define SYNTHETIC_WORDS 4096 /**< Number of words in synthetic text vocabulary */
+#define SYNTHETIC_WORD_MAX 16 /**< Maximal length of word in synthetic text vocabulary */
+#define SYNTHETIC_THREADS 4 /**< Number of threads used to compress synthetic text */
+#define LOOKUP_LABELS 64 /**< Number of labels looked up in orth index by a single run */
+
+#if HAVE_ATTRIBUTE_NORETURN
+static void exit_with_usage(const char *progname) __attribute__((noreturn));
+#else
+static void exit_with_usage(const char *progname);
+#endif
+
+/**
+ @brief Document loading method
+ */
+typedef struct {
+    const char *name; /**< Method name printed in results */
+    unsigned int flags; /**< Flags passed to mobi_set_loadflags() */
+    bool mmap; /**< Use mobi_load_filename_mmap() */
+} LoadMethod;
+
+const LoadMethod load_methods[] = {
+    { "file", MOBI_LOAD_DEFAULT, false },
+    { "arena", MOBI_LOAD_ARENA, false },
+    { "mmap", MOBI_LOAD_DEFAULT, true },
+};
+
+/**
+ @brief Decompression function
+ */
+typedef MOBI_RET (*Decompressor)(unsigned char *out, const unsigned char *in, size_t *len_out, const size_t len_in);
+
+/**
+ @brief Decompression method
+ */
+typedef struct {
+    const char *name; /**< Method name printed in results */
+    Decompressor function; /**< Decompression function */
+} DecompressMethod;
+
+const DecompressMethod lz77_methods[] = {
+    { "reference", mobi_decompress_lz77_reference },
+    { "fast", mobi_decompress_lz77 },
+};
+
+/**
+ @brief Measurements of a single stage
+ */
+typedef struct {
+    bool used; /**< Stage was run */
+    size_t bytes; /**< Size of data processed in single run */
+    size_t records; /**< Number of items processed in single run */
+    double seconds; /**< Total time */
+    size_t allocs; /**< Total number of allocations */
+    size_t alloc_bytes; /**< Total size of allocations */
+    double start_time; /**< Time at the start of current run */
+    size_t start_allocs; /**< Allocations counter at the start of current run */
+    size_t start_alloc_bytes; /**< Allocated bytes counter at the start of current run */
+} BenchStage;
+
+/**
+ @brief Index types parsed by reconstruction pipeline
+ */
+typedef enum {
+    INDX_SKEL = 0, /**< Skeleton index */
+    INDX_FRAG, /**< Fragments index */
+    INDX_GUIDE, /**< Guide index */
+    INDX_NCX, /**< NCX index */
+    INDX_ORTH, /**< Orth index */
+    INDX_INFL, /**< Inflections index */
+    INDX_COUNT /**< Number of index types */
+} BenchIndx;
+
+const char *indx_names[INDX_COUNT] = { "skel", "frag", "guide", "ncx", "orth", "infl" };
+
+/**
+ @brief Measurements of reconstruction pipeline stages
+ */
+typedef struct {
+    BenchStage flow; /**< FDST parsing, flow and resources reconstruction */
+    BenchStage indx[INDX_COUNT]; /**< Index parsing */
+    BenchStage parts; /**< mobi_reconstruct_parts() */
+    BenchStage opf; /**< OPF and NCX building */
+    BenchStage links; /**< mobi_reconstruct_links() */
+    BenchStage markup; /**< Stripping tags and conversion to utf-8 */
+    BenchStage epub; /**< EPUB packing */
+} BenchPipeline;
+
+/* allocation counters, updated by wrappers used by library sources */
+static size_t alloc_count = 0;
+static size_t alloc_bytes = 0;
+
+/**
+ @brief Count allocation
+ 
+ @param[in] size Allocated size
+ */
+static void count_alloc(const size_t size) {
+#if defined(__GNUC__)
+    __atomic_fetch_add(&alloc_count, 1, __ATOMIC_RELAXED);
+    __atomic_fetch_add(&alloc_bytes, size, __ATOMIC_RELAXED);
+#else
+    alloc_count++;
+    alloc_bytes += size;
+#endif
+}
+
+/* allocation wrappers used by library sources compiled into the benchmark with MOBI_DEBUG_ALLOC */
+void debug_free(void *ptr, const char *file, const int line) {
+    (void) file; (void) line;
+    free(ptr);
+}
+void *debug_malloc(const size_t size, const char *file, const int line) {
+    (void) file; (void) line;
+    count_alloc(size);
+    return malloc(size);
+}
+void *debug_realloc(void *ptr, const size_t size, const char *file, const int line) {
+    (void) file; (void) line;
+    count_alloc(size);
+    return realloc(ptr, size);
+}
+void *debug_calloc(const size_t num, const size_t size, const char *file, const int line) {
+    (void) file; (void) line;
+    count_alloc(num * size);
+    return calloc(num, size);
+}
+
+/**
+ @brief Get current time in seconds from monotonic clock
+ 
+ @return Time in seconds
+ */
+static double get_time(void) {
+#ifdef CLOCK_MONOTONIC
+    struct timespec ts;
+    if (clock_gettime(CLOCK_MONOTONIC, &ts) == 0) {
+        return (double) ts.tv_sec + (double) ts.tv_nsec / 1e9;
+    }
+#endif
+    return (double) clock() / CLOCKS_PER_SEC;
+}
+
+/**
+ @brief Start measurement of a stage run
+ 
+ @param[in,out] stage Stage measurements
+ */
+static void stage_start(BenchStage *stage) {
+    stage->used = true;
+    stage->start_allocs = alloc_count;
+    stage->start_alloc_bytes = alloc_bytes;
+    stage->start_time = get_time();
+}
+
+/**
+ @brief Stop measurement of a stage run
+ 
+ @param[in,out] stage Stage measurements
+ */
+static void stage_stop(BenchStage *stage) {
+    stage->seconds += get_time() - stage->start_time;
+    stage->allocs += alloc_count - stage->start_allocs;
+    stage->alloc_bytes += alloc_bytes - stage->start_alloc_bytes;
+}
+
+/**
+ @brief Print results of a stage
+ 
+ @param[in] name Stage name
+ @param[in] method Method name
+ @param[in] basename Document name
+ @param[in] iterations Number of repetitions
+ @param[in] stage Stage measurements
+ */
+static void print_stage(const char *name, const char *method, const char *basename, const size_t iterations, const BenchStage *stage) {
+    if (!stage->used) {
+        return;
+    }
+    const double seconds = stage->seconds / (double) iterations;
+    const double mbps = seconds > 0 ? (double) stage->bytes / seconds / (1024 * 1024) : 0;
+    printf("%s\t%s\t%s\t%zu\t%zu\t%zu\t%.9f\t%.2f\t%zu\t%zu\n",
+           name, method, basename, stage->bytes, stage->records, iterations, seconds, mbps,
+           stage->allocs / iterations, stage->alloc_bytes / iterations);
+}
+
+/**
+ @brief Get size of the file
+ 
+ @param[in] path Path to file
+ @return Size in bytes, 0 on failure
+ */
+static size_t get_file_size(const char *path) {
+    struct stat st;
+    if (stat(path, &st) != 0 || st.st_size < 0) {
+        return 0;
+    }
+    return (size_t) st.st_size;
+}
+
+/**
+ @brief Load and release document once
+ 
+ @param[in] path Path to document
+ @param[in] method Loading method
+ @param[out] records_count Number of loaded records
+ @return SUCCESS or ERROR
+ */
+static int load_once(const char *path, const LoadMethod *method, size_t *records_count) {
+    MOBIData *m = mobi_init();
+    if (m == NULL) {
+        printf("Memory allocation failed\n");
+        return ERROR;
+    }
+    MOBI_RET mobi_ret = mobi_set_loadflags(m, method->flags);
+    if (mobi_ret == MOBI_SUCCESS) {
+        if (method->mmap) {
+            mobi_ret = mobi_load_filename_mmap(m, path);
+        } else {
+            mobi_ret = mobi_load_filename(m, path);
+        }
+    }
+    if (mobi_ret != MOBI_SUCCESS) {
+        printf("Error while loading document %s (%s)\n", path, libmobi_msg(mobi_ret));
+        mobi_free(m);
+        return ERROR;
+    }
+    size_t count = 0;
+    const MOBIPdbRecord *curr = m->rec;
+    while (curr) {
+        count++;
+        curr = curr->next;
+    }
+    *records_count = count;
+    mobi_free(m);
+    return SUCCESS;
+}
+
+/**
+ @brief Measure document loading with all methods
+ 
+ @param[in] path Path to document
+ @param[in] basename Document name
+ @param[in] iterations Number of repetitions
+ @return SUCCESS or ERROR
+ */
+static int bench_load(const char *path, const char *basename, const size_t iterations) {
+    for (size_t i = 0; i < ARRAYSIZE(load_methods); i++) {
+        const LoadMethod *method = &load_methods[i];
+        BenchStage stage;
+        memset(&stage, 0, sizeof(stage));
+        /* warm up file cache */
+        if (load_once(path, method, &stage.records) != SUCCESS) {
+            return ERROR;
+        }
+        stage.bytes = get_file_size(path);
+        stage_start(&stage);
+        for (size_t j = 0; j < iterations; j++) {
+            if (load_once(path, method, &stage.records) != SUCCESS) {
+                return ERROR;
+            }
+        }
+        stage_stop(&stage);
+        print_stage("load", method->name, basename, iterations, &stage);
+    }
+    return SUCCESS;
+}
+
+/**
+ @brief Decompress all text records with given LZ77 method
+ 
+ @param[in] method Decompression method
+ @param[in] records Array of compressed text records data
+ @param[in] sizes Array of compressed sizes of text records (without trailing entries)
+ @param[in] count Number of text records
+ @param[out] out Buffer for decompressed data of all records
+ @param[in] record_maxsize Maximal size of decompressed record
+ @param[out] out_size Total size of decompressed data
+ @return SUCCESS or ERROR
+ */
+static int decompress_lz77(const DecompressMethod *method, unsigned char **records, const size_t *sizes, const size_t count,
+                           unsigned char *out, const size_t record_maxsize, size_t *out_size) {
+    size_t total = 0;
+    for (size_t i = 0; i < count; i++) {
+        size_t len = record_maxsize;
+        if (method->function(out + total, records[i], &len, sizes[i]) != MOBI_SUCCESS) {
+            printf("Decompression of record %zu with %s method failed\n", i + 1, method->name);
+            return ERROR;
+        }
+        total += len;
+    }
+    *out_size = total;
+    return SUCCESS;
+}
+
+/**
+ @brief Measure PalmDOC LZ77 decompression of text records with all methods
+ 
+ Output of all methods is verified against expected text.
+ 
+ @param[in] basename Document name
+ @param[in] records Array of compressed text records data
+ @param[in] sizes Array of compressed sizes of text records (without trailing entries)
+ @param[in] count Number of text records
+ @param[in] record_maxsize Maximal size of decompressed record
+ @param[in] text Expected decompressed text
+ @param[in] length Length of expected text
+ @param[in] iterations Number of repetitions
+ @return SUCCESS or ERROR
+ */
+static int bench_lz77(const char *basename, unsigned char **records, const size_t *sizes, const size_t count,
+                      const size_t record_maxsize, const unsigned char *text, const size_t length, const size_t iterations) {
+    unsigned char *out = malloc(count * record_maxsize + 1);
+    if (out == NULL) {
+        printf("Memory allocation failed\n");
+        return ERROR;
+    }
+    int ret = SUCCESS;
+    for (size_t i = 0; i < ARRAYSIZE(lz77_methods); i++) {
+        const DecompressMethod *method = &lz77_methods[i];
+        BenchStage stage;
+        memset(&stage, 0, sizeof(stage));
+        ret = decompress_lz77(method, records, sizes, count, out, record_maxsize, &stage.bytes);
+        if (ret != SUCCESS) {
+            break;
+        }
+        if (stage.bytes != length || memcmp(out, text, length) != 0) {
+            printf("Output of %s method differs from expected text\n", method->name);
+            ret = ERROR;
+            break;
+        }
+        stage.records = count;
+        stage_start(&stage);
+        for (size_t j = 0; j < iterations; j++) {
+            decompress_lz77(method, records, sizes, count, out, record_maxsize, &stage.bytes);
+        }
+        stage_stop(&stage);
+        print_stage("lz77", method->name, basename, iterations, &stage);
+    }
+    free(out);
+    return ret;
+}
+
+/**
+ @brief Decompress all text records with huffman decoder
+ 
+ @param[in] huffcdic Parsed HUFF/CDIC data with decoding tables
+ @param[in] records Array of compressed text records data
+ @param[in] sizes Array of compressed sizes of text records (without trailing entries)
+ @param[in] count Number of text records
+ @param[out] out Buffer for decompressed data of all records
+ @param[in] record_maxsize Maximal size of decompressed record
+ @param[out] out_size Total size of decompressed data
+ @return SUCCESS or ERROR
+ */
+static int decompress_huffman(const MOBIHuffCdic *huffcdic, unsigned char **records, const size_t *sizes, const size_t count,
+                              unsigned char *out, const size_t record_maxsize, size_t *out_size) {
+    size_t total = 0;
+    for (size_t i = 0; i < count; i++) {
+        size_t len = record_maxsize;
+        if (mobi_decompress_huffman(out + total, records[i], &len, sizes[i], huffcdic) != MOBI_SUCCESS) {
+            printf("Huffman decompression of record %zu failed\n", i + 1);
+            return ERROR;
+        }
+        total += len;
+    }
+    *out_size = total;
+    return SUCCESS;
+}
+
+/**
+ @brief Measure HUFF/CDIC decompression of text records
+ 
+ Output is verified against expected text.
+ 
+ @param[in] basename Document name
+ @param[in] huffcdic Parsed HUFF/CDIC data with decoding tables
+ @param[in] records Array of compressed text records data
+ @param[in] sizes Array of compressed sizes of text records (without trailing entries)
+ @param[in] count Number of text records
+ @param[in] record_maxsize Maximal size of decompressed record
+ @param[in] text Expected decompressed text
+ @param[in] length Length of expected text
+ @param[in] iterations Number of repetitions
+ @return SUCCESS or ERROR
+ */
+static int bench_huffman(const char *basename, const MOBIHuffCdic *huffcdic, unsigned char **records, const size_t *sizes, const size_t count,
+                         const size_t record_maxsize, const unsigned char *text, const size_t length, const size_t iterations) {
+    unsigned char *out = malloc(count * record_maxsize + 1);
+    if (out == NULL) {
+        printf("Memory allocation failed\n");
+        return ERROR;
+    }
+    BenchStage stage;
+    memset(&stage, 0, sizeof(stage));
+    int ret = decompress_huffman(huffcdic, records, sizes, count, out, record_maxsize, &stage.bytes);
+    if (ret == SUCCESS && (stage.bytes != length || memcmp(out, text, length) != 0)) {
+        printf("Output of huffman decoder differs from expected text\n");
+        ret = ERROR;
+    }
+    if (ret == SUCCESS) {
+        stage.records = count;
+        stage_start(&stage);
+        for (size_t j = 0; j < iterations; j++) {
+            decompress_huffman(huffcdic, records, sizes, count, out, record_maxsize, &stage.bytes);
+        }
+        stage_stop(&stage);
+        print_stage("huffcdic", "decode", basename, iterations, &stage);
+    }
+    free(out);
+    return ret;
+}
+
+/**
+ @brief Measure parsing of HUFF/CDIC records and building of decoding tables
+ 
+ @param[in] m MOBIData structure with loaded document
+ @param[in] basename Document name
+ @param[in] iterations Number of repetitions
+ @return Parsed HUFF/CDIC data on success, NULL otherwise
+ */
+static MOBIHuffCdic * bench_huffcdic_tables(const MOBIData *m, const char *basename, const size_t iterations) {
+    if (m->mh == NULL || m->mh->huff_rec_index == NULL || m->mh->huff_rec_count == NULL) {
+        printf("HUFF/CDIC records metadata not found\n");
+        return NULL;
+    }
+    BenchStage stage;
+    memset(&stage, 0, sizeof(stage));
+    stage.records = *m->mh->huff_rec_count;
+    const MOBIPdbRecord *curr = mobi_get_record_by_seqnumber(m, *m->mh->huff_rec_index + mobi_get_kf8offset(m));
+    for (size_t i = 0; curr && i < stage.records; i++) {
+        stage.bytes += curr->size;
+        curr = mobi_next_record(m, curr);
+    }
+    MOBIHuffCdic *huffcdic = NULL;
+    for (size_t j = 0; j <= iterations; j++) {
+        if (j == 1) {
+            /* first run is a warm up */
+            stage_start(&stage);
+        }
+        mobi_free_huffcdic(huffcdic);
+        huffcdic = mobi_init_huffcdic();
+        if (huffcdic == NULL || mobi_parse_huffdic(m, huffcdic) != MOBI_SUCCESS) {
+            printf("Parsing of HUFF/CDIC records failed\n");
+            mobi_free_huffcdic(huffcdic);
+            return NULL;
+        }
+    }
+    stage_stop(&stage);
+    print_stage("huffcdic", "tables", basename, iterations, &stage);
+    return huffcdic;
+}
+
+/**
+ @brief Measure decompression of whole text with public mobi_get_rawml()
+ 
+ @param[in] m MOBIData structure with loaded document
+ @param[in] basename Document name
+ @param[out] text Buffer for decompressed text, must be freed by caller
+ @param[out] length Length of decompressed text
+ @param[in] iterations Number of repetitions
+ @return SUCCESS or ERROR
+ */
+static int bench_rawml(const MOBIData *m, const char *basename, char **text, size_t *length, const size_t iterations) {
+    const size_t maxlen = mobi_get_text_maxsize(m);
+    if (maxlen == MOBI_NOTSET) {
+        printf("Insane text length\n");
+        return ERROR;
+    }
+    *text = malloc(maxlen + 1);
+    if (*text == NULL) {
+        printf("Memory allocation failed\n");
+        return ERROR;
+    }
+    BenchStage stage;
+    memset(&stage, 0, sizeof(stage));
+    stage.records = m->rh->text_record_count;
+    for (size_t j = 0; j <= iterations; j++) {
+        if (j == 1) {
+            /* first run is a warm up */
+            stage_start(&stage);
+        }
+        stage.bytes = maxlen;
+        const MOBI_RET mobi_ret = mobi_get_rawml(m, *text, &stage.bytes);
+        if (mobi_ret != MOBI_SUCCESS) {
+            printf("Text decompression failed (%s)\n", libmobi_msg(mobi_ret));
+            free(*text);
+            *text = NULL;
+            return ERROR;
+        }
+    }
+    stage_stop(&stage);
+    print_stage("text", "rawml", basename, iterations, &stage);
+    *length = stage.bytes;
+    return SUCCESS;
+}
+
+/**
+ @brief Get size of INDX records starting at given record
+ 
+ @param[in] m MOBIData structure with loaded document
+ @param[in] seqnumber Sequential number of first INDX record
+ @return Total size of consecutive INDX records
+ */
+static size_t get_indx_size(const MOBIData *m, const size_t seqnumber) {
+    size_t size = 0;
+    const MOBIPdbRecord *curr = mobi_get_record_by_seqnumber(m, seqnumber);
+    while (curr && curr->data && curr->size >= 4 && memcmp(curr->data, INDX_MAGIC, 4) == 0) {
+        size += curr->size;
+        curr = mobi_next_record(m, curr);
+    }
+    return size;
+}
+
+/**
+ @brief Parse index into rawml structure, measuring parsing time
+ 
+ @param[in] m MOBIData structure with loaded document
+ @param[out] indx Parsed index, will be freed with rawml structure
+ @param[in] seqnumber Sequential number of first INDX record
+ @param[in,out] stage Stage measurements
+ @return MOBI_RET status code (on success MOBI_SUCCESS)
+ */
+static MOBI_RET parse_indx(const MOBIData *m, MOBIIndx **indx, const size_t seqnumber, BenchStage *stage) {
+    stage_start(stage);
+    *indx = mobi_init_indx();
+    MOBI_RET ret = MOBI_MALLOC_FAILED;
+    if (*indx) {
+        ret = mobi_parse_index(m, *indx, seqnumber);
+    }
+    stage_stop(stage);
+    if (ret == MOBI_SUCCESS) {
+        stage->records = (*indx)->entries_count;
+        stage->bytes = get_indx_size(m, seqnumber);
+    }
+    return ret;
+}
+
+/**
+ @brief Measure loading of FDST record and indices from sidecar file
+ 
+ Sidecar is written once in current directory by mobi_parse_rawml_opt()
+ and removed when measurements are done.
+ 
+ @param[in] m MOBIData structure with loaded document
+ @param[in] basename Document name
+ @param[in] iterations Number of repetitions
+ @return SUCCESS or ERROR
+ */
+static int bench_sidecar(MOBIData *m, const char *basename, const size_t iterations) {
+    const char *path = "mobi_bench.sidecar";
+    MOBIRawml *rawml = mobi_init_rawml(m);
+    if (rawml == NULL) {
+        printf("Memory allocation failed\n");
+        return ERROR;
+    }
+    MOBI_RET mobi_ret = mobi_set_sidecar(m, path);
+    if (mobi_ret == MOBI_SUCCESS) {
+        mobi_ret = mobi_parse_rawml_opt(rawml, m, true, true, false);
+    }
+    const size_t count = mobi_sidecar_count(rawml);
+    mobi_free_rawml(rawml);
+    BenchStage stage;
+    memset(&stage, 0, sizeof(stage));
+    stage.bytes = get_file_size(path);
+    for (size_t j = 0; j <= iterations && mobi_ret == MOBI_SUCCESS && stage.bytes; j++) {
+        if (j == 1) {
+            /* first run is a warm up */
+            stage_start(&stage);
+        }
+        rawml = mobi_init_rawml(m);
+        if (rawml == NULL || mobi_sidecar_load(rawml, m, true, true) != count) {
+            mobi_ret = MOBI_DATA_CORRUPT;
+        } else {
+            const MOBIIndx *indices[] = { rawml->skel, rawml->frag, rawml->guide, rawml->ncx, rawml->orth, rawml->infl };
+            stage.records = 0;
+            for (size_t i = 0; i < ARRAYSIZE(indices); i++) {
+                stage.records += indices[i] ? indices[i]->entries_count : 0;
+            }
+        }
+        mobi_free_rawml(rawml);
+    }
+    stage_stop(&stage);
+    mobi_set_sidecar(m, NULL);
+    remove(path);
+    if (mobi_ret != MOBI_SUCCESS) {
+        printf("Loading sidecar failed (%s)\n", libmobi_msg(mobi_ret));
+        return ERROR;
+    }
+    print_stage("sidecar", "load", basename, iterations, &stage);
+    return SUCCESS;
+}
+
+/**
+ @brief Measure lazy opening of orth index followed by lookups of labels
+ 
+ Labels of entries spread evenly over the index are looked up in each run.
+ The same words are then looked up with dictionary api (mobi_dict_open(), mobi_dict_lookup()),
+ which also prepares and searches inflections.
+ 
+ @param[in] m MOBIData structure with loaded document
+ @param[in] basename Document name
+ @param[in] iterations Number of repetitions
+ @return SUCCESS or ERROR
+ */
+static int bench_lookup(const MOBIData *m, const char *basename, const size_t iterations) {
+    if (!mobi_is_dictionary(m)) {
+        return SUCCESS;
+    }
+    const size_t seqnumber = *m->mh->orth_index + mobi_get_kf8offset(m);
+    MOBIIndxReader *reader = NULL;
+    MOBI_RET mobi_ret = mobi_open_index(m, &reader, seqnumber);
+    if (mobi_ret != MOBI_SUCCESS) {
+        printf("Opening orth index failed (%s)\n", libmobi_msg(mobi_ret));
+        return ERROR;
+    }
+    const size_t total = reader->total_entries_count;
+    const size_t count = total < LOOKUP_LABELS ? total : LOOKUP_LABELS;
+    char (*labels)[INDX_LABEL_SIZEMAX + 1] = malloc((count + 1) * sizeof(*labels));
+    if (labels == NULL) {
+        printf("Memory allocation failed\n");
+        mobi_free_indx_reader(reader);
+        return ERROR;
+    }
+    for (size_t i = 0; i < count && mobi_ret == MOBI_SUCCESS; i++) {
+        mobi_ret = mobi_get_index_label(reader, labels[i], i * total / count);
+    }
+    const bool is_utf8 = mobi_indx_reader_is_utf8(reader);
+    mobi_free_indx_reader(reader);
+    BenchStage stage;
+    memset(&stage, 0, sizeof(stage));
+    stage.records = count;
+    stage.bytes = get_indx_size(m, seqnumber);
+    for (size_t j = 0; j <= iterations && mobi_ret == MOBI_SUCCESS; j++) {
+        if (j == 1) {
+            /* first run is a warm up */
+            stage_start(&stage);
+        }
+        mobi_ret = mobi_open_index(m, &reader, seqnumber);
+        for (size_t i = 0; i < count && mobi_ret == MOBI_SUCCESS; i++) {
+            size_t number;
+            mobi_ret = mobi_find_index_entry(reader, &number, labels[i]);
+        }
+        mobi_free_indx_reader(reader);
+    }
+    stage_stop(&stage);
+    if (mobi_ret != MOBI_SUCCESS) {
+        free(labels);
+        printf("Orth index lookup failed (%s)\n", libmobi_msg(mobi_ret));
+        return ERROR;
+    }
+    print_stage("lookup", "orth", basename, iterations, &stage);
+    /* the same words looked up with public dictionary api, including inflections */
+    char (*words)[3 * INDX_LABEL_SIZEMAX + 1] = malloc((count + 1) * sizeof(*words));
+    if (words == NULL) {
+        printf("Memory allocation failed\n");
+        free(labels);
+        return ERROR;
+    }
+    for (size_t i = 0; i < count; i++) {
+        size_t size = sizeof(*words);
+        if (is_utf8) {
+            snprintf(words[i], size, "%s", labels[i]);
+        } else {
+            mobi_cp1252_to_utf8(words[i], labels[i], &size, strlen(labels[i]));
+        }
+    }
+    free(labels);
+    memset(&stage, 0, sizeof(stage));
+    stage.records = count;
+    stage.bytes = get_indx_size(m, seqnumber);
+    for (size_t j = 0; j <= iterations && mobi_ret == MOBI_SUCCESS; j++) {
+        if (j == 1) {
+            /* first run is a warm up */
+            stage_start(&stage);
+        }
+        MOBIDict *dict = NULL;
+        mobi_ret = mobi_dict_open(&dict, m);
+        for (size_t i = 0; i < count && mobi_ret == MOBI_SUCCESS; i++) {
+            MOBIDictEntry *entries;
+            size_t entries_count;
+            mobi_ret = mobi_dict_lookup(&entries, &entries_count, dict, words[i]);
+            mobi_dict_free_entries(entries, entries_count);
+        }
+        mobi_dict_free(dict);
+    }
+    stage_stop(&stage);
+    free(words);
+    if (mobi_ret != MOBI_SUCCESS) {
+        printf("Dictionary lookup failed (%s)\n", libmobi_msg(mobi_ret));
+        return ERROR;
+    }
+    print_stage("lookup", "dict", basename, iterations, &stage);
+    return SUCCESS;
+}
+
+/**
+ @brief Count parts in a list
+ 
+ @param[in] part First part
+ @return Number of parts
+ */
+static size_t count_parts(const MOBIPart *part) {
+    size_t count = 0;
+    while (part) {
+        count++;
+        part = part->next;
+    }
+    return count;
+}
+
+#ifdef USE_XMLWRITER
+/**
+ @brief Allocation function passed to miniz
+ */
+static void * zip_alloc(void *opaque, size_t items, size_t size) {
+    (void) opaque;
+    count_alloc(items * size);
+    return malloc(items * size);
+}
+
+/**
+ @brief Free function passed to miniz
+ */
+static void zip_free(void *opaque, void *address) {
+    (void) opaque;
+    free(address);
+}
+
+/**
+ @brief Reallocation function passed to miniz
+ */
+static void * zip_realloc(void *opaque, void *address, size_t items, size_t size) {
+    (void) opaque;
+    count_alloc(items * size);
+    return realloc(address, items * size);
+}
+
+/**
+ @brief Add file to EPUB archive
+ 
+ @param[in,out] zip Archive
+ @param[in] name File name in archive
+ @param[in] data File data
+ @param[in] size File size
+ @param[in,out] stage Stage measurements, size and number of files are updated
+ @return SUCCESS or ERROR
+ */
+static int epub_add(mz_zip_archive *zip, const char *name, const void *data, const size_t size, BenchStage *stage) {
+    const mz_uint level = strcmp(name, "mimetype") == 0 ? MZ_NO_COMPRESSION : (mz_uint) MZ_DEFAULT_COMPRESSION;
+    if (!mz_zip_writer_add_mem(zip, name, data, size, level)) {
+        printf("Could not add file to archive: %s\n", name);
+        return ERROR;
+    }
+    stage->bytes += size;
+    stage->records++;
+    return SUCCESS;
+}
+
+/**
+ @brief Pack reconstructed document into EPUB archive in memory
+ 
+ Archive has the same layout as one created by mobitool.
+ 
+ @param[in] rawml MOBIRawml structure with reconstructed document
+ @param[in,out] stage Stage measurements, size and number of files are updated
+ @return SUCCESS or ERROR
+ */
+static int pack_epub(const MOBIRawml *rawml, BenchStage *stage) {
+    mz_zip_archive zip;
+    memset(&zip, 0, sizeof(mz_zip_archive));
+    zip.m_pAlloc = zip_alloc;
+    zip.m_pFree = zip_free;
+    zip.m_pRealloc = zip_realloc;
+    if (!mz_zip_writer_init_heap(&zip, 0, 0)) {
+        printf("Could not initialize zip archive\n");
+        return ERROR;
+    }
+    stage->bytes = 0;
+    stage->records = 0;
+    int ret = epub_add(&zip, "mimetype", EPUB_MIMETYPE, sizeof(EPUB_MIMETYPE) - 1, stage);
+    if (ret == SUCCESS) {
+        ret = epub_add(&zip, "META-INF/container.xml", EPUB_CONTAINER, sizeof(EPUB_CONTAINER) - 1, stage);
+    }
+    char partname[FILENAME_MAX];
+    const MOBIPart *curr = rawml->markup;
+    while (ret == SUCCESS && curr) {
+        const MOBIFileMeta file_meta = mobi_get_filemeta_by_type(curr->type);
+        snprintf(partname, sizeof(partname), "OEBPS/part%05zu.%s", curr->uid, file_meta.extension);
+        ret = epub_add(&zip, partname, curr->data, curr->size, stage);
+        curr = curr->next;
+    }
+    /* skip raw html file */
+    curr = rawml->flow ? rawml->flow->next : NULL;
+    while (ret == SUCCESS && curr) {
+        const MOBIFileMeta file_meta = mobi_get_filemeta_by_type(curr->type);
+        snprintf(partname, sizeof(partname), "OEBPS/flow%05zu.%s", curr->uid, file_meta.extension);
+        ret = epub_add(&zip, partname, curr->data, curr->size, stage);
+        curr = curr->next;
+    }
+    curr = rawml->resources;
+    while (ret == SUCCESS && curr) {
+        const MOBIFileMeta file_meta = mobi_get_filemeta_by_type(curr->type);
+        if (curr->size > 0) {
+            if (file_meta.type == T_OPF) {
+                snprintf(partname, sizeof(partname), "OEBPS/content.opf");
+            } else {
+                snprintf(partname, sizeof(partname), "OEBPS/resource%05zu.%s", curr->uid, file_meta.extension);
+            }
+            ret = epub_add(&zip, partname, curr->data, curr->size, stage);
+        }
+        curr = curr->next;
+    }
+    void *archive = NULL;
+    size_t archive_size = 0;
+    if (ret == SUCCESS && !mz_zip_writer_finalize_heap_archive(&zip, &archive, &archive_size)) {
+        printf("Could not finalize zip archive\n");
+        ret = ERROR;
+    }
+    mz_zip_writer_end(&zip);
+    free(archive);
+    return ret;
+}
+#endif
+
+/**
+ @brief Run all stages of document reconstruction once
+ 
+ Stages follow mobi_parse_rawml_opt() with all options enabled, followed by EPUB packing.
+ 
+ @param[in] m MOBIData structure with loaded document
+ @param[in] text Decompressed text
+ @param[in] length Length of decompressed text
+ @param[in,out] pipeline Stages measurements
+ @return SUCCESS or ERROR
+ */
+static int run_pipeline(const MOBIData *m, const char *text, const size_t length, BenchPipeline *pipeline) {
+    MOBIRawml *rawml = mobi_init_rawml(m);
+    if (rawml == NULL) {
+        printf("Memory allocation failed\n");
+        return ERROR;
+    }
+    MOBI_RET mobi_ret = MOBI_SUCCESS;
+    /* flow and resources */
+    stage_start(&pipeline->flow);
+    if (mobi_exists_fdst(m) && m->mh->fdst_section_count && *m->mh->fdst_section_count > 1) {
+        mobi_ret = mobi_parse_fdst(m, rawml);
+    }
+    if (mobi_ret == MOBI_SUCCESS) {
+        mobi_ret = mobi_reconstruct_flow(rawml, text, length);
+    }
+    if (mobi_ret == MOBI_SUCCESS) {
+        mobi_ret = mobi_reconstruct_resources(m, rawml);
+    }
+    stage_stop(&pipeline->flow);
+    pipeline->flow.bytes = length;
+    pipeline->flow.records = count_parts(rawml->flow) + count_parts(rawml->resources);
+    /* indices */
+    const size_t offset = mobi_get_kf8offset(m);
+    if (mobi_ret == MOBI_SUCCESS && mobi_exists_skel_indx(m) && mobi_exists_frag_indx(m)) {
+        mobi_ret = parse_indx(m, &rawml->skel, *m->mh->skeleton_index + offset, &pipeline->indx[INDX_SKEL]);
+    }
+    if (mobi_ret == MOBI_SUCCESS && mobi_exists_frag_indx(m)) {
+        mobi_ret = parse_indx(m, &rawml->frag, *m->mh->fragment_index + offset, &pipeline->indx[INDX_FRAG]);
+    }
+    if (mobi_ret == MOBI_SUCCESS && mobi_exists_guide_indx(m)) {
+        mobi_ret = parse_indx(m, &rawml->guide, *m->mh->guide_index + offset, &pipeline->indx[INDX_GUIDE]);
+    }
+    if (mobi_ret == MOBI_SUCCESS && mobi_exists_ncx(m)) {
+        mobi_ret = parse_indx(m, &rawml->ncx, *m->mh->ncx_index + offset, &pipeline->indx[INDX_NCX]);
+    }
+    if (mobi_ret == MOBI_SUCCESS && mobi_is_dictionary(m)) {
+        mobi_ret = parse_indx(m, &rawml->orth, *m->mh->orth_index + offset, &pipeline->indx[INDX_ORTH]);
+        if (mobi_ret == MOBI_SUCCESS && mobi_exists_infl(m)) {
+            mobi_ret = parse_indx(m, &rawml->infl, *m->mh->infl_index + offset, &pipeline->indx[INDX_INFL]);
+        }
+    }
+    /* parts */
+    if (mobi_ret == MOBI_SUCCESS) {
+        stage_start(&pipeline->parts);
+        mobi_ret = mobi_reconstruct_parts(rawml);
+        stage_stop(&pipeline->parts);
+        pipeline->parts.bytes = length;
+        pipeline->parts.records = count_parts(rawml->markup);
+    }
+#ifdef USE_XMLWRITER
+    /* opf and ncx */
+    if (mobi_ret == MOBI_SUCCESS) {
+        stage_start(&pipeline->opf);
+        mobi_ret = mobi_build_opf(rawml, m);
+        stage_stop(&pipeline->opf);
+        pipeline->opf.bytes = length;
+        pipeline->opf.records = 1;
+    }
+#endif
+    /* links */
+    if (mobi_ret == MOBI_SUCCESS) {
+        stage_start(&pipeline->links);
+        mobi_ret = mobi_reconstruct_links(rawml);
+        stage_stop(&pipeline->links);
+        pipeline->links.bytes = length;
+        pipeline->links.records = count_parts(rawml->markup);
+    }
+    /* markup cleanup */
+    if (mobi_ret == MOBI_SUCCESS) {
+        stage_start(&pipeline->markup);
+        if (mobi_is_kf8(m)) {
+            mobi_ret = mobi_iterate_txtparts(rawml, mobi_strip_mobitags);
+        }
+        if (mobi_ret == MOBI_SUCCESS && mobi_is_cp1252(m)) {
+            mobi_ret = mobi_iterate_txtparts(rawml, mobi_markup_to_utf8);
+        }
+        stage_stop(&pipeline->markup);
+        pipeline->markup.bytes = length;
+        pipeline->markup.records = count_parts(rawml->markup);
+    }
+    if (mobi_ret != MOBI_SUCCESS) {
+        printf("Document reconstruction failed (%s)\n", libmobi_msg(mobi_ret));
+        mobi_free_rawml(rawml);
+        return ERROR;
+    }
+    int ret = SUCCESS;
+#ifdef USE_XMLWRITER
+    stage_start(&pipeline->epub);
+    ret = pack_epub(rawml, &pipeline->epub);
+    stage_stop(&pipeline->epub);
+#endif
+    mobi_free_rawml(rawml);
+    return ret;
+}
+
+/**
+ @brief Measure document reconstruction stages
+ 
+ @param[in] m MOBIData structure with loaded document
+ @param[in] basename Document name
+ @param[in] text Decompressed text
+ @param[in] length Length of decompressed text
+ @param[in] iterations Number of repetitions
+ @return SUCCESS or ERROR
+ */
+static int bench_pipeline(const MOBIData *m, const char *basename, const char *text, const size_t length, const size_t iterations) {
+    BenchPipeline pipeline;
+    memset(&pipeline, 0, sizeof(pipeline));
+    /* first run is a warm up */
+    if (run_pipeline(m, text, length, &pipeline) != SUCCESS) {
+        return ERROR;
+    }
+    memset(&pipeline, 0, sizeof(pipeline));
+    for (size_t j = 0; j < iterations; j++) {
+        if (run_pipeline(m, text, length, &pipeline) != SUCCESS) {
+            return ERROR;
+        }
+    }
+    print_stage("flow", "reconstruct", basename, iterations, &pipeline.flow);
+    for (size_t i = 0; i < INDX_COUNT; i++) {
+        print_stage("indx", indx_names[i], basename, iterations, &pipeline.indx[i]);
+    }
+    print_stage("parts", "reconstruct", basename, iterations, &pipeline.parts);
+    print_stage("opf", "build", basename, iterations, &pipeline.opf);
+    print_stage("links", "reconstruct", basename, iterations, &pipeline.links);
+    print_stage("markup", "cleanup", basename, iterations, &pipeline.markup);
+    print_stage("epub", "pack", basename, iterations, &pipeline.epub);
+    return SUCCESS;
+}
+
+/**
+ @brief Get text records of loaded document
+ 
+ @param[in] m MOBIData structure with loaded document
+ @param[out] records Array of text records data, must be freed by caller
+ @param[out] sizes Array of text records sizes without trailing entries, must be freed by caller
+ @return SUCCESS or ERROR
+ */
+static int get_text_records(const MOBIData *m, unsigned char ***records, size_t **sizes) {
+    const size_t count = m->rh->text_record_count;
+    const uint16_t extra_flags = (m->mh && m->mh->extra_flags) ? *m->mh->extra_flags : 0;
+    *records = malloc(count * sizeof(**records));
+    *sizes = malloc(count * sizeof(**sizes));
+    if (*records == NULL || *sizes == NULL) {
+        printf("Memory allocation failed\n");
+        return ERROR;
+    }
+    const MOBIPdbRecord *curr = mobi_get_record_by_seqnumber(m, mobi_get_kf8offset(m) + 1);
+    for (size_t i = 0; i < count; i++) {
+        const size_t extra_size = (curr && extra_flags) ? mobi_get_record_extrasize(curr, extra_flags) : 0;
+        if (curr == NULL || extra_size == MOBI_NOTSET || extra_size > curr->size) {
+            printf("Invalid text record %zu\n", i + 1);
+            return ERROR;
+        }
+        (*records)[i] = curr->data;
+        (*sizes)[i] = curr->size - extra_size;
+        curr = mobi_next_record(m, curr);
+    }
+    return SUCCESS;
+}
+
+/**
+ @brief Measure all stages of document processing
+ 
+ Encrypted documents are measured only if their key does not depend on device (old encryption),
+ stages working on raw text records are skipped for them. Other encrypted documents are only loaded.
+ 
+ @param[in] path Path to document
+ @param[in] iterations Number of repetitions
+ @return SUCCESS or ERROR
+ */
+static int bench_document(const char *path, const size_t iterations) {
+    char dirname[FILENAME_MAX];
+    char basename[FILENAME_MAX];
+    split_fullpath(path, dirname, basename, FILENAME_MAX);
+    if (bench_load(path, basename, iterations) != SUCCESS) {
+        return ERROR;
+    }
+    MOBIData *m = mobi_init();
+    if (m == NULL) {
+        printf("Memory allocation failed\n");
+        return ERROR;
+    }
+    MOBI_RET mobi_ret = mobi_load_filename(m, path);
+    if (mobi_ret != MOBI_SUCCESS) {
+        printf("Error while loading document %s (%s)\n", path, libmobi_msg(mobi_ret));
+        mobi_free(m);
+        return ERROR;
+    }
+    if (m->rh == NULL || m->rh->text_record_count == 0) {
+        mobi_free(m);
+        return SUCCESS;
+    }
+    const bool encrypted = mobi_is_encrypted(m);
+    if (encrypted && mobi_drm_setkey(m, NULL) != MOBI_SUCCESS) {
+        mobi_free(m);
+        return SUCCESS;
+    }
+    char *text = NULL;
+    size_t length = 0;
+    unsigned char **records = NULL;
+    size_t *sizes = NULL;
+    MOBIHuffCdic *huffcdic = NULL;
+    int ret = bench_rawml(m, basename, &text, &length, iterations);
+    if (ret == SUCCESS && !encrypted && m->rh->compression_type != MOBI_COMPRESSION_NONE) {
+        ret = get_text_records(m, &records, &sizes);
+    }
+    if (ret == SUCCESS && !encrypted) {
+        const size_t count = m->rh->text_record_count;
+        const size_t record_maxsize = mobi_get_textrecord_maxsize(m);
+        if (m->rh->compression_type == MOBI_COMPRESSION_PALMDOC) {
+            ret = bench_lz77(basename, records, sizes, count, record_maxsize, (unsigned char *) text, length, iterations);
+        } else if (m->rh->compression_type == MOBI_COMPRESSION_HUFFCDIC) {
+            huffcdic = bench_huffcdic_tables(m, basename, iterations);
+            if (huffcdic == NULL) {
+                ret = ERROR;
+            } else {
+                ret = bench_huffman(basename, huffcdic, records, sizes, count, record_maxsize, (unsigned char *) text, length, iterations);
+            }
+        }
+    }
+    if (ret == SUCCESS) {
+        ret = bench_pipeline(m, basename, text, length, iterations);
+    }
+    if (ret == SUCCESS) {
+        ret = bench_sidecar(m, basename, iterations);
+    }
+    if (ret == SUCCESS) {
+        ret = bench_lookup(m, basename, iterations);
+    }
+    mobi_free_huffcdic(huffcdic);
+    free(records);
+    free(sizes);
+    free(text);
+    mobi_free(m);
+    return ret;
+}
+
+/**
+ @brief Get next value of pseudo-random generator
+ 
+ @param[in,out] state Generator state
+ @return Pseudo-random value
+ */
+static uint32_t next_random(uint32_t *state) {
+    uint32_t x = *state;
+    x ^= x << 13;
+    x ^= x >> 17;
+    x ^= x << 5;
+    *state = x;
+    return x;
+}
+
+/**
+ @brief Generate synthetic text resembling book markup
+ 
+ Paragraphs are built from pseudo-random words of fixed vocabulary,
+ frequent words are chosen more often. Output is the same for the same size.
+ 
+ @param[in] size Size of text
+ @return Generated text, must be freed by caller, NULL on failure
+ */
+static unsigned char * generate_text(const size_t size) {
+    static const char *syllables[] = {
+        "a", "be", "ca", "de", "el", "fo", "ga", "hi", "in", "jo", "ka", "le", "ma", "ne", "on", "pa",
+        "qui", "ra", "se", "ta", "un", "ve", "wa", "xe", "yo", "za", "th", "st", "er", "an", "or", "is"
+    };
+    char (*words)[SYNTHETIC_WORD_MAX + 1] = malloc(SYNTHETIC_WORDS * sizeof(*words));
+    unsigned char *text = malloc(size + SYNTHETIC_RECORD_SIZE);
+    if (words == NULL || text == NULL) {
+        printf("Memory allocation failed\n");
+        free(words);
+        free(text);
+        return NULL;
+    }
+    uint32_t state = 2463534242U;
+    for (size_t i = 0; i < SYNTHETIC_WORDS; i++) {
+        const size_t syllables_count = 1 + next_random(&state) % 4;
+        words[i][0] = '\0';
+        for (size_t j = 0; j < syllables_count; j++) {
+            strcat(words[i], syllables[next_random(&state) % ARRAYSIZE(syllables)]);
+        }
+    }
+    size_t length = 0;
+    size_t paragraph = 0;
+    while (length < size) {
+        if (paragraph % 40 == 0) {
+            length += (size_t) sprintf((char *) text + length, "<h2>Chapter %zu</h2>\n", paragraph / 40 + 1);
+        }
+        memcpy(text + length, "<p>", 3);
+        length += 3;
+        const size_t words_count = 20 + next_random(&state) % 100;
+        for (size_t i = 0; i < words_count && length < size; i++) {
+            /* product of two uniform values favours low indices */
+            const size_t index = (size_t) (next_random(&state) % SYNTHETIC_WORDS) * (next_random(&state) % SYNTHETIC_WORDS) / SYNTHETIC_WORDS;
+            const size_t word_length = strlen(words[index]);
+            if (i > 0) {
+                text[length++] = (next_random(&state) % 12 == 0) ? ',' : ' ';
+                if (text[length - 1] == ',') {
+                    text[length++] = ' ';
+                }
+            }
+            memcpy(text + length, words[index], word_length);
+            length += word_length;
+        }
+        memcpy(text + length, ".</p>\n", 6);
+        length += 6;
+        paragraph++;
+    }
+    free(words);
+    return text;
+}
+
+/**
+ @brief Measure decompression of synthetic text
+ 
+ Text is compressed into records with both PalmDOC and HUFF/CDIC compressors.
+ 
+ @param[in] megabytes Size of text in megabytes
+ @param[in] iterations Number of repetitions
+ @return SUCCESS or ERROR
+ */
+static int bench_synthetic(const size_t megabytes, const size_t iterations) {
+    const size_t length = megabytes * 1024 * 1024;
+    const size_t count = (length + SYNTHETIC_RECORD_SIZE - 1) / SYNTHETIC_RECORD_SIZE;
+    char basename[FILENAME_MAX];
+    snprintf(basename, sizeof(basename), "synthetic-%zuMB", megabytes);
+    unsigned char *text = generate_text(length);
+    if (text == NULL) {
+        return ERROR;
+    }
+    size_t *sizes = malloc(count * sizeof(*sizes));
+    unsigned char **records = calloc(count, sizeof(*records));
+    if (sizes == NULL || records == NULL) {
+        printf("Memory allocation failed\n");
+        free(text);
+        free(sizes);
+        free(records);
+        return ERROR;
+    }
+    for (size_t i = 0; i < count; i++) {
+        sizes[i] = (i + 1) * SYNTHETIC_RECORD_SIZE <= length ? SYNTHETIC_RECORD_SIZE : length - i * SYNTHETIC_RECORD_SIZE;
+    }
+    /* palmdoc */
+    int ret = SUCCESS;
+    size_t *compressed_sizes = malloc(count * sizeof(*compressed_sizes));
+    if (compressed_sizes == NULL) {
+        printf("Memory allocation failed\n");
+        ret = ERROR;
+    }
+    for (size_t i = 0; ret == SUCCESS && i < count; i++) {
+        compressed_sizes[i] = sizes[i] + (sizes[i] + 7) / 8;
+        records[i] = malloc(compressed_sizes[i]);
+        if (records[i] == NULL) {
+            printf("Memory allocation failed\n");
+            ret = ERROR;
+        } else if (mobi_compress_lz77(records[i], text + i * SYNTHETIC_RECORD_SIZE, &compressed_sizes[i], sizes[i], MOBI_LZ77_LEVEL_DEFAULT) != MOBI_SUCCESS) {
+            printf("Compression of synthetic text failed\n");
+            ret = ERROR;
+        }
+    }
+    if (ret == SUCCESS) {
+        ret = bench_lz77(basename, records, compressed_sizes, count, SYNTHETIC_RECORD_SIZE, text, length, iterations);
+    }
+    for (size_t i = 0; i < count; i++) {
+        free(records[i]);
+    }
+    free(records);
+    free(compressed_sizes);
+    /* huff/cdic */
+    MOBIHuffCdicOutput output;
+    memset(&output, 0, sizeof(output));
+    MOBIHuffCdic *huffcdic = NULL;
+    if (ret == SUCCESS) {
+        if (mobi_compress_huffcdic(&output, text, sizes, count, MOBI_LZ77_LEVEL_FAST, SYNTHETIC_THREADS) != MOBI_SUCCESS) {
+            printf("Huff/cdic compression of synthetic text failed\n");
+            ret = ERROR;
+        } else {
+            huffcdic = mobi_init_huffcdic();
+            if (huffcdic) {
+                huffcdic->symbols = malloc((output.record_count - 1) * sizeof(*huffcdic->symbols));
+            }
+            if (huffcdic == NULL || huffcdic->symbols == NULL) {
+                printf("Memory allocation failed\n");
+                ret = ERROR;
+            }
+        }
+    }
+    for (size_t i = 0; ret == SUCCESS && i < output.record_count; i++) {
+        MOBIPdbRecord record;
+        memset(&record, 0, sizeof(record));
+        record.size = output.record_sizes[i];
+        record.data = output.records[i];
+        const MOBI_RET mobi_ret = i == 0 ? mobi_parse_huff(huffcdic, &record) : mobi_parse_cdic(huffcdic, &record, i - 1);
+        if (mobi_ret != MOBI_SUCCESS) {
+            printf("Parsing of synthetic HUFF/CDIC records failed\n");
+            ret = ERROR;
+        }
+    }
+    if (ret == SUCCESS && mobi_build_huffcdic_tables(huffcdic, SYNTHETIC_RECORD_SIZE) != MOBI_SUCCESS) {
+        printf("Building of huffman tables failed\n");
+        ret = ERROR;
+    }
+    if (ret == SUCCESS) {
+        ret = bench_huffman(basename, huffcdic, output.texts, output.text_sizes, count, SYNTHETIC_RECORD_SIZE, text, length, iterations);
+    }
+    mobi_free_huffcdic(huffcdic);
+    mobi_free_huffcdic_output(&output);
+    free(sizes);
+    free(text);
+    return ret;
+}
+
+/**
+ @brief Print usage info
+ @param[in] progname Executed program name
+ */
+static void exit_with_usage(const char *progname) {
+    char *p = strrchr(progname, separator);
+    if (p) { progname = ++p; }
+    printf("usage: %s [-hv] [-n iterations] [-s megabytes] [filename ...]\n", progname);
+    printf("       -n iterations  repeat each measurement given number of times (default: %d)\n", ITERATIONS_DEFAULT);
+    printf("       -s megabytes   also measure decompression of synthetic text of given size\n");
+    printf("       -h             show this usage summary and exit\n");
+    printf("       -v             show version and exit\n");
+    exit(ERROR);
+}
+
+/**
+ @brief Main
+ 
+ @param[in] argc Arguments count
+ @param[in] argv Arguments values
+ */
+int main(int argc, char *argv[]) {
+    if (argc < 2) {
+        exit_with_usage(argv[0]);
+    }
+    size_t iterations = ITERATIONS_DEFAULT;
+    size_t synthetic_size = 0;
+    int c;
+    while ((c = getopt(argc, argv, "hn:s:v")) != -1) {
+        switch (c) {
+            case 'n': {
+                const long value = strtol(optarg, NULL, 10);
+                if (value <= 0) {
+                    printf("Invalid number of iterations: %s\n", optarg);
+                    return ERROR;
+                }
+                iterations = (size_t) value;
+                break;
+            }
+            case 's': {
+                const long value = strtol(optarg, NULL, 10);
+                if (value <= 0 || value > 4096) {
+                    printf("Invalid size of synthetic text: %s\n", optarg);
+                    return ERROR;
+                }
+                synthetic_size = (size_t) value;
+                break;
+            }
+            case 'v':
+                printf("mobi_bench build: " __DATE__ " " __TIME__ " (" COMPILER ")\n");
+                printf("libmobi: %s\n", mobi_version());
+                return SUCCESS;
+            case '?':
+                if (isprint(optopt)) {
+                    fprintf(stderr, "Unknown option `-%c'\n", optopt);
+                }
+                else {
+                    fprintf(stderr, "Unknown option character `\\x%x'\n", optopt);
+                }
+                exit_with_usage(argv[0]);
+            case 'h':
+            default:
+                exit_with_usage(argv[0]);
+        }
+    }
+    if (argc <= optind && synthetic_size == 0) {
+        printf("Missing filename\n");
+        exit_with_usage(argv[0]);
+    }
+    printf("stage\tmethod\tfile\tbytes\trecords\titerations\tseconds\tmb_per_s\tallocs\talloc_bytes\n");
+    int ret = SUCCESS;
+    for (int i = optind; i < argc; i++) {
+        if (bench_document(argv[i], iterations) != SUCCESS) {
+            ret = ERROR;
+        }
+    }
+    if (synthetic_size && bench_synthetic(synthetic_size, iterations) != SUCCESS) {
+        ret = ERROR;
+    }
+    return ret;
+}
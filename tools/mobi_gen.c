@@ -0,0 +1,1397 @@
+/** @file mobi_gen.c
+ *
+ * @brief mobi_gen
+ *
+ * Program generating synthetic documents for scaling tests.
+ * Document records are assembled in memory and saved with mobi_write_file().
+ * By default KF8 book is created: html flow split into skeletons and fragments,
+ * css flow, NCX index with one chapter per skeleton, links between fragments
+ * and embedded images.
+ * With dictionary entries requested KF7 dictionary is created instead,
+ * as libmobi reconstructs dictionary markup only for KF7 documents:
+ * text holds entries with filepos links, orth index points to entries
+ * and infl index holds inflection rules.
+ * Output is the same for the same parameters, except for timestamps.
+ *
+ * Copyright (c) 2026 Bartek Fabiszewski
+ * http://www.fabiszewski.net
+ *
+ * Licensed under LGPL, either version 3, or any later.
+ * See <http://www.gnu.org/licenses/>
+ */
+
+#include <stdio.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <stdarg.h>
+#include <errno.h>
+#include <ctype.h>
+#include <string.h>
+#include <time.h>
+#include <mobi.h>
+
+#include "common.h"
+
+#define GEN_RECORD_SIZE 4096 /**< Size of uncompressed text record */
+#define GEN_RECORDS_MAX 0xffff /**< Maximal number of records in palm database */
+#define GEN_TEXT_MAX 0x0fffffff /**< Maximal size of text, values in index entries are limited to 28 bits */
+#define GEN_BASE32_MAX (32 * 32 * 32 * 32) /**< Maximal number of fragments or images, ids are written with 4 base32 digits */
+#define GEN_DIV_FORMAT "<div id=\"f%08zu\" aid=\"%s\">" /**< Opening tag of fragment */
+#define GEN_DIV_LENGTH (sizeof("<div id=\"f00000000\" aid=\"0000\">") - 1) /**< Length of opening tag of fragment */
+#define GEN_INDX_HEADER_LEN 192 /**< Length of INDX record header */
+#define GEN_INDX_RECORD_MAX 0xfff0 /**< Maximal size of INDX record, IDXT holds 16-bit offsets */
+#define GEN_INDX_ENTRIES_MAX 4096 /**< Maximal number of entries in INDX data record */
+#define GEN_CNCX_MAX 0x0fffffff /**< Maximal size of CNCX data */
+#define GEN_PARAGRAPH_SIZE 450 /**< Approximate size of generated paragraph */
+#define GEN_WORDS 4096 /**< Number of words in vocabulary */
+#define GEN_WORD_MAX 16 /**< Maximal length of word in vocabulary */
+#define GEN_HEADWORD_DIGITS 8 /**< Number of syllables in dictionary headword, each encodes decimal digit */
+#define GEN_ENTRIES_MAX 100000000 /**< Maximal number of dictionary entries, limited by headword digits */
+#define GEN_INFL_SUFFIX_MAX 5 /**< Maximal length of suffix in inflection rule */
+
+#if HAVE_ATTRIBUTE_NORETURN
+static void exit_with_usage(const char *progname) __attribute__((noreturn));
+#else
+static void exit_with_usage(const char *progname);
+#endif
+
+/**
+ @brief Generator parameters
+ */
+typedef struct {
+    size_t records; /**< Approximate number of text records */
+    size_t skeletons; /**< Number of skeleton parts (KF8) */
+    size_t fragments; /**< Number of fragments (KF8) */
+    size_t links; /**< Number of links */
+    size_t pictures; /**< Number of image resources */
+    size_t entries; /**< Number of dictionary entries (KF7 dictionary) */
+    size_t rules; /**< Number of inflection rules (KF7 dictionary) */
+    uint16_t compression_type; /**< Compression applied on write or MOBI_COMPRESSION_NONE */
+    int compression_level; /**< Compression level */
+} GenOptions;
+
+/**
+ @brief Growable byte buffer
+ */
+typedef struct {
+    unsigned char *data; /**< Data */
+    size_t size; /**< Size of data */
+    size_t capacity; /**< Size of allocated memory */
+    bool error; /**< Set if memory allocation failed */
+} GenBuffer;
+
+/**
+ @brief Records of generated document
+ */
+typedef struct {
+    MOBIData *m; /**< Document */
+    MOBIPdbRecord *last; /**< Last record in the list */
+    size_t count; /**< Number of records */
+} GenDocument;
+
+/**
+ @brief Tag of generated index
+ */
+typedef struct {
+    uint8_t tag; /**< Tag id */
+    uint8_t values_count; /**< Number of values in each group */
+    uint8_t bitmask; /**< Bitmask of groups count in control byte */
+} GenTag;
+
+/**
+ @brief Index under construction
+ */
+typedef struct {
+    const GenTag *tags; /**< Tags of entries */
+    size_t tags_count; /**< Number of tags */
+    GenBuffer *records; /**< Completed data records */
+    size_t records_count; /**< Number of completed data records */
+    GenBuffer labels; /**< Last label and entries count of each completed data record */
+    GenBuffer current; /**< Data record being filled */
+    uint16_t offsets[GEN_INDX_ENTRIES_MAX]; /**< Offsets of entries in current data record */
+    size_t entries_count; /**< Number of entries in current data record */
+    size_t total_entries_count; /**< Number of all entries */
+    char last_label[256]; /**< Label of last added entry */
+    GenBuffer cncx; /**< CNCX strings */
+    GenBuffer entry; /**< Scratch buffer for an entry */
+} GenIndex;
+
+/**
+ @brief Vocabulary of generated text
+ */
+typedef struct {
+    char (*words)[GEN_WORD_MAX + 1]; /**< Words */
+    uint32_t state; /**< State of pseudo-random generator */
+} GenWords;
+
+/** @brief Transparent 1x1 GIF image */
+static const unsigned char gif_image[] = {
+    0x47, 0x49, 0x46, 0x38, 0x39, 0x61, 0x01, 0x00, 0x01, 0x00, 0x80, 0x00, 0x00, 0xff, 0xff, 0xff,
+    0x00, 0x00, 0x00, 0x21, 0xf9, 0x04, 0x01, 0x00, 0x00, 0x00, 0x00, 0x2c, 0x00, 0x00, 0x00, 0x00,
+    0x01, 0x00, 0x01, 0x00, 0x00, 0x02, 0x02, 0x44, 0x01, 0x00, 0x3b
+};
+
+/** @brief Stylesheet stored in second KF8 flow */
+static const char css_flow[] = "h1 { text-align: center; }\np { margin: 0; text-indent: 1.5em; }\n";
+
+/**
+ @brief Make sure buffer can hold additional data
+ 
+ @param[in,out] buf Buffer
+ @param[in] size Size of additional data
+ @return True on success, false if memory allocation failed
+ */
+static bool buffer_reserve(GenBuffer *buf, const size_t size) {
+    if (buf->error) {
+        return false;
+    }
+    if (buf->size + size <= buf->capacity) {
+        return true;
+    }
+    size_t capacity = buf->capacity ? buf->capacity : 1024;
+    while (capacity < buf->size + size) {
+        capacity *= 2;
+    }
+    unsigned char *data = realloc(buf->data, capacity);
+    if (data == NULL) {
+        buf->error = true;
+        return false;
+    }
+    buf->data = data;
+    buf->capacity = capacity;
+    return true;
+}
+
+/**
+ @brief Append data to buffer
+ 
+ @param[in,out] buf Buffer
+ @param[in] data Data
+ @param[in] size Size of data
+ */
+static void buffer_add(GenBuffer *buf, const void *data, const size_t size) {
+    if (size && buffer_reserve(buf, size)) {
+        memcpy(buf->data + buf->size, data, size);
+        buf->size += size;
+    }
+}
+
+/**
+ @brief Append zeros to buffer
+ 
+ @param[in,out] buf Buffer
+ @param[in] count Number of zeros
+ */
+static void buffer_addzeros(GenBuffer *buf, const size_t count) {
+    if (count && buffer_reserve(buf, count)) {
+        memset(buf->data + buf->size, 0, count);
+        buf->size += count;
+    }
+}
+
+/**
+ @brief Append byte to buffer
+ 
+ @param[in,out] buf Buffer
+ @param[in] value Value
+ */
+static void buffer_add8(GenBuffer *buf, const uint8_t value) {
+    buffer_add(buf, &value, 1);
+}
+
+/**
+ @brief Append big-endian 16-bit value to buffer
+ 
+ @param[in,out] buf Buffer
+ @param[in] value Value
+ */
+static void buffer_add16(GenBuffer *buf, const uint16_t value) {
+    const unsigned char bytes[] = { (unsigned char) (value >> 8), (unsigned char) value };
+    buffer_add(buf, bytes, sizeof(bytes));
+}
+
+/**
+ @brief Append big-endian 32-bit value to buffer
+ 
+ @param[in,out] buf Buffer
+ @param[in] value Value
+ */
+static void buffer_add32(GenBuffer *buf, const uint32_t value) {
+    const unsigned char bytes[] = {
+        (unsigned char) (value >> 24), (unsigned char) (value >> 16),
+        (unsigned char) (value >> 8), (unsigned char) value
+    };
+    buffer_add(buf, bytes, sizeof(bytes));
+}
+
+/**
+ @brief Overwrite big-endian 32-bit value at given offset
+ 
+ @param[in,out] buf Buffer
+ @param[in] offset Offset, value must fit in data already in buffer
+ @param[in] value Value
+ */
+static void buffer_set32(GenBuffer *buf, const size_t offset, const uint32_t value) {
+    if (buf->error || offset + 4 > buf->size) {
+        return;
+    }
+    buf->data[offset] = (unsigned char) (value >> 24);
+    buf->data[offset + 1] = (unsigned char) (value >> 16);
+    buf->data[offset + 2] = (unsigned char) (value >> 8);
+    buf->data[offset + 3] = (unsigned char) value;
+}
+
+/**
+ @brief Append string to buffer, without terminating null
+ 
+ @param[in,out] buf Buffer
+ @param[in] string String
+ */
+static void buffer_addstring(GenBuffer *buf, const char *string) {
+    buffer_add(buf, string, strlen(string));
+}
+
+/**
+ @brief Append formatted string to buffer, without terminating null
+ 
+ @param[in,out] buf Buffer
+ @param[in] format Format string
+ @param[in] ... Format arguments
+ */
+static void buffer_printf(GenBuffer *buf, const char *format, ...) {
+    size_t size = 256;
+    while (buffer_reserve(buf, size)) {
+        va_list args;
+        va_start(args, format);
+        const int n = vsnprintf((char *) buf->data + buf->size, buf->capacity - buf->size, format, args);
+        va_end(args);
+        if (n < 0) {
+            buf->error = true;
+            return;
+        }
+        if ((size_t) n < buf->capacity - buf->size) {
+            buf->size += (size_t) n;
+            return;
+        }
+        size = (size_t) n + 1;
+    }
+}
+
+/**
+ @brief Append variable length value to buffer
+ 
+ Value is stored in 7-bit groups, most significant first.
+ High bit is set in the last byte.
+ 
+ @param[in,out] buf Buffer
+ @param[in] value Value, at most 28 bits
+ */
+static void buffer_addvarlen(GenBuffer *buf, uint32_t value) {
+    unsigned char bytes[4];
+    size_t count = 0;
+    do {
+        bytes[count++] = value & 0x7f;
+        value >>= 7;
+    } while (value && count < sizeof(bytes));
+    bytes[0] |= 0x80;
+    while (count--) {
+        buffer_add8(buf, bytes[count]);
+    }
+}
+
+/**
+ @brief Free buffer data
+ 
+ @param[in,out] buf Buffer
+ */
+static void buffer_free(GenBuffer *buf) {
+    free(buf->data);
+    memset(buf, 0, sizeof(*buf));
+}
+
+/**
+ @brief Append record holding buffer data to document
+ 
+ Buffer data is moved to the record, buffer is left empty.
+ 
+ @param[in,out] doc Document
+ @param[in,out] buf Buffer with record data
+ @return SUCCESS or ERROR
+ */
+static int add_record(GenDocument *doc, GenBuffer *buf) {
+    if (buf->error) {
+        printf("Memory allocation failed\n");
+        return ERROR;
+    }
+    if (doc->count >= GEN_RECORDS_MAX) {
+        printf("Too many records (%zu), reduce document size\n", doc->count);
+        return ERROR;
+    }
+    MOBIPdbRecord *record = calloc(1, sizeof(MOBIPdbRecord));
+    if (record == NULL) {
+        printf("Memory allocation failed\n");
+        return ERROR;
+    }
+    record->data = buf->data;
+    record->size = buf->size;
+    memset(buf, 0, sizeof(*buf));
+    if (doc->last) {
+        doc->last->next = record;
+    } else {
+        doc->m->rec = record;
+    }
+    doc->last = record;
+    doc->count++;
+    return SUCCESS;
+}
+
+/**
+ @brief Append records holding text split into fixed size parts
+ 
+ @param[in,out] doc Document
+ @param[in] text Text
+ @return SUCCESS or ERROR
+ */
+static int add_text_records(GenDocument *doc, const GenBuffer *text) {
+    for (size_t offset = 0; offset < text->size; offset += GEN_RECORD_SIZE) {
+        GenBuffer record = { 0 };
+        const size_t size = text->size - offset < GEN_RECORD_SIZE ? text->size - offset : GEN_RECORD_SIZE;
+        buffer_add(&record, text->data + offset, size);
+        if (add_record(doc, &record) != SUCCESS) {
+            return ERROR;
+        }
+    }
+    return SUCCESS;
+}
+
+/**
+ @brief Append image resource records
+ 
+ @param[in,out] doc Document
+ @param[in] count Number of images
+ @return SUCCESS or ERROR
+ */
+static int add_image_records(GenDocument *doc, const size_t count) {
+    for (size_t i = 0; i < count; i++) {
+        GenBuffer record = { 0 };
+        buffer_add(&record, gif_image, sizeof(gif_image));
+        if (add_record(doc, &record) != SUCCESS) {
+            return ERROR;
+        }
+    }
+    return SUCCESS;
+}
+
+/**
+ @brief Append end of file record
+ 
+ @param[in,out] doc Document
+ @return SUCCESS or ERROR
+ */
+static int add_eof_record(GenDocument *doc) {
+    GenBuffer record = { 0 };
+    buffer_add(&record, "\xe9\x8e\r\n", 4);
+    return add_record(doc, &record);
+}
+
+/**
+ @brief Write INDX record header
+ 
+ Fields not used by generated indices are zeroed.
+ 
+ @param[in,out] buf Buffer, must be empty
+ */
+static void index_add_header(GenBuffer *buf) {
+    buffer_addstring(buf, "INDX");
+    buffer_add32(buf, GEN_INDX_HEADER_LEN);
+    buffer_addzeros(buf, GEN_INDX_HEADER_LEN - 8);
+}
+
+/**
+ @brief Initialize index
+ 
+ @param[in,out] index Index
+ @param[in] tags Tags of entries
+ @param[in] tags_count Number of tags
+ */
+static void index_init(GenIndex *index, const GenTag *tags, const size_t tags_count) {
+    memset(index, 0, sizeof(*index));
+    index->tags = tags;
+    index->tags_count = tags_count;
+}
+
+/**
+ @brief Free index data
+ 
+ @param[in,out] index Index
+ */
+static void index_free(GenIndex *index) {
+    for (size_t i = 0; i < index->records_count; i++) {
+        buffer_free(&index->records[i]);
+    }
+    free(index->records);
+    buffer_free(&index->labels);
+    buffer_free(&index->current);
+    buffer_free(&index->cncx);
+    buffer_free(&index->entry);
+}
+
+/**
+ @brief Append string to index CNCX data
+ 
+ All strings are kept in a single CNCX record, so offsets are plain offsets in record data.
+ 
+ @param[in,out] index Index
+ @param[in] string String
+ @return Offset of the string, MOBI_NOTSET if CNCX data is too large
+ */
+static uint32_t index_add_cncx(GenIndex *index, const char *string) {
+    const size_t offset = index->cncx.size;
+    const size_t length = strlen(string);
+    if (offset + length + 4 > GEN_CNCX_MAX) {
+        return MOBI_NOTSET;
+    }
+    buffer_addvarlen(&index->cncx, (uint32_t) length);
+    buffer_add(&index->cncx, string, length);
+    return (uint32_t) offset;
+}
+
+/**
+ @brief Close current data record of index
+ 
+ IDXT with offsets of entries is appended and header is filled.
+ Last label of the record is saved for the meta record.
+ 
+ @param[in,out] index Index
+ @return SUCCESS or ERROR
+ */
+static int index_flush(GenIndex *index) {
+    GenBuffer *buf = &index->current;
+    const size_t idxt_offset = buf->size;
+    buffer_addstring(buf, "IDXT");
+    for (size_t i = 0; i < index->entries_count; i++) {
+        buffer_add16(buf, index->offsets[i]);
+    }
+    buffer_addzeros(buf, (4 - buf->size % 4) % 4);
+    buffer_set32(buf, 20, (uint32_t) idxt_offset);
+    buffer_set32(buf, 24, (uint32_t) index->entries_count);
+    GenBuffer *records = realloc(index->records, (index->records_count + 1) * sizeof(*records));
+    if (records == NULL || buf->error) {
+        printf("Memory allocation failed\n");
+        return ERROR;
+    }
+    index->records = records;
+    index->records[index->records_count++] = *buf;
+    memset(buf, 0, sizeof(*buf));
+    const size_t label_length = strlen(index->last_label);
+    buffer_add8(&index->labels, (uint8_t) label_length);
+    buffer_add(&index->labels, index->last_label, label_length);
+    buffer_add16(&index->labels, (uint16_t) index->entries_count);
+    index->entries_count = 0;
+    return SUCCESS;
+}
+
+/**
+ @brief Append entry to index
+ 
+ Values of all tags are given in a single array, in order of index tags.
+ Entries must be added in order of labels.
+ 
+ @param[in,out] index Index
+ @param[in] label Label of the entry, at most 255 bytes
+ @param[in] values Values of the entry
+ @param[in] counts Number of values for each tag, multiple of tag values count
+ @return SUCCESS or ERROR
+ */
+static int index_add_entry(GenIndex *index, const char *label, const uint32_t *values, const size_t *counts) {
+    const size_t label_length = strlen(label);
+    if (label_length > 255) {
+        printf("Index label too long: %s\n", label);
+        return ERROR;
+    }
+    GenBuffer *entry = &index->entry;
+    entry->size = 0;
+    buffer_add8(entry, (uint8_t) label_length);
+    buffer_add(entry, label, label_length);
+    uint8_t control_byte = 0;
+    size_t values_total = 0;
+    for (size_t i = 0; i < index->tags_count; i++) {
+        const GenTag *tag = &index->tags[i];
+        const size_t groups = counts[i] / tag->values_count;
+        values_total += counts[i];
+        if (groups == 0) {
+            continue;
+        }
+        uint8_t shift = 0;
+        while (((tag->bitmask >> shift) & 1) == 0) {
+            shift++;
+        }
+        const size_t groups_max = tag->bitmask >> shift;
+        /* all mask bits set would require additional byte count field */
+        if ((groups_max == 1 && groups > 1) || (groups_max > 1 && groups >= groups_max)) {
+            printf("Too many values of tag %u\n", tag->tag);
+            return ERROR;
+        }
+        control_byte |= (uint8_t) (groups << shift);
+    }
+    buffer_add8(entry, control_byte);
+    for (size_t i = 0; i < values_total; i++) {
+        buffer_addvarlen(entry, values[i]);
+    }
+    if (entry->error) {
+        printf("Memory allocation failed\n");
+        return ERROR;
+    }
+    const size_t idxt_size = 4 + 2 * (index->entries_count + 1) + 3;
+    if (index->entries_count == GEN_INDX_ENTRIES_MAX
+        || (index->entries_count && index->current.size + entry->size + idxt_size > GEN_INDX_RECORD_MAX)) {
+        if (index_flush(index) != SUCCESS) {
+            return ERROR;
+        }
+    }
+    if (index->current.size == 0) {
+        index_add_header(&index->current);
+    }
+    index->offsets[index->entries_count++] = (uint16_t) index->current.size;
+    buffer_add(&index->current, entry->data, entry->size);
+    memcpy(index->last_label, label, label_length + 1);
+    index->total_entries_count++;
+    return SUCCESS;
+}
+
+/**
+ @brief Append index records to document
+ 
+ Meta record holding TAGX section is followed by data records
+ and CNCX record if any strings were added.
+ 
+ @param[in,out] doc Document
+ @param[in,out] index Index
+ @return Record number of meta record, MOBI_NOTSET on failure
+ */
+static uint32_t index_finish(GenDocument *doc, GenIndex *index) {
+    if (index->entries_count && index_flush(index) != SUCCESS) {
+        return MOBI_NOTSET;
+    }
+    const uint32_t meta_number = (uint32_t) doc->count;
+    GenBuffer meta = { 0 };
+    index_add_header(&meta);
+    buffer_set32(&meta, 24, (uint32_t) index->records_count);
+    buffer_set32(&meta, 28, MOBI_UTF8);
+    buffer_set32(&meta, 32, MOBI_NOTSET);
+    buffer_set32(&meta, 36, (uint32_t) index->total_entries_count);
+    buffer_set32(&meta, 52, index->cncx.size ? 1 : 0);
+    buffer_addstring(&meta, "TAGX");
+    buffer_add32(&meta, (uint32_t) (12 + 4 * (index->tags_count + 1)));
+    buffer_add32(&meta, 1);
+    for (size_t i = 0; i < index->tags_count; i++) {
+        buffer_add8(&meta, index->tags[i].tag);
+        buffer_add8(&meta, index->tags[i].values_count);
+        buffer_add8(&meta, index->tags[i].bitmask);
+        buffer_add8(&meta, 0);
+    }
+    const unsigned char tagx_end[] = { 0, 0, 0, 1 };
+    buffer_add(&meta, tagx_end, sizeof(tagx_end));
+    /* last labels of data records, referenced by IDXT */
+    const size_t labels_offset = meta.size;
+    buffer_add(&meta, index->labels.data, index->labels.size);
+    buffer_addzeros(&meta, (4 - meta.size % 4) % 4);
+    const size_t idxt_offset = meta.size;
+    buffer_addstring(&meta, "IDXT");
+    size_t offset = labels_offset;
+    for (size_t i = 0; i < index->records_count; i++) {
+        buffer_add16(&meta, (uint16_t) offset);
+        offset += 1 + (size_t) index->labels.data[offset - labels_offset] + 2;
+    }
+    buffer_addzeros(&meta, (4 - meta.size % 4) % 4);
+    buffer_set32(&meta, 20, (uint32_t) idxt_offset);
+    if (meta.size > GEN_INDX_RECORD_MAX) {
+        printf("Too many index records (%zu)\n", index->records_count);
+        buffer_free(&meta);
+        return MOBI_NOTSET;
+    }
+    if (add_record(doc, &meta) != SUCCESS) {
+        buffer_free(&meta);
+        return MOBI_NOTSET;
+    }
+    for (size_t i = 0; i < index->records_count; i++) {
+        if (add_record(doc, &index->records[i]) != SUCCESS) {
+            return MOBI_NOTSET;
+        }
+    }
+    if (index->cncx.size && add_record(doc, &index->cncx) != SUCCESS) {
+        return MOBI_NOTSET;
+    }
+    return meta_number;
+}
+
+/**
+ @brief Get next value from xorshift pseudo-random generator
+ 
+ @param[in,out] state Generator state
+ @return Pseudo-random value
+ */
+static uint32_t next_random(uint32_t *state) {
+    uint32_t x = *state;
+    x ^= x << 13;
+    x ^= x >> 17;
+    x ^= x << 5;
+    *state = x;
+    return x;
+}
+
+/**
+ @brief Get pseudo-random value from range
+ 
+ @param[in,out] words Vocabulary holding generator state
+ @param[in] min Minimal value
+ @param[in] max Maximal value
+ @return Pseudo-random value
+ */
+static size_t random_range(GenWords *words, const size_t min, const size_t max) {
+    return min + next_random(&words->state) % (max - min + 1);
+}
+
+/**
+ @brief Build vocabulary of pseudo-random words
+ 
+ @param[in,out] words Vocabulary
+ @return SUCCESS or ERROR
+ */
+static int words_init(GenWords *words) {
+    static const char *syllables[] = {
+        "a", "be", "ca", "de", "el", "fo", "ga", "hi", "in", "jo", "ka", "le", "ma", "ne", "on", "pa",
+        "qui", "ra", "se", "ta", "un", "ve", "wa", "xe", "yo", "za", "th", "st", "er", "an", "or", "is"
+    };
+    words->words = malloc(GEN_WORDS * sizeof(*words->words));
+    if (words->words == NULL) {
+        printf("Memory allocation failed\n");
+        return ERROR;
+    }
+    words->state = 2463534242U;
+    for (size_t i = 0; i < GEN_WORDS; i++) {
+        const size_t syllables_count = random_range(words, 1, 4);
+        words->words[i][0] = '\0';
+        for (size_t j = 0; j < syllables_count; j++) {
+            strcat(words->words[i], syllables[next_random(&words->state) % ARRAYSIZE(syllables)]);
+        }
+    }
+    return SUCCESS;
+}
+
+/**
+ @brief Append pseudo-random words to text
+ 
+ Frequent words are chosen more often.
+ 
+ @param[in,out] text Text
+ @param[in,out] words Vocabulary
+ @param[in] count Number of words
+ */
+static void add_words(GenBuffer *text, GenWords *words, const size_t count) {
+    for (size_t i = 0; i < count; i++) {
+        /* product of two uniform values favours low indices */
+        const size_t index = (size_t) (next_random(&words->state) % GEN_WORDS) * (next_random(&words->state) % GEN_WORDS) / GEN_WORDS;
+        if (i > 0) {
+            buffer_addstring(text, (next_random(&words->state) % 12 == 0) ? ", " : " ");
+        }
+        buffer_addstring(text, words->words[index]);
+    }
+}
+
+/**
+ @brief Write value as base32 number with fixed number of digits
+ 
+ @param[in,out] out Output, must hold digits + 1 characters
+ @param[in] value Value
+ @param[in] digits Number of digits
+ */
+static void base32_string(char *out, size_t value, const size_t digits) {
+    static const char alphabet[] = "0123456789ABCDEFGHIJKLMNOPQRSTUV";
+    for (size_t i = digits; i > 0; i--) {
+        out[i - 1] = alphabet[value % 32];
+        value /= 32;
+    }
+    out[digits] = '\0';
+}
+
+/**
+ @brief Allocate MOBI header fields common for generated documents
+ 
+ @param[in,out] m Document
+ @param[in] version Format version
+ @param[in] title Title
+ @return SUCCESS or ERROR
+ */
+static int set_headers(MOBIData *m, const uint32_t version, const char *title) {
+    m->ph = calloc(1, sizeof(MOBIPdbHeader));
+    m->rh = calloc(1, sizeof(MOBIRecord0Header));
+    m->mh = calloc(1, sizeof(MOBIMobiHeader));
+    if (m->ph == NULL || m->rh == NULL || m->mh == NULL) {
+        printf("Memory allocation failed\n");
+        return ERROR;
+    }
+    const uint32_t now = (uint32_t) time(NULL);
+    m->ph->ctime = now;
+    m->ph->mtime = now;
+    strcpy(m->ph->type, "BOOK");
+    strcpy(m->ph->creator, "MOBI");
+    m->rh->compression_type = MOBI_COMPRESSION_NONE;
+    m->rh->text_record_size = GEN_RECORD_SIZE;
+    MOBIMobiHeader *mh = m->mh;
+    strcpy(mh->mobi_magic, "MOBI");
+    const bool kf8 = (version == 8);
+    struct {
+        uint32_t **field;
+        uint32_t value;
+    } fields[] = {
+        { &mh->header_length, 0 },
+        { &mh->mobi_type, 2 },
+        { &mh->uid, 0x6d6f6269 },
+        { &mh->version, version },
+        { &mh->orth_index, MOBI_NOTSET },
+        { &mh->infl_index, MOBI_NOTSET },
+        { &mh->names_index, MOBI_NOTSET },
+        { &mh->keys_index, MOBI_NOTSET },
+        { &mh->extra0_index, MOBI_NOTSET },
+        { &mh->extra1_index, MOBI_NOTSET },
+        { &mh->extra2_index, MOBI_NOTSET },
+        { &mh->extra3_index, MOBI_NOTSET },
+        { &mh->extra4_index, MOBI_NOTSET },
+        { &mh->extra5_index, MOBI_NOTSET },
+        { &mh->non_text_index, MOBI_NOTSET },
+        { &mh->full_name_offset, 0 },
+        { &mh->full_name_length, 0 },
+        { &mh->locale, 0x409 },
+        { &mh->dict_input_lang, 0 },
+        { &mh->dict_output_lang, 0 },
+        { &mh->min_version, version },
+        { &mh->image_index, MOBI_NOTSET },
+        { &mh->huff_rec_index, 0 },
+        { &mh->huff_rec_count, 0 },
+        { &mh->datp_rec_index, 0 },
+        { &mh->datp_rec_count, 0 },
+        { &mh->exth_flags, 0x50 },
+        { &mh->unknown6, MOBI_NOTSET },
+        { &mh->drm_offset, MOBI_NOTSET },
+        { &mh->drm_count, 0 },
+        { &mh->drm_size, 0 },
+        { &mh->drm_flags, 0 },
+        { kf8 ? &mh->fdst_index : NULL, MOBI_NOTSET },
+        { &mh->fdst_section_count, 1 },
+        { &mh->fcis_index, MOBI_NOTSET },
+        { &mh->fcis_count, 0 },
+        { &mh->flis_index, MOBI_NOTSET },
+        { &mh->flis_count, 0 },
+        { &mh->unknown10, 0 },
+        { &mh->unknown11, 0 },
+        { &mh->srcs_index, MOBI_NOTSET },
+        { &mh->srcs_count, 0 },
+        { &mh->unknown12, MOBI_NOTSET },
+        { &mh->unknown13, 0 },
+        { &mh->ncx_index, MOBI_NOTSET },
+        { kf8 ? &mh->fragment_index : &mh->unknown14, MOBI_NOTSET },
+        { kf8 ? &mh->skeleton_index : &mh->unknown15, MOBI_NOTSET },
+        { &mh->datp_index, MOBI_NOTSET },
+        { kf8 ? &mh->guide_index : &mh->unknown16, MOBI_NOTSET },
+        { &mh->unknown17, MOBI_NOTSET },
+        { &mh->unknown18, 0 },
+        { &mh->unknown19, 0 },
+        { &mh->unknown20, 0 },
+    };
+    for (size_t i = 0; i < ARRAYSIZE(fields); i++) {
+        if (fields[i].field == NULL) {
+            continue;
+        }
+        *fields[i].field = malloc(sizeof(uint32_t));
+        if (*fields[i].field == NULL) {
+            printf("Memory allocation failed\n");
+            return ERROR;
+        }
+        **fields[i].field = fields[i].value;
+    }
+    mh->text_encoding = malloc(sizeof(MOBIEncoding));
+    mh->extra_flags = malloc(sizeof(uint16_t));
+    /* full name is replaced with title by mobi_meta_set_title() */
+    mh->full_name = calloc(1, 1);
+    if (!kf8) {
+        mh->first_text_index = malloc(sizeof(uint16_t));
+        mh->last_text_index = malloc(sizeof(uint16_t));
+    }
+    if (mh->text_encoding == NULL || mh->extra_flags == NULL || mh->full_name == NULL
+        || (!kf8 && (mh->first_text_index == NULL || mh->last_text_index == NULL))) {
+        printf("Memory allocation failed\n");
+        return ERROR;
+    }
+    *mh->text_encoding = MOBI_UTF8;
+    *mh->extra_flags = 0;
+    /* palm database name is copied from fixed size buffer */
+    char name[sizeof(m->ph->name)] = { 0 };
+    strncpy(name, title, sizeof(name) - 1);
+    MOBI_RET mobi_ret = mobi_meta_set_title(m, name);
+    if (mobi_ret == MOBI_SUCCESS) {
+        mobi_ret = mobi_meta_set_author(m, "libmobi");
+    }
+    if (mobi_ret != MOBI_SUCCESS) {
+        printf("Setting metadata failed (%s)\n", libmobi_msg(mobi_ret));
+        return ERROR;
+    }
+    return SUCCESS;
+}
+
+/**
+ @brief Set text fields of record 0 header
+ 
+ @param[in,out] m Document
+ @param[in] text_length Length of text
+ @return SUCCESS or ERROR
+ */
+static int set_text_length(MOBIData *m, const size_t text_length) {
+    const size_t records = (text_length + GEN_RECORD_SIZE - 1) / GEN_RECORD_SIZE;
+    if (text_length > GEN_TEXT_MAX || records >= GEN_RECORDS_MAX) {
+        printf("Text too large (%zu bytes)\n", text_length);
+        return ERROR;
+    }
+    m->rh->text_length = (uint32_t) text_length;
+    m->rh->text_record_count = (uint16_t) records;
+    *m->mh->non_text_index = (uint32_t) records + 1;
+    if (m->mh->last_text_index) {
+        *m->mh->first_text_index = 1;
+        *m->mh->last_text_index = (uint16_t) records;
+    }
+    return SUCCESS;
+}
+
+/**
+ @brief Generate KF8 book
+ 
+ Raw html flow is made of skeletons, each followed by its fragments.
+ Every skeleton starts a new chapter. Links and chapters point to the first element
+ following opening tag of a fragment.
+ 
+ @param[in,out] doc Document
+ @param[in] options Generator parameters
+ @param[in,out] words Vocabulary
+ @return SUCCESS or ERROR
+ */
+static int generate_kf8(GenDocument *doc, const GenOptions *options, GenWords *words) {
+    if (set_headers(doc->m, 8, "Synthetic book") != SUCCESS) {
+        return ERROR;
+    }
+    GenBuffer text = { 0 };
+    GenIndex frag;
+    GenIndex skel;
+    GenIndex ncx;
+    static const GenTag frag_tags[] = { { 2, 1, 0x01 }, { 3, 1, 0x02 }, { 4, 1, 0x04 }, { 6, 2, 0x08 } };
+    static const GenTag skel_tags[] = { { 1, 1, 0x03 }, { 6, 2, 0x0c } };
+    static const GenTag ncx_tags[] = { { 1, 1, 0x01 }, { 3, 1, 0x02 }, { 4, 1, 0x04 }, { 6, 2, 0x08 } };
+    index_init(&frag, frag_tags, ARRAYSIZE(frag_tags));
+    index_init(&skel, skel_tags, ARRAYSIZE(skel_tags));
+    index_init(&ncx, ncx_tags, ARRAYSIZE(ncx_tags));
+    int ret = ERROR;
+    const size_t target_size = options->records * GEN_RECORD_SIZE;
+    const size_t fragment_size = target_size / options->fragments;
+    size_t paragraph = 0;
+    for (size_t s = 0; s < options->skeletons; s++) {
+        const size_t first_fragment = s * options->fragments / options->skeletons;
+        const size_t last_fragment = (s + 1) * options->fragments / options->skeletons;
+        const size_t skel_position = text.size;
+        buffer_printf(&text, "<?xml version=\"1.0\" encoding=\"utf-8\"?>\n"
+                      "<html xmlns=\"http://www.w3.org/1999/xhtml\"><head><title>Chapter %zu</title>"
+                      "<link href=\"kindle:flow:0001?mime=text/css\" rel=\"stylesheet\" type=\"text/css\"/>"
+                      "</head><body>", s + 1);
+        const size_t head_length = text.size - skel_position;
+        buffer_addstring(&text, "</body></html>");
+        const size_t skel_length = text.size - skel_position;
+        char label[32];
+        snprintf(label, sizeof(label), "SKEL%010zu", s);
+        const uint32_t skel_values[] = {
+            (uint32_t) (last_fragment - first_fragment), (uint32_t) skel_position, (uint32_t) skel_length
+        };
+        const size_t skel_counts[] = { 1, 2 };
+        if (index_add_entry(&skel, label, skel_values, skel_counts) != SUCCESS) {
+            goto cleanup;
+        }
+        char chapter[32];
+        snprintf(chapter, sizeof(chapter), "Chapter %zu", s + 1);
+        const uint32_t chapter_cncx = index_add_cncx(&ncx, chapter);
+        snprintf(label, sizeof(label), "%05zx", s);
+        const uint32_t ncx_values[] = {
+            (uint32_t) (skel_position + head_length + GEN_DIV_LENGTH), chapter_cncx, 0,
+            (uint32_t) first_fragment, GEN_DIV_LENGTH
+        };
+        const size_t ncx_counts[] = { 1, 1, 1, 2 };
+        if (chapter_cncx == MOBI_NOTSET || index_add_entry(&ncx, label, ncx_values, ncx_counts) != SUCCESS) {
+            goto cleanup;
+        }
+        size_t insert_position = skel_position + head_length;
+        for (size_t f = first_fragment; f < last_fragment; f++) {
+            const size_t fragment_start = text.size;
+            char aid[5];
+            base32_string(aid, f, 4);
+            buffer_printf(&text, GEN_DIV_FORMAT, f, aid);
+            if (f == first_fragment) {
+                buffer_printf(&text, "<h1>%s</h1>", chapter);
+            }
+            const size_t first_link = f * options->links / options->fragments;
+            size_t links = (f + 1) * options->links / options->fragments - first_link;
+            const size_t first_picture = f * options->pictures / options->fragments;
+            size_t pictures = (f + 1) * options->pictures / options->fragments - first_picture;
+            do {
+                buffer_printf(&text, "<p id=\"p%08zu\">", paragraph++);
+                add_words(&text, words, random_range(words, 10, 60));
+                /* spread links and images over estimated number of remaining paragraphs */
+                const size_t written = text.size - fragment_start;
+                const size_t paragraphs_left = written < fragment_size ? (fragment_size - written) / GEN_PARAGRAPH_SIZE + 1 : 1;
+                size_t paragraph_links = (links + paragraphs_left - 1) / paragraphs_left;
+                size_t paragraph_pictures = (pictures + paragraphs_left - 1) / paragraphs_left;
+                while (paragraph_links || paragraph_pictures) {
+                    if (paragraph_links) {
+                        char fid[5];
+                        base32_string(fid, random_range(words, 0, options->fragments - 1), 4);
+                        char off[11];
+                        base32_string(off, GEN_DIV_LENGTH, 10);
+                        buffer_printf(&text, " <a href=\"kindle:pos:fid:%s:off:%s\">", fid, off);
+                        add_words(&text, words, random_range(words, 1, 3));
+                        buffer_addstring(&text, "</a> ");
+                        paragraph_links--;
+                        links--;
+                    }
+                    if (paragraph_pictures) {
+                        char uid[5];
+                        base32_string(uid, first_picture + pictures, 4);
+                        buffer_printf(&text, " <img src=\"kindle:embed:%s?mime=image/gif\" alt=\"\"/> ", uid);
+                        paragraph_pictures--;
+                        pictures--;
+                    }
+                    add_words(&text, words, random_range(words, 2, 10));
+                }
+                add_words(&text, words, random_range(words, 10, 60));
+                buffer_addstring(&text, ".</p>\n");
+            } while (text.size - fragment_start < fragment_size || links || pictures);
+            buffer_addstring(&text, "</div>");
+            const size_t fragment_length = text.size - fragment_start;
+            char selector[64];
+            snprintf(selector, sizeof(selector), "P-//*[@aid='%s']", aid);
+            const uint32_t aid_cncx = index_add_cncx(&frag, selector);
+            snprintf(label, sizeof(label), "%010zu", insert_position);
+            const uint32_t frag_values[] = {
+                aid_cncx, (uint32_t) s, (uint32_t) f,
+                (uint32_t) (insert_position - skel_position), (uint32_t) fragment_length
+            };
+            const size_t frag_counts[] = { 1, 1, 1, 2 };
+            if (aid_cncx == MOBI_NOTSET || index_add_entry(&frag, label, frag_values, frag_counts) != SUCCESS) {
+                goto cleanup;
+            }
+            insert_position += fragment_length;
+        }
+        if (text.size > GEN_TEXT_MAX) {
+            printf("Text too large (%zu bytes)\n", text.size);
+            goto cleanup;
+        }
+    }
+    const size_t html_length = text.size;
+    buffer_addstring(&text, css_flow);
+    if (text.error || set_text_length(doc->m, text.size) != SUCCESS) {
+        goto cleanup;
+    }
+    MOBIMobiHeader *mh = doc->m->mh;
+    if (add_text_records(doc, &text) != SUCCESS) {
+        goto cleanup;
+    }
+    if ((*mh->fragment_index = index_finish(doc, &frag)) == MOBI_NOTSET
+        || (*mh->skeleton_index = index_finish(doc, &skel)) == MOBI_NOTSET
+        || (*mh->ncx_index = index_finish(doc, &ncx)) == MOBI_NOTSET) {
+        goto cleanup;
+    }
+    GenBuffer fdst = { 0 };
+    buffer_addstring(&fdst, "FDST");
+    buffer_add32(&fdst, 12);
+    buffer_add32(&fdst, 2);
+    buffer_add32(&fdst, 0);
+    buffer_add32(&fdst, (uint32_t) html_length);
+    buffer_add32(&fdst, (uint32_t) html_length);
+    buffer_add32(&fdst, (uint32_t) text.size);
+    *mh->fdst_index = (uint32_t) doc->count;
+    *mh->fdst_section_count = 2;
+    if (add_record(doc, &fdst) != SUCCESS) {
+        buffer_free(&fdst);
+        goto cleanup;
+    }
+    if (options->pictures) {
+        *mh->image_index = (uint32_t) doc->count;
+    }
+    if (add_image_records(doc, options->pictures) != SUCCESS || add_eof_record(doc) != SUCCESS) {
+        goto cleanup;
+    }
+    printf("KF8 book: %zu bytes of text, %zu skeletons, %zu fragments, %zu links, %zu images\n",
+           text.size, options->skeletons, options->fragments, options->links, options->pictures);
+    ret = SUCCESS;
+cleanup:
+    buffer_free(&text);
+    index_free(&frag);
+    index_free(&skel);
+    index_free(&ncx);
+    return ret;
+}
+
+/**
+ @brief Generate headword of dictionary entry
+ 
+ Decimal digits of entry number are written as syllables in alphabetical order,
+ so headwords sort in the order of entries.
+ 
+ @param[in,out] out Output, must hold GEN_HEADWORD_DIGITS * 2 + 1 characters
+ @param[in] number Entry number
+ */
+static void headword_string(char *out, size_t number) {
+    static const char *syllables[] = { "ba", "de", "fi", "go", "ku", "la", "me", "ni", "po", "ru" };
+    for (size_t i = GEN_HEADWORD_DIGITS; i > 0; i--) {
+        memcpy(out + 2 * (i - 1), syllables[number % 10], 2);
+        number /= 10;
+    }
+    out[GEN_HEADWORD_DIGITS * 2] = '\0';
+}
+
+/**
+ @brief Generate label of inflection rule
+ 
+ Rule appends suffix to headword, suffix is stored reversed after rule mode byte.
+ Digits of rule number in base of suffix alphabet are written with fixed length,
+ so labels sort in the order of rules.
+ 
+ @param[in,out] out Output, must hold length + 2 characters
+ @param[in] number Rule number
+ @param[in] length Length of suffix
+ */
+static void rule_string(char *out, size_t number, const size_t length) {
+    static const char letters[] = "adeilnorst";
+    const size_t base = ARRAYSIZE(letters) - 1;
+    out[0] = '\x02';
+    for (size_t i = length; i > 0; i--) {
+        out[i] = letters[number % base];
+        number /= base;
+    }
+    out[length + 1] = '\0';
+}
+
+/**
+ @brief Generate KF7 dictionary
+ 
+ Every entry starts with headword and may hold filepos links to preceding entries.
+ Each headword references one or two inflection rules.
+ 
+ @param[in,out] doc Document
+ @param[in] options Generator parameters
+ @param[in,out] words Vocabulary
+ @return SUCCESS or ERROR
+ */
+static int generate_dictionary(GenDocument *doc, const GenOptions *options, GenWords *words) {
+    if (set_headers(doc->m, 6, "Synthetic dictionary") != SUCCESS) {
+        return ERROR;
+    }
+    *doc->m->mh->dict_input_lang = 0x09;
+    *doc->m->mh->dict_output_lang = 0x09;
+    GenBuffer text = { 0 };
+    size_t *positions = malloc(options->entries * sizeof(size_t));
+    GenIndex orth;
+    GenIndex infl;
+    static const GenTag orth_tags[] = { { 1, 1, 0x01 }, { 2, 1, 0x02 }, { 42, 1, 0x0c } };
+    static const GenTag infl_tags[] = { { 5, 1, 0x01 }, { 26, 1, 0x02 } };
+    index_init(&orth, orth_tags, ARRAYSIZE(orth_tags));
+    index_init(&infl, infl_tags, ARRAYSIZE(infl_tags));
+    int ret = ERROR;
+    if (positions == NULL) {
+        printf("Memory allocation failed\n");
+        goto cleanup;
+    }
+    size_t suffix_length = 1;
+    for (size_t count = 10; count < options->rules; count *= 10) {
+        suffix_length++;
+    }
+    for (size_t r = 0; r < options->rules; r++) {
+        char label[GEN_INFL_SUFFIX_MAX + 2];
+        rule_string(label, r, suffix_length);
+        char group[32];
+        snprintf(group, sizeof(group), "group%zu", r);
+        const uint32_t group_cncx = index_add_cncx(&infl, group);
+        const uint32_t infl_values[] = { group_cncx, (uint32_t) r };
+        const size_t infl_counts[] = { 1, 1 };
+        if (group_cncx == MOBI_NOTSET || index_add_entry(&infl, label, infl_values, infl_counts) != SUCCESS) {
+            goto cleanup;
+        }
+    }
+    buffer_addstring(&text, "<html><head><guide></guide></head><body>");
+    const size_t target_size = options->records * GEN_RECORD_SIZE;
+    const size_t entry_size = target_size / options->entries;
+    for (size_t e = 0; e < options->entries; e++) {
+        const size_t entry_start = text.size;
+        positions[e] = entry_start;
+        char headword[GEN_HEADWORD_DIGITS * 2 + 1];
+        headword_string(headword, e);
+        buffer_printf(&text, "<p><b>%s</b> ", headword);
+        const size_t first_link = e * options->links / options->entries;
+        size_t links = (e + 1) * options->links / options->entries - first_link;
+        const size_t first_picture = e * options->pictures / options->entries;
+        size_t pictures = (e + 1) * options->pictures / options->entries - first_picture;
+        do {
+            add_words(&text, words, random_range(words, 4, 20));
+            if (links && e > 0) {
+                buffer_printf(&text, " <a filepos=%010zu>", positions[random_range(words, 0, e - 1)]);
+                add_words(&text, words, 1);
+                buffer_addstring(&text, "</a> ");
+            }
+            if (links) {
+                links--;
+            }
+            if (pictures) {
+                buffer_printf(&text, " <img recindex=\"%05zu\"> ", first_picture + pictures);
+                pictures--;
+            }
+        } while (text.size - entry_start < entry_size || links || pictures);
+        buffer_addstring(&text, ".</p><mbp:pagebreak/>\n");
+        uint32_t orth_values[4] = { (uint32_t) entry_start, (uint32_t) (text.size - entry_start) };
+        size_t orth_counts[] = { 1, 1, 0 };
+        if (options->rules) {
+            orth_values[2] = (uint32_t) random_range(words, 0, options->rules - 1);
+            orth_counts[2] = 1;
+            if (options->rules > 1 && random_range(words, 0, 3) == 0) {
+                orth_values[3] = (uint32_t) random_range(words, 0, options->rules - 1);
+                orth_counts[2] = 2;
+            }
+        }
+        if (index_add_entry(&orth, headword, orth_values, orth_counts) != SUCCESS) {
+            goto cleanup;
+        }
+        if (text.size > GEN_TEXT_MAX) {
+            printf("Text too large (%zu bytes)\n", text.size);
+            goto cleanup;
+        }
+    }
+    buffer_addstring(&text, "</body></html>");
+    if (text.error || set_text_length(doc->m, text.size) != SUCCESS) {
+        goto cleanup;
+    }
+    MOBIMobiHeader *mh = doc->m->mh;
+    if (add_text_records(doc, &text) != SUCCESS) {
+        goto cleanup;
+    }
+    if ((*mh->orth_index = index_finish(doc, &orth)) == MOBI_NOTSET) {
+        goto cleanup;
+    }
+    if (options->rules && (*mh->infl_index = index_finish(doc, &infl)) == MOBI_NOTSET) {
+        goto cleanup;
+    }
+    if (options->pictures) {
+        *mh->image_index = (uint32_t) doc->count;
+    }
+    if (add_image_records(doc, options->pictures) != SUCCESS || add_eof_record(doc) != SUCCESS) {
+        goto cleanup;
+    }
+    printf("KF7 dictionary: %zu bytes of text, %zu entries, %zu inflection rules, %zu links, %zu images\n",
+           text.size, options->entries, options->rules, options->links, options->pictures);
+    ret = SUCCESS;
+cleanup:
+    free(positions);
+    buffer_free(&text);
+    index_free(&orth);
+    index_free(&infl);
+    return ret;
+}
+
+/**
+ @brief Generate document and save it
+ 
+ @param[in] fullpath Output path
+ @param[in] options Generator parameters
+ @return SUCCESS or ERROR
+ */
+static int generate_document(const char *fullpath, const GenOptions *options) {
+    GenWords words;
+    if (words_init(&words) != SUCCESS) {
+        return ERROR;
+    }
+    GenDocument doc = { 0 };
+    doc.m = mobi_init();
+    if (doc.m == NULL) {
+        printf("Memory allocation failed\n");
+        free(words.words);
+        return ERROR;
+    }
+    int ret = ERROR;
+    /* record 0 is serialized from headers on write */
+    GenBuffer record0 = { 0 };
+    if (add_record(&doc, &record0) != SUCCESS) {
+        goto cleanup;
+    }
+    if (options->entries) {
+        ret = generate_dictionary(&doc, options, &words);
+    } else {
+        ret = generate_kf8(&doc, options, &words);
+    }
+    if (ret != SUCCESS) {
+        goto cleanup;
+    }
+    ret = ERROR;
+    MOBI_RET mobi_ret;
+    if (options->compression_type != MOBI_COMPRESSION_NONE) {
+        mobi_ret = mobi_set_compression(doc.m, options->compression_type, options->compression_level);
+        if (mobi_ret != MOBI_SUCCESS) {
+            printf("Setting compression failed (%s)\n", libmobi_msg(mobi_ret));
+            goto cleanup;
+        }
+    }
+    printf("Saving %s...\n", fullpath);
+    FILE *file = fopen(fullpath, "wb");
+    if (file == NULL) {
+        int errsv = errno;
+        printf("Error opening file: %s (%s)\n", fullpath, strerror(errsv));
+        goto cleanup;
+    }
+    mobi_ret = mobi_write_file(file, doc.m);
+    fclose(file);
+    if (mobi_ret != MOBI_SUCCESS) {
+        printf("Error writing file (%s)\n", libmobi_msg(mobi_ret));
+        goto cleanup;
+    }
+    printf("Records: %u\n", doc.m->ph->rec_count);
+    ret = SUCCESS;
+cleanup:
+    mobi_free(doc.m);
+    free(words.words);
+    return ret;
+}
+
+/**
+ @brief Parse count option value
+ 
+ @param[out] value Parsed value
+ @param[in] arg Option argument
+ @param[in] min Minimal value
+ @param[in] max Maximal value
+ @return SUCCESS or ERROR
+ */
+static int parse_count(size_t *value, const char *arg, const size_t min, const size_t max) {
+    char *end;
+    const unsigned long long number = strtoull(arg, &end, 10);
+    if (*arg == '\0' || *end != '\0' || number < min || number > max) {
+        printf("Invalid value: %s (expected %zu-%zu)\n", arg, min, max);
+        return ERROR;
+    }
+    *value = (size_t) number;
+    return SUCCESS;
+}
+
+/**
+ @brief Print usage info
+ @param[in] progname Executed program name
+ */
+static void exit_with_usage(const char *progname) {
+    char *p = strrchr(progname, separator);
+    if (p) { progname = ++p; }
+    printf("usage: %s [-hvz] [-c level] [-f count] [-i count] [-l count] [-o count] [-p count] [-r count] [-s count] filename\n", progname);
+    printf("       without arguments creates KF8 book, with -o creates KF7 dictionary\n");
+    printf("       -c level       compress text with PalmDOC compression of given level (1-9)\n");
+    printf("       -f count       number of fragments (default: 16)\n");
+    printf("       -i count       number of inflection rules of dictionary (default: 0)\n");
+    printf("       -l count       number of links (default: 32)\n");
+    printf("       -o count       number of dictionary entries (default: 0)\n");
+    printf("       -p count       number of images (default: 4)\n");
+    printf("       -r count       approximate number of text records (default: 16)\n");
+    printf("       -s count       number of skeletons (default: 4)\n");
+    printf("       -z             compress text with HUFF/CDIC compression\n");
+    printf("       -h             show this usage summary and exit\n");
+    printf("       -v             show version and exit\n");
+    exit(ERROR);
+}
+
+/**
+ @brief Main
+ 
+ @param[in] argc Arguments count
+ @param[in] argv Arguments values
+ */
+int main(int argc, char *argv[]) {
+    if (argc < 2) {
+        exit_with_usage(argv[0]);
+    }
+    GenOptions options = {
+        .records = 16,
+        .skeletons = 4,
+        .fragments = 16,
+        .links = 32,
+        .pictures = 4,
+        .entries = 0,
+        .rules = 0,
+        .compression_type = MOBI_COMPRESSION_NONE,
+        .compression_level = 0
+    };
+    size_t level = 0;
+    int c;
+    while ((c = getopt(argc, argv, "c:f:hi:l:o:p:r:s:vz")) != -1) {
+        int ret = SUCCESS;
+        switch (c) {
+            case 'c':
+                ret = parse_count(&level, optarg, MOBI_LZ77_LEVEL_FAST, MOBI_LZ77_LEVEL_BEST);
+                options.compression_type = MOBI_COMPRESSION_PALMDOC;
+                options.compression_level = (int) level;
+                break;
+            case 'f':
+                ret = parse_count(&options.fragments, optarg, 1, GEN_BASE32_MAX - 1);
+                break;
+            case 'i':
+                ret = parse_count(&options.rules, optarg, 0, 100000);
+                break;
+            case 'l':
+                ret = parse_count(&options.links, optarg, 0, GEN_TEXT_MAX);
+                break;
+            case 'o':
+                ret = parse_count(&options.entries, optarg, 0, GEN_ENTRIES_MAX - 1);
+                break;
+            case 'p':
+                ret = parse_count(&options.pictures, optarg, 0, GEN_BASE32_MAX - 1);
+                break;
+            case 'r':
+                ret = parse_count(&options.records, optarg, 1, GEN_RECORDS_MAX);
+                break;
+            case 's':
+                ret = parse_count(&options.skeletons, optarg, 1, GEN_BASE32_MAX - 1);
+                break;
+            case 'z':
+                options.compression_type = MOBI_COMPRESSION_HUFFCDIC;
+                options.compression_level = MOBI_LZ77_LEVEL_DEFAULT;
+                break;
+            case 'v':
+                printf("mobi_gen build: " __DATE__ " " __TIME__ " (" COMPILER ")\n");
+                printf("libmobi: %s\n", mobi_version());
+                return SUCCESS;
+            case '?':
+                if (isprint(optopt)) {
+                    fprintf(stderr, "Unknown option `-%c'\n", optopt);
+                }
+                else {
+                    fprintf(stderr, "Unknown option character `\\x%x'\n", optopt);
+                }
+                exit_with_usage(argv[0]);
+            case 'h':
+            default:
+                exit_with_usage(argv[0]);
+        }
+        if (ret != SUCCESS) {
+            return ERROR;
+        }
+    }
+    if (argc <= optind) {
+        printf("Missing filename\n");
+        exit_with_usage(argv[0]);
+    }
+    if (options.entries == 0 && options.skeletons > options.fragments) {
+        printf("Number of fragments (%zu) must not be lower than number of skeletons (%zu)\n", options.fragments, options.skeletons);
+        return ERROR;
+    }
+    if (options.rules && options.entries == 0) {
+        printf("Inflection rules require dictionary entries\n");
+        return ERROR;
+    }
+    return generate_document(argv[optind], &options);
+}
@@ -32,6 +32,7 @@ size_t serial_count = 0;
 size_t pid_count = 0;
 time_t valid_from = -1;
 time_t valid_to = -1;
+size_t threads_opt = 1;
 
 
 /**
@@ -39,7 +40,7 @@ time_t valid_to = -1;
  @param[in] progname Executed program name
  */
 static void print_usage(const char *progname) {
-    printf("usage: %s [-d | -e] [-hv] [-p pid] [-f date] [-t date] [-s serial] [-o dir] filename\n", progname);
+    printf("usage: %s [-d | -e] [-hv] [-j threads] [-p pid] [-f date] [-t date] [-s serial] [-o dir] filename\n", progname);
     printf("       without arguments prints document metadata and exits\n\n");
 
     printf("       Decrypt options:\n");
@@ -54,6 +55,7 @@ static void print_usage(const char *progname) {
     printf("       -t date   set validity period to date (yyyy-mm-dd) when encrypting (inclusive)\n\n");
     
     printf("       Common options:\n");
+    printf("       -j threads process records with given number of threads\n");
     printf("       -o dir    save output to dir folder\n");
     printf("       -h        show this usage summary and exit\n");
     printf("       -v        show version and exit\n");
@@ -217,6 +219,10 @@ static int loadfilename(const char *fullpath) {
         return ERROR;
     }
     
+    if (threads_opt > 1) {
+        mobi_set_threads(m, threads_opt);
+    }
+    
     errno = 0;
     FILE *file = fopen(fullpath, "rb");
     if (file == NULL) {
@@ -330,7 +336,7 @@ int main(int argc, char *argv[]) {
     }
     opterr = 0;
     int c;
-    while ((c = getopt(argc, argv, "def:ho:p:s:t:vx:")) != -1) {
+    while ((c = getopt(argc, argv, "def:hj:o:p:s:t:vx:")) != -1) {
         switch(c) {
             case 'd':
                 if (encrypt_opt) {
@@ -363,6 +369,15 @@ int main(int argc, char *argv[]) {
                 }
                 expiry_opt = true;
                 break;
+            case 'j': {
+                const long value = strtol(optarg, NULL, 10);
+                if (value <= 0) {
+                    printf("Invalid number of threads: %s\n", optarg);
+                    return ERROR;
+                }
+                threads_opt = (size_t) value;
+                break;
+            }
             case 'o':
                 if (strlen(optarg) == 2 && optarg[0] == '-') {
                     printf("Option -%c requires an argument.\n", c);
@@ -38,6 +38,8 @@ bool setserial_opt = false;
 #endif
 
 /* options values */
+int compression_level_opt = 0;
+bool huffcdic_opt = false;
 #ifdef USE_ENCRYPTION
 char *pid = NULL;
 char *serial = NULL;
@@ -91,12 +93,14 @@ const CB meta_functions[] = {
 static void exit_with_usage(const char *progname) {
     char *p = strrchr(progname, separator);
     if (p) { progname = ++p; }
-    printf("usage: %s [-a | -s meta=value[,meta=value,...]] [-d meta[,meta,...]]" PRINT_ENC_USG " [-hv] filein [fileout]\n", progname);
+    printf("usage: %s [-a | -s meta=value[,meta=value,...]] [-d meta[,meta,...]] [-c level] [-z]" PRINT_ENC_USG " [-hv] filein [fileout]\n", progname);
     printf("       without arguments prints document metadata and exits\n");
     printf("       -a ?           list valid meta named keys\n");
     printf("       -a meta=value  add metadata\n");
     printf("       -d meta        delete metadata\n");
     printf("       -s meta=value  set metadata\n");
+    printf("       -c level       recompress text with palmdoc compression level (1-9)\n");
+    printf("       -z             recompress text with huff/cdic compression, for large dictionaries\n");
 #ifdef USE_ENCRYPTION
     printf("       -p pid         set pid for decryption\n");
     printf("       -P serial      set device serial for decryption\n");
@@ -187,7 +191,7 @@ int main(int argc, char *argv[]) {
     int opt;
     int subopt;
     bool parse;
-    while ((opt = getopt(argc, argv, "a:d:hs:" PRINT_ENC_ARG "v")) != -1) {
+    while ((opt = getopt(argc, argv, "a:c:d:hs:" PRINT_ENC_ARG "vz")) != -1) {
         switch (opt) {
             case 'a':
             case 'd':
@@ -233,6 +237,18 @@ int main(int argc, char *argv[]) {
                     }
                 }
                 break;
+            case 'c': {
+                const long value = strtol(optarg, NULL, 10);
+                if (value < MOBI_LZ77_LEVEL_FAST || value > MOBI_LZ77_LEVEL_BEST) {
+                    printf("Invalid compression level: %s\n", optarg);
+                    return ERROR;
+                }
+                compression_level_opt = (int) value;
+                break;
+            }
+            case 'z':
+                huffcdic_opt = true;
+                break;
 #ifdef USE_ENCRYPTION
             case 'p':
                 if (strlen(optarg) == 2 && optarg[0] == '-') {
@@ -319,7 +335,7 @@ int main(int argc, char *argv[]) {
     }
 #endif
     
-    if (cmd_count == 0) {
+    if (cmd_count == 0 && compression_level_opt == 0 && huffcdic_opt == false) {
         print_summary(m);
         print_exth(m);
         mobi_free(m);
@@ -374,6 +390,17 @@ int main(int argc, char *argv[]) {
         
     }
     
+    if (compression_level_opt || huffcdic_opt) {
+        const int level = compression_level_opt ? compression_level_opt : MOBI_LZ77_LEVEL_DEFAULT;
+        const uint16_t compression_type = huffcdic_opt ? MOBI_COMPRESSION_HUFFCDIC : MOBI_COMPRESSION_PALMDOC;
+        mobi_ret = mobi_set_compression(m, compression_type, level);
+        if (mobi_ret != MOBI_SUCCESS) {
+            printf("Setting compression level failed (%s)\n", libmobi_msg(mobi_ret));
+            mobi_free(m);
+            return ERROR;
+        }
+    }
+    
     /* write */
     printf("Saving %s...\n", outfile);
     FILE *file_out = fopen(outfile, "wb");
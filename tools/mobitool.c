@@ -57,14 +57,6 @@ static void exit_with_usage(const char *progname) __attribute__((noreturn));
 static void exit_with_usage(const char *progname);
 #endif
 
-#define EPUB_CONTAINER "<?xml version=\"1.0\" encoding=\"UTF-8\"?>\n\
-<container version=\"1.0\" xmlns=\"urn:oasis:names:tc:opendocument:xmlns:container\">\n\
-  <rootfiles>\n\
-    <rootfile full-path=\"OEBPS/content.opf\" media-type=\"application/oebps-package+xml\"/>\n\
-  </rootfiles>\n\
-</container>"
-#define EPUB_MIMETYPE "application/epub+zip"
-
 /* command line options */
 bool dump_cover_opt = false;
 bool dump_rawml_opt = false;
@@ -77,6 +69,7 @@ bool dump_parts_opt = false;
 bool print_rusage_opt = false;
 bool extract_source_opt = false;
 bool split_opt = false;
+size_t threads_opt = 1;
 #ifdef USE_ENCRYPTION
 bool setpid_opt = false;
 bool setserial_opt = false;
@@ -295,7 +288,8 @@ static int dump_records(const MOBIData *m, const char *fullpath) {
     }
     printf("Saving records to %s\n", newdir);
     /* Linked list of MOBIPdbRecord structures holds records data and metadata */
-    const MOBIPdbRecord *currec = m->rec;
+    /* Records data not read while loading is read by mobi_get_record_by_seqnumber() and mobi_next_record() */
+    const MOBIPdbRecord *currec = mobi_get_record_by_seqnumber(m, 0);
     int i = 0;
     while (currec != NULL) {
         char name[FILENAME_MAX];
@@ -303,8 +297,12 @@ static int dump_records(const MOBIData *m, const char *fullpath) {
         if (write_to_dir(newdir, name, currec->data, currec->size) == ERROR) {
             return ERROR;
         }
-
-        currec = currec->next;
+        const MOBIPdbRecord *next = mobi_next_record(m, currec);
+        if (next == NULL && currec->next != NULL) {
+            printf("Error reading record %i\n", i);
+            return ERROR;
+        }
+        currec = next;
     }
     return SUCCESS;
 }
@@ -781,6 +779,13 @@ static int loadfilename(const char *fullpath) {
         /* Force it to parse KF7 part */
         mobi_parse_kf7(m);
     }
+    /* Records used only by the other part of hybrid file are read if needed, unless all records are dumped */
+    if (!dump_rec_opt) {
+        mobi_set_loadflags(m, MOBI_LOAD_SKIP_HYBRID);
+    }
+    if (threads_opt > 1) {
+        mobi_set_threads(m, threads_opt);
+    }
     errno = 0;
     FILE *file = fopen(fullpath, "rb");
     if (file == NULL) {
@@ -896,7 +901,7 @@ static int loadfilename(const char *fullpath) {
  @param[in] progname Executed program name
  */
 static void exit_with_usage(const char *progname) {
-    printf("usage: %s [-cd" PRINT_EPUB_ARG "himrst" PRINT_RUSAGE_ARG "vx7] [-o dir]" PRINT_ENC_USG " filename\n", progname);
+    printf("usage: %s [-cd" PRINT_EPUB_ARG "himrst" PRINT_RUSAGE_ARG "vx7] [-j threads] [-o dir]" PRINT_ENC_USG " filename\n", progname);
     printf("       without arguments prints document metadata and exits\n");
     printf("       -c        dump cover\n");
     printf("       -d        dump rawml text record\n");
@@ -905,6 +910,7 @@ static void exit_with_usage(const char *progname) {
 #endif
     printf("       -h        show this usage summary and exit\n");
     printf("       -i        print detailed metadata\n");
+    printf("       -j threads decompress text and parse indices with given number of threads\n");
     printf("       -m        print records metadata\n");
     printf("       -o dir    save output to dir folder\n");
 #ifdef USE_ENCRYPTION
@@ -936,7 +942,7 @@ int main(int argc, char *argv[]) {
     }
     opterr = 0;
     int c;
-    while ((c = getopt(argc, argv, "cd" PRINT_EPUB_ARG "himo:" PRINT_ENC_ARG "rst" PRINT_RUSAGE_ARG "vx7")) != -1) {
+    while ((c = getopt(argc, argv, "cd" PRINT_EPUB_ARG "hij:mo:" PRINT_ENC_ARG "rst" PRINT_RUSAGE_ARG "vx7")) != -1) {
         switch (c) {
             case 'c':
                 dump_cover_opt = true;
@@ -952,6 +958,15 @@ int main(int argc, char *argv[]) {
             case 'i':
                 print_extended_meta_opt = true;
                 break;
+            case 'j': {
+                const long value = strtol(optarg, NULL, 10);
+                if (value <= 0) {
+                    printf("Invalid number of threads: %s\n", optarg);
+                    return ERROR;
+                }
+                threads_opt = (size_t) value;
+                break;
+            }
             case 'm':
                 print_rec_meta_opt = true;
                 break;